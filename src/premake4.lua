@@ -5,14 +5,18 @@ solution "rae_ray"
    configurations { "Debug", "Release" }
    platforms {"native", "x64", "x32"}
 
+   -- The files of the windowed app. Everything else under rae/ is the headless core.
+   local appFiles = { "rae/main.cpp", "rae/Engine.*", "rae/RenderSystem.*", "rae/ObjectFactory.*", "rae/Shader.*",
+      "rae/InputCameraSystem.*", "rae/*Gl.cpp", "rae/core/ScreenSystem.*", "rae/core/ScreenInfo.*", "rae/ui/**" }
+
    -- A project defines one build target
    project "rae_ray"
       kind "ConsoleApp"
       language "C++"
       targetdir "../bin/"
-      files { "rae/**.hpp", "rae/**.cpp" }
+      files { appFiles }
       includedirs { "external/glew/include", "external/glfw/include", "external/nanovg/src", "external/glm", "external/glm/glm", "rae", "external/" }
-      links {"glfw3", "glew", "nanovg", "assimp"}
+      links {"rae_core", "glfw3", "glew", "nanovg", "assimp"}
       defines { "GLEW_STATIC", "NANOVG_GLEW" }
 
       configuration { "linux" }
@@ -36,6 +40,58 @@ solution "rae_ray"
          flags { "Optimize" }
          debugdir "../bin/"
 
+   -- The path tracing core: scene, BVH, materials, camera, integrators and accumulation.
+   -- No GL, GLFW or nanovg, so it builds on machines without a GPU.
+   project "rae_core"
+      kind "StaticLib"
+      language "C++"
+      targetdir "../lib"
+      files { "rae/**.hpp", "rae/**.cpp" }
+      excludes { appFiles, "rae/cli/**" }
+      includedirs { "external/glm", "external/glm/glm", "rae", "external/" }
+
+      configuration { "linux" }
+         buildoptions { "-std=c++11" }
+         targetdir "../lib_linux"
+
+      configuration { "macosx" }
+         buildoptions { "-std=c++11 -stdlib=libc++" }
+
+      configuration "Debug"
+         defines { "DEBUG" }
+         flags { "Symbols" }
+
+      configuration "Release"
+         defines { "NDEBUG" }
+         flags { "Optimize" }
+
+   -- Command line renderer for headless machines
+   project "rae_ray_cli"
+      kind "ConsoleApp"
+      language "C++"
+      targetdir "../bin/"
+      files { "rae/cli/**.cpp" }
+      includedirs { "external/glm", "external/glm/glm", "rae", "external/" }
+      links {"rae_core", "assimp"}
+
+      configuration { "linux" }
+         buildoptions { "-std=c++11" }
+         links {"pthread"}
+
+      configuration { "macosx" }
+         buildoptions { "-std=c++11 -stdlib=libc++" }
+         linkoptions { "-stdlib=libc++" }
+
+      configuration "Debug"
+         defines { "DEBUG" }
+         flags { "Symbols" }
+         debugdir "../bin/"
+
+      configuration "Release"
+         defines { "NDEBUG" }
+         flags { "Optimize" }
+         debugdir "../bin/"
+
    -- GLFW Library
    project "glfw3"
       kind "StaticLib"
@@ -13,7 +13,7 @@ class Aabb
 public:
 	Aabb()
 	: m_min(FLT_MAX, FLT_MAX, FLT_MAX),
-	m_max(FLT_MIN, FLT_MIN, FLT_MIN)
+	m_max(-FLT_MAX, -FLT_MAX, -FLT_MAX)
 	{
 	}
 
@@ -26,10 +26,10 @@ public:
 	void clear()
 	{
 		m_min = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
-		m_max = vec3(FLT_MIN, FLT_MIN, FLT_MIN);
+		m_max = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
 	}
 
-	bool valid()
+	bool valid() const
 	{
 		if (m_min.x <= m_max.x
 			&& m_min.y <= m_max.y
@@ -42,7 +42,7 @@ public:
 	void grow(const Aabb& set);
 	void grow(vec3 set);
 
-	vec3 dimensions()
+	vec3 dimensions() const
 	{
 		return m_max - m_min;
 	}
@@ -0,0 +1,447 @@
+#include "Bdpt.hpp"
+
+#include <algorithm>
+#include <cfloat>
+
+#include "core/Utils.hpp"
+#include "Hitable.hpp"
+#include "HitRecord.hpp"
+#include "LightBvh.hpp"
+#include "Material.hpp"
+#include "RayTracer.hpp"
+#include "Sampler.hpp"
+#include "SplatBuffer.hpp"
+
+using namespace Rae;
+
+namespace
+{
+	bool isBlack(const vec3& color)
+	{
+		return color.x <= 0.0f && color.y <= 0.0f && color.z <= 0.0f;
+	}
+
+	// Solid angle density at from, converted to the area density at to.
+	float toAreaDensity(float pdf, const BdptVertex& from, const BdptVertex& to)
+	{
+		const vec3 offset = to.point - from.point;
+		const float distanceSquared = glm::dot(offset, offset);
+		if (distanceSquared <= 0.0f)
+			return 0.0f;
+		// The camera is a point, not a surface.
+		if (to.type != BdptVertex::Type::Camera)
+			pdf *= std::abs(glm::dot(to.normal, offset)) / sqrt(distanceSquared);
+		return pdf / distanceSquared;
+	}
+
+	// Delta vertices have no density, and their ratios in the MIS weights are left as one.
+	float remapZero(float pdf)
+	{
+		return pdf != 0.0f ? pdf : 1.0f;
+	}
+}
+
+bool BdptVertex::isConnectible() const
+{
+	switch (type)
+	{
+		case Type::Camera:
+		case Type::Light:
+			return true;
+		default:
+		break;
+	}
+	return isDelta == false && material != nullptr && material->isDiffuse();
+}
+
+Bdpt::Bdpt(const Hitable& scene, const LightBvh& lightBvh, std::function<vec3(const Ray&)> sky)
+: m_scene(scene),
+m_lightBvh(lightBvh),
+m_sky(sky)
+{
+}
+
+vec3 Bdpt::trace(const CameraView& view, const Ray& cameraRay, int maxDepth, Sampler& sampler, SplatBuffer& splats,
+	PixelFeatures* features) const
+{
+	maxDepth = std::min(maxDepth, MaxDepth);
+
+	BdptVertex cameraVertices[MaxDepth + 2];
+	BdptVertex lightVertices[MaxDepth + 1];
+
+	// The sky isn't a light that subpaths start from, so only the camera subpath finds it.
+	vec3 color(0.0f, 0.0f, 0.0f);
+	const int cameraCount = cameraSubpath(view, cameraRay, maxDepth + 2, sampler, cameraVertices, color, features);
+	const int lightCount = lightSubpath(maxDepth + 1, sampler, lightVertices);
+	splats.addPaths(1);
+
+	for (int t = 1; t <= cameraCount; ++t)
+	{
+		for (int s = 0; s <= lightCount; ++s)
+		{
+			const int depth = s + t - 2;
+			if ((s == 1 && t == 1) || depth < 0 || depth > maxDepth)
+				continue;
+
+			color += connect(view, lightVertices, cameraVertices, s, t, sampler, splats);
+		}
+	}
+	return color;
+}
+
+int Bdpt::cameraSubpath(const CameraView& view, const Ray& ray, int maxVertices, Sampler& sampler, BdptVertex* path,
+	vec3& skyColor, PixelFeatures* features) const
+{
+	BdptVertex& camera = path[0];
+	camera = BdptVertex();
+	camera.type = BdptVertex::Type::Camera;
+	camera.point = ray.origin();
+	camera.normal = view.forward();
+	camera.beta = vec3(1.0f, 1.0f, 1.0f);
+
+	const int count = randomWalk(ray, camera.beta, view.directionPdf(ray.direction()), maxVertices, sampler, path,
+		&skyColor, features);
+	// From the centre of the lens like the rest of the depths, not from the lens sample.
+	if (features && count > 1)
+		features->depth = glm::length(path[1].point - view.position);
+	return count;
+}
+
+int Bdpt::lightSubpath(int maxVertices, Sampler& sampler, BdptVertex* path) const
+{
+	// The dimensions are taken even without lights, to keep them the same for every path.
+	const float lightChoice = sampler.get1D();
+	const vec2 pointSample = sampler.get2D();
+	const vec2 directionSample = sampler.get2D();
+
+	float lightPmf = 0.0f;
+	const int lightIndex = m_lightBvh.samplePower(lightChoice, lightPmf);
+	if (lightIndex == -1)
+		return 0;
+
+	const AreaLight& light = m_lightBvh.light(lightIndex);
+	BdptVertex& origin = path[0];
+	origin = BdptVertex();
+	origin.type = BdptVertex::Type::Light;
+	light.samplePoint(pointSample, origin.point, origin.normal);
+	origin.lightIndex = lightIndex;
+	origin.beta = light.emission();
+	origin.pdfFwd = lightPmf / light.area();
+
+	// Cosine weighted emission, so Le * cos / (pdfPosition * pdfDirection) is Le * pi / pdfPosition.
+	const vec3 direction = toWorld(sampleCosineHemisphere(directionSample), origin.normal);
+	const float directionPdf = glm::dot(origin.normal, direction) / Math::PI;
+	if (directionPdf <= 0.0f)
+		return 1;
+
+	const vec3 beta = light.emission() * Math::PI / origin.pdfFwd;
+	return randomWalk(Ray(origin.point, direction), beta, directionPdf, maxVertices, sampler, path, nullptr, nullptr);
+}
+
+int Bdpt::randomWalk(Ray ray, vec3 beta, float pdf, int maxVertices, Sampler& sampler, BdptVertex* path,
+	vec3* skyColor, PixelFeatures* features) const
+{
+	const bool isCameraPath = skyColor != nullptr;
+	int count = 1;
+	float pdfFwd = pdf;
+
+	while (count < maxVertices)
+	{
+		HitRecord record;
+		if (m_scene.hit(ray, 0.001f, FLT_MAX, record) == false || record.material == nullptr)
+		{
+			if (isCameraPath)
+			{
+				const vec3 skyLight = m_sky(ray);
+				*skyColor += beta * skyLight;
+				if (features && count == 1)
+				{
+					features->albedo = skyLight;
+					features->normal = vec3(0.0f, 0.0f, 0.0f);
+					features->depth = FLT_MAX;
+				}
+			}
+			break;
+		}
+
+		const bool isEmitter = isBlack(record.material->emitted(record.point)) == false;
+		// Lights absorb what arrives from other lights.
+		if (isEmitter && isCameraPath == false)
+			break;
+
+		if (features && count == 1)
+		{
+			features->albedo = record.material->albedo;
+			features->normal = record.normal;
+			features->depth = glm::length(record.point - ray.origin());
+		}
+
+		const vec3 direction = glm::normalize(ray.direction());
+		BdptVertex& previous = path[count - 1];
+		BdptVertex& vertex = path[count];
+		vertex = BdptVertex();
+		vertex.point = record.point;
+		vertex.normal = glm::dot(record.normal, direction) > 0.0f ? -record.normal : record.normal;
+		vertex.material = record.material;
+		vertex.lightIndex = isEmitter ? m_lightBvh.lightIndex(record) : -1;
+		vertex.beta = beta;
+		vertex.pdfFwd = toAreaDensity(pdfFwd, previous, vertex);
+		++count;
+
+		if (isEmitter || count >= maxVertices)
+			break;
+
+		float pdfRev = 0.0f;
+		if (record.material->isDiffuse())
+		{
+			const vec3 scattered = toWorld(sampleCosineHemisphere(sampler.get2D()), vertex.normal);
+			pdfFwd = record.material->pdf(vertex.normal, scattered);
+			const vec3 bsdf = record.material->evaluate(vertex.normal, scattered);
+			if (pdfFwd <= 0.0f || isBlack(bsdf))
+				break;
+
+			beta *= bsdf / pdfFwd;
+			pdfRev = record.material->pdf(vertex.normal, -direction);
+			ray = Ray(record.point, scattered);
+		}
+		else
+		{
+			vec3 attenuation;
+			Ray scattered;
+			if (record.material->scatter(ray, record, attenuation, scattered, sampler) == false)
+				break;
+
+			beta *= attenuation;
+			vertex.isDelta = true;
+			pdfFwd = 0.0f;
+			ray = scattered;
+		}
+		previous.pdfRev = toAreaDensity(pdfRev, vertex, previous);
+	}
+
+	return count;
+}
+
+vec3 Bdpt::connect(const CameraView& view, const BdptVertex* lightVertices, const BdptVertex* cameraVertices, int s, int t,
+	Sampler& sampler, SplatBuffer& splats) const
+{
+	const vec3 black(0.0f, 0.0f, 0.0f);
+	vec3 light = black;
+	BdptVertex sampled;
+
+	if (s == 0)
+	{
+		// The camera subpath hit a light.
+		const BdptVertex& pt = cameraVertices[t - 1];
+		if (pt.material == nullptr)
+			return black;
+		if (pt.lightIndex == -1)
+		{
+			// Only the camera subpaths find emitters that aren't in the light BVH.
+			return pt.beta * pt.material->emitted(pt.point);
+		}
+		light = pt.beta * emitted(pt, cameraVertices[t - 2].point - pt.point);
+	}
+	else if (t == 1)
+	{
+		// Light tracing: connect the light subpath to a point on the lens, and splat it to its pixel.
+		const vec2 lensSample = sampler.get2D();
+		const BdptVertex& qs = lightVertices[s - 1];
+		if (qs.isConnectible() == false)
+			return black;
+
+		sampled.type = BdptVertex::Type::Camera;
+		sampled.point = view.sampleLens(lensSample);
+		sampled.normal = view.forward();
+
+		float imageS, imageT;
+		if (view.projectFromLens(sampled.point, qs.point, imageS, imageT) == false
+			|| imageS < 0.0f || imageS >= 1.0f || imageT < 0.0f || imageT >= 1.0f)
+			return black;
+
+		const vec3 toCamera = sampled.point - qs.point;
+		const float distanceSquared = glm::dot(toCamera, toCamera);
+		const vec3 direction = toCamera / sqrt(distanceSquared);
+		// The importance of the camera is the pdf of its rays. The lens pdfs cancel out.
+		const float importance = view.directionPdf(-direction);
+		light = qs.beta * qs.material->evaluate(qs.normal, direction) * (importance / distanceSquared);
+		if (isBlack(light) || isVisible(qs.point, sampled.point) == false)
+			return black;
+
+		const float weight = misWeight(view, lightVertices, cameraVertices, sampled, s, t);
+		splats.add(int(imageS * float(splats.width())), int(imageT * float(splats.height())), light * weight);
+		return black;
+	}
+	else if (s == 1)
+	{
+		// Next event estimation, with the light BVH instead of the light subpath's origin.
+		const float lightChoice = sampler.get1D();
+		const vec2 pointOnLight = sampler.get2D();
+		const BdptVertex& pt = cameraVertices[t - 1];
+		if (pt.isConnectible() == false)
+			return black;
+
+		float lightPmf = 0.0f;
+		const int lightIndex = m_lightBvh.sample(pt.point, pt.normal, lightChoice, lightPmf);
+		if (lightIndex == -1)
+			return black;
+		const AreaLight& areaLight = m_lightBvh.light(lightIndex);
+		const LightSample lightSample = areaLight.sample(pt.point, pointOnLight);
+		if (lightSample.pdf <= 0.0f)
+			return black;
+
+		sampled.type = BdptVertex::Type::Light;
+		sampled.point = lightSample.point;
+		sampled.normal = areaLight.normal(lightSample.point);
+		sampled.lightIndex = lightIndex;
+		sampled.beta = lightSample.radiance / (lightPmf * lightSample.pdf);
+		// In the MIS weights the vertex counts as the origin of a light subpath, like in pbrt.
+		sampled.pdfFwd = lightOriginPdf(sampled);
+
+		light = pt.beta * pt.material->evaluate(pt.normal, lightSample.direction) * sampled.beta;
+		if (isBlack(light) || isVisible(pt.point, sampled.point) == false)
+			return black;
+	}
+	else
+	{
+		const BdptVertex& qs = lightVertices[s - 1];
+		const BdptVertex& pt = cameraVertices[t - 1];
+		if (qs.isConnectible() == false || pt.isConnectible() == false)
+			return black;
+
+		const vec3 offset = pt.point - qs.point;
+		const float distanceSquared = glm::dot(offset, offset);
+		if (distanceSquared <= 0.0f)
+			return black;
+		const vec3 direction = offset / sqrt(distanceSquared);
+
+		light = qs.beta * qs.material->evaluate(qs.normal, direction) * pt.material->evaluate(pt.normal, -direction)
+			* pt.beta / distanceSquared;
+		if (isBlack(light) || isVisible(qs.point, pt.point) == false)
+			return black;
+	}
+
+	if (isBlack(light))
+		return black;
+	return light * misWeight(view, lightVertices, cameraVertices, sampled, s, t);
+}
+
+float Bdpt::misWeight(const CameraView& view, const BdptVertex* lightVertices, const BdptVertex* cameraVertices,
+	const BdptVertex& sampled, int s, int t) const
+{
+	if (s + t == 2)
+		return 1.0f;
+
+	// Copies of the subpaths, changed to what they are with this connection.
+	BdptVertex light[MaxDepth + 1];
+	BdptVertex camera[MaxDepth + 2];
+	std::copy(lightVertices, lightVertices + s, light);
+	std::copy(cameraVertices, cameraVertices + t, camera);
+	if (s == 1)
+		light[0] = sampled;
+	else if (t == 1)
+		camera[0] = sampled;
+
+	BdptVertex* qs = s > 0 ? &light[s - 1] : nullptr;
+	BdptVertex* pt = &camera[t - 1];
+	BdptVertex* qsMinus = s > 1 ? &light[s - 2] : nullptr;
+	BdptVertex* ptMinus = t > 1 ? &camera[t - 2] : nullptr;
+
+	if (s > 0)
+	{
+		pt->pdfRev = pdf(view, *qs, *pt);
+		if (ptMinus)
+			ptMinus->pdfRev = pdf(view, *pt, *ptMinus);
+		qs->pdfRev = pdf(view, *pt, *qs);
+		if (qsMinus)
+			qsMinus->pdfRev = pdf(view, *qs, *qsMinus);
+	}
+	else
+	{
+		pt->pdfRev = lightOriginPdf(*pt);
+		if (ptMinus)
+			ptMinus->pdfRev = lightEmissionPdf(*pt, *ptMinus);
+	}
+
+	// Connecting requires that neither end is specular.
+	pt->isDelta = false;
+	if (qs)
+		qs->isDelta = false;
+
+	// The power heuristic, from the ratios of the path pdfs of the neighbouring strategies.
+	float sumRatios = 0.0f;
+	float ratio = 1.0f;
+	for (int i = t - 1; i > 0; --i)
+	{
+		const float step = remapZero(camera[i].pdfRev) / remapZero(camera[i].pdfFwd);
+		ratio *= step * step;
+		if (camera[i].isDelta == false && camera[i - 1].isDelta == false)
+			sumRatios += ratio;
+	}
+
+	ratio = 1.0f;
+	for (int i = s - 1; i >= 0; --i)
+	{
+		const float step = remapZero(light[i].pdfRev) / remapZero(light[i].pdfFwd);
+		ratio *= step * step;
+		const bool isPreviousDelta = i > 0 ? light[i - 1].isDelta : false;
+		if (light[i].isDelta == false && isPreviousDelta == false)
+			sumRatios += ratio;
+	}
+
+	return 1.0f / (1.0f + sumRatios);
+}
+
+float Bdpt::pdf(const CameraView& view, const BdptVertex& vertex, const BdptVertex& next) const
+{
+	switch (vertex.type)
+	{
+		case BdptVertex::Type::Camera:
+			return toAreaDensity(view.directionPdf(next.point - vertex.point), vertex, next);
+		case BdptVertex::Type::Light:
+			return lightEmissionPdf(vertex, next);
+		default:
+		break;
+	}
+
+	if (vertex.isConnectible() == false)
+		return 0.0f;
+	const vec3 direction = glm::normalize(next.point - vertex.point);
+	return toAreaDensity(vertex.material->pdf(vertex.normal, direction), vertex, next);
+}
+
+float Bdpt::lightOriginPdf(const BdptVertex& vertex) const
+{
+	if (vertex.lightIndex == -1)
+		return 0.0f;
+	return m_lightBvh.powerPmf(vertex.lightIndex) / m_lightBvh.light(vertex.lightIndex).area();
+}
+
+float Bdpt::lightEmissionPdf(const BdptVertex& vertex, const BdptVertex& next) const
+{
+	const vec3 direction = glm::normalize(next.point - vertex.point);
+	const float cosTheta = glm::dot(vertex.normal, direction);
+	if (cosTheta <= 0.0f)
+		return 0.0f;
+	return toAreaDensity(cosTheta / Math::PI, vertex, next);
+}
+
+vec3 Bdpt::emitted(const BdptVertex& vertex, const vec3& toward) const
+{
+	// Lights emit from the side their normal is on, the same as the light subpaths leave them.
+	const AreaLight& light = m_lightBvh.light(vertex.lightIndex);
+	if (glm::dot(light.normal(vertex.point), toward) <= 0.0f)
+		return vec3(0.0f, 0.0f, 0.0f);
+	return light.emission();
+}
+
+bool Bdpt::isVisible(const vec3& from, const vec3& to) const
+{
+	const vec3 offset = to - from;
+	const float distance = glm::length(offset);
+	if (distance <= 0.0f)
+		return false;
+
+	HitRecord occluder;
+	return m_scene.hit(Ray(from, offset / distance), 0.001f, distance * 0.999f, occluder) == false;
+}
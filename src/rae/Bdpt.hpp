@@ -0,0 +1,92 @@
+#pragma once
+
+#include <functional>
+
+#include <glm/glm.hpp>
+using glm::vec2;
+using glm::vec3;
+
+#include "Camera.hpp"
+#include "Ray.hpp"
+
+namespace Rae
+{
+
+class Hitable;
+class LightBvh;
+class Material;
+class Sampler;
+class SplatBuffer;
+struct PixelFeatures;
+
+// A vertex of a camera or light subpath.
+struct BdptVertex
+{
+	enum class Type
+	{
+		Camera,
+		Light, // the first vertex of a light subpath
+		Surface
+	};
+
+	// Only diffuse surfaces can be connected to. Mirrors, glass and metal are treated as specular.
+	bool isConnectible() const;
+
+	Type type = Type::Surface;
+	vec3 point;
+	vec3 normal; // facing the side the path arrived from. The emitting side on lights, the view axis on the camera.
+	const Material* material = nullptr;
+	int lightIndex = -1; // the light that the vertex is on, or -1
+	vec3 beta; // throughput of the subpath up to the vertex
+	bool isDelta = false;
+	// Area densities of this vertex being sampled from the previous vertex of its own subpath,
+	// and from the next one, i.e. by the walk of the other subpath.
+	float pdfFwd = 0.0f;
+	float pdfRev = 0.0f;
+};
+
+// Bidirectional path tracing (Veach 1997, Robust Monte Carlo Methods for Light Transport Simulation,
+// and pbrt-v3 chapter 16). Every pixel sample traces a subpath from the camera and one from a light,
+// connects all pairs of their vertices, and weights the strategies with the power heuristic.
+// The strategies with a single camera vertex reach some other pixel, so they are splatted.
+// Light finds its way through small lights and caustics that camera paths rarely hit.
+class Bdpt
+{
+public:
+	Bdpt(const Hitable& scene, const LightBvh& lightBvh, std::function<vec3(const Ray&)> sky);
+
+	// One sample of the pixel that the camera ray goes through. Returns the light of the strategies
+	// with two or more camera vertices, splats the rest, and counts the light subpath in splats.
+	vec3 trace(const CameraView& view, const Ray& cameraRay, int maxDepth, Sampler& sampler, SplatBuffer& splats,
+		PixelFeatures* features = nullptr) const;
+
+	static const int MaxDepth = 16; // in bounces. Longer paths are cut short.
+
+protected:
+	int cameraSubpath(const CameraView& view, const Ray& ray, int maxVertices, Sampler& sampler, BdptVertex* path,
+		vec3& skyColor, PixelFeatures* features) const;
+	int lightSubpath(int maxVertices, Sampler& sampler, BdptVertex* path) const;
+	// Continues a subpath from path[0]. pdf is the solid angle pdf of the ray's direction.
+	int randomWalk(Ray ray, vec3 beta, float pdf, int maxVertices, Sampler& sampler, BdptVertex* path,
+		vec3* skyColor, PixelFeatures* features) const;
+
+	// Light of the strategy with s light vertices and t camera vertices, with its MIS weight.
+	vec3 connect(const CameraView& view, const BdptVertex* lightVertices, const BdptVertex* cameraVertices, int s, int t,
+		Sampler& sampler, SplatBuffer& splats) const;
+	float misWeight(const CameraView& view, const BdptVertex* lightVertices, const BdptVertex* cameraVertices,
+		const BdptVertex& sampled, int s, int t) const;
+
+	// Area density at next of the vertex sampling it.
+	float pdf(const CameraView& view, const BdptVertex& vertex, const BdptVertex& next) const;
+	// Area density of a light subpath starting from the vertex, and of the light emitting towards next.
+	float lightOriginPdf(const BdptVertex& vertex) const;
+	float lightEmissionPdf(const BdptVertex& vertex, const BdptVertex& next) const;
+	vec3 emitted(const BdptVertex& vertex, const vec3& toward) const;
+	bool isVisible(const vec3& from, const vec3& to) const;
+
+	const Hitable& m_scene;
+	const LightBvh& m_lightBvh;
+	std::function<vec3(const Ray&)> m_sky;
+};
+
+} // end namespace Rae
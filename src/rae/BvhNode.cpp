@@ -1,92 +1,204 @@
 #include "BvhNode.hpp"
 #include "HitRecord.hpp"
 
-#include "Random.hpp"
-
-#include <iostream>
 #include <algorithm>
+#include <cfloat>
+#include <cstring>
 
 using namespace Rae;
 
-int g_deep = 0;
+namespace
+{
+	// A hitable goes to the side list when it is this many times wider than all the smaller ones together.
+	const float HugeFactor = 8.0f;
+
+	thread_local int64_t t_rayCount = 0;
+}
+
+// The bounds are read once, not on every comparison of the build. Two pointers wide, since the build
+// moves the entries around a lot. The center is min + max, halving it wouldn't change the order.
+struct BvhNode::BuildEntry
+{
+	Hitable* hitable;
+	Aabb aabb;
+
+	float center(int axis) const { return aabb.min()[axis] + aabb.max()[axis]; }
+};
 
 BvhNode::BvhNode(std::vector<Hitable*>& hitables, float time0, float time1)
 {
-	init(hitables, time0, time1);
+	std::vector<BuildEntry> entries;
+	entries.reserve(hitables.size());
+	for (Hitable* hitable : hitables)
+		entries.push_back(BuildEntry{ hitable, hitable->getAabb(time0, time1) });
+	if (entries.empty() == false)
+		build(entries.data(), entries.data() + entries.size());
+}
+
+BvhNode::BvhNode(BuildEntry* begin, BuildEntry* end)
+{
+	build(begin, end);
 }
 
 void BvhNode::init(std::vector<Hitable*>& hitables, float time0, float time1)
 {
-	g_deep++;
-	std::cout << "bvh deep: " << g_deep << std::endl;
+	m_isRoot = true;
+	m_unbounded.clear();
+	m_left = nullptr;
+	m_right = nullptr;
+	m_aabb.clear();
+
+	std::vector<BuildEntry> entries;
+	entries.reserve(hitables.size());
+	// The size in the high bits and the index in the low ones. Sizes are positive, so their bits sort
+	// like the floats, and the index breaks the ties like a stable sort would.
+	std::vector<uint64_t> sizes;
+	sizes.reserve(hitables.size());
+	for (Hitable* hitable : hitables)
+	{
+		const Aabb aabb = hitable->getAabb(time0, time1);
+		const vec3 dimensions = aabb.dimensions();
+		const float size = aabb.valid() ? std::max(0.0f, std::max(dimensions.x, std::max(dimensions.y, dimensions.z))) : FLT_MAX;
+		uint32_t sizeBits;
+		memcpy(&sizeBits, &size, sizeof(sizeBits));
+		sizes.push_back((uint64_t(sizeBits) << 32) | uint64_t(entries.size()));
+		entries.push_back(BuildEntry{ hitable, aabb });
+	}
 
-	int axis = int(3 * drand48());
-	std::cout << "axis up: " << axis << std::endl;
+	// From the smallest to the biggest, a hitable is huge when it is many times wider than the bounds of
+	// all the smaller ones. A single huge one doesn't then hide the others.
+	std::sort(sizes.begin(), sizes.end());
 
-	// A much cleaner comparison function than in Shirley's book.
-	// We use a lambda which captures the axis.
-	// We can compare all three axes with just one lambda.
-	auto aabbCompare = [axis](Hitable* a, Hitable* b) -> bool
+	// Kept in their original order, which is the order of the file and usually close in space.
+	std::vector<bool> isHuge(entries.size(), false);
+	Aabb smallerBounds;
+	float boundsSize = 0.0f;
+	for (uint64_t key : sizes)
 	{
-		std::cout << "axis down: " << axis << std::endl;
-		Aabb left = a->getAabb(0,0);
-		Aabb right = b->getAabb(0,0);
-		if (left.valid() == false || right.valid() == false)
-			std::cerr << "No aabb in BvhNode constructor\n";
+		const uint32_t index = uint32_t(key);
+		const uint32_t sizeBits = uint32_t(key >> 32);
+		float size;
+		memcpy(&size, &sizeBits, sizeof(size));
 
-		if (left.min()[axis] - right.min()[axis] < 0.0f)
-			return true;
-		return false;
-	};
-
-	if (hitables.size() > 1)
-		std::sort(hitables.begin(), hitables.end(), aabbCompare);
+		if (size >= FLT_MAX || (boundsSize > 0.0f && size > HugeFactor * boundsSize))
+		{
+			isHuge[index] = true;
+			m_unbounded.push_back(hitables[index]);
+			continue;
+		}
+		smallerBounds.grow(entries[index].aabb);
+		const vec3 dimensions = smallerBounds.dimensions();
+		boundsSize = std::max(dimensions.x, std::max(dimensions.y, dimensions.z));
+	}
 
-	if (hitables.size() == 1)
+	if (m_unbounded.empty() == false)
 	{
-		std::cout << "bvh 1 here.\n";
-		m_left = hitables[0];
-		m_right = hitables[0];
+		size_t count = 0;
+		for (size_t i = 0; i < entries.size(); ++i)
+		{
+			if (isHuge[i] == false)
+				entries[count++] = entries[i];
+		}
+		entries.resize(count);
 	}
-	else if (hitables.size() == 2)
+
+	if (entries.empty() == false)
+		build(entries.data(), entries.data() + entries.size());
+}
+
+void BvhNode::build(BuildEntry* begin, BuildEntry* end)
+{
+	const std::ptrdiff_t count = end - begin;
+	if (count <= 2)
 	{
-		std::cout << "bvh 2 here.\n";
-		m_left = hitables[0];
-		m_right = hitables[1];
+		m_left = begin[0].hitable;
+		m_right = begin[count - 1].hitable;
+		m_aabb.init(begin[0].aabb, begin[count - 1].aabb);
+		return;
 	}
-	else
+
+	Aabb centerBounds;
+	for (BuildEntry* entry = begin; entry != end; ++entry)
+		centerBounds.grow(entry->aabb.min() + entry->aabb.max());
+
+	// Split at the middle of the longest axis of the centers. A random axis, like in Shirley's book,
+	// often cuts across a flat scene, and the halves then overlap. A single pass partitions the range,
+	// and the children split the same range, without copies.
+	const vec3 extent = centerBounds.dimensions();
+	const int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+	const float split = centerBounds.min()[axis] + 0.5f * extent[axis];
+	BuildEntry* middle = std::partition(begin, end,
+		[axis, split](const BuildEntry& entry) { return entry.center(axis) < split; });
+
+	// All on one side, when the centers are clumped or the same. The median, which only needs itself
+	// to be in place, always splits.
+	if (middle == begin || middle == end)
 	{
-		const std::size_t halfSize = hitables.size() / 2;
-		std::vector<Hitable*> splitLow(hitables.begin(), hitables.begin() + halfSize);
-		std::vector<Hitable*> splitHigh(hitables.begin() + halfSize, hitables.end());
+		middle = begin + count / 2;
+		std::nth_element(begin, middle, end,
+			[axis](const BuildEntry& a, const BuildEntry& b) { return a.center(axis) < b.center(axis); });
+	}
+
+	BvhNode* left = new BvhNode(begin, middle);
+	BvhNode* right = new BvhNode(middle, end);
+	m_left = left;
+	m_right = right;
+	// From the children, so that the bounds of each level aren't gathered from all the entries again.
+	m_aabb.init(left->m_aabb, right->m_aabb);
+}
+
+int64_t BvhNode::takeRayCount()
+{
+	const int64_t count = t_rayCount;
+	t_rayCount = 0;
+	return count;
+}
+
+bool BvhNode::hit(const Ray& ray, float t_min, float t_max, HitRecord& record) const
+{
+	if (m_isRoot)
+		++t_rayCount;
 
-		std::cout << "bvh more size: " << hitables.size() << " halfSize: " << halfSize << " lowSize: " << splitLow.size() << " highSize: " << splitHigh.size() << std::endl;
+	if (m_unbounded.empty())
+		return m_left != nullptr && hitTree(ray, t_min, t_max, record);
 
-		m_left = new BvhNode(splitLow, time0, time1);
-		m_right = new BvhNode(splitHigh, time0, time1);
+	// The side list first, so that the tree is culled to the closest of its hits, e.g. the ground.
+	bool isHit = false;
+	for (const Hitable* hitable : m_unbounded)
+	{
+		HitRecord sideRecord;
+		if (hitable->hit(ray, t_min, t_max, sideRecord))
+		{
+			record = sideRecord;
+			t_max = sideRecord.t;
+			isHit = true;
+		}
 	}
 
-	Aabb left = m_left->getAabb(time0, time1);
-	Aabb right = m_right->getAabb(time0, time1);
-	if (left.valid() == false || right.valid() == false)
-		std::cerr << "No aabb in BvhNode constructor\n";
+	if (m_left == nullptr)
+		return isHit;
 
-	m_aabb.init(left, right);
+	HitRecord treeRecord;
+	if (hitTree(ray, t_min, t_max, treeRecord))
+	{
+		record = treeRecord;
+		return true;
+	}
+	return isHit;
 }
 
-bool BvhNode::hit(const Ray& ray, float t_min, float t_max, HitRecord& record) const
+bool BvhNode::hitTree(const Ray& ray, float t_min, float t_max, HitRecord& record) const
 {
 	if (m_aabb.hit(ray, t_min, t_max))
 	{
 		HitRecord leftRecord, rightRecord;
 
+		// The right side only needs hits closer than the left one.
 		bool hitLeft = m_left->hit(ray, t_min, t_max, leftRecord);
-		bool hitRight = m_right->hit(ray, t_min, t_max, rightRecord);
-		if (hitLeft && hitRight)
+		bool hitRight = m_right->hit(ray, t_min, hitLeft ? leftRecord.t : t_max, rightRecord);
+		if (hitRight)
 		{
-			if (leftRecord.t < rightRecord.t)
-				record = leftRecord;
-			else record = rightRecord;
+			record = rightRecord;
 			return true;
 		}
 		else if (hitLeft)
@@ -94,11 +206,6 @@ bool BvhNode::hit(const Ray& ray, float t_min, float t_max, HitRecord& record) c
 			record = leftRecord;
 			return true;
 		}
-		else if (hitRight)
-		{
-			record = rightRecord;
-			return true;
-		}
 		return false;
 	}
 	return false;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <stdint.h>
 
 #include <glm/glm.hpp>
 using glm::vec3;
@@ -21,17 +22,33 @@ public:
 	BvhNode(){}
 	BvhNode(std::vector<Hitable*>& hitables, float time0, float time1);
 
+	// Builds the tree. Unbounded hitables, like planes, and ones much bigger than the rest of the scene,
+	// like a huge sphere for the ground, would overlap every node near the root. They are kept in
+	// a side list instead, which the root tests before the tree.
 	void init(std::vector<Hitable*>& hitables, float time0, float time1);
 
 	virtual bool hit(const Ray& ray, float t_min, float t_max, HitRecord& record) const;
+	// Without the side list
 	virtual Aabb getAabb(float t0, float t1) const;
 
+	const std::vector<Hitable*>& unbounded() const { return m_unbounded; }
+
+	// The rays that the calling thread has cast at a tree built with init(), since the last call.
+	static int64_t takeRayCount();
+
 protected:
+	struct BuildEntry;
+
+	BvhNode(BuildEntry* begin, BuildEntry* end);
+	void build(BuildEntry* begin, BuildEntry* end);
+	bool hitTree(const Ray& ray, float t_min, float t_max, HitRecord& record) const;
 
-	Hitable* m_left;
-	Hitable* m_right;
+	Hitable* m_left = nullptr;
+	Hitable* m_right = nullptr;
 
 	Aabb m_aabb;
+	std::vector<Hitable*> m_unbounded;
+	bool m_isRoot = false; // only the root counts rays
 };
 
 }
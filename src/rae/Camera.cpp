@@ -8,6 +8,7 @@ using glm::dot;
 #include <iostream>
 
 #include "Random.hpp"
+#include "Sampler.hpp"
 #include "Camera.hpp"
 
 namespace Rae
@@ -15,12 +16,8 @@ namespace Rae
 
 vec3 randomInUnitDisk()
 {
-	vec3 point;
-	do
-	{
-		point = 2.0f * vec3(getRandom(), getRandom(), 0) - vec3(1,1,0);
-	} while(dot(point, point) >= 1.0f);
-	return point;
+	vec2 point = sampleConcentricDisk(vec2(getRandom(), getRandom()));
+	return vec3(point.x, point.y, 0.0f);
 }
 
 Camera::Camera(float fieldOfViewRadians, float setAspectRatio, float aperture, float focusDistance)
@@ -47,6 +44,13 @@ Ray Camera::getRay(float s, float t)
 	return Ray(m_position + offset, m_topLeftCorner + (s * m_horizontal) - (t * m_vertical) - m_position - offset);
 }
 
+Ray Camera::getRay(float s, float t, const vec2& lensSample)
+{
+	vec2 rd = m_lensRadius * sampleConcentricDisk(lensSample);
+	vec3 offset = m_right * rd.x + m_up * rd.y;
+	return Ray(m_position + offset, m_topLeftCorner + (s * m_horizontal) - (t * m_vertical) - m_position - offset);
+}
+
 Ray Camera::getExactRay(float s, float t)
 {
 	//return Ray(origin, lowerLeftCorner + (s * m_horizontal) + (t * m_vertical) - origin);
@@ -55,6 +59,73 @@ Ray Camera::getExactRay(float s, float t)
 	return Ray(m_position, m_topLeftCorner + (s * m_horizontal) - (t * m_vertical) - m_position);
 }
 
+CameraView Camera::view() const
+{
+	CameraView view;
+	view.position = m_position;
+	view.topLeftCorner = m_topLeftCorner;
+	view.horizontal = m_horizontal;
+	view.vertical = m_vertical;
+	view.lensRadius = m_lensRadius;
+	return view;
+}
+
+Ray CameraView::getExactRay(float s, float t) const
+{
+	return Ray(position, topLeftCorner + (s * horizontal) - (t * vertical) - position);
+}
+
+bool CameraView::project(const vec3& point, float& s, float& t) const
+{
+	return projectFromLens(position, point, s, t);
+}
+
+bool CameraView::projectFromLens(const vec3& lensPoint, const vec3& point, float& s, float& t) const
+{
+	// Intersect the line from the lens to the point with the image plane.
+	vec3 planeNormal = glm::cross(horizontal, vertical);
+	float pointDistance = dot(point - lensPoint, planeNormal);
+	float planeDistance = dot(topLeftCorner - lensPoint, planeNormal);
+	if (pointDistance == 0.0f)
+		return false;
+
+	float scale = planeDistance / pointDistance;
+	if (scale <= 0.0f)
+		return false;
+
+	vec3 onPlane = lensPoint + (point - lensPoint) * scale - topLeftCorner;
+
+	s = dot(onPlane, horizontal) / dot(horizontal, horizontal);
+	t = -dot(onPlane, vertical) / dot(vertical, vertical);
+	return true;
+}
+
+vec3 CameraView::sampleLens(const vec2& u) const
+{
+	if (lensRadius <= 0.0f)
+		return position;
+	vec2 rd = lensRadius * sampleConcentricDisk(u);
+	return position + glm::normalize(horizontal) * rd.x + glm::normalize(vertical) * rd.y;
+}
+
+vec3 CameraView::forward() const
+{
+	return glm::normalize(topLeftCorner + 0.5f * horizontal - 0.5f * vertical - position);
+}
+
+float CameraView::directionPdf(const vec3& direction) const
+{
+	const vec3 axis = forward();
+	const float cosTheta = dot(glm::normalize(direction), axis);
+	if (cosTheta <= 0.0f)
+		return 0.0f;
+
+	// The image plane is at the focus distance, and its area maps uniformly onto the image.
+	const float planeDistance = dot(topLeftCorner - position, axis);
+	const float planeArea = glm::length(horizontal) * glm::length(vertical);
+	return (planeDistance * planeDistance) / (planeArea * cosTheta * cosTheta * cosTheta);
+}
+
 void Camera::calculateFrustum()
 {
 	m_lensRadius = m_aperture / 2.0f;
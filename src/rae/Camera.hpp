@@ -4,6 +4,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+using glm::vec2;
 using glm::vec3;
 
 #include "core/Utils.hpp"
@@ -16,13 +17,41 @@ namespace Rae
 
 vec3 randomInUnitDisk();
 
+// A snapshot of the pinhole projection of a camera. Kept around to map points
+// between the current and a previous frame.
+struct CameraView
+{
+	Ray getExactRay(float s, float t) const;
+	// Finds the screen coordinates of a world space point. s and t go from 0 to 1 over the
+	// image, with t pointing down. Returns false if the point is behind the camera.
+	bool project(const vec3& point, float& s, float& t) const;
+	// The same for the ray from a point on the lens, which is what light tracing connects to.
+	bool projectFromLens(const vec3& lensPoint, const vec3& point, float& s, float& t) const;
+
+	// A uniform point on the lens. Always the position for a pinhole.
+	vec3 sampleLens(const vec2& u) const;
+	vec3 forward() const;
+	// Solid angle pdf of the camera ray directions from any point on the lens,
+	// when the image position is uniform. Zero behind the camera.
+	float directionPdf(const vec3& direction) const;
+
+	vec3 position = vec3(0.0f, 0.0f, 0.0f);
+	vec3 topLeftCorner = vec3(-2.0f, 1.0f, -1.0f);
+	vec3 horizontal = vec3(4.0f, 0.0f, 0.0f);
+	vec3 vertical = vec3(0.0f, 2.0f, 0.0f);
+	float lensRadius = 0.0f;
+};
+
 class Camera
 {
 public:
 	Camera(float fieldOfViewRadians, float setAspectRatio, float aperture, float focusDistance);
 
 	Ray getRay(float s, float t);
+	// lensSample is a point in the unit square, warped onto the lens.
+	Ray getRay(float s, float t, const vec2& lensSample);
 	Ray getExactRay(float s, float t);
+	CameraView view() const;
 
 	void calculateFrustum();
 
@@ -11,18 +11,15 @@
 namespace Rae
 {
 
-class Input;
-
+// Owns the camera and tells the listeners when it changes. Works without a window,
+// InputCameraSystem adds the mouse and keyboard controls.
 class CameraSystem : public System
 {
 public:
-	CameraSystem(Input& input);
+	CameraSystem();
 
 	void update(double time, double delta_time, std::vector<Entity>& entities) override;
 
-	void onMouseEvent(const Input& input);
-	void onKeyEvent(const Input& input);
-
 	void setNeedsUpdate() { m_camera.setNeedsUpdate(); }
 	void setAspectRatio(float aspect) { m_camera.setAspectRatio(aspect); }
 
@@ -31,8 +28,7 @@ public:
 
 	void connectCameraChangedEventHandler(std::function<void(const Camera&)> handler);
 
-private:
-	Input& m_input;
+protected:
 	Camera m_camera;
 
 	void emitCameraChangedEvent();
@@ -0,0 +1,215 @@
+#include "CausticPhotonMap.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+#include "core/Utils.hpp"
+#include "core/ThreadPool.hpp"
+#include "Hitable.hpp"
+#include "HitRecord.hpp"
+#include "Material.hpp"
+#include "LightBvh.hpp"
+#include "Ray.hpp"
+#include "Sampler.hpp"
+
+using namespace Rae;
+
+void CausticPhotonMap::clear()
+{
+	m_photons.clear();
+	m_cells.clear();
+	m_passCount = 0;
+	m_radius = 0.0f;
+}
+
+void CausticPhotonMap::emitPass(const Hitable& scene, const LightBvh& lightBvh, ThreadPool& threadPool)
+{
+	if (lightBvh.isEmpty())
+	{
+		clear();
+		return;
+	}
+
+	// r^2 of pass i+1 = r^2 of pass i * (i + alpha) / (i + 1)
+	if (m_passCount == 0)
+		m_radius = m_initialRadius;
+	else
+		m_radius *= sqrt((float(m_passCount) + m_alpha) / float(m_passCount + 1));
+	m_cellSize = 2.0f * m_radius;
+
+	const int passIndex = m_passCount;
+	const int photonsPerPass = m_photonsPerPass;
+
+	// Every photon is a separate task, so the index seeds its sampler and the map is the same
+	// for any thread count.
+	std::vector<std::vector<Photon>> threadPhotons(threadPool.threadCount());
+	threadPool.parallelFor(photonsPerPass, [&](int photonIndex, int threadIndex)
+	{
+		RandomSampler sampler;
+		sampler.startPixelSample(photonIndex, 0, passIndex);
+
+		float lightPmf = 0.0f;
+		const int lightIndex = lightBvh.samplePower(sampler.get1D(), lightPmf);
+		if (lightIndex == -1)
+			return;
+
+		const AreaLight& light = lightBvh.light(lightIndex);
+		vec3 point;
+		vec3 normal;
+		light.samplePoint(sampler.get2D(), point, normal);
+		const vec3 direction = toWorld(sampleCosineHemisphere(sampler.get2D()), normal);
+
+		// Le * cos / (pdfArea * pdfDirection), with pdfArea = pmf / area and pdfDirection = cos / pi.
+		vec3 power = light.emission() * light.area() * Math::PI / (lightPmf * float(photonsPerPass));
+		Ray ray(point, direction);
+		bool isAfterSpecular = false;
+
+		for (int bounce = 0; bounce < MaxBounces; ++bounce)
+		{
+			HitRecord record;
+			if (scene.hit(ray, 0.001f, FLT_MAX, record) == false || record.material == nullptr)
+				return;
+
+			if (record.material->isDiffuse())
+			{
+				if (isAfterSpecular)
+				{
+					Photon photon;
+					photon.point = record.point;
+					photon.direction = glm::normalize(ray.direction());
+					photon.power = power;
+					threadPhotons[threadIndex].push_back(photon);
+				}
+				// Light that goes on from here is no longer a caustic.
+				return;
+			}
+
+			vec3 attenuation;
+			Ray scattered;
+			if (record.material->scatter(ray, record, attenuation, scattered, sampler) == false)
+				return; // absorbed, or hit a light
+
+			power *= attenuation;
+			if (glm::max(power.x, glm::max(power.y, power.z)) <= 0.0f)
+				return;
+			ray = scattered;
+			isAfterSpecular = true;
+		}
+	});
+
+	m_photons.clear();
+	for (const std::vector<Photon>& photons : threadPhotons)
+		m_photons.insert(m_photons.end(), photons.begin(), photons.end());
+
+	buildGrid();
+	++m_passCount;
+}
+
+void CausticPhotonMap::cellOf(const vec3& point, int& x, int& y, int& z) const
+{
+	x = int(floor(point.x / m_cellSize));
+	y = int(floor(point.y / m_cellSize));
+	z = int(floor(point.z / m_cellSize));
+}
+
+uint64_t CausticPhotonMap::cellKey(int x, int y, int z) const
+{
+	// 21 bits per axis, and the top bit set so that no key is zero.
+	const uint64_t mask = (1 << 21) - 1;
+	const uint64_t ux = uint64_t(int64_t(x) + (1 << 20)) & mask;
+	const uint64_t uy = uint64_t(int64_t(y) + (1 << 20)) & mask;
+	const uint64_t uz = uint64_t(int64_t(z) + (1 << 20)) & mask;
+	return (uint64_t(1) << 63) | (ux << 42) | (uy << 21) | uz;
+}
+
+void CausticPhotonMap::buildGrid()
+{
+	m_cells.clear();
+	if (m_photons.empty())
+		return;
+
+	std::vector<std::pair<uint64_t, int>> keys(m_photons.size());
+	for (size_t i = 0; i < m_photons.size(); ++i)
+	{
+		int x, y, z;
+		cellOf(m_photons[i].point, x, y, z);
+		keys[i] = std::make_pair(cellKey(x, y, z), int(i));
+	}
+	std::sort(keys.begin(), keys.end());
+
+	std::vector<Photon> sorted(m_photons.size());
+	for (size_t i = 0; i < keys.size(); ++i)
+		sorted[i] = m_photons[keys[i].second];
+	m_photons.swap(sorted);
+
+	// At most half full, so the linear probing stays short.
+	int capacity = 1;
+	while (capacity < int(keys.size()) * 2)
+		capacity *= 2;
+	m_cells.resize(capacity);
+
+	int begin = 0;
+	while (begin < int(keys.size()))
+	{
+		int end = begin + 1;
+		while (end < int(keys.size()) && keys[end].first == keys[begin].first)
+			++end;
+
+		int slot = int(mixBits(keys[begin].first) & uint64_t(capacity - 1));
+		while (m_cells[slot].key != 0)
+			slot = (slot + 1) & (capacity - 1);
+		m_cells[slot].key = keys[begin].first;
+		m_cells[slot].begin = begin;
+		m_cells[slot].end = end;
+
+		begin = end;
+	}
+}
+
+int CausticPhotonMap::findCell(uint64_t key) const
+{
+	const int mask = int(m_cells.size()) - 1;
+	int slot = int(mixBits(key) & uint64_t(mask));
+	while (m_cells[slot].key != 0)
+	{
+		if (m_cells[slot].key == key)
+			return slot;
+		slot = (slot + 1) & mask;
+	}
+	return -1;
+}
+
+vec3 CausticPhotonMap::irradiance(const vec3& point, const vec3& normal) const
+{
+	vec3 result(0.0f, 0.0f, 0.0f);
+	if (m_cells.empty())
+		return result;
+
+	const float radiusSquared = m_radius * m_radius;
+	int minX, minY, minZ, maxX, maxY, maxZ;
+	cellOf(point - vec3(m_radius), minX, minY, minZ);
+	cellOf(point + vec3(m_radius), maxX, maxY, maxZ);
+
+	for (int z = minZ; z <= maxZ; ++z)
+	for (int y = minY; y <= maxY; ++y)
+	for (int x = minX; x <= maxX; ++x)
+	{
+		const int slot = findCell(cellKey(x, y, z));
+		if (slot == -1)
+			continue;
+
+		for (int i = m_cells[slot].begin; i < m_cells[slot].end; ++i)
+		{
+			const Photon& photon = m_photons[i];
+			// Only photons that arrived on this side of the surface.
+			if (glm::dot(photon.direction, normal) >= 0.0f)
+				continue;
+			const vec3 offset = photon.point - point;
+			if (glm::dot(offset, offset) <= radiusSquared)
+				result += photon.power;
+		}
+	}
+
+	return result / (Math::PI * radiusSquared);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+using glm::vec3;
+
+namespace Rae
+{
+
+class Hitable;
+class LightBvh;
+class ThreadPool;
+
+struct Photon
+{
+	vec3 point;
+	vec3 direction; // the direction the photon travelled in
+	vec3 power;
+};
+
+// Caustics: light that reached a diffuse surface through metal or glass. Photons are traced from
+// the lights, and only the ones that bounced off a specular surface before their first diffuse
+// hit are kept. Diffuse hits of camera paths gather the photons around them, and the camera paths
+// leave out the light that they find through specular bounces after that.
+// Each pass is a new photon map with a smaller radius (Knaus and Zwicker 2011, Progressive Photon
+// Mapping: A Probabilistic Approach), and averaging the pixel samples over the passes converges.
+// Nothing depends on the camera, so the passes carry on over camera moves.
+class CausticPhotonMap
+{
+public:
+	void clear();
+	// Traces the next pass. Call while no thread renders.
+	void emitPass(const Hitable& scene, const LightBvh& lightBvh, ThreadPool& threadPool);
+
+	bool isEmpty() const { return m_photons.empty(); }
+	// Caustic irradiance at a point on a diffuse surface, from the photons within radius().
+	vec3 irradiance(const vec3& point, const vec3& normal) const;
+
+	int passCount() const { return m_passCount; }
+	int photonCount() const { return int(m_photons.size()); }
+	float radius() const { return m_radius; }
+
+	void setPhotonsPerPass(int set) { m_photonsPerPass = set; }
+	void setInitialRadius(float set) { m_initialRadius = set; clear(); }
+
+	static const int MaxBounces = 8;
+
+protected:
+	uint64_t cellKey(int x, int y, int z) const;
+	void cellOf(const vec3& point, int& x, int& y, int& z) const;
+	void buildGrid();
+	int findCell(uint64_t key) const;
+
+	int m_photonsPerPass = 50000; // emitted, most don't become caustic photons
+	float m_initialRadius = 0.05f; // in world units
+	float m_alpha = 2.0f / 3.0f; // how fast the radius shrinks. The squared radius goes down as 1 / pass^(1 - alpha).
+
+	int m_passCount = 0;
+	float m_radius = 0.0f;
+	float m_cellSize = 0.0f; // twice the radius, so a gather touches at most 2x2x2 cells
+
+	// Photons sorted by cell, and a hash table from the cell to its range of photons
+	std::vector<Photon> m_photons;
+	struct Cell
+	{
+		uint64_t key = 0; // zero for an empty slot
+		int begin = 0;
+		int end = 0;
+	};
+	std::vector<Cell> m_cells;
+};
+
+} // end namespace Rae
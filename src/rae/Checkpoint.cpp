@@ -0,0 +1,197 @@
+#include "Checkpoint.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "core/MappedFile.hpp"
+
+using namespace Rae;
+
+// The file is the header and then the arrays of the accumulation, one after another as they are
+// in memory. Like the mesh cache, it's only for the machine that wrote it.
+namespace
+{
+	const char CheckpointMagic[8] = { 'R', 'A', 'E', 'C', 'K', 'P', 'T', '\0' };
+	// Bump when the header or any of the arrays changes.
+	const uint32_t CheckpointVersion = 2;
+	const int MaxSize = 1 << 16;
+
+	struct CheckpointHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t headerSize;
+		uint64_t key;
+		int32_t width;
+		int32_t height;
+		int32_t tilesX;
+		int32_t tilesY;
+		int32_t currentSample;
+		int32_t refinementStep;
+		int32_t finishedRefinementStep;
+		int32_t activeTileCount;
+		// The RenderJob
+		int32_t jobIsActive;
+		int32_t jobStep;
+		int32_t jobIsRefinement;
+		int32_t jobIsAdaptive;
+		int32_t jobTilesX;
+		int32_t jobTilesY;
+		int32_t jobNextTile;
+		int32_t jobStartX;
+		int32_t jobStartY;
+		int32_t jobEndX;
+		int32_t jobEndY;
+		int32_t padding;
+		int64_t splatPathCount;
+	};
+
+	size_t arraysSize(size_t pixelCount, size_t tileCount)
+	{
+		return pixelCount * (5 * sizeof(vec3) + sizeof(int) + sizeof(float)) + tileCount;
+	}
+
+	template <typename T>
+	void writeArray(std::ostream& out, const std::vector<T>& array)
+	{
+		if (array.empty() == false)
+			out.write(reinterpret_cast<const char*>(array.data()), std::streamsize(array.size() * sizeof(T)));
+	}
+
+	template <typename T>
+	bool readArray(std::ifstream& in, std::vector<T>& array, size_t count)
+	{
+		array.resize(count);
+		return count == 0 || in.read(reinterpret_cast<char*>(array.data()), std::streamsize(count * sizeof(T))).good();
+	}
+}
+
+bool Rae::writeCheckpoint(const std::string& path, const RenderCheckpoint& checkpoint)
+{
+	const ImageBuffer& buffer = checkpoint.buffer;
+	const size_t pixelCount = size_t(buffer.width) * size_t(buffer.height);
+	if (buffer.colorData.size() != pixelCount || buffer.varianceData.size() != pixelCount
+		|| buffer.sampleCounts.size() != pixelCount || buffer.albedoData.size() != pixelCount
+		|| buffer.normalData.size() != pixelCount || buffer.depthData.size() != pixelCount
+		|| buffer.tileActive.size() != size_t(buffer.tilesX) * size_t(buffer.tilesY)
+		|| checkpoint.splats.size() != pixelCount * 3)
+		return false;
+
+	CheckpointHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CheckpointMagic, sizeof(CheckpointMagic));
+	header.version = CheckpointVersion;
+	header.headerSize = sizeof(CheckpointHeader);
+	header.key = checkpoint.key;
+	header.width = buffer.width;
+	header.height = buffer.height;
+	header.tilesX = buffer.tilesX;
+	header.tilesY = buffer.tilesY;
+	header.currentSample = checkpoint.currentSample;
+	header.refinementStep = checkpoint.refinementStep;
+	header.finishedRefinementStep = checkpoint.finishedRefinementStep;
+	header.activeTileCount = checkpoint.activeTileCount;
+	const RenderJob& job = checkpoint.job;
+	header.jobIsActive = job.isActive ? 1 : 0;
+	header.jobStep = job.step;
+	header.jobIsRefinement = job.isRefinement ? 1 : 0;
+	header.jobIsAdaptive = job.isAdaptive ? 1 : 0;
+	header.jobTilesX = job.tilesX;
+	header.jobTilesY = job.tilesY;
+	header.jobNextTile = job.nextTile;
+	header.jobStartX = job.startX;
+	header.jobStartY = job.startY;
+	header.jobEndX = job.endX;
+	header.jobEndY = job.endY;
+	header.splatPathCount = checkpoint.splatPathCount;
+
+	return writeFileAtomically(path, [&](std::ostream& out)
+	{
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		writeArray(out, buffer.colorData);
+		writeArray(out, buffer.varianceData);
+		writeArray(out, buffer.sampleCounts);
+		writeArray(out, buffer.albedoData);
+		writeArray(out, buffer.normalData);
+		writeArray(out, buffer.depthData);
+		writeArray(out, buffer.tileActive);
+		writeArray(out, checkpoint.splats);
+	});
+}
+
+bool Rae::readCheckpoint(const std::string& path, RenderCheckpoint& checkpoint)
+{
+	std::ifstream in(path.c_str(), std::ios::binary | std::ios::ate);
+	if (in.is_open() == false)
+		return false;
+	const size_t fileSize = size_t(in.tellg());
+	in.seekg(0);
+
+	CheckpointHeader header;
+	if (fileSize < sizeof(header) || in.read(reinterpret_cast<char*>(&header), sizeof(header)).fail())
+		return false;
+	if (memcmp(header.magic, CheckpointMagic, sizeof(CheckpointMagic)) != 0
+		|| header.version != CheckpointVersion
+		|| header.headerSize != sizeof(CheckpointHeader)
+		|| header.width <= 0 || header.width > MaxSize
+		|| header.height <= 0 || header.height > MaxSize
+		|| header.tilesX != (header.width + ImageBuffer::TileSize - 1) / ImageBuffer::TileSize
+		|| header.tilesY != (header.height + ImageBuffer::TileSize - 1) / ImageBuffer::TileSize)
+		return false;
+
+	// The pass in progress goes on from its next tile, so it has to fit the image.
+	if (header.jobIsActive != 0)
+	{
+		if (header.jobStep < 1 || header.jobStep > MaxSize
+			|| header.jobStartX < 0 || header.jobEndX <= header.jobStartX || header.jobEndX > header.width
+			|| header.jobStartY < 0 || header.jobEndY <= header.jobStartY || header.jobEndY > header.height)
+			return false;
+		const int tileSize = RenderJob::TileLatticeSize * header.jobStep;
+		if (header.jobTilesX != (header.jobEndX - header.jobStartX + tileSize - 1) / tileSize
+			|| header.jobTilesY != (header.jobEndY - header.jobStartY + tileSize - 1) / tileSize
+			|| header.jobNextTile < 0 || header.jobNextTile > header.jobTilesX * header.jobTilesY)
+			return false;
+	}
+
+	const size_t pixelCount = size_t(header.width) * size_t(header.height);
+	const size_t tileCount = size_t(header.tilesX) * size_t(header.tilesY);
+	if (fileSize != sizeof(header) + arraysSize(pixelCount, tileCount))
+		return false;
+
+	ImageBuffer& buffer = checkpoint.buffer;
+	buffer.width = header.width;
+	buffer.height = header.height;
+	buffer.tilesX = header.tilesX;
+	buffer.tilesY = header.tilesY;
+	if (readArray(in, buffer.colorData, pixelCount) == false
+		|| readArray(in, buffer.varianceData, pixelCount) == false
+		|| readArray(in, buffer.sampleCounts, pixelCount) == false
+		|| readArray(in, buffer.albedoData, pixelCount) == false
+		|| readArray(in, buffer.normalData, pixelCount) == false
+		|| readArray(in, buffer.depthData, pixelCount) == false
+		|| readArray(in, buffer.tileActive, tileCount) == false
+		|| readArray(in, checkpoint.splats, pixelCount * 3) == false)
+		return false;
+
+	checkpoint.key = header.key;
+	checkpoint.currentSample = header.currentSample;
+	checkpoint.refinementStep = header.refinementStep;
+	checkpoint.finishedRefinementStep = header.finishedRefinementStep;
+	checkpoint.activeTileCount = header.activeTileCount;
+	checkpoint.splatPathCount = header.splatPathCount;
+	RenderJob& job = checkpoint.job;
+	job.isActive = header.jobIsActive != 0;
+	job.step = header.jobStep;
+	job.isRefinement = header.jobIsRefinement != 0;
+	job.isAdaptive = header.jobIsAdaptive != 0;
+	job.tilesX = header.jobTilesX;
+	job.tilesY = header.jobTilesY;
+	job.nextTile = header.jobNextTile;
+	job.startX = header.jobStartX;
+	job.startY = header.jobStartY;
+	job.endX = header.jobEndX;
+	job.endY = header.jobEndY;
+	job.elapsedTime = 0.0;
+	return true;
+}
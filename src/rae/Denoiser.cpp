@@ -0,0 +1,193 @@
+#include "Denoiser.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+
+#include "RayTracer.hpp"
+#include "core/ThreadPool.hpp"
+
+using namespace Rae;
+
+namespace
+{
+	const float Kernel[3] = { 0.25f, 0.5f, 0.25f };
+	const float NoVariance = 1.0e4f; // Pixels with under two samples have no variance estimate.
+
+	float luminanceOf(const vec3& color)
+	{
+		return glm::dot(color, vec3(0.2126f, 0.7152f, 0.0722f));
+	}
+
+	vec3 safeAlbedo(const vec3& albedo)
+	{
+		return glm::max(albedo, vec3(0.001f, 0.001f, 0.001f));
+	}
+
+	vec3 safeNormalize(const vec3& normal)
+	{
+		float length = glm::length(normal);
+		if (length < 0.01f)
+			return vec3(0.0f, 0.0f, 0.0f);
+		return normal / length;
+	}
+}
+
+void Denoiser::denoise(const ImageBuffer& buffer, ThreadPool& threadPool)
+{
+	denoise(buffer, buffer.colorData, threadPool);
+}
+
+void Denoiser::denoise(const ImageBuffer& buffer, const std::vector<vec3>& color, ThreadPool& threadPool)
+{
+	auto startTime = std::chrono::steady_clock::now();
+
+	const int pixelCount = buffer.width * buffer.height;
+	for (int i = 0; i < 2; ++i)
+	{
+		m_illumination[i].resize(pixelCount);
+		m_variance[i].resize(pixelCount);
+	}
+	m_normals.resize(pixelCount);
+	m_output.resize(pixelCount);
+
+	// Demodulate albedo
+	threadPool.parallelFor(buffer.height, [&](int j, int)
+	{
+		for (int i = 0; i < buffer.width; ++i)
+		{
+			const int index = (j * buffer.width) + i;
+			vec3 albedo = safeAlbedo(buffer.albedoData[index]);
+			m_illumination[0][index] = color[index] / albedo;
+			m_normals[index] = safeNormalize(buffer.normalData[index]);
+
+			if (buffer.sampleCounts[index] < 2)
+			{
+				m_variance[0][index] = NoVariance;
+			}
+			else
+			{
+				float albedoLuminance = std::max(luminanceOf(albedo), 0.001f);
+				m_variance[0][index] = buffer.varianceOfMean(index) / (albedoLuminance * albedoLuminance);
+			}
+		}
+	});
+
+	int current = 0;
+	for (int iteration = 0; iteration < m_iterations; ++iteration)
+	{
+		filterIteration(buffer, threadPool, iteration,
+			m_illumination[current], m_variance[current],
+			m_illumination[1 - current], m_variance[1 - current]);
+		current = 1 - current;
+	}
+
+	// Remodulate, and blend towards the raw accumulation
+	const std::vector<vec3>& filtered = m_illumination[current];
+	threadPool.parallelFor(buffer.height, [&](int j, int)
+	{
+		for (int i = 0; i < buffer.width; ++i)
+		{
+			const int index = (j * buffer.width) + i;
+			vec3 denoised = filtered[index] * safeAlbedo(buffer.albedoData[index]);
+
+			if (m_isBlendToRaw)
+			{
+				float rawWeight = glm::clamp(float(buffer.sampleCounts[index]) / float(m_blendSamples), 0.0f, 1.0f);
+				m_output[index] = glm::mix(denoised, color[index], rawWeight);
+			}
+			else
+			{
+				m_output[index] = denoised;
+			}
+		}
+	});
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+	m_lastDenoiseTime = elapsed.count();
+}
+
+void Denoiser::filterIteration(const ImageBuffer& buffer, ThreadPool& threadPool, int iteration,
+	const std::vector<vec3>& inColor, const std::vector<float>& inVariance,
+	std::vector<vec3>& outColor, std::vector<float>& outVariance)
+{
+	const int step = 1 << iteration;
+	const int width = buffer.width;
+	const int height = buffer.height;
+
+	threadPool.parallelFor(height, [&](int j, int)
+	{
+		for (int i = 0; i < width; ++i)
+		{
+			const int index = (j * width) + i;
+
+			const vec3 centerColor = inColor[index];
+			const float centerLuminance = luminanceOf(centerColor);
+			const float luminanceScale = 1.0f / (m_colorSigma * sqrt(std::max(inVariance[index], 0.0f)) + 0.0001f);
+			const vec3 centerNormal = m_normals[index];
+			const bool isCenterSky = centerNormal == vec3(0.0f, 0.0f, 0.0f);
+			const float centerDepth = buffer.depthData[index];
+			const vec3 centerAlbedo = buffer.albedoData[index];
+			const float depthScale = 1.0f / (m_depthSigma * float(step) * std::max(centerDepth, 0.001f));
+			const float albedoScale = 1.0f / m_albedoSigma;
+
+			vec3 colorSum(0.0f, 0.0f, 0.0f);
+			float varianceSum = 0.0f;
+			float weightSum = 0.0f;
+
+			for (int dy = -1; dy <= 1; ++dy)
+			{
+				const int y = j + dy * step;
+				if (y < 0 || y >= height)
+					continue;
+
+				for (int dx = -1; dx <= 1; ++dx)
+				{
+					const int x = i + dx * step;
+					if (x < 0 || x >= width)
+						continue;
+
+					const int sampleIndex = (y * width) + x;
+					const vec3& sampleColor = inColor[sampleIndex];
+
+					float weight = Kernel[dx + 1] * Kernel[dy + 1];
+
+					if (sampleIndex != index)
+					{
+						const vec3& sampleNormal = m_normals[sampleIndex];
+						const bool isSampleSky = sampleNormal == vec3(0.0f, 0.0f, 0.0f);
+						if (isCenterSky != isSampleSky)
+							continue;
+
+						// All the exponential weights are summed into one exp.
+						float exponent = 0.0f;
+
+						if (isCenterSky == false)
+						{
+							float normalWeight = std::max(0.0f, glm::dot(centerNormal, sampleNormal));
+							for (int k = 0; k < m_normalPowerLog2; ++k)
+								normalWeight *= normalWeight;
+							weight *= normalWeight;
+
+							exponent += fabs(centerDepth - buffer.depthData[sampleIndex]) * depthScale;
+						}
+
+						const vec3 albedoDifference = glm::abs(centerAlbedo - buffer.albedoData[sampleIndex]);
+						exponent += (albedoDifference.x + albedoDifference.y + albedoDifference.z) * albedoScale;
+						exponent += fabs(centerLuminance - luminanceOf(sampleColor)) * luminanceScale;
+
+						weight *= exp(-exponent);
+					}
+
+					colorSum += weight * sampleColor;
+					varianceSum += weight * weight * inVariance[sampleIndex];
+					weightSum += weight;
+				}
+			}
+
+			// The center pixel always has a weight, so weightSum is never zero.
+			outColor[index] = colorSum / weightSum;
+			outVariance[index] = varianceSum / (weightSum * weightSum);
+		}
+	});
+}
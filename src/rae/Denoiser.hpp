@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+using glm::vec3;
+
+namespace Rae
+{
+
+struct ImageBuffer;
+class ThreadPool;
+
+// Edge-avoiding à-trous wavelet filter (Dammertz et al. 2010), with the per-pixel
+// variance guided color weights of SVGF (Schied et al. 2017).
+// Filters the illumination, i.e. color divided by albedo, so that surface detail stays sharp.
+class Denoiser
+{
+public:
+	// Filters the accumulated image of the buffer into output().
+	void denoise(const ImageBuffer& buffer, ThreadPool& threadPool);
+	// Same, but filters the given color instead of the buffer's, e.g. with splats added.
+	void denoise(const ImageBuffer& buffer, const std::vector<vec3>& color, ThreadPool& threadPool);
+
+	const std::vector<vec3>& output() const { return m_output; }
+	double lastDenoiseTime() const { return m_lastDenoiseTime; } // in seconds
+
+	void setIterations(int set) { m_iterations = set; }
+	int iterations() const { return m_iterations; }
+
+	// The denoised image is blended towards the raw accumulation as samples grow,
+	// reaching the raw image at blendSamples.
+	void toggleBlendToRaw() { m_isBlendToRaw = !m_isBlendToRaw; }
+	bool isBlendToRaw() const { return m_isBlendToRaw; }
+	void setBlendSamples(int set) { m_blendSamples = set; }
+
+protected:
+	void filterIteration(const ImageBuffer& buffer, ThreadPool& threadPool, int iteration,
+		const std::vector<vec3>& inColor, const std::vector<float>& inVariance,
+		std::vector<vec3>& outColor, std::vector<float>& outVariance);
+
+	int m_iterations = 5;
+	float m_colorSigma = 4.0f; // in standard deviations of the pixel's noise
+	int m_normalPowerLog2 = 6; // normal weight is dot(n0, n1)^64
+	float m_depthSigma = 0.02f; // relative depth difference per pixel of step
+	float m_albedoSigma = 0.1f;
+
+	bool m_isBlendToRaw = true;
+	int m_blendSamples = 256;
+
+	std::vector<vec3> m_normals; // normalized, zero for the sky
+	std::vector<vec3> m_illumination[2];
+	std::vector<float> m_variance[2];
+	std::vector<vec3> m_output;
+
+	double m_lastDenoiseTime = 0.0;
+};
+
+} // end namespace Rae
@@ -1,5 +1,7 @@
 #include "Engine.hpp"
 
+#include <chrono>
+
 #include <glm/glm.hpp>
 
 #include "System.hpp"
@@ -31,10 +33,16 @@ m_renderSystem(m_objectFactory, m_window, m_input, m_cameraSystem, m_rayTracer)
 	addSystem(m_rayTracer);
 	addSystem(m_renderSystem);
 
-	// Load model
-	Mesh& mesh = m_objectFactory.createMesh();
-	mesh.loadModel("./data/models/bunny.obj");
-	m_modelID = mesh.id();
+	// Load model. In the background, as an import without a cache takes seconds. The mesh stays
+	// empty until update moves the model in.
+	const int modelID = m_objectFactory.createMesh().id();
+	m_modelID = modelID;
+	m_modelLoad = std::async(std::launch::async, [modelID]()
+	{
+		std::unique_ptr<Mesh> mesh(new Mesh(modelID));
+		mesh->loadModel("./data/models/bunny.obj");
+		return mesh;
+	});
 
 	m_meshID     = m_renderSystem.createBox().id();
 	m_materialID = m_renderSystem.createMaterial(0, glm::vec4(0.2f, 0.5f, 0.7f, 0.0f)).id();
@@ -59,6 +67,7 @@ m_renderSystem(m_objectFactory, m_window, m_input, m_cameraSystem, m_rayTracer)
 
 	using std::placeholders::_1;
 	m_input.connectMouseButtonPressEventHandler(std::bind(&Engine::onMouseEvent, this, _1));
+	m_input.connectMouseMotionEventHandler(std::bind(&Engine::onMouseEvent, this, _1));
 	m_input.connectKeyEventHandler(std::bind(&Engine::onKeyEvent, this, _1));
 }
 
@@ -91,6 +100,14 @@ void Engine::run()
 
 void Engine::update(double time, double delta_time)
 {
+	// The VBOs need the GL context of this thread.
+	if (m_modelLoad.valid() && m_modelLoad.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	{
+		Mesh& mesh = *m_objectFactory.getMesh(m_modelID);
+		mesh = std::move(*m_modelLoad.get());
+		mesh.createVBOs();
+	}
+
 	reactToInput(m_input);
 
 	for(auto system : m_systems)
@@ -263,9 +280,29 @@ void Engine::osKeyEvent(int key, int scancode, int action, int mods)
 
 void Engine::onMouseEvent(const Input& input)
 {
-	if (input.eventType == EventType::MOUSE_BUTTON_PRESS)
+	// The ray traced image fills the window, so the mouse is in image coordinates with the top left at 0.
+	const vec2 imagePoint(
+		(input.mouse.xP / float(m_renderSystem.windowPixelWidth())) + 0.5f,
+		(input.mouse.yP / float(m_renderSystem.windowPixelHeight())) + 0.5f);
+
+	if (input.eventType == EventType::MOUSE_MOTION)
+	{
+		if (m_rayTracer.isRoiCursorMode())
+		{
+			m_rayTracer.setRoiCenter(imagePoint);
+		}
+		else if (m_rayTracer.isCropMode() && input.mouse.button(MouseButton::FIRST))
+		{
+			const vec2 pressPoint(
+				(input.mouse.xOnButtonPressP[MouseButton::FIRST] / float(m_renderSystem.windowPixelWidth())) + 0.5f,
+				(input.mouse.yOnButtonPressP[MouseButton::FIRST] / float(m_renderSystem.windowPixelHeight())) + 0.5f);
+			m_rayTracer.setCropWindow(pressPoint, imagePoint);
+		}
+	}
+	else if (input.eventType == EventType::MOUSE_BUTTON_PRESS)
 	{
-		if (input.mouse.eventButton == MouseButton::FIRST)
+		// In the crop mode the first button drags the crop window instead of picking.
+		if (input.mouse.eventButton == MouseButton::FIRST && m_rayTracer.isCropMode() == false)
 		{
 			//cout << "mouse press: x: "<< input.mouse.x << " y: " << input.mouse.y << endl;
 			//cout << "mouse press: xP: "<< (int)m_screenSystem.heightToPixels(input.mouse.x) + (m_renderSystem.windowPixelWidth() / 2)
@@ -315,12 +352,24 @@ void Engine::onKeyEvent(const Input& input)
 				m_rayTracer.toggleIsEnabled();
 				break;
 			case KeySym::T: m_rayTracer.toggleInfoText(); break;
-			case KeySym::Y: m_rayTracer.toggleBufferQuality(); break;
+			case KeySym::Y: m_rayTracer.governor().toggleEnabled(); break;
 			case KeySym::U: m_rayTracer.toggleFastMode(); break;
 			case KeySym::H: m_rayTracer.toggleVisualizeFocusDistance(); break;
+			case KeySym::P: m_rayTracer.toggleRenderToErrorThreshold(); break;
+			case KeySym::J: m_rayTracer.toggleVisualizeSampleCount(); break;
+			case KeySym::C: m_rayTracer.nextSampler(); break;
+			case KeySym::Tab: m_rayTracer.nextIntegrator(); break;
+			case KeySym::F1: m_rayTracer.togglePathGuiding(); break;
+			case KeySym::F2: m_rayTracer.toggleRadianceCache(); break;
+			case KeySym::F3: m_rayTracer.toggleCaustics(); break;
+			case KeySym::F4: m_rayTracer.nextRoiMode(); break;
+			case KeySym::F5: m_rayTracer.saveImage("render.exr", true, false); break;
+			case KeySym::X: m_rayTracer.toggleDenoiser(); break;
+			case KeySym::Z: m_rayTracer.toggleTemporalReprojection(); break;
 			case KeySym::_1: m_rayTracer.showScene(1); break;
 			case KeySym::_2: m_rayTracer.showScene(2); break;
 			case KeySym::_3: m_rayTracer.showScene(3); break;
+			case KeySym::_4: m_rayTracer.showScene(4); break;
 			default:
 			break;
 		}
@@ -2,14 +2,17 @@
 #define RAE_ENGINE_HPP
 
 #include <vector>
+#include <memory>
+#include <future>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
 #include "ObjectFactory.hpp"
+#include "Mesh.hpp"
 #include "core/ScreenSystem.hpp"
 #include "ui/Input.hpp"
-#include "CameraSystem.hpp"
+#include "InputCameraSystem.hpp"
 #include "RenderSystem.hpp"
 #include "RayTracer.hpp"
 
@@ -66,12 +69,13 @@ protected:
 
 	std::vector<System*> m_systems;
 
-	CameraSystem		m_cameraSystem;
+	InputCameraSystem	m_cameraSystem;
 	RayTracer			m_rayTracer;
 	RenderSystem		m_renderSystem;
 
 	int m_meshID; // These should go someplace else...
 	int m_modelID;
+	std::future<std::unique_ptr<Mesh>> m_modelLoad; // moved into the mesh of m_modelID when it's done
 	int m_materialID;
 	int m_bunnyMaterialID;
 	int m_buttonMaterialID;
@@ -0,0 +1,290 @@
+#include "HdrImage.hpp"
+
+#include <cstring>
+#include <sstream>
+#include <stdint.h>
+
+#include "core/MappedFile.hpp"
+
+using namespace Rae;
+
+// Both formats are written little endian, like the caches, which is what EXR wants and what the
+// negative scale of a PFM says.
+namespace
+{
+	bool endsWith(const std::string& text, const std::string& ending)
+	{
+		return text.size() >= ending.size()
+			&& text.compare(text.size() - ending.size(), ending.size(), ending) == 0;
+	}
+
+	// A viewer never gets half a progress save.
+	bool writeFile(const std::string& path, const std::vector<char>& contents)
+	{
+		return writeFileAtomically(path, [&contents](std::ostream& out)
+		{
+			out.write(contents.data(), std::streamsize(contents.size()));
+		});
+	}
+
+	template <typename T>
+	void append(std::vector<char>& out, const T& value)
+	{
+		const char* bytes = reinterpret_cast<const char*>(&value);
+		out.insert(out.end(), bytes, bytes + sizeof(T));
+	}
+
+	void appendString(std::vector<char>& out, const char* text)
+	{
+		out.insert(out.end(), text, text + strlen(text) + 1);
+	}
+
+	// PFM
+
+	// components is 3 for a PF colour file and 1 for a Pf greyscale one.
+	bool writePfmLayer(const std::string& path, int width, int height, const float* data, int components)
+	{
+		std::ostringstream header;
+		header << (components == 3 ? "PF" : "Pf") << "\n" << width << " " << height << "\n-1.0\n";
+		const std::string headerText = header.str();
+
+		const size_t rowSize = size_t(width) * components * sizeof(float);
+		std::vector<char> contents;
+		contents.reserve(headerText.size() + rowSize * height);
+		contents.insert(contents.end(), headerText.begin(), headerText.end());
+		// The rows go from the bottom up.
+		for (int j = height - 1; j >= 0; --j)
+		{
+			const char* row = reinterpret_cast<const char*>(data + size_t(j) * width * components);
+			contents.insert(contents.end(), row, row + rowSize);
+		}
+		return writeFile(path, contents);
+	}
+
+	// EXR
+
+	const int32_t ExrMagic = 20000630;
+	const int32_t ExrVersion = 2; // a single part scanline file
+	const uint8_t ExrRleCompression = 1;
+	const int32_t ExrHalf = 1;
+	const int32_t ExrFloat = 2;
+
+	struct ExrChannel
+	{
+		const char* name;
+		const float* data;
+		int stride; // floats from one pixel to the next
+	};
+
+	void appendAttribute(std::vector<char>& out, const char* name, const char* type, int32_t size)
+	{
+		appendString(out, name);
+		appendString(out, type);
+		append(out, size);
+	}
+
+	void appendBox(std::vector<char>& out, const char* name, int width, int height)
+	{
+		appendAttribute(out, name, "box2i", 16);
+		append(out, int32_t(0));
+		append(out, int32_t(0));
+		append(out, int32_t(width - 1));
+		append(out, int32_t(height - 1));
+	}
+
+	// The RLE of OpenEXR: the low and high bytes of the values in two halves, each byte stored as
+	// the difference to the previous one, and then runs of equal bytes. Smooth half float images
+	// get to about half their size.
+	const int MinRunLength = 3;
+	const int MaxRunLength = 127;
+
+	void rleCompress(const std::vector<uint8_t>& data, std::vector<char>& packed, std::vector<uint8_t>& temp)
+	{
+		const size_t size = data.size();
+		temp.resize(size);
+		size_t low = 0;
+		size_t high = (size + 1) / 2;
+		for (size_t i = 0; i < size; ++i)
+			temp[(i % 2 == 0) ? low++ : high++] = data[i];
+
+		int previous = size > 0 ? temp[0] : 0;
+		for (size_t i = 1; i < size; ++i)
+		{
+			const int value = temp[i];
+			temp[i] = uint8_t(value - previous + 128 + 256);
+			previous = value;
+		}
+
+		packed.clear();
+		const uint8_t* runStart = temp.data();
+		const uint8_t* runEnd = runStart + 1;
+		const uint8_t* end = runStart + size;
+		while (runStart < end)
+		{
+			while (runEnd < end && *runStart == *runEnd && runEnd - runStart - 1 < MaxRunLength)
+				++runEnd;
+
+			if (runEnd - runStart >= MinRunLength)
+			{
+				// A run: the count minus one and the byte.
+				packed.push_back(char(runEnd - runStart - 1));
+				packed.push_back(char(*runStart));
+				runStart = runEnd;
+			}
+			else
+			{
+				// Literal bytes up to the next run, with their count negated.
+				while (runEnd < end
+					&& ((runEnd + 1 >= end || *runEnd != *(runEnd + 1))
+						|| (runEnd + 2 >= end || *(runEnd + 1) != *(runEnd + 2)))
+					&& runEnd - runStart < MaxRunLength)
+					++runEnd;
+				packed.push_back(char(runStart - runEnd));
+				packed.insert(packed.end(), runStart, runEnd);
+				runStart = runEnd;
+			}
+			++runEnd;
+		}
+	}
+}
+
+bool Rae::writePfm(const std::string& path, const HdrImage& image)
+{
+	const size_t pixelCount = size_t(image.width) * size_t(image.height);
+	if (image.width <= 0 || image.height <= 0 || image.color.size() != pixelCount)
+		return false;
+	if (writePfmLayer(path, image.width, image.height, &image.color[0].x, 3) == false)
+		return false;
+	if (image.hasFeatures() == false)
+		return true;
+	if (image.normal.size() != pixelCount || image.depth.size() != pixelCount)
+		return false;
+
+	const std::string base = endsWith(path, ".pfm") ? path.substr(0, path.size() - 4) : path;
+	return writePfmLayer(base + ".albedo.pfm", image.width, image.height, &image.albedo[0].x, 3)
+		&& writePfmLayer(base + ".normal.pfm", image.width, image.height, &image.normal[0].x, 3)
+		&& writePfmLayer(base + ".depth.pfm", image.width, image.height, image.depth.data(), 1);
+}
+
+bool Rae::writeExr(const std::string& path, const HdrImage& image, bool isFloat)
+{
+	const int width = image.width;
+	const int height = image.height;
+	const size_t pixelCount = size_t(width) * size_t(height);
+	if (width <= 0 || height <= 0 || image.color.size() != pixelCount)
+		return false;
+
+	// In the order of their names, which is the order of the file.
+	std::vector<ExrChannel> channels;
+	channels.push_back({ "B", &image.color[0].z, 3 });
+	channels.push_back({ "G", &image.color[0].y, 3 });
+	channels.push_back({ "R", &image.color[0].x, 3 });
+	if (image.hasFeatures())
+	{
+		if (image.albedo.size() != pixelCount || image.normal.size() != pixelCount || image.depth.size() != pixelCount)
+			return false;
+		channels.push_back({ "Z", image.depth.data(), 1 });
+		channels.push_back({ "albedo.B", &image.albedo[0].z, 3 });
+		channels.push_back({ "albedo.G", &image.albedo[0].y, 3 });
+		channels.push_back({ "albedo.R", &image.albedo[0].x, 3 });
+		channels.push_back({ "normal.X", &image.normal[0].x, 3 });
+		channels.push_back({ "normal.Y", &image.normal[0].y, 3 });
+		channels.push_back({ "normal.Z", &image.normal[0].z, 3 });
+	}
+	const int32_t pixelType = isFloat ? ExrFloat : ExrHalf;
+	const size_t valueSize = isFloat ? 4 : 2;
+
+	std::vector<char> contents;
+	append(contents, ExrMagic);
+	append(contents, ExrVersion);
+
+	int32_t channelListSize = 1;
+	for (const ExrChannel& channel : channels)
+		channelListSize += int32_t(strlen(channel.name) + 1 + 16);
+	appendAttribute(contents, "channels", "chlist", channelListSize);
+	for (const ExrChannel& channel : channels)
+	{
+		appendString(contents, channel.name);
+		append(contents, pixelType);
+		append(contents, uint32_t(0)); // pLinear and reserved
+		append(contents, int32_t(1)); // xSampling
+		append(contents, int32_t(1)); // ySampling
+	}
+	contents.push_back('\0');
+
+	appendAttribute(contents, "compression", "compression", 1);
+	append(contents, ExrRleCompression);
+	appendBox(contents, "dataWindow", width, height);
+	appendBox(contents, "displayWindow", width, height);
+	appendAttribute(contents, "lineOrder", "lineOrder", 1);
+	append(contents, uint8_t(0)); // increasing y
+	appendAttribute(contents, "pixelAspectRatio", "float", 4);
+	append(contents, 1.0f);
+	appendAttribute(contents, "screenWindowCenter", "v2f", 8);
+	append(contents, 0.0f);
+	append(contents, 0.0f);
+	appendAttribute(contents, "screenWindowWidth", "float", 4);
+	append(contents, 1.0f);
+	contents.push_back('\0');
+
+	// One scanline a chunk for RLE, each found from the table of offsets.
+	const size_t tableStart = contents.size();
+	contents.resize(tableStart + size_t(height) * sizeof(uint64_t));
+	contents.reserve(contents.size() + pixelCount * channels.size() * valueSize);
+
+	std::vector<uint8_t> scanline(size_t(width) * channels.size() * valueSize);
+	std::vector<char> packed;
+	std::vector<uint8_t> temp;
+	for (int j = 0; j < height; ++j)
+	{
+		uint8_t* write = scanline.data();
+		for (const ExrChannel& channel : channels)
+		{
+			const float* read = channel.data + size_t(j) * width * channel.stride;
+			for (int i = 0; i < width; ++i, read += channel.stride)
+			{
+				if (isFloat)
+				{
+					memcpy(write, read, 4);
+				}
+				else
+				{
+					const uint16_t half = uint16_t(glm::packHalf2x16(glm::vec2(*read, 0.0f)) & 0xFFFF);
+					memcpy(write, &half, 2);
+				}
+				write += valueSize;
+			}
+		}
+
+		const uint64_t offset = contents.size();
+		memcpy(&contents[tableStart + size_t(j) * sizeof(uint64_t)], &offset, sizeof(offset));
+		append(contents, int32_t(j));
+		// A chunk that doesn't get smaller is stored as it is, which readers know from its size.
+		rleCompress(scanline, packed, temp);
+		if (packed.size() < scanline.size())
+		{
+			append(contents, int32_t(packed.size()));
+			contents.insert(contents.end(), packed.begin(), packed.end());
+		}
+		else
+		{
+			append(contents, int32_t(scanline.size()));
+			contents.insert(contents.end(), scanline.begin(), scanline.end());
+		}
+	}
+	return writeFile(path, contents);
+}
+
+bool Rae::writeHdrImage(const std::string& path, const HdrImage& image, bool isFloat)
+{
+	if (endsWith(path, ".exr"))
+		return writeExr(path, image, isFloat);
+	if (endsWith(path, ".pfm"))
+		return writePfm(path, image);
+	return false;
+}
+
+bool Rae::isHdrImagePath(const std::string& path)
+{
+	return endsWith(path, ".exr") || endsWith(path, ".pfm");
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+using glm::vec3;
+
+namespace Rae
+{
+
+// A linear float image with the features of its first hits, for compositing and for denoisers
+// outside the renderer. The feature arrays are empty when they aren't written.
+struct HdrImage
+{
+	int width = 0;
+	int height = 0;
+	std::vector<vec3> color;
+	std::vector<vec3> albedo;
+	std::vector<vec3> normal;
+	std::vector<float> depth;
+
+	bool hasFeatures() const { return albedo.empty() == false; }
+};
+
+// PFM holds one layer, so the features go next to it: render.pfm, render.albedo.pfm,
+// render.normal.pfm and render.depth.pfm. Always 32-bit floats.
+bool writePfm(const std::string& path, const HdrImage& image);
+// One OpenEXR scanline file: R, G, B, and Z, albedo.* and normal.* for the features. Half floats
+// unless isFloat. RLE compressed, which needs nothing but the file itself.
+bool writeExr(const std::string& path, const HdrImage& image, bool isFloat);
+// By the extension, .pfm or .exr.
+bool writeHdrImage(const std::string& path, const HdrImage& image, bool isFloat);
+// .pfm and .exr
+bool isHdrImagePath(const std::string& path);
+
+}
@@ -4,6 +4,7 @@ namespace Rae
 {
 
 class Material;
+class Hitable;
 
 // Hitable.hpp
 struct HitRecord
@@ -12,6 +13,8 @@ struct HitRecord
 	vec3 point;
 	vec3 normal;
 	Material* material = nullptr;
+	const Hitable* hitable = nullptr;
+	int primitiveIndex = 0; // the triangle of a mesh
 };
 
 }
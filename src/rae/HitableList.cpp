@@ -1,10 +1,61 @@
 #include "HitableList.hpp"
+
+#include <utility>
+
 #include "Ray.hpp"
 #include "HitRecord.hpp"
 #include "Aabb.hpp"
+#include "Material.hpp"
+#include "Instance.hpp"
 
 using namespace Rae;
 
+void HitableList::clear()
+{
+	for (int i = 0; i < (int)m_owned.size(); ++i)
+	{
+		delete m_owned[i];
+	}
+	m_owned.clear();
+	m_list.clear();
+
+	for (int i = 0; i < (int)m_materials.size(); ++i)
+	{
+		delete m_materials[i];
+	}
+	m_materials.clear();
+
+	for (int i = 0; i < (int)m_instanceBlocks.size(); ++i)
+	{
+		delete[] m_instanceBlocks[i];
+	}
+	m_instanceBlocks.clear();
+	m_instanceBlockUsed = InstanceBlockSize;
+}
+
+void HitableList::swap(HitableList& other)
+{
+	m_list.swap(other.m_list);
+	m_owned.swap(other.m_owned);
+	m_materials.swap(other.m_materials);
+	m_instanceBlocks.swap(other.m_instanceBlocks);
+	std::swap(m_instanceBlockUsed, other.m_instanceBlockUsed);
+}
+
+Instance* HitableList::addInstance(const Hitable* object, const glm::mat4& transform)
+{
+	if (m_instanceBlockUsed == InstanceBlockSize)
+	{
+		m_instanceBlocks.push_back(new Instance[InstanceBlockSize]);
+		m_instanceBlockUsed = 0;
+	}
+
+	Instance* instance = &m_instanceBlocks.back()[m_instanceBlockUsed++];
+	*instance = Instance(object, transform);
+	m_list.push_back(instance);
+	return instance;
+}
+
 bool HitableList::hit(const Ray& ray, float t_min, float t_max, HitRecord& record) const
 {
 	HitRecord tempRecord;
@@ -25,4 +76,4 @@ bool HitableList::hit(const Ray& ray, float t_min, float t_max, HitRecord& recor
 Aabb HitableList::getAabb(float t0, float t1) const
 {
 	return Aabb();
-}
\ No newline at end of file
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <glm/glm.hpp>
 #include "Hitable.hpp"
 
 namespace Rae
@@ -8,7 +9,10 @@ namespace Rae
 
 class Ray;
 struct HitRecord;
+class Material;
+class Instance;
 
+// The scene. Owns its hitables and materials, and frees them in clear().
 class HitableList : public Hitable
 {
 public:
@@ -22,14 +26,9 @@ public:
 		clear();
 	}
 
-	void clear()
-	{
-		for(int i = 0; i < (int)m_list.size(); ++i)
-		{
-			delete m_list[i];
-		}
-		m_list.clear();
-	}
+	void clear();
+	// The instances stay where they are, so the pointers to the hitables stay valid.
+	void swap(HitableList& other);
 
 	virtual bool hit(const Ray& ray, float t_min, float t_max, HitRecord& record) const;
 	virtual Aabb getAabb(float t0, float t1) const;
@@ -37,12 +36,29 @@ public:
 	void add(Hitable* hitable)
 	{
 		m_list.push_back(hitable);
+		m_owned.push_back(hitable);
 	}
+	// An object that is only in the scene through its instances
+	void addObject(Hitable* object) { m_owned.push_back(object); }
+	// Materials can be shared, so the hitables don't own them.
+	Material* addMaterial(Material* material)
+	{
+		m_materials.push_back(material);
+		return material;
+	}
+	// Instances are allocated in blocks, as a scene can have millions of them.
+	Instance* addInstance(const Hitable* object, const glm::mat4& transform);
 
 	std::vector<Hitable*>& list() { return m_list; }
 
 protected:
 	std::vector<Hitable*> m_list;
+	std::vector<Hitable*> m_owned;
+	std::vector<Material*> m_materials;
+
+	static const int InstanceBlockSize = 4096;
+	std::vector<Instance*> m_instanceBlocks;
+	int m_instanceBlockUsed = InstanceBlockSize;
 };
 
 }
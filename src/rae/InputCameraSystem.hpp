@@ -0,0 +1,25 @@
+#pragma once
+
+#include "CameraSystem.hpp"
+
+namespace Rae
+{
+
+class Input;
+
+// The camera controls of the windowed app
+class InputCameraSystem : public CameraSystem
+{
+public:
+	InputCameraSystem(Input& input);
+
+	void update(double time, double delta_time, std::vector<Entity>& entities) override;
+
+	void onMouseEvent(const Input& input);
+	void onKeyEvent(const Input& input);
+
+private:
+	Input& m_input;
+};
+
+}
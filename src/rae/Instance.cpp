@@ -0,0 +1,57 @@
+#include "Instance.hpp"
+#include "Ray.hpp"
+#include "HitRecord.hpp"
+
+#include <cmath>
+
+using namespace Rae;
+
+Instance::Instance(const Hitable* object, const mat4& transform)
+: m_object(object),
+m_toWorld(transform),
+m_toObject(glm::inverse(transform))
+{
+	// The box around the transformed corners of the object's box
+	const Aabb objectAabb = m_object->getAabb(0, 0);
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		const vec3 point(
+			(corner & 1) ? objectAabb.max().x : objectAabb.min().x,
+			(corner & 2) ? objectAabb.max().y : objectAabb.min().y,
+			(corner & 4) ? objectAabb.max().z : objectAabb.min().z);
+		m_aabb.grow(toWorld(point));
+	}
+}
+
+bool Instance::hit(const Ray& ray, float t_min, float t_max, HitRecord& record) const
+{
+	if (m_aabb.hit(ray, t_min, t_max) == false)
+		return false;
+
+	// The direction isn't normalized, so t is the same in both spaces.
+	const Ray objectRay(m_toObject * glm::vec4(ray.origin(), 1.0f), m_toObject * glm::vec4(ray.direction(), 0.0f));
+	if (m_object->hit(objectRay, t_min, t_max, record) == false)
+		return false;
+
+	record.point = ray.point_at_parameter(record.t);
+	// Normals go with the inverse transpose.
+	record.normal = glm::normalize(glm::transpose(glm::mat3(m_toObject)) * record.normal);
+	record.hitable = this;
+	return true;
+}
+
+float Instance::uniformScale() const
+{
+	const float scaleX = glm::length(m_toWorld[0]);
+	const float scaleY = glm::length(m_toWorld[1]);
+	const float scaleZ = glm::length(m_toWorld[2]);
+	const float tolerance = 1e-4f * scaleX;
+	if (std::abs(scaleX - scaleY) > tolerance || std::abs(scaleX - scaleZ) > tolerance)
+		return 0.0f;
+	// Also the axes need to stay perpendicular.
+	if (std::abs(glm::dot(m_toWorld[0], m_toWorld[1])) > tolerance * scaleX
+		|| std::abs(glm::dot(m_toWorld[0], m_toWorld[2])) > tolerance * scaleX
+		|| std::abs(glm::dot(m_toWorld[1], m_toWorld[2])) > tolerance * scaleX)
+		return 0.0f;
+	return scaleX;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <glm/glm.hpp>
+using glm::vec3;
+using glm::mat4;
+
+#include "Hitable.hpp"
+#include "Aabb.hpp"
+
+namespace Rae
+{
+
+class Ray;
+struct HitRecord;
+
+// A shared object, like a mesh, placed in the scene with a transform of its own. Rays are moved into
+// the object's space, so a thousand copies of a mesh store its triangles once.
+// The object needs a finite bounding box, so planes can't be instanced.
+class Instance : public Hitable
+{
+public:
+	Instance(){}
+	Instance(const Hitable* object, const mat4& transform);
+
+	virtual bool hit(const Ray& ray, float t_min, float t_max, HitRecord& record) const;
+	virtual Aabb getAabb(float t0, float t1) const { return m_aabb; }
+
+	const Hitable* object() const { return m_object; }
+	vec3 toWorld(const vec3& point) const { return m_toWorld * glm::vec4(point, 1.0f); }
+	// The scale of a transform that scales all axes the same, or 0 for any other.
+	float uniformScale() const;
+
+protected:
+	const Hitable* m_object = nullptr;
+	// Affine, so the last row is left out.
+	glm::mat4x3 m_toWorld;
+	glm::mat4x3 m_toObject;
+	Aabb m_aabb; // of the transformed object
+};
+
+}
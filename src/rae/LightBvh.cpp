@@ -0,0 +1,581 @@
+#include "LightBvh.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+#include "core/Utils.hpp"
+#include "HitRecord.hpp"
+#include "Hitable.hpp"
+#include "Sphere.hpp"
+#include "Mesh.hpp"
+#include "Instance.hpp"
+#include "Material.hpp"
+#include "Sampler.hpp"
+
+using namespace Rae;
+
+namespace
+{
+	float luminanceOf(const vec3& color)
+	{
+		return glm::dot(color, vec3(0.2126f, 0.7152f, 0.0722f));
+	}
+
+	float safeAcos(float value)
+	{
+		return acos(glm::clamp(value, -1.0f, 1.0f));
+	}
+
+	bool isBlack(const vec3& color)
+	{
+		return color.x <= 0.0f && color.y <= 0.0f && color.z <= 0.0f;
+	}
+
+	// Rotates v around the unit vector axis.
+	vec3 rotate(const vec3& v, const vec3& axis, float angle)
+	{
+		float cosAngle = cos(angle);
+		return v * cosAngle + glm::cross(axis, v) * sin(angle) + axis * glm::dot(axis, v) * (1.0f - cosAngle);
+	}
+}
+
+float LightBounds::importance(const vec3& p, const vec3& normal) const
+{
+	if (power <= 0.0f)
+		return 0.0f;
+
+	const vec3 center = (boxMin + boxMax) * 0.5f;
+	const float radius = glm::length(boxMax - boxMin) * 0.5f;
+	vec3 toPoint = p - center;
+	float distanceSquared = glm::dot(toPoint, toPoint);
+	// Don't let the importance blow up near or inside the box.
+	distanceSquared = std::max(distanceSquared, radius * radius * 0.25f);
+	const float distance = sqrt(distanceSquared);
+	if (distance > 0.0f)
+		toPoint /= distance;
+
+	// The angle that the box takes from the point's view.
+	const bool isInside = p.x >= boxMin.x && p.y >= boxMin.y && p.z >= boxMin.z
+		&& p.x <= boxMax.x && p.y <= boxMax.y && p.z <= boxMax.z;
+	const float thetaB = (isInside || radius >= distance) ? Math::PI : asin(radius / distance);
+
+	// Angle between the emission cone and the point, minus all the slack that the bounds allow.
+	const float thetaW = safeAcos(glm::dot(axis, toPoint));
+	const float thetaPrime = std::max(0.0f, thetaW - thetaO - thetaB);
+	if (thetaPrime >= thetaE)
+		return 0.0f;
+
+	float result = power * cos(thetaPrime) / distanceSquared;
+
+	if (normal != vec3(0.0f, 0.0f, 0.0f))
+	{
+		// The receiving surface only sees the lights above its horizon.
+		const float thetaI = safeAcos(glm::dot(-toPoint, normal));
+		const float thetaIPrime = std::max(0.0f, thetaI - thetaB);
+		if (thetaIPrime >= Math::PI * 0.5f)
+			return 0.0f;
+		result *= cos(thetaIPrime);
+	}
+
+	return std::max(result, 0.0f);
+}
+
+void LightBounds::grow(const LightBounds& other)
+{
+	if (other.power <= 0.0f)
+		return;
+	if (power <= 0.0f)
+	{
+		*this = other;
+		return;
+	}
+
+	boxMin = glm::min(boxMin, other.boxMin);
+	boxMax = glm::max(boxMax, other.boxMax);
+	power += other.power;
+
+	// Union of the two cones
+	const LightBounds& wide = thetaO >= other.thetaO ? *this : other;
+	const LightBounds& narrow = thetaO >= other.thetaO ? other : *this;
+	const float newThetaE = std::max(thetaE, other.thetaE);
+	const float thetaD = safeAcos(glm::dot(wide.axis, narrow.axis));
+
+	if (std::min(thetaD + narrow.thetaO, Math::PI) <= wide.thetaO)
+	{
+		axis = wide.axis;
+		thetaO = wide.thetaO;
+	}
+	else
+	{
+		const float newThetaO = (wide.thetaO + thetaD + narrow.thetaO) * 0.5f;
+		vec3 rotationAxis = glm::cross(wide.axis, narrow.axis);
+		if (newThetaO >= Math::PI || glm::dot(rotationAxis, rotationAxis) < 1.0e-10f)
+		{
+			axis = wide.axis;
+			thetaO = Math::PI;
+		}
+		else
+		{
+			axis = glm::normalize(rotate(wide.axis, glm::normalize(rotationAxis), newThetaO - wide.thetaO));
+			thetaO = newThetaO;
+		}
+	}
+	thetaE = newThetaE;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+AreaLight AreaLight::createSphere(const vec3& center, float radius, const vec3& emission)
+{
+	AreaLight light;
+	light.m_isSphere = true;
+	light.m_center = center;
+	light.m_radius = radius;
+	light.m_emission = emission;
+	return light;
+}
+
+AreaLight AreaLight::createTriangle(const vec3& v0, const vec3& v1, const vec3& v2, const vec3& emission)
+{
+	AreaLight light;
+	light.m_isSphere = false;
+	light.m_vertices[0] = v0;
+	light.m_vertices[1] = v1;
+	light.m_vertices[2] = v2;
+	// Mesh::hit only finds front faces, which are the ones this normal points out of.
+	vec3 normal = glm::cross(v1 - v0, v2 - v0);
+	light.m_normal = glm::length(normal) > 0.0f ? glm::normalize(normal) : vec3(0.0f, 0.0f, 1.0f);
+	light.m_emission = emission;
+	return light;
+}
+
+float AreaLight::area() const
+{
+	if (m_isSphere)
+		return 2.0f * Math::TAU * m_radius * m_radius;
+	return 0.5f * glm::length(glm::cross(m_vertices[1] - m_vertices[0], m_vertices[2] - m_vertices[0]));
+}
+
+vec3 AreaLight::normal(const vec3& pointOnLight) const
+{
+	if (m_isSphere)
+		return glm::normalize(pointOnLight - m_center);
+	return m_normal;
+}
+
+void AreaLight::samplePoint(const vec2& u, vec3& point, vec3& normal) const
+{
+	if (m_isSphere)
+	{
+		normal = sampleUniformSphere(u);
+		point = m_center + normal * m_radius;
+		return;
+	}
+
+	const float sqrtU = sqrt(u.x);
+	const float b0 = 1.0f - sqrtU;
+	const float b1 = u.y * sqrtU;
+	point = b0 * m_vertices[0] + b1 * m_vertices[1] + (1.0f - b0 - b1) * m_vertices[2];
+	normal = m_normal;
+}
+
+LightBounds AreaLight::bounds() const
+{
+	LightBounds bounds;
+	// Lambertian emitters: the power is radiance * area * pi.
+	bounds.power = luminanceOf(m_emission) * area() * Math::PI;
+	bounds.thetaE = Math::PI * 0.5f;
+
+	if (m_isSphere)
+	{
+		const vec3 extent(m_radius, m_radius, m_radius);
+		bounds.boxMin = m_center - extent;
+		bounds.boxMax = m_center + extent;
+		bounds.axis = vec3(0.0f, 0.0f, 1.0f);
+		bounds.thetaO = Math::PI; // emits in every direction
+	}
+	else
+	{
+		bounds.boxMin = glm::min(m_vertices[0], glm::min(m_vertices[1], m_vertices[2]));
+		bounds.boxMax = glm::max(m_vertices[0], glm::max(m_vertices[1], m_vertices[2]));
+		bounds.axis = m_normal;
+		bounds.thetaO = 0.0f;
+	}
+	return bounds;
+}
+
+// For small spheres 1 - cos(thetaMax) would lose all precision, so it comes from sin^2 instead.
+float oneMinusCosThetaMax(float sinThetaMaxSquared)
+{
+	if (sinThetaMaxSquared < 0.001f)
+		return sinThetaMaxSquared * 0.5f;
+	return 1.0f - sqrt(std::max(0.0f, 1.0f - sinThetaMaxSquared));
+}
+
+LightSample AreaLight::sample(const vec3& from, const vec2& u) const
+{
+	LightSample result;
+
+	if (m_isSphere)
+	{
+		vec3 toCenter = m_center - from;
+		const float centerDistanceSquared = glm::dot(toCenter, toCenter);
+		if (centerDistanceSquared <= m_radius * m_radius)
+			return result; // Inside the light. Those paths are left to the BSDF samples.
+
+		// Uniform sampling of the cone of directions that the sphere covers.
+		const float centerDistance = sqrt(centerDistanceSquared);
+		toCenter /= centerDistance;
+		const float sinThetaMaxSquared = (m_radius * m_radius) / centerDistanceSquared;
+		const float coneFraction = oneMinusCosThetaMax(sinThetaMaxSquared);
+
+		const float cosTheta = 1.0f - u.x * coneFraction;
+		const float sinThetaSquared = std::max(0.0f, 1.0f - cosTheta * cosTheta);
+		const float sinTheta = sqrt(sinThetaSquared);
+		const float phi = Math::TAU * u.y;
+		vec3 local(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta);
+
+		result.direction = glm::normalize(toWorld(local, toCenter));
+		// Distance to the near side of the sphere along the direction
+		const float halfChord = sqrt(std::max(0.0f, m_radius * m_radius - centerDistanceSquared * sinThetaSquared));
+		result.distance = std::max(0.0f, centerDistance * cosTheta - halfChord);
+		result.point = from + result.direction * result.distance;
+		result.radiance = m_emission;
+		result.pdf = 1.0f / (Math::TAU * coneFraction);
+		return result;
+	}
+
+	// Uniform point on the triangle
+	const float sqrtU = sqrt(u.x);
+	const float b0 = 1.0f - sqrtU;
+	const float b1 = u.y * sqrtU;
+	result.point = b0 * m_vertices[0] + b1 * m_vertices[1] + (1.0f - b0 - b1) * m_vertices[2];
+
+	vec3 toLight = result.point - from;
+	const float distanceSquared = glm::dot(toLight, toLight);
+	if (distanceSquared <= 0.0f)
+		return result;
+
+	result.distance = sqrt(distanceSquared);
+	result.direction = toLight / result.distance;
+	const float cosLight = -glm::dot(result.direction, m_normal);
+	if (cosLight <= 0.0f)
+		return result; // the back side doesn't emit
+
+	result.radiance = m_emission;
+	result.pdf = distanceSquared / (area() * cosLight);
+	return result;
+}
+
+float AreaLight::pdf(const vec3& from, const vec3& pointOnLight) const
+{
+	if (m_isSphere)
+	{
+		const vec3 toCenter = m_center - from;
+		const float centerDistanceSquared = glm::dot(toCenter, toCenter);
+		if (centerDistanceSquared <= m_radius * m_radius)
+			return 0.0f;
+		return 1.0f / (Math::TAU * oneMinusCosThetaMax((m_radius * m_radius) / centerDistanceSquared));
+	}
+
+	const vec3 toLight = pointOnLight - from;
+	const float distanceSquared = glm::dot(toLight, toLight);
+	if (distanceSquared <= 0.0f)
+		return 0.0f;
+	const float cosLight = -glm::dot(toLight, m_normal) / sqrt(distanceSquared);
+	if (cosLight <= 0.0f)
+		return 0.0f;
+	return distanceSquared / (area() * cosLight);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void LightBvh::clear()
+{
+	m_lights.clear();
+	m_lightBounds.clear();
+	m_nodes.clear();
+	m_bitTrails.clear();
+	m_powerCdf.clear();
+	m_firstLightIndex.clear();
+}
+
+void LightBvh::build(const std::vector<Hitable*>& hitables)
+{
+	clear();
+
+	for (const Hitable* hitable : hitables)
+	{
+		if (const Sphere* sphere = dynamic_cast<const Sphere*>(hitable))
+		{
+			if (sphere->material == nullptr)
+				continue;
+			vec3 emission = sphere->material->emitted(sphere->center);
+			if (isBlack(emission))
+				continue;
+
+			m_firstLightIndex[hitable] = int(m_lights.size());
+			m_lights.push_back(AreaLight::createSphere(sphere->center, sphere->radius, emission));
+		}
+		else if (const Mesh* mesh = dynamic_cast<const Mesh*>(hitable))
+		{
+			if (mesh->material() == nullptr || mesh->triangleCount() == 0)
+				continue;
+			vec3 v0, v1, v2;
+			mesh->getTriangle(0, v0, v1, v2);
+			vec3 emission = mesh->material()->emitted(v0);
+			if (isBlack(emission))
+				continue;
+
+			// Every triangle is a light, so a hit triangle's light index is the first index plus its index.
+			m_firstLightIndex[hitable] = int(m_lights.size());
+			for (int i = 0; i < mesh->triangleCount(); ++i)
+			{
+				mesh->getTriangle(i, v0, v1, v2);
+				m_lights.push_back(AreaLight::createTriangle(v0, v1, v2, emission));
+			}
+		}
+		else if (const Instance* instance = dynamic_cast<const Instance*>(hitable))
+		{
+			addInstanceLights(*instance);
+		}
+	}
+
+	if (m_lights.empty())
+		return;
+
+	m_lightBounds.reserve(m_lights.size());
+	for (const AreaLight& light : m_lights)
+		m_lightBounds.push_back(light.bounds());
+
+	m_bitTrails.assign(m_lights.size(), 0);
+
+	std::vector<int> lightIndices;
+	lightIndices.reserve(m_lights.size());
+	for (int i = 0; i < int(m_lights.size()); ++i)
+	{
+		// Lights that can't emit anything are never picked.
+		if (m_lightBounds[i].power > 0.0f)
+			lightIndices.push_back(i);
+	}
+
+	if (lightIndices.empty())
+	{
+		m_lights.clear();
+		m_firstLightIndex.clear();
+		return;
+	}
+
+	m_nodes.reserve(2 * lightIndices.size());
+	buildRecursive(lightIndices, 0, int(lightIndices.size()), 0, 0);
+
+	m_powerCdf.resize(m_lights.size());
+	float powerSum = 0.0f;
+	for (size_t i = 0; i < m_lights.size(); ++i)
+	{
+		powerSum += std::max(0.0f, m_lightBounds[i].power);
+		m_powerCdf[i] = powerSum;
+	}
+}
+
+void LightBvh::addInstanceLights(const Instance& instance)
+{
+	// The same as the object's lights, moved to the instance.
+	if (const Sphere* sphere = dynamic_cast<const Sphere*>(instance.object()))
+	{
+		// A sphere that is scaled more along some axis isn't a sphere anymore. Those are only found
+		// by the scattered rays.
+		const float scale = instance.uniformScale();
+		if (sphere->material == nullptr || scale == 0.0f)
+			return;
+		vec3 emission = sphere->material->emitted(sphere->center);
+		if (isBlack(emission))
+			return;
+
+		m_firstLightIndex[&instance] = int(m_lights.size());
+		m_lights.push_back(AreaLight::createSphere(instance.toWorld(sphere->center), sphere->radius * scale, emission));
+	}
+	else if (const Mesh* mesh = dynamic_cast<const Mesh*>(instance.object()))
+	{
+		if (mesh->material() == nullptr || mesh->triangleCount() == 0)
+			return;
+		vec3 v0, v1, v2;
+		mesh->getTriangle(0, v0, v1, v2);
+		vec3 emission = mesh->material()->emitted(v0);
+		if (isBlack(emission))
+			return;
+
+		m_firstLightIndex[&instance] = int(m_lights.size());
+		for (int i = 0; i < mesh->triangleCount(); ++i)
+		{
+			mesh->getTriangle(i, v0, v1, v2);
+			m_lights.push_back(AreaLight::createTriangle(instance.toWorld(v0), instance.toWorld(v1), instance.toWorld(v2), emission));
+		}
+	}
+}
+
+int LightBvh::buildRecursive(std::vector<int>& lightIndices, int begin, int end, uint64_t bitTrail, int depth)
+{
+	const int nodeIndex = int(m_nodes.size());
+	m_nodes.push_back(Node());
+
+	if (end - begin == 1)
+	{
+		const int lightIndex = lightIndices[begin];
+		m_nodes[nodeIndex].bounds = m_lightBounds[lightIndex];
+		m_nodes[nodeIndex].lightIndex = lightIndex;
+		m_bitTrails[lightIndex] = bitTrail;
+		return nodeIndex;
+	}
+
+	// Split the centroids at the middle of their longest axis.
+	vec3 centroidMin(FLT_MAX, FLT_MAX, FLT_MAX);
+	vec3 centroidMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int i = begin; i < end; ++i)
+	{
+		const LightBounds& bounds = m_lightBounds[lightIndices[i]];
+		vec3 centroid = (bounds.boxMin + bounds.boxMax) * 0.5f;
+		centroidMin = glm::min(centroidMin, centroid);
+		centroidMax = glm::max(centroidMax, centroid);
+	}
+
+	const vec3 extent = centroidMax - centroidMin;
+	int axis = 0;
+	if (extent.y > extent[axis])
+		axis = 1;
+	if (extent.z > extent[axis])
+		axis = 2;
+	const float splitPosition = (centroidMin[axis] + centroidMax[axis]) * 0.5f;
+
+	int middle = int(std::partition(lightIndices.begin() + begin, lightIndices.begin() + end, [&](int lightIndex)
+	{
+		const LightBounds& bounds = m_lightBounds[lightIndex];
+		return (bounds.boxMin[axis] + bounds.boxMax[axis]) * 0.5f < splitPosition;
+	}) - lightIndices.begin());
+
+	// All centroids in the same spot: split by count.
+	if (middle == begin || middle == end)
+		middle = (begin + end) / 2;
+
+	// Past half of the bit trail the tree is balanced by count, so that it can't get deeper than 64.
+	if (depth >= 32)
+		middle = (begin + end) / 2;
+
+	buildRecursive(lightIndices, begin, middle, bitTrail, depth + 1);
+	const int secondChild = buildRecursive(lightIndices, middle, end, bitTrail | (uint64_t(1) << depth), depth + 1);
+
+	Node& node = m_nodes[nodeIndex];
+	node.secondChild = secondChild;
+	node.bounds = m_nodes[nodeIndex + 1].bounds;
+	node.bounds.grow(m_nodes[secondChild].bounds);
+	return nodeIndex;
+}
+
+int LightBvh::sample(const vec3& p, const vec3& normal, float u, float& pmf) const
+{
+	pmf = 0.0f;
+	if (m_nodes.empty())
+		return -1;
+
+	int nodeIndex = 0;
+	float probability = 1.0f;
+
+	while (true)
+	{
+		const Node& node = m_nodes[nodeIndex];
+		if (node.lightIndex != -1)
+		{
+			if (nodeIndex == 0 && node.bounds.importance(p, normal) <= 0.0f)
+				return -1;
+			pmf = probability;
+			return node.lightIndex;
+		}
+
+		const float firstImportance = m_nodes[nodeIndex + 1].bounds.importance(p, normal);
+		const float secondImportance = m_nodes[node.secondChild].bounds.importance(p, normal);
+		if (firstImportance <= 0.0f && secondImportance <= 0.0f)
+			return -1;
+
+		const float firstProbability = firstImportance / (firstImportance + secondImportance);
+		if (u < firstProbability)
+		{
+			nodeIndex = nodeIndex + 1;
+			u = std::min(u / firstProbability, 0.99999994f);
+			probability *= firstProbability;
+		}
+		else
+		{
+			nodeIndex = node.secondChild;
+			u = std::min((u - firstProbability) / (1.0f - firstProbability), 0.99999994f);
+			probability *= 1.0f - firstProbability;
+		}
+	}
+}
+
+float LightBvh::pmf(const vec3& p, const vec3& normal, int lightIndex) const
+{
+	if (lightIndex < 0 || lightIndex >= int(m_bitTrails.size()) || m_nodes.empty())
+		return 0.0f;
+
+	uint64_t bitTrail = m_bitTrails[lightIndex];
+	int nodeIndex = 0;
+	float probability = 1.0f;
+
+	while (true)
+	{
+		const Node& node = m_nodes[nodeIndex];
+		if (node.lightIndex != -1)
+		{
+			if (nodeIndex == 0 && node.bounds.importance(p, normal) <= 0.0f)
+				return 0.0f;
+			return node.lightIndex == lightIndex ? probability : 0.0f;
+		}
+
+		const float firstImportance = m_nodes[nodeIndex + 1].bounds.importance(p, normal);
+		const float secondImportance = m_nodes[node.secondChild].bounds.importance(p, normal);
+		if (firstImportance <= 0.0f && secondImportance <= 0.0f)
+			return 0.0f;
+
+		const float firstProbability = firstImportance / (firstImportance + secondImportance);
+		if (bitTrail & 1)
+		{
+			nodeIndex = node.secondChild;
+			probability *= 1.0f - firstProbability;
+		}
+		else
+		{
+			nodeIndex = nodeIndex + 1;
+			probability *= firstProbability;
+		}
+		bitTrail >>= 1;
+	}
+}
+
+int LightBvh::samplePower(float u, float& pmf) const
+{
+	pmf = 0.0f;
+	if (m_powerCdf.empty())
+		return -1;
+
+	const float choice = u * m_powerCdf.back();
+	const int index = std::min(int(std::upper_bound(m_powerCdf.begin(), m_powerCdf.end(), choice) - m_powerCdf.begin()),
+		int(m_powerCdf.size()) - 1);
+	pmf = powerPmf(index);
+	return pmf > 0.0f ? index : -1;
+}
+
+float LightBvh::powerPmf(int lightIndex) const
+{
+	if (m_powerCdf.empty())
+		return 0.0f;
+	const float previous = lightIndex > 0 ? m_powerCdf[lightIndex - 1] : 0.0f;
+	return (m_powerCdf[lightIndex] - previous) / m_powerCdf.back();
+}
+
+int LightBvh::lightIndex(const HitRecord& record) const
+{
+	auto found = m_firstLightIndex.find(record.hitable);
+	if (found == m_firstLightIndex.end())
+		return -1;
+	return found->second + record.primitiveIndex;
+}
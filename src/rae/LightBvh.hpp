@@ -0,0 +1,120 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include <float.h>
+
+#include <glm/glm.hpp>
+using glm::vec2;
+using glm::vec3;
+
+namespace Rae
+{
+
+class Hitable;
+class Instance;
+struct HitRecord;
+
+// A point sampled on a light, seen from a shading point.
+struct LightSample
+{
+	vec3 point;
+	vec3 direction; // unit vector from the shading point to the light
+	float distance = 0.0f;
+	vec3 radiance;
+	float pdf = 0.0f; // solid angle pdf at the shading point, zero if the sample failed
+};
+
+// Power, extent and emission directions of a group of lights (Conty and Kulla 2018,
+// Importance Sampling of Many Lights with Adaptive Tree Splitting).
+struct LightBounds
+{
+	// How much light the group can send to the point p. A zero normal means the point
+	// receives from every direction. Conservative, so it is never zero for a contributing light.
+	float importance(const vec3& p, const vec3& normal) const;
+	void grow(const LightBounds& other);
+
+	vec3 boxMin = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+	vec3 boxMax = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	float power = 0.0f;
+	// Emission cone: all normals are within thetaO of the axis, and each emits up to thetaE from its normal.
+	vec3 axis = vec3(0.0f, 0.0f, 1.0f);
+	float thetaO = 0.0f;
+	float thetaE = 0.0f;
+};
+
+// An emissive sphere, or one emissive triangle of a mesh.
+class AreaLight
+{
+public:
+	static AreaLight createSphere(const vec3& center, float radius, const vec3& emission);
+	static AreaLight createTriangle(const vec3& v0, const vec3& v1, const vec3& v2, const vec3& emission);
+
+	LightSample sample(const vec3& from, const vec2& u) const;
+	// Solid angle pdf of sample() picking pointOnLight as seen from the point from.
+	float pdf(const vec3& from, const vec3& pointOnLight) const;
+	LightBounds bounds() const;
+
+	float area() const;
+	vec3 emission() const { return m_emission; }
+	// Unit normal of the emitting side at a point on the light
+	vec3 normal(const vec3& pointOnLight) const;
+	// Uniform point on the emitting surface, for tracing light out of it. The pdf is 1 / area().
+	void samplePoint(const vec2& u, vec3& point, vec3& normal) const;
+
+protected:
+	bool m_isSphere = true;
+	vec3 m_center; // sphere
+	float m_radius = 0.0f;
+	vec3 m_vertices[3]; // triangle
+	vec3 m_normal; // the side of the triangle that emits
+	vec3 m_emission;
+};
+
+// Picks a light for a shading point in O(log N), going down a BVH over the lights and choosing
+// each child in proportion to its estimated contribution.
+class LightBvh
+{
+public:
+	// Collects the spheres and mesh triangles that have an emitting material, also those of instances.
+	void build(const std::vector<Hitable*>& hitables);
+	void clear();
+
+	bool isEmpty() const { return m_lights.empty(); }
+	int lightCount() const { return int(m_lights.size()); }
+	const AreaLight& light(int index) const { return m_lights[index]; }
+
+	// Returns the light index, or -1 if no light can reach the point. pmf is the probability of the choice.
+	int sample(const vec3& p, const vec3& normal, float u, float& pmf) const;
+	// The probability that sample() picks the light.
+	float pmf(const vec3& p, const vec3& normal, int lightIndex) const;
+	// The light that the hit landed on, or -1 if it is not a light.
+	int lightIndex(const HitRecord& record) const;
+
+	// Picks a light in proportion to its power, for paths that start from the lights.
+	int samplePower(float u, float& pmf) const;
+	float powerPmf(int lightIndex) const;
+
+protected:
+	struct Node
+	{
+		LightBounds bounds;
+		int secondChild = -1; // The first child follows its parent. Leaves have no children.
+		int lightIndex = -1;
+	};
+
+	int buildRecursive(std::vector<int>& lightIndices, int begin, int end, uint64_t bitTrail, int depth);
+	void addInstanceLights(const Instance& instance);
+
+	std::vector<AreaLight> m_lights;
+	std::vector<LightBounds> m_lightBounds;
+	std::vector<Node> m_nodes;
+	// The path from the root to each light, one bit per level, 1 for the second child.
+	std::vector<uint64_t> m_bitTrails;
+	std::vector<float> m_powerCdf; // running sum of the light powers
+	// First light index of each emissive hitable. Mesh triangles follow each other.
+	std::unordered_map<const Hitable*, int> m_firstLightIndex;
+};
+
+} // end namespace Rae
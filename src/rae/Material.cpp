@@ -2,14 +2,12 @@
 using namespace std;
 #include <math.h>
 #include <assert.h>
+#include <algorithm>
 
-#include "Random.hpp"
+#include "core/Utils.hpp"
+#include "Sampler.hpp"
 
-#include "Material.hpp" // includes glew.h which is needed by nanovg headers.
-
-#include "nanovg.h"
-#include "nanovg_gl.h"
-#include "nanovg_gl_utils.h"
+#include "Material.hpp"
 
 using glm::vec3;
 using glm::dot;
@@ -17,39 +15,42 @@ using glm::dot;
 namespace Rae
 {
 
-// ray_tracing_utils.hpp
-vec3 random_in_unit_sphere()
-{
-	vec3 p;
-	do
-	{
-		p = 2.0f * vec3(getRandom(), getRandom(), getRandom()) - vec3(1,1,1);
-	} while (dot(p,p) >= 1.0f);
-	return p;
-}
-
-bool Material::scatter(const Ray& r_in, const HitRecord& record, vec3& attenuation, Ray& scattered) const
+bool Material::scatter(const Ray& r_in, const HitRecord& record, vec3& attenuation, Ray& scattered, Sampler& sampler) const
 {
 	return false;
 }
 
-bool Lambertian::scatter(const Ray& r_in, const HitRecord& record, vec3& attenuation, Ray& scattered) const
+bool Lambertian::scatter(const Ray& r_in, const HitRecord& record, vec3& attenuation, Ray& scattered, Sampler& sampler) const
 {
-	vec3 target = record.point + record.normal + random_in_unit_sphere();
-	scattered = Ray(record.point, target - record.point);
+	vec3 direction = toWorld(sampleCosineHemisphere(sampler.get2D()), record.normal);
+	scattered = Ray(record.point, direction);
 	attenuation = albedo;
 	return true;
 }
 
+vec3 Lambertian::evaluate(const vec3& normal, const vec3& direction) const
+{
+	float cosTheta = dot(normal, direction);
+	if (cosTheta <= 0.0f)
+		return vec3(0.0f, 0.0f, 0.0f);
+	return albedo * (cosTheta / Math::PI);
+}
+
+float Lambertian::pdf(const vec3& normal, const vec3& direction) const
+{
+	return std::max(0.0f, dot(normal, direction)) / Math::PI;
+}
+
 vec3 reflect(const vec3& v, const vec3& normal)
 {
 	return v - 2.0f * dot(v, normal) * normal;
 }
 
-bool Metal::scatter(const Ray& r_in, const HitRecord& record, vec3& attenuation, Ray& scattered) const
+bool Metal::scatter(const Ray& r_in, const HitRecord& record, vec3& attenuation, Ray& scattered, Sampler& sampler) const
 {
 	vec3 reflected = reflect( glm::normalize(r_in.direction()), record.normal );
-	scattered = Ray(record.point, reflected + roughness * random_in_unit_sphere());
+	vec2 u = sampler.get2D();
+	scattered = Ray(record.point, reflected + roughness * sampleUniformBall(u, sampler.get1D()));
 	attenuation = albedo;
 	return (dot(scattered.direction(), record.normal) > 0);
 }
@@ -74,7 +75,7 @@ float schlick(float cosine, float refractive_index)
 	return r0 + (1.0f - r0) * pow((1.0f - cosine), 5.0f);
 }
 
-bool Dielectric::scatter(const Ray& r_in, const HitRecord& record, vec3& attenuation, Ray& scattered) const
+bool Dielectric::scatter(const Ray& r_in, const HitRecord& record, vec3& attenuation, Ray& scattered, Sampler& sampler) const
 {
 	vec3 outward_normal;
 	vec3 reflected = reflect(r_in.direction(), record.normal);
@@ -105,7 +106,7 @@ bool Dielectric::scatter(const Ray& r_in, const HitRecord& record, vec3& attenua
 		reflect_probability = 1.0f;
 	}
 
-	if (drand48() < reflect_probability)
+	if (sampler.get1D() < reflect_probability)
 	{
 		scattered = Ray(record.point, reflected); // REFLECT vs
 	}
@@ -128,71 +129,6 @@ m_color(set_color)
 {
 }
 
-void Material::generateFBO(NVGcontext* vg)
-{
-	m_framebufferObject = nvgluCreateFramebuffer(vg, m_width, m_height, NVG_IMAGE_REPEATX | NVG_IMAGE_REPEATY);
-	if (m_framebufferObject == nullptr)
-	{
-		cout << "Could not create FBO.\n";
-		assert(0);
-	}
-}
-
-void Material::update(NVGcontext* vg, double time)
-{
-	if (m_framebufferObject == nullptr)
-		return;
-
-	if (m_initialized == true && m_animate == false)
-		return;
-
-	float circle_size = float((cos(time) + 1.0) * 128.0);
-
-	nvgluBindFramebuffer(m_framebufferObject);
-	glViewport(0, 0, m_width, m_height);
-
-	// Any alpha other than zero will fail for some FBO reason
-	glClearColor(m_color.r, m_color.g, m_color.b, 0.0f);
-	
-	glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-	nvgBeginFrame(vg, m_width, m_height, /*pixelRatio*/1.0f);
-
-		nvgBeginPath(vg);
-
-		if (m_animate)
-			nvgCircle(vg, float(m_width) * 0.5f, float(m_height) * 0.5f, circle_size);
-		
-		if(m_type == 2)
-			nvgFillColor(vg, nvgRGBA(220, 45, 0, 200));
-		else if(m_type == 1)
-			nvgFillColor(vg, nvgRGBA(0, 220, 45, 200));
-		else nvgFillColor(vg, nvgRGBA(10, 145, 200, 200)); 
-
-		nvgFill(vg);
-
-		if(m_type == 2)
-		{
-			nvgFontFace(vg, "sans");
-
-			nvgFontSize(vg, 80.0f);
-			nvgTextAlign(vg, NVG_ALIGN_CENTER);
-			nvgFillColor(vg, nvgRGBA(255, 255, 255, 255));
-			nvgText(vg, float(m_width) * 0.5f, (float(m_height) * 0.5f) + 20.0f, "Add Object", nullptr);
-		}
-
-	nvgEndFrame(vg);
-	nvgluBindFramebuffer(NULL);
-
-	m_initialized = true;
-}
-
-GLuint Material::textureID()
-{
-	if( m_framebufferObject == nullptr )
-		return 0;
-	return m_framebufferObject->texture;
-}
-
 void Material::setColor(glm::vec4 set)
 {
 	m_color = set;
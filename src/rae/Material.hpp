@@ -1,7 +1,6 @@
 #ifndef RAE_MATERIAL_HPP
 #define RAE_MATERIAL_HPP
 
-#include <GL/glew.h>
 #include <glm/glm.hpp>
 
 #include "Ray.hpp"
@@ -13,6 +12,8 @@ struct NVGLUframebuffer;
 namespace Rae
 {
 
+class Sampler;
+
 class Material
 {
 public:
@@ -28,10 +29,15 @@ public:
 	{
 	}
 
-	~Material(){}
+	virtual ~Material(){}
 
-	virtual bool scatter(const Ray& r_in, const HitRecord& record, vec3& attenuation, Ray& scattered) const;
+	virtual bool scatter(const Ray& r_in, const HitRecord& record, vec3& attenuation, Ray& scattered, Sampler& sampler) const;
 	virtual vec3 emitted(const vec3& p) const { return vec3(0.0f, 0.0f, 0.0f); }
+	// Materials that can be lit by explicit light samples. The rest are only lit by scattered rays.
+	virtual bool isDiffuse() const { return false; }
+	// BSDF times the cosine for the unit direction, and the pdf of scatter() producing it.
+	virtual vec3 evaluate(const vec3& normal, const vec3& direction) const { return vec3(0.0f, 0.0f, 0.0f); }
+	virtual float pdf(const vec3& normal, const vec3& direction) const { return 0.0f; }
 
 	vec3 albedo;
 
@@ -39,10 +45,11 @@ public:
 
 	Material(int set_id, int set_type, const glm::vec4& set_color); // That type thing is really strange...
 
+	// The GL side is in MaterialGl.cpp, so that the ray tracing core builds without GL.
 	void generateFBO(NVGcontext* vg);
 	void update(NVGcontext* vg, double time);
 
-	GLuint textureID();
+	unsigned textureID(); // a GLuint
 
 	void setColor(glm::vec4 set);
 	const glm::vec4& color() { return m_color; }
@@ -68,7 +75,10 @@ public:
 		: Material(set_albedo)
 	{}
 
-	bool scatter(const Ray& r_in, const HitRecord& record, vec3& attenuation, Ray& scattered) const override;
+	bool scatter(const Ray& r_in, const HitRecord& record, vec3& attenuation, Ray& scattered, Sampler& sampler) const override;
+	bool isDiffuse() const override { return true; }
+	vec3 evaluate(const vec3& normal, const vec3& direction) const override;
+	float pdf(const vec3& normal, const vec3& direction) const override;
 };
 
 class Metal : public Material
@@ -79,7 +89,7 @@ public:
 		roughness(set_roughness)
 	{}
 
-	bool scatter(const Ray& r_in, const HitRecord& record, vec3& attenuation, Ray& scattered) const override;
+	bool scatter(const Ray& r_in, const HitRecord& record, vec3& attenuation, Ray& scattered, Sampler& sampler) const override;
 
 	float roughness = 0.0f;
 };
@@ -92,7 +102,7 @@ public:
 		refractive_index(set_refractive_index)
 	{}
 
-	bool scatter(const Ray& r_in, const HitRecord& record, vec3& attenuation, Ray& scattered) const override;
+	bool scatter(const Ray& r_in, const HitRecord& record, vec3& attenuation, Ray& scattered, Sampler& sampler) const override;
 
 	float refractive_index = 0.0f;
 };
@@ -105,7 +115,7 @@ public:
 	{
 	}
 
-	bool scatter(const Ray& r_in, const HitRecord& record, vec3& attenuation, Ray& scattered) const override { return false; }
+	bool scatter(const Ray& r_in, const HitRecord& record, vec3& attenuation, Ray& scattered, Sampler& sampler) const override { return false; }
 	vec3 emitted(const vec3& p) const override { return albedo; }
 };
 
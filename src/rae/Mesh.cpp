@@ -1,39 +1,202 @@
 
-#include "GL/glew.h"
 #include "Mesh.hpp"
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <new>
+#include <cmath>
+#include <cstring>
 
 #include "Material.hpp"
+#include "core/ClusterPager.hpp"
 
 namespace Rae
 {
 
+namespace
+{
+	const uint32_t MaxLeafTriangles = 4;
+	// About 200 kB of nodes, triangles and vertices, which pages in quickly and in one go.
+	const uint32_t ClusterTriangles = 4096;
+	// Past this depth the splits are at the median, so the traversal stack below is always deep enough.
+	const int MaxMidpointDepth = 32;
+	const int TraversalStackSize = 64;
+
+	// Touching counts as a hit, so that the flat bounds of an axis aligned triangle are hit too.
+	bool hitBounds(const MeshBvhNode& node, const vec3& origin, const vec3& inverseDirection,
+		float t_min, float t_max)
+	{
+		for (int a = 0; a < 3; ++a)
+		{
+			float t0 = (node.min[a] - origin[a]) * inverseDirection[a];
+			float t1 = (node.max[a] - origin[a]) * inverseDirection[a];
+			if (inverseDirection[a] < 0.0f)
+				std::swap(t0, t1);
+			t_min = t0 > t_min ? t0 : t_min;
+			t_max = t1 < t_max ? t1 : t_max;
+			if (t_max < t_min)
+				return false;
+		}
+		return true;
+	}
+
+	// Octahedral: the normal on the octahedron, the lower half folded over the upper, and the
+	// square that gives stored in two snorm16s. The error is under a tenth of a degree.
+	uint32_t packNormal(const vec3& normal)
+	{
+		const vec3 n = normal / (fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z));
+		glm::vec2 square(n.x, n.y);
+		if (n.z < 0.0f)
+		{
+			square = glm::vec2((1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+				(1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+		}
+		return glm::packSnorm2x16(square);
+	}
+
+	vec3 unpackNormal(uint32_t packed)
+	{
+		const glm::vec2 square = glm::unpackSnorm2x16(packed);
+		vec3 n(square.x, square.y, 1.0f - fabsf(square.x) - fabsf(square.y));
+		if (n.z < 0.0f)
+		{
+			n.x = (1.0f - fabsf(square.y)) * (square.x >= 0.0f ? 1.0f : -1.0f);
+			n.y = (1.0f - fabsf(square.x)) * (square.y >= 0.0f ? 1.0f : -1.0f);
+		}
+		return glm::normalize(n);
+	}
+
+	// Of the bits, so that only the vertices that are the same in every attribute are welded.
+	uint32_t weldHash(const vec3& position, const vec3& normal, const glm::vec2& uv)
+	{
+		float values[8] = { position.x, position.y, position.z, normal.x, normal.y, normal.z, uv.x, uv.y };
+		uint32_t words[8];
+		memcpy(words, values, sizeof(words));
+		uint64_t hash = 14695981039346656037ULL;
+		for (uint32_t word : words)
+			hash = (hash ^ word) * 1099511628211ULL;
+		return uint32_t(hash ^ (hash >> 32));
+	}
+
+	struct BvhBuilder
+	{
+		// The roots of the clusters, which are built after the top of the tree.
+		struct Pending
+		{
+			uint32_t node;
+			uint32_t begin;
+			uint32_t end;
+			int depth;
+		};
+
+		BvhBuilder(std::vector<MeshBvhNode>& setNodes, std::vector<MeshCluster>& setClusters,
+			const std::vector<Aabb>& setBounds, const std::vector<vec3>& setCenters, uint32_t* setOrder)
+		: nodes(setNodes),
+		clusters(setClusters),
+		bounds(setBounds),
+		centers(setCenters),
+		order(setOrder)
+		{
+		}
+
+		std::vector<MeshBvhNode>& nodes;
+		std::vector<MeshCluster>& clusters;
+		const std::vector<Aabb>& bounds;
+		const std::vector<vec3>& centers;
+		uint32_t* order;
+		std::vector<Pending> pending;
+
+		// The top of the tree first, then each cluster, so that the nodes of a cluster are contiguous.
+		void buildClustered(uint32_t count)
+		{
+			nodes.push_back(MeshBvhNode());
+			build(0, 0, count, 0, /*isTop*/true);
+			for (const Pending& cluster : pending)
+			{
+				const uint32_t nodeBegin = uint32_t(nodes.size());
+				build(cluster.node, cluster.begin, cluster.end, cluster.depth, /*isTop*/false);
+				nodes[cluster.node].count = MeshBvhNode::ClusterRoot | uint32_t(clusters.size());
+				clusters.push_back(MeshCluster{ nodeBegin, uint32_t(nodes.size()), cluster.begin, cluster.end, 0, 0 });
+			}
+		}
+
+		void build(uint32_t nodeIndex, uint32_t begin, uint32_t end, int depth, bool isTop)
+		{
+			Aabb aabb;
+			Aabb centerBounds;
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				aabb.grow(bounds[order[i]]);
+				centerBounds.grow(centers[order[i]]);
+			}
+			nodes[nodeIndex].min = aabb.min();
+			nodes[nodeIndex].max = aabb.max();
+
+			// A cluster root is an inner node, tiny meshes don't need paging.
+			if (isTop && end - begin <= ClusterTriangles && end - begin > MaxLeafTriangles)
+			{
+				pending.push_back(Pending{ nodeIndex, begin, end, depth });
+				return;
+			}
+
+			if (end - begin <= MaxLeafTriangles)
+			{
+				nodes[nodeIndex].first = begin;
+				nodes[nodeIndex].count = end - begin;
+				return;
+			}
+
+			// Like BvhNode: the middle of the longest axis of the centers, or the median when that
+			// leaves one side empty.
+			const vec3 extent = centerBounds.dimensions();
+			const int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+			const std::vector<vec3>& c = centers;
+			uint32_t* middle = order + begin;
+			if (depth < MaxMidpointDepth)
+			{
+				const float split = centerBounds.min()[axis] + 0.5f * extent[axis];
+				middle = std::partition(order + begin, order + end,
+					[&c, axis, split](uint32_t triangle) { return c[triangle][axis] < split; });
+			}
+			if (middle == order + begin || middle == order + end)
+			{
+				middle = order + begin + (end - begin) / 2;
+				std::nth_element(order + begin, middle, order + end,
+					[&c, axis](uint32_t a, uint32_t b) { return c[a][axis] < c[b][axis]; });
+			}
+
+			const uint32_t left = uint32_t(nodes.size());
+			nodes.push_back(MeshBvhNode());
+			nodes.push_back(MeshBvhNode());
+			nodes[nodeIndex].first = left;
+			nodes[nodeIndex].count = 0;
+			build(left, begin, uint32_t(middle - order), depth + 1, isTop);
+			build(left + 1, uint32_t(middle - order), end, depth + 1, isTop);
+		}
+	};
+}
+
 Mesh::Mesh(int set_id)
 : m_id(set_id)
 {
-	//material = new Lambertian(vec3(0.1f, 0.2f, 0.7f));
-	material = new Metal(vec3(0.1f, 0.2f, 0.7f), 0.3f);
+	//m_material = new Lambertian(vec3(0.1f, 0.2f, 0.7f));
+	m_material = new Metal(vec3(0.1f, 0.2f, 0.7f), 0.3f);
 }
 
 Mesh::~Mesh()
 {
-	glDeleteBuffers(1, &vertexBufferID);
-	glDeleteBuffers(1, &uvBufferID);
-	glDeleteBuffers(1, &normalBufferID);
-	glDeleteBuffers(1, &indexBufferID);	
+	releaseCache();
 }
 
 // Möller-Trumbore ray triangle intersection
 // t is outDistance on the ray
 // u and v are coordinates on the triangle plane?
 bool Mesh::rayTriangleIntersection(const vec3& rayStart, const vec3& rayDirection,
-	const vec3& v1, const vec3& v2, const vec3& v3,
+	const vec3& v1, const vec3& e1, const vec3& e2,
 	float& t, float& u, float& v/*, bool& frontFacing*/) const
 {
-	vec3 e2 = v3 - v1;            // second edge
-	vec3 e1 = v2 - v1;            // first edge
+	// The edges v2 - v1 and v3 - v1 are precomputed in MeshTriangle.
 	vec3 r = glm::cross(rayDirection, e2); // (rayDirection X e2)
 	vec3 s = rayStart - v1;       // translated ray origin
 	float a = glm::dot(e1, r);    // a = (d X e2) * e1
@@ -92,32 +255,57 @@ bool Mesh::rayTriangleIntersection(const vec3& rayStart, const vec3& rayDirectio
 
 bool Mesh::hit(const Ray& ray, float t_min, float t_max, HitRecord& record) const
 {
-	if (m_aabb.hit(ray, t_min, t_max) == false)
+	if (m_nodeCount == 0)
 		return false;
 
-	vec3 v0, v1, v2;
+	const vec3 origin = ray.origin();
+	const vec3 direction = ray.direction();
+	const vec3 inverseDirection = 1.0f / direction;
 	float u, v;
 	float hitDistance;
+	int hitTriangle = -1;
 
-	bool isHit = false;
-
-	for (int i = 0; i < triangleCount(); ++i)
+	uint32_t stack[TraversalStackSize];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
 	{
-		getTriangle(i, v0, v1, v2);
+		const MeshBvhNode& node = m_nodeData[stack[--stackSize]];
+		if (hitBounds(node, origin, inverseDirection, t_min, t_max) == false)
+			continue;
+
+		if (node.count == 0 || node.count >= MeshBvhNode::ClusterRoot)
+		{
+			if (node.count != 0 && m_pager != nullptr)
+				m_pager->touch(m_firstPagerCluster + int(node.count & ~MeshBvhNode::ClusterRoot));
+			stack[stackSize++] = node.first + 1;
+			stack[stackSize++] = node.first;
+			continue;
+		}
 
-		if (rayTriangleIntersection(ray.origin(), ray.direction(), v0, v1, v2, hitDistance, u, v)
-			&& hitDistance < t_max
-			&& hitDistance > t_min)
+		for (uint32_t i = node.first; i < node.first + node.count; ++i)
 		{
-			isHit = true;
-			record.t = hitDistance;
-			record.point = ray.point_at_parameter(record.t);
-			record.normal = getFaceNormal(i); // currently just face normals
-			record.material = material;
+			const MeshTriangle& triangle = m_triangleData[i];
+			if (rayTriangleIntersection(origin, direction, triangle.v0, triangle.edge1, triangle.edge2, hitDistance, u, v)
+				&& hitDistance < t_max
+				&& hitDistance > t_min)
+			{
+				t_max = hitDistance; // only closer triangles after this
+				hitTriangle = int(triangle.index);
+			}
 		}
 	}
 
-	return isHit;
+	if (hitTriangle < 0)
+		return false;
+
+	record.t = t_max;
+	record.point = ray.point_at_parameter(record.t);
+	record.normal = getFaceNormal(hitTriangle); // currently just face normals
+	record.material = m_material;
+	record.hitable = this;
+	record.primitiveIndex = hitTriangle;
+	return true;
 }
 
 void Mesh::getTriangle(int idx, vec3& out0, vec3& out1, vec3& out2) const
@@ -129,9 +317,9 @@ void Mesh::getTriangle(int idx, vec3& out0, vec3& out1, vec3& out2) const
 	}
 
 	idx = idx * 3;
-	out0 = vertices[indices[idx]];
-	out1 = vertices[indices[idx+1]];
-	out2 = vertices[indices[idx+2]];
+	out0 = m_vertexData[m_indexData[idx]];
+	out1 = m_vertexData[m_indexData[idx+1]];
+	out2 = m_vertexData[m_indexData[idx+2]];
 }
 
 vec3 Mesh::getFaceNormal(int idx) const
@@ -143,12 +331,22 @@ vec3 Mesh::getFaceNormal(int idx) const
 	}
 
 	idx = idx * 3;
-	vec3 normal = normals[indices[idx]];
-	normal += normals[indices[idx+1]];
-	normal += normals[indices[idx+2]];
+	vec3 normal = vertexNormal(m_indexData[idx]);
+	normal += vertexNormal(m_indexData[idx+1]);
+	normal += vertexNormal(m_indexData[idx+2]);
 	return glm::normalize(normal);
 }
 
+vec3 Mesh::vertexNormal(uint32_t vertex) const
+{
+	return m_isCompact ? unpackNormal(m_packedNormalData[vertex]) : m_normalData[vertex];
+}
+
+glm::vec2 Mesh::vertexUv(uint32_t vertex) const
+{
+	return m_isCompact ? glm::unpackHalf2x16(m_packedUvData[vertex]) : m_uvData[vertex];
+}
+
 //version without initializer lists (vs2012):
 void Mesh::generateBox()
 {
@@ -327,6 +525,7 @@ void Mesh::generateBox()
 	indices.push_back(23);
 
 	computeAabb();
+	buildBvh();
 
 	//std::cout << "size of: vertices: " << vertices.size() << " size of indices: " << indices.size() << "\n";
 }
@@ -340,193 +539,344 @@ void Mesh::computeAabb()
 	}
 }
 
-/*
-// C++11 version. TODO fix UVs in this version to be the same as above
-
-void Mesh::generateBox()
+void Mesh::translate(const vec3& offset)
 {
-	std::cout<<"Generating Mesh.\n";
+	copyFromCache();
+	for (auto& vertex : vertices)
+		vertex += offset;
+	computeAabb();
+	buildBvh();
+}
 
-	float boxSize = 0.5f; // Actually half of the box size
+void Mesh::buildBvh()
+{
+	copyFromCache();
+	unpackAttributes();
+
+	const uint32_t count = uint32_t(indices.size() / 3);
+	std::vector<Aabb> bounds(count);
+	std::vector<vec3> centers(count);
+	std::vector<uint32_t> order(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		for (int corner = 0; corner < 3; ++corner)
+			bounds[i].grow(vertices[indices[i * 3 + corner]]);
+		centers[i] = 0.5f * (bounds[i].min() + bounds[i].max());
+		order[i] = i;
+	}
 
-	vertices =
+	m_nodes.clear();
+	m_triangles.clear();
+	m_clusters.clear();
+	if (count > 0)
 	{
-		glm::vec3(-boxSize,  boxSize,  boxSize), // 0
-		glm::vec3( boxSize,  boxSize,  boxSize), // 1
-		glm::vec3( boxSize,  boxSize, -boxSize), // 2
-		glm::vec3(-boxSize,  boxSize, -boxSize), // 3
-
-		glm::vec3(-boxSize, -boxSize,  boxSize), // 4
-		glm::vec3(-boxSize, -boxSize, -boxSize), // 5
-		glm::vec3( boxSize, -boxSize, -boxSize), // 6
-		glm::vec3( boxSize, -boxSize,  boxSize), // 7
-
-		glm::vec3(-boxSize, -boxSize, -boxSize), // 8
-		glm::vec3(-boxSize,  boxSize, -boxSize), // 9
-		glm::vec3( boxSize,  boxSize, -boxSize), // 10
-		glm::vec3( boxSize, -boxSize, -boxSize), // 11
-		
-		glm::vec3( boxSize, -boxSize,  boxSize), // 12
-		glm::vec3( boxSize,  boxSize,  boxSize), // 13
-		glm::vec3(-boxSize,  boxSize,  boxSize), // 14
-		glm::vec3(-boxSize, -boxSize,  boxSize), // 15
-
-		glm::vec3(-boxSize, -boxSize,  boxSize), // 16
-		glm::vec3(-boxSize,  boxSize,  boxSize), // 17
-		glm::vec3(-boxSize,  boxSize, -boxSize), // 18
-		glm::vec3(-boxSize, -boxSize, -boxSize), // 19
-		
-		glm::vec3( boxSize, -boxSize, -boxSize), // 20
-		glm::vec3( boxSize,  boxSize, -boxSize), // 21
-		glm::vec3( boxSize,  boxSize,  boxSize), // 22
-		glm::vec3( boxSize, -boxSize,  boxSize) // 23
-	};
+		m_nodes.reserve(2 * (count / MaxLeafTriangles + 1));
+		BvhBuilder builder(m_nodes, m_clusters, bounds, centers, order.data());
+		builder.buildClustered(count);
+
+		// The indices to the leaf order, and the vertices to the order the triangles first use them.
+		// The triangles of a cluster then use a narrow range of the vertices.
+		const uint32_t unused = 0xffffffffu;
+		std::vector<uint32_t> remap(vertices.size(), unused);
+		std::vector<uint32_t> newIndices(indices.size());
+		std::vector<uint32_t> verticesBefore(count + 1);
+		uint32_t vertexCount = 0;
+		for (uint32_t triangle = 0; triangle < count; ++triangle)
+		{
+			verticesBefore[triangle] = vertexCount;
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				const uint32_t vertex = indices[order[triangle] * 3 + corner];
+				if (remap[vertex] == unused)
+					remap[vertex] = vertexCount++;
+				newIndices[triangle * 3 + corner] = remap[vertex];
+			}
+		}
+		verticesBefore[count] = vertexCount;
+		// Vertices that no triangle uses go to the end.
+		for (uint32_t& index : remap)
+		{
+			if (index == unused)
+				index = vertexCount++;
+		}
+
+		std::vector<glm::vec3> newVertices(vertices.size());
+		for (size_t i = 0; i < vertices.size(); ++i)
+			newVertices[remap[i]] = vertices[i];
+		vertices.swap(newVertices);
+		if (uvs.size() == newVertices.size())
+		{
+			std::vector<glm::vec2> newUvs(uvs.size());
+			for (size_t i = 0; i < uvs.size(); ++i)
+				newUvs[remap[i]] = uvs[i];
+			uvs.swap(newUvs);
+		}
+		if (normals.size() == newVertices.size())
+		{
+			std::vector<glm::vec3> newNormals(normals.size());
+			for (size_t i = 0; i < normals.size(); ++i)
+				newNormals[remap[i]] = normals[i];
+			normals.swap(newNormals);
+		}
+		indices.swap(newIndices);
+
+		// The leaves now point to the triangles in the same order as the index buffer.
+		m_triangles.reserve(count);
+		for (uint32_t triangle = 0; triangle < count; ++triangle)
+		{
+			const vec3& v0 = vertices[indices[triangle * 3]];
+			const vec3& v1 = vertices[indices[triangle * 3 + 1]];
+			const vec3& v2 = vertices[indices[triangle * 3 + 2]];
+			m_triangles.push_back(MeshTriangle{ v0, v1 - v0, v2 - v0, triangle });
+		}
+
+		// The vertices that a cluster uses first. The ones it shares with an earlier cluster are
+		// paged with that one.
+		for (MeshCluster& cluster : m_clusters)
+		{
+			cluster.vertexBegin = verticesBefore[cluster.triangleBegin];
+			cluster.vertexEnd = verticesBefore[cluster.triangleEnd];
+		}
+	}
+	if (m_isCompact)
+		packAttributes();
+	useOwnArrays();
+}
 
-	uvs =
+void Mesh::weldVertices(uint32_t firstVertex, size_t firstIndex)
+{
+	const uint32_t empty = 0xffffffffu;
+	const size_t count = vertices.size() - firstVertex;
+	size_t tableSize = 16;
+	while (tableSize < count * 2)
+		tableSize *= 2;
+	const size_t mask = tableSize - 1;
+	std::vector<uint32_t> table(tableSize, empty);
+	std::vector<uint32_t> remap(count);
+
+	// The first of the same vertices stays, and the kept ones move down over the welded ones.
+	uint32_t keptCount = firstVertex;
+	for (size_t i = firstVertex; i < vertices.size(); ++i)
 	{
-		glm::vec2( 0.0f,  0.0f), // 0
-		glm::vec2( 1.0f,  0.0f), // 1
-		glm::vec2( 1.0f,  1.0f), // 2
-		glm::vec2( 0.0f,  1.0f), // 3
-		
-		glm::vec2( 0.0f,  0.0f), // 0
-		glm::vec2( 1.0f,  0.0f), // 1
-		glm::vec2( 1.0f,  1.0f), // 2
-		glm::vec2( 0.0f,  1.0f), // 3
-
-		glm::vec2( 0.0f,  0.0f), // 0
-		glm::vec2( 1.0f,  0.0f), // 1
-		glm::vec2( 1.0f,  1.0f), // 2
-		glm::vec2( 0.0f,  1.0f), // 3
-
-		glm::vec2( 0.0f,  0.0f), // 0
-		glm::vec2( 1.0f,  0.0f), // 1
-		glm::vec2( 1.0f,  1.0f), // 2
-		glm::vec2( 0.0f,  1.0f), // 3
-
-		glm::vec2( 0.0f,  0.0f), // 0
-		glm::vec2( 1.0f,  0.0f), // 1
-		glm::vec2( 1.0f,  1.0f), // 2
-		glm::vec2( 0.0f,  1.0f), // 3
-
-		glm::vec2( 0.0f,  0.0f), // 0
-		glm::vec2( 1.0f,  0.0f), // 1
-		glm::vec2( 1.0f,  1.0f), // 2
-		glm::vec2( 0.0f,  1.0f) // 3
-	};
+		const vec3 position = vertices[i];
+		const vec3 normal = normals[i];
+		const glm::vec2 uv = uvs[i];
+		size_t slot = weldHash(position, normal, uv) & mask;
+		uint32_t vertex;
+		while ((vertex = table[slot]) != empty)
+		{
+			if (memcmp(&vertices[vertex], &position, sizeof(vec3)) == 0
+				&& memcmp(&normals[vertex], &normal, sizeof(vec3)) == 0
+				&& memcmp(&uvs[vertex], &uv, sizeof(glm::vec2)) == 0)
+				break;
+			slot = (slot + 1) & mask;
+		}
+		if (vertex == empty)
+		{
+			vertex = keptCount++;
+			vertices[vertex] = position;
+			normals[vertex] = normal;
+			uvs[vertex] = uv;
+			table[slot] = vertex;
+		}
+		remap[i - firstVertex] = vertex;
+	}
 
-	// *--------*
-	// |\      /|
-	// | *----* |
-	// | |    | |
-	// | *----* |
-	// |/      \|
-	// *--------*
+	vertices.resize(keptCount);
+	normals.resize(keptCount);
+	uvs.resize(keptCount);
+	for (size_t i = firstIndex; i < indices.size(); ++i)
+		indices[i] = remap[indices[i] - firstVertex];
+}
 
-	// 0--------1
-	//  \      /
-	//   3----2 
-	//       
-	//   5----6 
-	//  /      \
-	// 4--------7
+void Mesh::computeNormals(uint32_t firstVertex, size_t firstIndex)
+{
+	// The cross product is twice the area of the triangle, so the big ones weigh the most.
+	normals.resize(vertices.size());
+	std::fill(normals.begin() + firstVertex, normals.end(), vec3(0.0f));
+	for (size_t i = firstIndex; i + 2 < indices.size(); i += 3)
+	{
+		const vec3& v0 = vertices[indices[i]];
+		const vec3 faceNormal = glm::cross(vertices[indices[i + 1]] - v0, vertices[indices[i + 2]] - v0);
+		for (int corner = 0; corner < 3; ++corner)
+			normals[indices[i + corner]] += faceNormal;
+	}
+	for (size_t i = firstVertex; i < normals.size(); ++i)
+	{
+		const float length = glm::length(normals[i]);
+		normals[i] = length > 0.0f ? normals[i] / length : vec3(0.0f, 1.0f, 0.0f);
+	}
+}
 
-	// 14------13
-	// |        |
-	// | 9---10 |
-	// | |    | |
-	// | 8---11 |
-	// |        |
-	// 15------12
+void Mesh::packAttributes()
+{
+	m_packedNormals.resize(normals.size());
+	for (size_t i = 0; i < normals.size(); ++i)
+		m_packedNormals[i] = packNormal(normals[i]);
+	m_packedUvs.resize(uvs.size());
+	for (size_t i = 0; i < uvs.size(); ++i)
+		m_packedUvs[i] = glm::packHalf2x16(uvs[i]);
+	std::vector<glm::vec3>().swap(normals);
+	std::vector<glm::vec2>().swap(uvs);
+}
 
-	// 17       22
-	// |\      /|
-	// | 18   21|
-	// | |    | |
-	// | 19   20|
-	// |/      \|
-	// 16      23
+void Mesh::unpackAttributes()
+{
+	if (m_packedNormals.empty() && m_packedUvs.empty())
+		return;
+	normals.resize(m_packedNormals.size());
+	for (size_t i = 0; i < m_packedNormals.size(); ++i)
+		normals[i] = unpackNormal(m_packedNormals[i]);
+	uvs.resize(m_packedUvs.size());
+	for (size_t i = 0; i < m_packedUvs.size(); ++i)
+		uvs[i] = glm::unpackHalf2x16(m_packedUvs[i]);
+	std::vector<uint32_t>().swap(m_packedNormals);
+	std::vector<uint32_t>().swap(m_packedUvs);
+}
 
-	normals =
+void Mesh::setPager(ClusterPager* pager)
+{
+	if (m_pager != nullptr && m_cacheFile.isOpen())
+		m_pager->removeClusters(m_firstPagerCluster, m_clusterCount);
+	m_pager = nullptr;
+	if (pager == nullptr || m_cacheFile.isOpen() == false || m_clusterCount == 0)
+		return;
+
+	m_pager = pager;
+	for (int i = 0; i < m_clusterCount; ++i)
 	{
-		glm::vec3( 0.0f,  1.0f,  0.0f), // 0
-		glm::vec3( 0.0f,  1.0f,  0.0f), // 1
-		glm::vec3( 0.0f,  1.0f,  0.0f), // 2
-		glm::vec3( 0.0f,  1.0f,  0.0f), // 3
-		
-		glm::vec3( 0.0f,  -1.0f,  0.0f), // 0
-		glm::vec3( 0.0f,  -1.0f,  0.0f), // 1
-		glm::vec3( 0.0f,  -1.0f,  0.0f), // 2
-		glm::vec3( 0.0f,  -1.0f,  0.0f), // 3
-
-		glm::vec3( 0.0f,  0.0f,  -1.0f), // 0
-		glm::vec3( 0.0f,  0.0f,  -1.0f), // 1
-		glm::vec3( 0.0f,  0.0f,  -1.0f), // 2
-		glm::vec3( 0.0f,  0.0f,  -1.0f), // 3
-
-		glm::vec3( 0.0f,  0.0f,  1.0f), // 0
-		glm::vec3( 0.0f,  0.0f,  1.0f), // 1
-		glm::vec3( 0.0f,  0.0f,  1.0f), // 2
-		glm::vec3( 0.0f,  0.0f,  1.0f), // 3
-
-		glm::vec3( -1.0f,  0.0f,  0.0f), // 0
-		glm::vec3( -1.0f,  0.0f,  0.0f), // 1
-		glm::vec3( -1.0f,  0.0f,  0.0f), // 2
-		glm::vec3( -1.0f,  0.0f,  0.0f), // 3
-
-		glm::vec3( 1.0f,  0.0f,  0.0f), // 0
-		glm::vec3( 1.0f,  0.0f,  0.0f), // 1
-		glm::vec3( 1.0f,  0.0f,  0.0f), // 2
-		glm::vec3( 1.0f,  0.0f,  0.0f) // 3
-	};
+		const MeshCluster& cluster = m_clusterData[i];
+		const uint32_t vertexCount = cluster.vertexEnd - cluster.vertexBegin;
+		const ClusterPager::Range ranges[] =
+		{
+			{ m_nodeData + cluster.nodeBegin, (cluster.nodeEnd - cluster.nodeBegin) * sizeof(MeshBvhNode) },
+			{ m_triangleData + cluster.triangleBegin, (cluster.triangleEnd - cluster.triangleBegin) * sizeof(MeshTriangle) },
+			{ m_indexData + cluster.triangleBegin * 3, (cluster.triangleEnd - cluster.triangleBegin) * 3 * sizeof(uint32_t) },
+			{ m_vertexData + cluster.vertexBegin, vertexCount * sizeof(glm::vec3) },
+			m_isCompact ? ClusterPager::Range{ m_packedNormalData + cluster.vertexBegin, vertexCount * sizeof(uint32_t) }
+				: ClusterPager::Range{ m_normalData + cluster.vertexBegin, vertexCount * sizeof(glm::vec3) },
+			m_isCompact ? ClusterPager::Range{ m_packedUvData + cluster.vertexBegin, vertexCount * sizeof(uint32_t) }
+				: ClusterPager::Range{ m_uvData + cluster.vertexBegin, vertexCount * sizeof(glm::vec2) },
+		};
+		const int id = m_pager->addCluster(ranges, int(sizeof(ranges) / sizeof(ranges[0])));
+		if (i == 0)
+			m_firstPagerCluster = id;
+	}
+}
 
-	
-	
-	indices =
+void Mesh::releaseCache()
+{
+	if (m_pager != nullptr && m_cacheFile.isOpen())
+		m_pager->removeClusters(m_firstPagerCluster, m_clusterCount);
+	m_pager = nullptr;
+	m_cacheFile.close();
+}
+
+void Mesh::useOwnArrays()
+{
+	releaseCache();
+	m_vertexData = vertices.data();
+	m_uvData = uvs.data();
+	m_normalData = normals.data();
+	m_packedUvData = m_packedUvs.data();
+	m_packedNormalData = m_packedNormals.data();
+	m_indexData = indices.data();
+	m_nodeData = m_nodes.data();
+	m_triangleData = m_triangles.data();
+	m_clusterData = m_clusters.data();
+	m_vertexCount = int(vertices.size());
+	m_indexCount = int(indices.size());
+	m_nodeCount = int(m_nodes.size());
+	m_clusterCount = int(m_clusters.size());
+}
+
+void Mesh::copyFromCache()
+{
+	if (m_cacheFile.isOpen() == false)
+		return;
+
+	vertices.assign(m_vertexData, m_vertexData + m_vertexCount);
+	if (m_isCompact)
 	{
-		//roof
-		0, 1, 2,
-		0, 2, 3,
-		
-		//floor
-		4, 5, 6, 
-		4, 6, 7, 
-		
-		//back
-		8, 9, 10,
-		8, 10, 11,
+		m_packedUvs.assign(m_packedUvData, m_packedUvData + m_vertexCount);
+		m_packedNormals.assign(m_packedNormalData, m_packedNormalData + m_vertexCount);
+	}
+	else
+	{
+		uvs.assign(m_uvData, m_uvData + m_vertexCount);
+		normals.assign(m_normalData, m_normalData + m_vertexCount);
+	}
+	indices.assign(m_indexData, m_indexData + m_indexCount);
+	m_nodes.assign(m_nodeData, m_nodeData + m_nodeCount);
+	m_triangles.assign(m_triangleData, m_triangleData + m_indexCount / 3);
+	m_clusters.assign(m_clusterData, m_clusterData + m_clusterCount);
+	useOwnArrays();
+}
 
-		//front
-		12, 13, 14,
-		12, 14, 15,
+bool Mesh::loadModel(const string& filepath, ThreadPool* threadPool)
+{
+	const string cachePath = filepath + ".cache";
+	uint64_t sourceHash = 0;
+	const bool isCached = loadCache(cachePath, filepath, sourceHash);
+	m_sourceHash = sourceHash;
+	if (isCached)
+	{
+		cout << "Loaded " << filepath << " from " << cachePath << "\n";
+		return true;
+	}
 
-		//left
-		16, 17, 18,
-		16, 18, 19,
+	// A model too big for the memory fails to load, and the rest of the scene still renders.
+	try
+	{
+		// Off a cached mesh, so that buildBvh doesn't copy its arrays over the new ones.
+		copyFromCache();
+		unpackAttributes();
+		vertices.clear();
+		uvs.clear();
+		normals.clear();
+		indices.clear();
+
+		const size_t dot = filepath.find_last_of('.');
+		string extension = dot != string::npos ? filepath.substr(dot) : string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+		bool isLoaded = extension == ".obj" && loadObj(filepath, threadPool);
+		if (isLoaded == false)
+			isLoaded = importModel(filepath);
+		if (isLoaded == false)
+			return false;
 
-		//right
-		20, 21, 22,
-		20, 22, 23
+		computeAabb();
+		buildBvh();
+		// The caller creates the VBOs when the mesh is drawn with GL.
+	}
+	catch (const std::bad_alloc&)
+	{
+		std::vector<glm::vec3>().swap(vertices);
+		std::vector<glm::vec2>().swap(uvs);
+		std::vector<glm::vec3>().swap(normals);
+		std::vector<uint32_t>().swap(indices);
+		std::vector<uint32_t>().swap(m_packedUvs);
+		std::vector<uint32_t>().swap(m_packedNormals);
+		std::vector<MeshBvhNode>().swap(m_nodes);
+		std::vector<MeshTriangle>().swap(m_triangles);
+		std::vector<MeshCluster>().swap(m_clusters);
+		useOwnArrays();
+		cout << "Out of memory importing " << filepath << "\n";
+		return false;
+	}
 
-	};
+	if (saveCache(cachePath, filepath, sourceHash) == false)
+		cout << "Couldn't write the mesh cache " << cachePath << "\n";
 
-	std::cout<<"size of: vertices: "<<vertices.size()<<" size of indices: "<<indices.size()<<"\n";	
+	cout << "Succesfully imported scene " << filepath << "\n";
+	return true;
 }
-*/
 
-//ASSIMP
-bool Mesh::loadModel(const string& filepath)
+bool Mesh::importModel(const string& filepath)
 {
+	//ASSIMP
 	Assimp::Importer importer;
 
-	//Assimp::Logger::LogSeverity severity = Assimp::Logger::NORMAL;
-	Assimp::Logger::LogSeverity severity = Assimp::Logger::VERBOSE;
-	// Create a logger instance for Console Output
-	Assimp::DefaultLogger::create("",severity, aiDefaultLogStream_STDOUT);
-	// And another for file output
-	Assimp::DefaultLogger::create("assimp_log.txt",severity, aiDefaultLogStream_FILE);
-	Assimp::DefaultLogger::get()->info("this is my info-call");
-
 	const aiScene* scene = nullptr;
 
 	//check if file exists
@@ -552,192 +902,87 @@ bool Mesh::loadModel(const string& filepath)
 		return false;
 	}
 
-	loadNode(scene, scene->mRootNode);
-
-	// Aabb already computed inside loadNode because we need it for UV computation
-	//computeAabb();
-	createVBOs();
-
-	cout << "Succesfully imported scene " << filepath << "\n";
+	// All the meshes of the file, as one.
+	vertices.clear();
+	uvs.clear();
+	normals.clear();
+	indices.clear();
+	loadNode(scene, scene->mRootNode, glm::mat4(1.0f));
+	//end // ASSIMP
+	cout << "Imported " << scene->mNumMeshes << " meshes: " << vertices.size() << " vertices after welding, "
+		<< indices.size() / 3 << " triangles\n";
 	return true;
 }
 
-void Mesh::loadNode(const aiScene* scene, const aiNode* node)
+//ASSIMP
+void Mesh::loadNode(const aiScene* scene, const aiNode* node, const glm::mat4& parentTransform)
 {
-	cout << "Node mesh count: " << node->mNumMeshes << "\n";
+	const glm::mat4 transform = parentTransform * toMat4(node->mTransformation);
+	for (unsigned i = 0; i < node->mNumMeshes; ++i)
+		appendMesh(scene->mMeshes[node->mMeshes[i]], transform);
+	for (unsigned i = 0; i < node->mNumChildren; ++i)
+		loadNode(scene, node->mChildren[i], transform);
+}
 
-	if(node->mNumMeshes > 0)
+void Mesh::appendMesh(const aiMesh* mesh, const glm::mat4& transform)
+{
+	const uint32_t firstVertex = uint32_t(vertices.size());
+	const size_t firstIndex = indices.size();
+	// Normals go with the inverse transpose, which is the transform itself without a scale.
+	const glm::mat3 normalTransform = glm::transpose(glm::inverse(glm::mat3(transform)));
+	const bool hasNormals = mesh->HasNormals();
+
+	Aabb bounds;
+	vertices.resize(firstVertex + mesh->mNumVertices);
+	for(unsigned i = 0; i < mesh->mNumVertices; i++)
 	{
-
-		for(unsigned i = 0; i < node->mNumMeshes; ++i)
-		{
-			cout << "Node: " << i << "\n";
-
-			const aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-
-			unsigned f;
-			for(f = 0; f < mesh->mNumFaces; ++f)
-			{
-			
-			}
-
-			cout << "Faces: " << f << "\n";
-
-			for(unsigned n = 0; n < node->mNumChildren; ++n)
-			{
-				loadNode(scene, node->mChildren[n]);
-			}
-
-		}
+		aiVector3D pos = mesh->mVertices[i];
+		vertices[firstVertex + i] = vec3(transform * glm::vec4(pos.x, pos.y, pos.z, 1.0f));
+		bounds.grow(vertices[firstVertex + i]);
 	}
-	else
-	{
-		const aiMesh* mesh = scene->mMeshes[0]; // In this simple example code we always use the 1rst mesh (in OBJ files there is often only one anyway)
-
-		cout << "vertices: " << mesh->mNumVertices << "\n";
-		cout << "faces: " << mesh->mNumFaces << "\n";
-		
-		if(mesh->HasTextureCoords(0) == false)
-		{
-			cout << "no texture coordinates in mesh.\n";
-		}
+	const vec3 dimensions = bounds.dimensions();
 
-		m_aabb.clear();
-
-		// Fill vertices positions
-		vertices.reserve(mesh->mNumVertices);
-		for(unsigned i = 0; i < mesh->mNumVertices; i++)
+	uvs.resize(vertices.size());
+	normals.resize(vertices.size(), vec3(0.0f));
+	for(unsigned i = 0; i < mesh->mNumVertices; i++)
+	{
+		const vec3& position = vertices[firstVertex + i];
+		if(mesh->HasTextureCoords(0))
 		{
-			aiVector3D pos = mesh->mVertices[i];
-			vertices.push_back(glm::vec3(pos.x, pos.y, pos.z));
-			m_aabb.grow(vertices[i]);
+			aiVector3D UVW = mesh->mTextureCoords[0][i]; // Assume only 1 set of UV coords; AssImp supports 8 UV sets.
+			uvs[firstVertex + i] = glm::vec2(UVW.x, UVW.y);
 		}
-
-		// Fill vertices texture coordinates
-		uvs.reserve(mesh->mNumVertices);
-		for(unsigned i = 0; i < mesh->mNumVertices; i++)
+		else
 		{
-			//REMOVE cout <<"uv: " << i <<"\n";
-			if(mesh->HasTextureCoords(0))
-			{
-				aiVector3D UVW = mesh->mTextureCoords[0][i]; // Assume only 1 set of UV coords; AssImp supports 8 UV sets.
-				uvs.push_back(glm::vec2(UVW.x, UVW.y));
-			}
-			else
-			{
-				// really TEMP uvs
-				//uvs.push_back(glm::vec2(float(i) / float(mesh->mNumVertices), float(i) / float(mesh->mNumVertices)));
-
-				uvs.push_back(glm::vec2((vertices[i].x - m_aabb.min().x) / m_aabb.dimensions().x, (vertices[i].y - m_aabb.min().y) / m_aabb.dimensions().y));
-			}
+			// Planar from above, for a texture to have something.
+			uvs[firstVertex + i] = glm::vec2(dimensions.x > 0.0f ? (position.x - bounds.min().x) / dimensions.x : 0.0f,
+				dimensions.y > 0.0f ? (position.y - bounds.min().y) / dimensions.y : 0.0f);
 		}
-
-		// Fill vertices normals
-		normals.reserve(mesh->mNumVertices);
-		for(unsigned i = 0; i<mesh->mNumVertices; i++)
+		if (hasNormals)
 		{
-			if(mesh->HasNormals())
-			{
-				aiVector3D n = mesh->mNormals[i];
-				normals.push_back(glm::vec3(n.x, n.y, n.z));
-			}
-			else
-			{
-				// really TEMP normals
-				normals.push_back(glm::normalize( glm::vec3(float(i) / float(mesh->mNumVertices), float(i) / float(mesh->mNumVertices), 1.0f) ));
-			}
+			const vec3 normal = normalTransform * vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
+			const float length = glm::length(normal);
+			normals[firstVertex + i] = length > 0.0f ? normal / length : vec3(0.0f, 1.0f, 0.0f);
 		}
+	}
 
-		// Fill face indices
-		indices.reserve(3*mesh->mNumFaces);
-		for (unsigned i = 0; i<mesh->mNumFaces; i++)
+	// Polygons are split into fans, points and lines have no surface.
+	indices.reserve(firstIndex + 3 * mesh->mNumFaces);
+	for (unsigned i = 0; i < mesh->mNumFaces; i++)
+	{
+		const aiFace& face = mesh->mFaces[i];
+		for (unsigned corner = 2; corner < face.mNumIndices; ++corner)
 		{
-			// Assume the model has only triangles.
-			indices.push_back(mesh->mFaces[i].mIndices[0]);
-			indices.push_back(mesh->mFaces[i].mIndices[1]);
-			indices.push_back(mesh->mFaces[i].mIndices[2]);
+			indices.push_back(firstVertex + face.mIndices[0]);
+			indices.push_back(firstVertex + face.mIndices[corner - 1]);
+			indices.push_back(firstVertex + face.mIndices[corner]);
 		}
 	}
-}
-//end // ASSIMP
-
-
-void Mesh::createVBOs()
-{
-	glGenBuffers(1, &vertexBufferID);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), &vertices[0], GL_STATIC_DRAW);
 
-	glGenBuffers(1, &uvBufferID);
-	glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-	glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(glm::vec2), &uvs[0], GL_STATIC_DRAW);
-
-	glGenBuffers(1, &normalBufferID);
-	glBindBuffer(GL_ARRAY_BUFFER, normalBufferID);
-	glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec3), &normals[0], GL_STATIC_DRAW);
-
-	glGenBuffers(1, &indexBufferID);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0] , GL_STATIC_DRAW);
-}
-
-void Mesh::render(unsigned set_shader_program_id)
-{
-
-	// Get a handle for our buffers
-	GLuint vertex_position_id = glGetAttribLocation(set_shader_program_id, "inPosition");
-	GLuint vertex_uv_id = glGetAttribLocation(set_shader_program_id, "inUV");
-	GLuint vertex_normal_id = glGetAttribLocation(set_shader_program_id, "inNormal");
-
-		// vertices
-		glEnableVertexAttribArray(vertex_position_id);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-		glVertexAttribPointer(
-			vertex_position_id,  // The attribute we want to configure
-			3,                            // size
-			GL_FLOAT,                     // type
-			GL_FALSE,                     // normalized?
-			0,                            // stride
-			(void*)0                      // array buffer offset
-		);
-
-		// UVs
-		glEnableVertexAttribArray(vertex_uv_id);
-		glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-		glVertexAttribPointer(
-			vertex_uv_id,                   // The attribute we want to configure
-			2,                            // size : U+V => 2
-			GL_FLOAT,                     // type
-			GL_FALSE,                     // normalized?
-			0,                            // stride
-			(void*)0                      // array buffer offset
-		);
-
-		// normals
-		glEnableVertexAttribArray(vertex_normal_id);
-		glBindBuffer(GL_ARRAY_BUFFER, normalBufferID);
-		glVertexAttribPointer(
-			vertex_normal_id,    // The attribute we want to configure
-			3,                            // size
-			GL_FLOAT,                     // type
-			GL_FALSE,                     // normalized?
-			0,                            // stride
-			(void*)0                      // array buffer offset
-		);
-
-		// Index buffer
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-
-		glDrawElements(
-			GL_TRIANGLES,
-			(GLsizei)indices.size(),
-			GL_UNSIGNED_SHORT,
-			(void*)0
-		);
-
-		glDisableVertexAttribArray(vertex_position_id);
-		glDisableVertexAttribArray(vertex_uv_id);
-		glDisableVertexAttribArray(vertex_normal_id);
+	weldVertices(firstVertex, firstIndex);
+	if (hasNormals == false)
+		computeNormals(firstVertex, firstIndex);
 }
+//end // ASSIMP
 
 }//end namespace Rae
@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <string>
+#include <stdint.h>
 using namespace std;
 
 #include <glm/glm.hpp>
@@ -13,15 +14,64 @@ using glm::vec3;
 #include "assimp/scene.h"
 #include "assimp/DefaultLogger.hpp"
 #include "assimp/LogStream.hpp"
+
+namespace Rae
+{
+	// Assimp's matrices are row major.
+	inline glm::mat4 toMat4(const aiMatrix4x4& m)
+	{
+		return glm::transpose(glm::mat4(m.a1, m.a2, m.a3, m.a4, m.b1, m.b2, m.b3, m.b4,
+			m.c1, m.c2, m.c3, m.c4, m.d1, m.d2, m.d3, m.d4));
+	}
+}
 //end // ASSIMP
 
 #include "Hitable.hpp"
 #include "Aabb.hpp"
+#include "core/MappedFile.hpp"
 
 namespace Rae
 {
 
 class Material;
+class ClusterPager;
+class ThreadPool;
+
+// The triangle BVH of a mesh is a flat array, so that it goes to the cache file as it is.
+// The children of an inner node are next to each other.
+struct MeshBvhNode
+{
+	// In count, for the inner node at the root of a cluster. The rest of the bits are the cluster.
+	static const uint32_t ClusterRoot = 0x80000000u;
+
+	vec3 min;
+	uint32_t first; // the left child, or the first triangle of a leaf
+	vec3 max;
+	uint32_t count; // the triangles of a leaf, 0 for inner nodes
+};
+
+// The triangles in the leaf order of the BVH, with the edges for the intersection precomputed.
+// The index buffer is in the same order.
+struct MeshTriangle
+{
+	vec3 v0;
+	vec3 edge1;
+	vec3 edge2;
+	uint32_t index; // the triangle in the index buffer, for the normals and HitRecord::primitiveIndex
+};
+
+// A subtree of the BVH with a few thousand triangles close to each other. Its nodes, triangles and
+// indices are ranges of their arrays, and the vertices are renumbered in the order the triangles use
+// them, so a cluster is a handful of contiguous ranges that can be paged in and out together.
+struct MeshCluster
+{
+	uint32_t nodeBegin;
+	uint32_t nodeEnd;
+	uint32_t triangleBegin;
+	uint32_t triangleEnd;
+	uint32_t vertexBegin;
+	uint32_t vertexEnd;
+};
 
 class Mesh : public Hitable
 {
@@ -35,42 +85,127 @@ public:
 	Mesh(){}
 	Mesh(int set_id);
 	~Mesh();
+	// The arrays and the mapping keep their memory when moved, so the views stay valid.
+	Mesh(Mesh&& other) = default;
+	Mesh& operator=(Mesh&& other) = default;
 	
 	virtual bool hit(const Ray& ray, float t_min, float t_max, HitRecord& record) const;
 	virtual Aabb getAabb(float t0, float t1) const { return m_aabb; }
 
 	void generateBox();
+	// Moves the vertices in place. There's no transform yet.
+	void translate(const vec3& offset);
+
+	// Reads filepath.cache instead of importing, when it was made from the same file. Otherwise
+	// imports and writes the cache for the next time. OBJ files are read by loadObj, in parallel
+	// on the pool when there is one, and the rest with Assimp.
+	bool loadModel(const string& filepath, ThreadPool* threadPool = nullptr);
+	// The contents of the file that loadModel loaded, 0 for the generated meshes
+	uint64_t sourceHash() const { return m_sourceHash; }
+
+	// Octahedral 16-bit normals and half float UVs, 8 bytes a vertex instead of 20. Set before
+	// loadModel or generateBox, it's part of the cache.
+	void setCompactAttributes(bool set) { m_isCompact = set; }
+	bool isCompactAttributes() const { return m_isCompact; }
 
 	//ASSIMP
-	bool loadModel(const string& filepath);
-	void loadNode(const aiScene* scene, const aiNode* node);
+	// Adds the meshes of the node and its children, moved by their transforms, to this one.
+	void loadNode(const aiScene* scene, const aiNode* node, const glm::mat4& parentTransform);
+	// Adds one mesh and welds its vertices. Prints nothing, so meshes can be imported in parallel.
+	void appendMesh(const aiMesh* mesh, const glm::mat4& transform);
 	//end // ASSIMP
 
+	// The GL side is in MeshGl.cpp, so that the ray tracing core builds without GL.
+	// The buffers live as long as the GL context.
 	void createVBOs();
 	void render(unsigned set_shader_program_id);
-	int triangleCount() const { return int(indices.size()) / 3; }
+	int triangleCount() const { return m_indexCount / 3; }
 	void computeAabb();
+	// After the vertices or indices change. Reorders the indices and vertices to the leaf order.
+	void buildBvh();
+	// Lets the pager keep the clusters of a mesh from the cache under its budget. The pager needs
+	// to live longer than the mesh.
+	void setPager(ClusterPager* pager);
+
+	void getTriangle(int idx, vec3& out0, vec3& out1, vec3& out2) const;
+
+	Material* material() const { return m_material; }
+	// Doesn't delete the old material. TODO memory management.
+	void setMaterial(Material* set) { m_material = set; }
 
 protected:
 
 	bool rayTriangleIntersection(const vec3& rayStart, const vec3& rayDirection,
-		const vec3& v1, const vec3& v2, const vec3& v3,
+		const vec3& v1, const vec3& e1, const vec3& e2,
 		float& t, float& u, float& v/*, bool& frontFacing*/) const;
-	void getTriangle(int idx, vec3& out0, vec3& out1, vec3& out2) const;
 	vec3 getFaceNormal(int idx) const;
+	// From either the float or the compact arrays.
+	vec3 vertexNormal(uint32_t vertex) const;
+	glm::vec2 vertexUv(uint32_t vertex) const;
+	// Importers give each face corner its own vertex, so the same vertex comes many times. Welding
+	// the ones from firstVertex on makes the arrays smaller and lets the triangles share their normals.
+	void weldVertices(uint32_t firstVertex, size_t firstIndex);
+	// Area weighted, for models without normals. For the vertices from firstVertex on, which the
+	// triangles from firstIndex on use.
+	void computeNormals(uint32_t firstVertex, size_t firstIndex);
+	// Between the float vectors, which are the ones that can be changed, and the compact ones.
+	void packAttributes();
+	void unpackAttributes();
+
+	// In MeshObj.cpp. Fails on anything it doesn't understand, and Assimp gets to try.
+	bool loadObj(const string& filepath, ThreadPool* threadPool);
+	bool importModel(const string& filepath);
+
+	// The cache format is in MeshCache.cpp. loadCache hashes the source when its size or time
+	// doesn't match the cache, and gives the hash back for saveCache. On a hit it's the cache's.
+	bool loadCache(const string& cachePath, const string& sourcePath, uint64_t& sourceHash);
+	bool saveCache(const string& cachePath, const string& sourcePath, uint64_t sourceHash) const;
+	// Points the views to the vectors and lets go of the cache.
+	void useOwnArrays();
+	void releaseCache();
+	// A mesh from the cache is read-only, this copies it to the vectors before a change.
+	void copyFromCache();
 
 	std::vector<glm::vec3> vertices;
 	std::vector<glm::vec2> uvs;
 	std::vector<glm::vec3> normals;
-	std::vector<unsigned short> indices;
-
-	unsigned vertexBufferID;
-	unsigned uvBufferID;
-	unsigned normalBufferID;
-	unsigned indexBufferID;
+	std::vector<uint32_t> indices;
+	std::vector<uint32_t> m_packedUvs; // instead of uvs and normals when m_isCompact
+	std::vector<uint32_t> m_packedNormals;
+	std::vector<MeshBvhNode> m_nodes;
+	std::vector<MeshTriangle> m_triangles;
+	std::vector<MeshCluster> m_clusters;
+
+	// Everything reads the arrays through these. They point either to the vectors above, or into
+	// m_cacheFile, without a copy.
+	const glm::vec3* m_vertexData = nullptr;
+	const glm::vec2* m_uvData = nullptr;
+	const glm::vec3* m_normalData = nullptr;
+	const uint32_t* m_packedUvData = nullptr;
+	const uint32_t* m_packedNormalData = nullptr;
+	const uint32_t* m_indexData = nullptr;
+	const MeshBvhNode* m_nodeData = nullptr;
+	const MeshTriangle* m_triangleData = nullptr;
+	const MeshCluster* m_clusterData = nullptr;
+	int m_vertexCount = 0;
+	int m_indexCount = 0;
+	int m_nodeCount = 0;
+	int m_clusterCount = 0;
+	bool m_isCompact = false;
+	uint64_t m_sourceHash = 0;
+	MappedFile m_cacheFile;
+
+	// Only for a mesh from the cache. Owned arrays are always resident.
+	ClusterPager* m_pager = nullptr;
+	int m_firstPagerCluster = 0;
+
+	unsigned vertexBufferID = 0;
+	unsigned uvBufferID = 0;
+	unsigned normalBufferID = 0;
+	unsigned indexBufferID = 0;
 
 	Aabb m_aabb;
-	Material* material; // TODO make better, don't use pointer. Use component ID.
+	Material* m_material; // TODO make better, don't use pointer. Use component ID.
 };
 
 } // end namespace Rae
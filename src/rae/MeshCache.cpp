@@ -0,0 +1,236 @@
+#include "Mesh.hpp"
+
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+namespace Rae
+{
+
+// The cache file is the header and then the arrays exactly as they are in memory, each at a 16 byte
+// aligned offset. Loading maps the file and points the mesh into it, nothing is parsed or copied.
+// The cache is only for the machine that wrote it: the header checks the layout, not the byte order.
+namespace
+{
+	const char CacheMagic[8] = { 'R', 'A', 'E', 'M', 'E', 'S', 'H', '\0' };
+	// Bump when the header or any of the arrays changes.
+	const uint32_t CacheVersion = 3;
+	const uint32_t CacheCompact = 1;
+	const uint64_t CacheAlignment = 16;
+
+	struct CacheHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t headerSize;
+		uint32_t nodeSize;
+		uint32_t triangleSize;
+		// The source is the key. Its size and time only save hashing it when they haven't changed.
+		uint64_t sourceHash;
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		float aabbMin[3];
+		float aabbMax[3];
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint32_t nodeCount;
+		uint32_t clusterCount;
+		uint64_t vertexOffset;
+		uint64_t uvOffset;
+		uint64_t normalOffset;
+		uint64_t indexOffset;
+		uint64_t nodeOffset;
+		uint64_t triangleOffset;
+		uint64_t clusterOffset;
+		uint32_t flags;
+		uint32_t padding;
+	};
+
+	bool sourceInfo(const string& path, uint64_t& size, int64_t& time)
+	{
+		struct stat info;
+		if (stat(path.c_str(), &info) != 0)
+			return false;
+		size = uint64_t(info.st_size);
+		time = int64_t(info.st_mtime);
+		return true;
+	}
+
+	uint64_t alignUp(uint64_t offset)
+	{
+		return (offset + CacheAlignment - 1) / CacheAlignment * CacheAlignment;
+	}
+
+	bool isInside(uint64_t offset, uint64_t count, size_t elementSize, size_t fileSize)
+	{
+		return offset % CacheAlignment == 0 && offset <= fileSize && count <= (fileSize - offset) / elementSize;
+	}
+}
+
+bool Mesh::loadCache(const string& cachePath, const string& sourcePath, uint64_t& sourceHash)
+{
+	uint64_t sourceSize = 0;
+	int64_t sourceTime = 0;
+	if (sourceInfo(sourcePath, sourceSize, sourceTime) == false)
+		return false;
+
+	// On a miss the hash goes back to saveCache.
+	bool isHashed = false;
+	auto hashSource = [&]()
+	{
+		if (isHashed == false)
+		{
+			MappedFile source;
+			sourceHash = source.open(sourcePath) ? source.contentHash() : 0;
+			isHashed = true;
+		}
+	};
+	auto miss = [&]()
+	{
+		hashSource();
+		return false;
+	};
+
+	MappedFile file;
+	if (file.open(cachePath) == false || file.size() < sizeof(CacheHeader))
+		return miss();
+
+	CacheHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	if (memcmp(header.magic, CacheMagic, sizeof(CacheMagic)) != 0
+		|| header.version != CacheVersion
+		|| header.headerSize != sizeof(CacheHeader)
+		|| header.nodeSize != sizeof(MeshBvhNode)
+		|| header.triangleSize != sizeof(MeshTriangle)
+		|| ((header.flags & CacheCompact) != 0) != m_isCompact)
+		return miss();
+
+	if (header.sourceSize != sourceSize || header.sourceTime != sourceTime)
+	{
+		// Touched, copied or edited. Only a change to the contents makes the cache stale.
+		hashSource();
+		if (sourceHash != header.sourceHash)
+			return false;
+	}
+
+	const size_t size = file.size();
+	const uint64_t triangleCount = header.indexCount / 3;
+	const size_t uvSize = m_isCompact ? sizeof(uint32_t) : sizeof(glm::vec2);
+	const size_t normalSize = m_isCompact ? sizeof(uint32_t) : sizeof(glm::vec3);
+	if (header.indexCount % 3 != 0
+		|| (triangleCount > 0 && header.nodeCount == 0)
+		|| isInside(header.vertexOffset, header.vertexCount, sizeof(glm::vec3), size) == false
+		|| isInside(header.uvOffset, header.vertexCount, uvSize, size) == false
+		|| isInside(header.normalOffset, header.vertexCount, normalSize, size) == false
+		|| isInside(header.indexOffset, header.indexCount, sizeof(uint32_t), size) == false
+		|| isInside(header.nodeOffset, header.nodeCount, sizeof(MeshBvhNode), size) == false
+		|| isInside(header.triangleOffset, triangleCount, sizeof(MeshTriangle), size) == false
+		|| isInside(header.clusterOffset, header.clusterCount, sizeof(MeshCluster), size) == false)
+		return miss();
+
+	releaseCache();
+	vertices.clear();
+	uvs.clear();
+	normals.clear();
+	m_packedUvs.clear();
+	m_packedNormals.clear();
+	indices.clear();
+	m_nodes.clear();
+	m_triangles.clear();
+	m_clusters.clear();
+
+	const uint8_t* data = file.data();
+	m_vertexData = reinterpret_cast<const glm::vec3*>(data + header.vertexOffset);
+	if (m_isCompact)
+	{
+		m_uvData = nullptr;
+		m_normalData = nullptr;
+		m_packedUvData = reinterpret_cast<const uint32_t*>(data + header.uvOffset);
+		m_packedNormalData = reinterpret_cast<const uint32_t*>(data + header.normalOffset);
+	}
+	else
+	{
+		m_uvData = reinterpret_cast<const glm::vec2*>(data + header.uvOffset);
+		m_normalData = reinterpret_cast<const glm::vec3*>(data + header.normalOffset);
+		m_packedUvData = nullptr;
+		m_packedNormalData = nullptr;
+	}
+	m_indexData = reinterpret_cast<const uint32_t*>(data + header.indexOffset);
+	m_nodeData = reinterpret_cast<const MeshBvhNode*>(data + header.nodeOffset);
+	m_triangleData = reinterpret_cast<const MeshTriangle*>(data + header.triangleOffset);
+	m_clusterData = reinterpret_cast<const MeshCluster*>(data + header.clusterOffset);
+	m_vertexCount = int(header.vertexCount);
+	m_indexCount = int(header.indexCount);
+	m_nodeCount = int(header.nodeCount);
+	m_clusterCount = int(header.clusterCount);
+	m_aabb = Aabb(vec3(header.aabbMin[0], header.aabbMin[1], header.aabbMin[2]),
+		vec3(header.aabbMax[0], header.aabbMax[1], header.aabbMax[2]));
+	m_cacheFile = std::move(file);
+	sourceHash = header.sourceHash;
+	return true;
+}
+
+bool Mesh::saveCache(const string& cachePath, const string& sourcePath, uint64_t sourceHash) const
+{
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+	header.version = CacheVersion;
+	header.headerSize = sizeof(CacheHeader);
+	header.nodeSize = sizeof(MeshBvhNode);
+	header.triangleSize = sizeof(MeshTriangle);
+	header.sourceHash = sourceHash;
+	if (sourceInfo(sourcePath, header.sourceSize, header.sourceTime) == false)
+		return false;
+	for (int a = 0; a < 3; ++a)
+	{
+		header.aabbMin[a] = m_aabb.min()[a];
+		header.aabbMax[a] = m_aabb.max()[a];
+	}
+	header.vertexCount = uint32_t(m_vertexCount);
+	header.indexCount = uint32_t(m_indexCount);
+	header.nodeCount = uint32_t(m_nodeCount);
+	header.clusterCount = uint32_t(m_clusterCount);
+	header.flags = m_isCompact ? CacheCompact : 0;
+
+	struct Section { const void* data; uint64_t size; uint64_t* offset; };
+	const Section sections[] =
+	{
+		{ m_vertexData,   m_vertexCount * sizeof(glm::vec3),             &header.vertexOffset },
+		m_isCompact
+			? Section{ m_packedUvData, m_vertexCount * sizeof(uint32_t),  &header.uvOffset }
+			: Section{ m_uvData,       m_vertexCount * sizeof(glm::vec2), &header.uvOffset },
+		m_isCompact
+			? Section{ m_packedNormalData, m_vertexCount * sizeof(uint32_t),  &header.normalOffset }
+			: Section{ m_normalData,       m_vertexCount * sizeof(glm::vec3), &header.normalOffset },
+		{ m_indexData,    m_indexCount * sizeof(uint32_t),               &header.indexOffset },
+		{ m_nodeData,     m_nodeCount * sizeof(MeshBvhNode),             &header.nodeOffset },
+		{ m_triangleData, (m_indexCount / 3) * sizeof(MeshTriangle),     &header.triangleOffset },
+		{ m_clusterData,  m_clusterCount * sizeof(MeshCluster),          &header.clusterOffset },
+	};
+	uint64_t offset = alignUp(sizeof(CacheHeader));
+	for (const Section& section : sections)
+	{
+		*section.offset = offset;
+		offset = alignUp(offset + section.size);
+	}
+
+	// Two loads of a model can save at once, and another process can be reading the cache.
+	return writeFileAtomically(cachePath, [&](std::ostream& out)
+	{
+		const char zeros[CacheAlignment] = {};
+		uint64_t written = sizeof(CacheHeader);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		for (const Section& section : sections)
+		{
+			out.write(zeros, std::streamsize(*section.offset - written));
+			if (section.size > 0)
+				out.write(static_cast<const char*>(section.data), std::streamsize(section.size));
+			written = *section.offset + section.size;
+		}
+	});
+}
+
+}//end namespace Rae
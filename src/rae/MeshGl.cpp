@@ -0,0 +1,108 @@
+#include "GL/glew.h"
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace Rae
+{
+
+void Mesh::createVBOs()
+{
+	glGenBuffers(1, &vertexBufferID);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+	glBufferData(GL_ARRAY_BUFFER, m_vertexCount * sizeof(glm::vec3), m_vertexData, GL_STATIC_DRAW);
+
+	// The shaders take float attributes, so the compact ones are unpacked for the upload.
+	std::vector<glm::vec2> unpackedUvs;
+	std::vector<glm::vec3> unpackedNormals;
+	const glm::vec2* uvData = m_uvData;
+	const glm::vec3* normalData = m_normalData;
+	if (m_isCompact)
+	{
+		unpackedUvs.resize(m_vertexCount);
+		unpackedNormals.resize(m_vertexCount);
+		for (int i = 0; i < m_vertexCount; ++i)
+		{
+			unpackedUvs[i] = vertexUv(uint32_t(i));
+			unpackedNormals[i] = vertexNormal(uint32_t(i));
+		}
+		uvData = unpackedUvs.data();
+		normalData = unpackedNormals.data();
+	}
+
+	glGenBuffers(1, &uvBufferID);
+	glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
+	glBufferData(GL_ARRAY_BUFFER, m_vertexCount * sizeof(glm::vec2), uvData, GL_STATIC_DRAW);
+
+	glGenBuffers(1, &normalBufferID);
+	glBindBuffer(GL_ARRAY_BUFFER, normalBufferID);
+	glBufferData(GL_ARRAY_BUFFER, m_vertexCount * sizeof(glm::vec3), normalData, GL_STATIC_DRAW);
+
+	glGenBuffers(1, &indexBufferID);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indexCount * sizeof(uint32_t), m_indexData, GL_STATIC_DRAW);
+}
+
+void Mesh::render(unsigned set_shader_program_id)
+{
+	// No VBOs yet, like while the model loads.
+	if (indexBufferID == 0)
+		return;
+
+	// Get a handle for our buffers
+	GLuint vertex_position_id = glGetAttribLocation(set_shader_program_id, "inPosition");
+	GLuint vertex_uv_id = glGetAttribLocation(set_shader_program_id, "inUV");
+	GLuint vertex_normal_id = glGetAttribLocation(set_shader_program_id, "inNormal");
+
+		// vertices
+		glEnableVertexAttribArray(vertex_position_id);
+		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+		glVertexAttribPointer(
+			vertex_position_id,  // The attribute we want to configure
+			3,                            // size
+			GL_FLOAT,                     // type
+			GL_FALSE,                     // normalized?
+			0,                            // stride
+			(void*)0                      // array buffer offset
+		);
+
+		// UVs
+		glEnableVertexAttribArray(vertex_uv_id);
+		glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
+		glVertexAttribPointer(
+			vertex_uv_id,                   // The attribute we want to configure
+			2,                            // size : U+V => 2
+			GL_FLOAT,                     // type
+			GL_FALSE,                     // normalized?
+			0,                            // stride
+			(void*)0                      // array buffer offset
+		);
+
+		// normals
+		glEnableVertexAttribArray(vertex_normal_id);
+		glBindBuffer(GL_ARRAY_BUFFER, normalBufferID);
+		glVertexAttribPointer(
+			vertex_normal_id,    // The attribute we want to configure
+			3,                            // size
+			GL_FLOAT,                     // type
+			GL_FALSE,                     // normalized?
+			0,                            // stride
+			(void*)0                      // array buffer offset
+		);
+
+		// Index buffer
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+
+		glDrawElements(
+			GL_TRIANGLES,
+			(GLsizei)m_indexCount,
+			GL_UNSIGNED_INT,
+			(void*)0
+		);
+
+		glDisableVertexAttribArray(vertex_position_id);
+		glDisableVertexAttribArray(vertex_uv_id);
+		glDisableVertexAttribArray(vertex_normal_id);
+}
+
+}//end namespace Rae
@@ -0,0 +1,503 @@
+#include "Mesh.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <cstring>
+
+#include "core/MappedFile.hpp"
+#include "core/ThreadPool.hpp"
+#include "core/Utils.hpp"
+
+namespace Rae
+{
+
+// The OBJ file is mapped and cut into chunks at line ends, and each chunk is parsed by a thread of
+// its own into arrays of its own. Only v, vt, vn and f matter, the rest, like groups, smoothing and
+// materials, are skipped. Polygons are split into fans.
+namespace
+{
+	const uint32_t NoIndex = 0xffffffffu;
+	const uint32_t BadIndex = 0xfffffffeu;
+	// Small chunks balance better, but each one has a few vectors to grow.
+	const size_t MinChunkSize = 1 << 20;
+	const int ChunksPerThread = 4;
+
+	struct ObjCorner
+	{
+		uint32_t index[3]; // position, uv, normal
+		// A negative OBJ index counts back from the end of the earlier lines, and that is only known
+		// after all the chunks before are read. Until then it's from the start of the chunk.
+		int64_t relative[3];
+		bool isRelative[3];
+	};
+
+	struct ObjChunk
+	{
+		const char* begin = nullptr;
+		const char* end = nullptr;
+		std::vector<vec3> positions;
+		std::vector<glm::vec2> uvs;
+		std::vector<vec3> normals;
+		// The position, uv and normal of each triangle corner, from the start of the file.
+		std::vector<uint32_t> corners;
+		struct Relative
+		{
+			size_t slot;
+			int64_t index;
+		};
+		std::vector<Relative> relatives;
+		uint32_t positionBase = 0;
+		uint32_t uvBase = 0;
+		uint32_t normalBase = 0;
+		size_t cornerBase = 0;
+		const char* errorLine = nullptr;
+		bool hasBadIndex = false;
+	};
+
+	inline bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+	inline const char* skipSpace(const char* p, const char* end)
+	{
+		while (p < end && isSpace(*p))
+			++p;
+		return p;
+	}
+
+	bool readFloats(const char* p, const char* end, float* out, int count)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			p = Utils::readFloat(skipSpace(p, end), end, out[i]);
+			if (p == nullptr || (p < end && isSpace(*p) == false))
+				return false;
+		}
+		return true;
+	}
+
+	bool readIndex(const char*& p, const char* end, size_t localCount, ObjCorner& corner, int attribute)
+	{
+		const bool isNegative = p < end && *p == '-';
+		if (isNegative)
+			++p;
+		const char* digits = p;
+		uint64_t value = 0;
+		for (; p < end && *p >= '0' && *p <= '9'; ++p)
+		{
+			value = value * 10 + uint64_t(*p - '0');
+			if (value > 0x7fffffffu)
+				return false;
+		}
+		if (p == digits || value == 0)
+			return false;
+
+		corner.isRelative[attribute] = isNegative;
+		if (isNegative)
+			corner.relative[attribute] = int64_t(localCount) - int64_t(value);
+		else corner.index[attribute] = uint32_t(value - 1);
+		return true;
+	}
+
+	void addCorner(ObjChunk& chunk, const ObjCorner& corner)
+	{
+		for (int attribute = 0; attribute < 3; ++attribute)
+		{
+			if (corner.isRelative[attribute])
+				chunk.relatives.push_back(ObjChunk::Relative{ chunk.corners.size(), corner.relative[attribute] });
+			chunk.corners.push_back(corner.index[attribute]);
+		}
+	}
+
+	// v, v/vt, v//vn or v/vt/vn for each corner.
+	bool readFace(const char* p, const char* end, ObjChunk& chunk)
+	{
+		ObjCorner first;
+		ObjCorner previous;
+		int cornerCount = 0;
+		while ((p = skipSpace(p, end)) < end)
+		{
+			ObjCorner current = { { NoIndex, NoIndex, NoIndex }, { 0, 0, 0 }, { false, false, false } };
+			if (readIndex(p, end, chunk.positions.size(), current, 0) == false)
+				return false;
+			if (p < end && *p == '/')
+			{
+				++p;
+				if (p < end && *p != '/' && readIndex(p, end, chunk.uvs.size(), current, 1) == false)
+					return false;
+				if (p < end && *p == '/')
+				{
+					++p;
+					if (readIndex(p, end, chunk.normals.size(), current, 2) == false)
+						return false;
+				}
+			}
+			if (p < end && isSpace(*p) == false)
+				return false;
+
+			if (cornerCount == 0)
+				first = current;
+			else if (cornerCount >= 2)
+			{
+				addCorner(chunk, first);
+				addCorner(chunk, previous);
+				addCorner(chunk, current);
+			}
+			previous = current;
+			++cornerCount;
+		}
+		return cornerCount >= 3;
+	}
+
+	void parseChunk(ObjChunk& chunk)
+	{
+		const char* lineBegin = chunk.begin;
+		while (lineBegin < chunk.end)
+		{
+			const char* lineEnd = static_cast<const char*>(memchr(lineBegin, '\n', size_t(chunk.end - lineBegin)));
+			if (lineEnd == nullptr)
+				lineEnd = chunk.end;
+			const char* p = skipSpace(lineBegin, lineEnd);
+			const ptrdiff_t length = lineEnd - p;
+
+			bool isOk = true;
+			float values[3];
+			if (length >= 2 && p[0] == 'v' && isSpace(p[1]))
+			{
+				isOk = readFloats(p + 1, lineEnd, values, 3);
+				chunk.positions.push_back(vec3(values[0], values[1], values[2]));
+			}
+			else if (length >= 3 && p[0] == 'v' && p[1] == 't' && isSpace(p[2]))
+			{
+				isOk = readFloats(p + 2, lineEnd, values, 2);
+				chunk.uvs.push_back(glm::vec2(values[0], values[1]));
+			}
+			else if (length >= 3 && p[0] == 'v' && p[1] == 'n' && isSpace(p[2]))
+			{
+				isOk = readFloats(p + 2, lineEnd, values, 3);
+				chunk.normals.push_back(vec3(values[0], values[1], values[2]));
+			}
+			else if (length >= 2 && p[0] == 'f' && isSpace(p[1]))
+				isOk = readFace(p + 1, lineEnd, chunk);
+
+			if (isOk == false)
+			{
+				chunk.errorLine = lineBegin;
+				return;
+			}
+			lineBegin = lineEnd + 1;
+		}
+	}
+
+	// After the counts of the earlier chunks are known.
+	void resolveChunk(ObjChunk& chunk, uint32_t positionCount, uint32_t uvCount, uint32_t normalCount)
+	{
+		const uint32_t bases[3] = { chunk.positionBase, chunk.uvBase, chunk.normalBase };
+		for (const ObjChunk::Relative& relative : chunk.relatives)
+		{
+			const int64_t index = int64_t(bases[relative.slot % 3]) + relative.index;
+			chunk.corners[relative.slot] = index >= 0 && index < int64_t(BadIndex) ? uint32_t(index) : BadIndex;
+		}
+
+		for (size_t i = 0; i < chunk.corners.size(); i += 3)
+		{
+			const uint32_t position = chunk.corners[i];
+			const uint32_t uv = chunk.corners[i + 1];
+			const uint32_t normal = chunk.corners[i + 2];
+			if (position >= positionCount || (uv != NoIndex && uv >= uvCount) || (normal != NoIndex && normal >= normalCount))
+				chunk.hasBadIndex = true;
+		}
+	}
+
+	inline uint32_t mixHash(uint32_t hash)
+	{
+		hash ^= hash >> 16;
+		hash *= 0x85ebca6bu;
+		hash ^= hash >> 13;
+		hash *= 0xc2b2ae35u;
+		hash ^= hash >> 16;
+		return hash;
+	}
+
+	template <typename T>
+	uint32_t valueHash(const T& value)
+	{
+		uint32_t words[sizeof(T) / 4];
+		memcpy(words, &value, sizeof(words));
+		uint32_t hash = 0;
+		for (uint32_t word : words)
+			hash = mixHash(hash ^ word);
+		return hash;
+	}
+
+	// For each element, the first one that is equal to it. The elements are hashed once and sorted
+	// into parts by their hashes, keeping their order, and each thread looks up the elements of one
+	// part in a table of its own. So the result doesn't depend on the thread count.
+	template <typename HashAt, typename EqualAt>
+	void findFirstEqual(size_t count, const HashAt& hashAt, const EqualAt& equalAt,
+		std::vector<uint32_t>& first, ThreadPool* threadPool)
+	{
+		first.resize(count);
+		const int partCount = threadPool != nullptr ? threadPool->threadCount() : 1;
+		auto forEachPart = [&](const std::function<void(int part)>& func)
+		{
+			if (threadPool != nullptr)
+				threadPool->parallelFor(partCount, [&func](int part, int) { func(part); });
+			else func(0);
+		};
+		auto partOf = [partCount](uint32_t hash) { return int((hash >> 24) % uint32_t(partCount)); };
+		// Each thread also hashes and sorts a range of the elements.
+		auto rangeBegin = [count, partCount](int range) { return count * size_t(range) / size_t(partCount); };
+
+		std::vector<uint32_t> hashes(count);
+		std::vector<size_t> offsets(size_t(partCount) * partCount, 0); // of each range in each part
+		forEachPart([&](int range)
+		{
+			size_t* rangeCounts = &offsets[size_t(range) * partCount];
+			for (size_t i = rangeBegin(range); i < rangeBegin(range + 1); ++i)
+			{
+				hashes[i] = hashAt(i);
+				++rangeCounts[partOf(hashes[i])];
+			}
+		});
+
+		std::vector<size_t> partBegins(partCount + 1, 0);
+		size_t offset = 0;
+		for (int part = 0; part < partCount; ++part)
+		{
+			partBegins[part] = offset;
+			for (int range = 0; range < partCount; ++range)
+			{
+				const size_t rangeCount = offsets[size_t(range) * partCount + part];
+				offsets[size_t(range) * partCount + part] = offset;
+				offset += rangeCount;
+			}
+		}
+		partBegins[partCount] = offset;
+
+		std::vector<uint32_t> sorted(count);
+		forEachPart([&](int range)
+		{
+			size_t* rangeOffsets = &offsets[size_t(range) * partCount];
+			for (size_t i = rangeBegin(range); i < rangeBegin(range + 1); ++i)
+				sorted[rangeOffsets[partOf(hashes[i])]++] = uint32_t(i);
+		});
+
+		forEachPart([&](int part)
+		{
+			// At most half full, so no probe goes far.
+			size_t tableSize = 16;
+			while (tableSize < 2 * (partBegins[part + 1] - partBegins[part]))
+				tableSize *= 2;
+			std::vector<uint32_t> table(tableSize, NoIndex);
+			for (size_t k = partBegins[part]; k < partBegins[part + 1]; ++k)
+			{
+				const uint32_t i = sorted[k];
+				size_t slot = hashes[i] & (tableSize - 1);
+				uint32_t element;
+				while ((element = table[slot]) != NoIndex && (hashes[element] != hashes[i] || equalAt(element, i) == false))
+					slot = (slot + 1) & (tableSize - 1);
+				if (element != NoIndex)
+				{
+					first[i] = element;
+					continue;
+				}
+				first[i] = i;
+				table[slot] = i;
+			}
+		});
+	}
+
+	template <typename T>
+	void findFirstEqualValue(const std::vector<T>& values, std::vector<uint32_t>& first, ThreadPool* threadPool)
+	{
+		findFirstEqual(values.size(),
+			[&values](size_t i) { return valueHash(values[i]); },
+			[&values](size_t a, size_t b) { return memcmp(&values[a], &values[b], sizeof(T)) == 0; },
+			first, threadPool);
+	}
+
+	size_t lineLength(const char* line, const char* end)
+	{
+		const char* newline = static_cast<const char*>(memchr(line, '\n', size_t(end - line)));
+		return size_t((newline != nullptr ? newline : end) - line);
+	}
+}
+
+bool Mesh::loadObj(const string& filepath, ThreadPool* threadPool)
+{
+	auto startTime = std::chrono::steady_clock::now();
+
+	MappedFile file;
+	if (file.open(filepath) == false)
+	{
+		cout << "Couldn't open file: " << filepath << "\n";
+		return false;
+	}
+
+	const char* const data = reinterpret_cast<const char*>(file.data());
+	const char* const dataEnd = data + file.size();
+	const int threadCount = threadPool != nullptr ? threadPool->threadCount() : 1;
+	const size_t chunkSize = std::max(MinChunkSize, file.size() / size_t(threadCount * ChunksPerThread) + 1);
+	std::vector<ObjChunk> chunks;
+	for (const char* begin = data; begin < dataEnd;)
+	{
+		const char* end = begin + std::min(chunkSize, size_t(dataEnd - begin));
+		// On to the end of the line, so that the lines stay whole.
+		if (end < dataEnd)
+		{
+			const char* newline = static_cast<const char*>(memchr(end, '\n', size_t(dataEnd - end)));
+			end = newline != nullptr ? newline + 1 : dataEnd;
+		}
+		chunks.emplace_back();
+		chunks.back().begin = begin;
+		chunks.back().end = end;
+		begin = end;
+	}
+
+	auto forEachChunk = [&](const std::function<void(ObjChunk&)>& func)
+	{
+		if (threadPool != nullptr)
+			threadPool->parallelFor(int(chunks.size()), [&](int index, int) { func(chunks[index]); });
+		else
+		{
+			for (ObjChunk& chunk : chunks)
+				func(chunk);
+		}
+	};
+	forEachChunk(parseChunk);
+
+	size_t positionCount = 0;
+	size_t uvCount = 0;
+	size_t normalCount = 0;
+	size_t cornerCount = 0;
+	for (ObjChunk& chunk : chunks)
+	{
+		if (chunk.errorLine != nullptr)
+		{
+			cout << "Couldn't read " << filepath << " at: " << string(chunk.errorLine, lineLength(chunk.errorLine, dataEnd)) << "\n";
+			return false;
+		}
+		chunk.positionBase = uint32_t(positionCount);
+		chunk.uvBase = uint32_t(uvCount);
+		chunk.normalBase = uint32_t(normalCount);
+		chunk.cornerBase = cornerCount;
+		positionCount += chunk.positions.size();
+		uvCount += chunk.uvs.size();
+		normalCount += chunk.normals.size();
+		cornerCount += chunk.corners.size() / 3;
+	}
+	if (positionCount >= BadIndex || cornerCount >= BadIndex)
+	{
+		cout << "Too many vertices in " << filepath << "\n";
+		return false;
+	}
+
+	forEachChunk([&](ObjChunk& chunk) { resolveChunk(chunk, uint32_t(positionCount), uint32_t(uvCount), uint32_t(normalCount)); });
+	for (const ObjChunk& chunk : chunks)
+	{
+		if (chunk.hasBadIndex)
+		{
+			cout << "An index out of range in " << filepath << "\n";
+			return false;
+		}
+	}
+
+	// The arrays of the chunks one after the other.
+	std::vector<vec3> filePositions(positionCount);
+	std::vector<glm::vec2> fileUvs(uvCount);
+	std::vector<vec3> fileNormals(normalCount);
+	std::vector<uint32_t> corners(cornerCount * 3);
+	forEachChunk([&](ObjChunk& chunk)
+	{
+		std::copy(chunk.positions.begin(), chunk.positions.end(), filePositions.begin() + chunk.positionBase);
+		std::copy(chunk.uvs.begin(), chunk.uvs.end(), fileUvs.begin() + chunk.uvBase);
+		std::copy(chunk.normals.begin(), chunk.normals.end(), fileNormals.begin() + chunk.normalBase);
+		std::copy(chunk.corners.begin(), chunk.corners.end(), corners.begin() + chunk.cornerBase * 3);
+		std::vector<vec3>().swap(chunk.positions);
+		std::vector<glm::vec2>().swap(chunk.uvs);
+		std::vector<vec3>().swap(chunk.normals);
+		std::vector<uint32_t>().swap(chunk.corners);
+		std::vector<ObjChunk::Relative>().swap(chunk.relatives);
+	});
+
+	// Welding: the same values can come with different indices, so each index is first replaced by
+	// the first index of its value, and then every corner by the first corner with the same indices.
+	std::vector<uint32_t> firstPosition;
+	std::vector<uint32_t> firstUv;
+	std::vector<uint32_t> firstNormal;
+	findFirstEqualValue(filePositions, firstPosition, threadPool);
+	findFirstEqualValue(fileUvs, firstUv, threadPool);
+	findFirstEqualValue(fileNormals, firstNormal, threadPool);
+	forEachChunk([&](ObjChunk& chunk)
+	{
+		const size_t end = (&chunk == &chunks.back() ? cornerCount : (&chunk)[1].cornerBase) * 3;
+		for (size_t i = chunk.cornerBase * 3; i < end; i += 3)
+		{
+			corners[i] = firstPosition[corners[i]];
+			if (corners[i + 1] != NoIndex)
+				corners[i + 1] = firstUv[corners[i + 1]];
+			if (corners[i + 2] != NoIndex)
+				corners[i + 2] = firstNormal[corners[i + 2]];
+		}
+	});
+
+	std::vector<uint32_t> firstCorner;
+	findFirstEqual(cornerCount,
+		[&corners](size_t i) { return mixHash(corners[i * 3] ^ mixHash(corners[i * 3 + 1] ^ mixHash(corners[i * 3 + 2]))); },
+		[&corners](size_t a, size_t b) { return memcmp(&corners[a * 3], &corners[b * 3], 3 * sizeof(uint32_t)) == 0; },
+		firstCorner, threadPool);
+
+	// The vertices in the order the corners first use them.
+	std::vector<uint32_t> newIndices(cornerCount);
+	size_t vertexCount = 0;
+	for (size_t i = 0; i < cornerCount; ++i)
+		newIndices[i] = firstCorner[i] == i ? uint32_t(vertexCount++) : newIndices[firstCorner[i]];
+
+	vertices.resize(vertexCount);
+	uvs.resize(vertexCount);
+	normals.assign(vertexCount, vec3(0.0f));
+	m_aabb.clear();
+	bool hasAllUvs = true;
+	bool hasAllNormals = true;
+	for (size_t i = 0; i < cornerCount; ++i)
+	{
+		if (firstCorner[i] != i)
+			continue;
+		const uint32_t vertex = newIndices[i];
+		vertices[vertex] = filePositions[corners[i * 3]];
+		m_aabb.grow(vertices[vertex]);
+		if (corners[i * 3 + 1] != NoIndex)
+			uvs[vertex] = fileUvs[corners[i * 3 + 1]];
+		else hasAllUvs = false;
+		if (corners[i * 3 + 2] != NoIndex)
+			normals[vertex] = fileNormals[corners[i * 3 + 2]];
+		else hasAllNormals = false;
+	}
+	indices.swap(newIndices);
+
+	if (hasAllUvs == false)
+	{
+		// Planar from above, like the Assimp import.
+		const vec3 dimensions = m_aabb.dimensions();
+		for (size_t i = 0; i < cornerCount; ++i)
+		{
+			if (firstCorner[i] != i || corners[i * 3 + 1] != NoIndex)
+				continue;
+			const vec3& position = vertices[indices[i]];
+			uvs[indices[i]] = glm::vec2(dimensions.x > 0.0f ? (position.x - m_aabb.min().x) / dimensions.x : 0.0f,
+				dimensions.y > 0.0f ? (position.y - m_aabb.min().y) / dimensions.y : 0.0f);
+		}
+	}
+	// A file with some of the normals gets computed ones for all.
+	if (hasAllNormals == false)
+		computeNormals(0, 0);
+
+	std::chrono::duration<double> readTime = std::chrono::steady_clock::now() - startTime;
+	cout << "Read " << filepath << ": " << file.size() / (1024.0 * 1024.0) << " MB in " << readTime.count() * 1000.0
+		<< " ms, " << file.size() / (1024.0 * 1024.0) / readTime.count() << " MB/s, " << chunks.size() << " chunks, "
+		<< vertices.size() << " vertices, " << indices.size() / 3 << " triangles\n";
+	return true;
+}
+
+}//end namespace Rae
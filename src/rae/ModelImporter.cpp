@@ -0,0 +1,179 @@
+#include "ModelImporter.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <new>
+#include <iostream>
+#include <chrono>
+
+#include "HitableList.hpp"
+#include "Material.hpp"
+#include "Mesh.hpp"
+#include "core/ThreadPool.hpp"
+#include "core/MappedFile.hpp"
+
+using namespace Rae;
+
+namespace
+{
+	struct Placement
+	{
+		unsigned mesh;
+		glm::mat4 transform;
+	};
+
+	void collectPlacements(const aiNode* node, const glm::mat4& parentTransform, std::vector<Placement>& placements)
+	{
+		const glm::mat4 transform = parentTransform * toMat4(node->mTransformation);
+		for (unsigned i = 0; i < node->mNumMeshes; ++i)
+			placements.push_back(Placement{ node->mMeshes[i], transform });
+		for (unsigned i = 0; i < node->mNumChildren; ++i)
+			collectPlacements(node->mChildren[i], transform, placements);
+	}
+
+	// The nearest of ours: emissive is a light, see-through is glass, and a shiny specular is a
+	// metal with a roughness from the Phong exponent. The rest are diffuse.
+	Material* toMaterial(const aiMaterial* source)
+	{
+		aiColor3D diffuse(0.7f, 0.7f, 0.7f);
+		aiColor3D specular(0.0f, 0.0f, 0.0f);
+		aiColor3D emissive(0.0f, 0.0f, 0.0f);
+		float opacity = 1.0f;
+		float shininess = 0.0f;
+		float refractiveIndex = 1.5f;
+		source->Get(AI_MATKEY_COLOR_DIFFUSE, diffuse);
+		source->Get(AI_MATKEY_COLOR_SPECULAR, specular);
+		source->Get(AI_MATKEY_COLOR_EMISSIVE, emissive);
+		source->Get(AI_MATKEY_OPACITY, opacity);
+		source->Get(AI_MATKEY_SHININESS, shininess);
+		source->Get(AI_MATKEY_REFRACTI, refractiveIndex);
+
+		const vec3 color(diffuse.r, diffuse.g, diffuse.b);
+		if (emissive.r + emissive.g + emissive.b > 0.0f)
+			return new Light(vec3(emissive.r, emissive.g, emissive.b));
+		if (opacity < 1.0f)
+			return new Dielectric(color, refractiveIndex > 1.0f ? refractiveIndex : 1.5f);
+		if (std::max(specular.r, std::max(specular.g, specular.b)) > 0.5f && shininess > 0.0f)
+			return new Metal(vec3(specular.r, specular.g, specular.b), std::sqrt(2.0f / (shininess + 2.0f)));
+		return new Lambertian(color);
+	}
+}
+
+bool ModelImporter::import(const std::string& path, HitableList& world)
+{
+	auto startTime = std::chrono::steady_clock::now();
+
+	MappedFile file;
+	m_sourceHash = file.open(path) ? file.contentHash() : 0;
+	file.close();
+
+	Assimp::Importer importer;
+	const aiScene* scene = importer.ReadFile(path, 0);
+	if (scene == nullptr || scene->mRootNode == nullptr)
+	{
+		m_error = "couldn't import " + path + ": " + importer.GetErrorString();
+		return false;
+	}
+
+	std::vector<Placement> placements;
+	collectPlacements(scene->mRootNode, glm::mat4(1.0f), placements);
+	std::vector<int> useCount(scene->mNumMeshes, 0);
+	std::vector<glm::mat4> bakedTransform(scene->mNumMeshes, glm::mat4(1.0f));
+	for (const Placement& placement : placements)
+	{
+		++useCount[placement.mesh];
+		bakedTransform[placement.mesh] = placement.transform;
+	}
+
+	// Each task welds one mesh and builds its BVH, the biggest first so that they end together.
+	std::vector<unsigned> buildOrder;
+	for (unsigned i = 0; i < scene->mNumMeshes; ++i)
+	{
+		if (useCount[i] > 0)
+			buildOrder.push_back(i);
+	}
+	std::sort(buildOrder.begin(), buildOrder.end(), [scene](unsigned a, unsigned b)
+	{
+		return scene->mMeshes[a]->mNumFaces > scene->mMeshes[b]->mNumFaces;
+	});
+
+	std::vector<Mesh*> meshes(scene->mNumMeshes, nullptr);
+	auto buildMesh = [&](int index, int)
+	{
+		const unsigned i = buildOrder[index];
+		Mesh* mesh = new Mesh(0);
+		mesh->setCompactAttributes(m_isCompact);
+		try
+		{
+			// Only the meshes with instances keep their own space.
+			mesh->appendMesh(scene->mMeshes[i], useCount[i] == 1 ? bakedTransform[i] : glm::mat4(1.0f));
+			mesh->computeAabb();
+			mesh->buildBvh();
+		}
+		catch (const std::bad_alloc&)
+		{
+			delete mesh;
+			mesh = nullptr;
+		}
+		meshes[i] = mesh;
+	};
+	if (m_threadPool != nullptr)
+		m_threadPool->parallelFor(int(buildOrder.size()), buildMesh);
+	else
+	{
+		for (int index = 0; index < int(buildOrder.size()); ++index)
+			buildMesh(index, 0);
+	}
+
+	std::vector<Material*> materials(scene->mNumMaterials);
+	for (unsigned i = 0; i < scene->mNumMaterials; ++i)
+		materials[i] = world.addMaterial(toMaterial(scene->mMaterials[i]));
+	Material* defaultMaterial = nullptr;
+
+	int triangleCount = 0;
+	int skippedCount = 0;
+	for (unsigned i = 0; i < scene->mNumMeshes; ++i)
+	{
+		Mesh* mesh = meshes[i];
+		if (useCount[i] == 0)
+			continue;
+		// Out of memory, or only points and lines.
+		if (mesh == nullptr || mesh->triangleCount() == 0)
+		{
+			delete mesh;
+			meshes[i] = nullptr;
+			++skippedCount;
+			continue;
+		}
+
+		const unsigned materialIndex = scene->mMeshes[i]->mMaterialIndex;
+		if (materialIndex < materials.size())
+			mesh->setMaterial(materials[materialIndex]);
+		else
+		{
+			if (defaultMaterial == nullptr)
+				defaultMaterial = world.addMaterial(new Lambertian(vec3(0.7f, 0.7f, 0.7f)));
+			mesh->setMaterial(defaultMaterial);
+		}
+
+		if (useCount[i] == 1)
+			world.add(mesh);
+		else world.addObject(mesh);
+		triangleCount += mesh->triangleCount() * useCount[i];
+	}
+
+	for (const Placement& placement : placements)
+	{
+		if (useCount[placement.mesh] > 1 && meshes[placement.mesh] != nullptr)
+			world.addInstance(meshes[placement.mesh], placement.transform);
+	}
+
+	std::chrono::duration<double> importTime = std::chrono::steady_clock::now() - startTime;
+	std::cout << "Imported " << path << ": " << scene->mNumMeshes << " meshes, " << placements.size()
+		<< " placements, " << triangleCount << " triangles, " << scene->mNumMaterials << " materials in "
+		<< importTime.count() * 1000.0 << " ms\n";
+	if (skippedCount > 0)
+		std::cout << "Left out " << skippedCount << " meshes without triangles or out of memory\n";
+	return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <stdint.h>
+
+namespace Rae
+{
+
+class HitableList;
+class ThreadPool;
+
+// Imports all of a model file with Assimp. Every mesh of the file gets a BVH of its own, and the
+// meshes are welded and built in parallel. The node graph is flattened: a mesh that one node uses
+// is moved into place when it's built, and one that many nodes use is an object with an instance
+// for each. The materials of the file are mapped to ours and go to the scene's material table.
+class ModelImporter
+{
+public:
+	// Without a pool the meshes are built one after another. Not while the pool is rendering.
+	void setThreadPool(ThreadPool* threadPool) { m_threadPool = threadPool; }
+	void setCompactAttributes(bool set) { m_isCompact = set; }
+
+	// On failure nothing is added to the world.
+	bool import(const std::string& path, HitableList& world);
+	const std::string& error() const { return m_error; }
+	// The contents of the last file imported
+	uint64_t sourceHash() const { return m_sourceHash; }
+
+protected:
+	ThreadPool* m_threadPool = nullptr;
+	uint64_t m_sourceHash = 0;
+	bool m_isCompact = false;
+	std::string m_error;
+};
+
+}
@@ -0,0 +1,165 @@
+#include "PathGuide.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "core/Utils.hpp"
+#include "Sampler.hpp"
+
+using namespace Rae;
+
+PathGuide::PathGuide()
+: m_keys(new std::atomic<uint64_t>[CellCount]),
+m_histograms(new std::atomic<float>[CellCount * BinCount]),
+m_sampleCounts(new std::atomic<int>[CellCount])
+{
+	m_distributionKeys.resize(CellCount);
+	m_cdf.resize(CellCount * BinCount);
+	clear();
+}
+
+void PathGuide::clear()
+{
+	// Not while rendering, see RadianceCache::clear.
+	for (int i = 0; i < CellCount; ++i)
+	{
+		m_keys[i].store(0, std::memory_order_relaxed);
+		m_sampleCounts[i].store(0, std::memory_order_relaxed);
+	}
+	for (int i = 0; i < CellCount * BinCount; ++i)
+		m_histograms[i].store(0.0f, std::memory_order_relaxed);
+
+	std::fill(m_distributionKeys.begin(), m_distributionKeys.end(), 0);
+	m_learnedCellCount = 0;
+}
+
+uint64_t PathGuide::cellKey(const vec3& point) const
+{
+	// 21 bits per axis, and the top bit set so that no key is zero.
+	const uint64_t mask = (1 << 21) - 1;
+	const uint64_t x = uint64_t(int64_t(floor(point.x / m_cellSize)) + (1 << 20)) & mask;
+	const uint64_t y = uint64_t(int64_t(floor(point.y / m_cellSize)) + (1 << 20)) & mask;
+	const uint64_t z = uint64_t(int64_t(floor(point.z / m_cellSize)) + (1 << 20)) & mask;
+	return (uint64_t(1) << 63) | (x << 42) | (y << 21) | z;
+}
+
+int PathGuide::findTrainingCell(uint64_t key)
+{
+	const int start = int(mixBits(key) & (CellCount - 1));
+	for (int probe = 0; probe < MaxProbes; ++probe)
+	{
+		const int slot = (start + probe) & (CellCount - 1);
+		uint64_t slotKey = m_keys[slot].load(std::memory_order_relaxed);
+		if (slotKey == key)
+			return slot;
+		if (slotKey == 0)
+		{
+			// Claim the empty slot, unless another thread got there first.
+			if (m_keys[slot].compare_exchange_strong(slotKey, key) || slotKey == key)
+				return slot;
+		}
+	}
+	return -1; // The neighbourhood is full. That part of space just isn't learned.
+}
+
+int PathGuide::findDistribution(const vec3& point) const
+{
+	if (m_learnedCellCount == 0)
+		return -1;
+
+	const uint64_t key = cellKey(point);
+	const int start = int(mixBits(key) & (CellCount - 1));
+	for (int probe = 0; probe < MaxProbes; ++probe)
+	{
+		const int slot = (start + probe) & (CellCount - 1);
+		if (m_distributionKeys[slot] == key)
+			return slot;
+	}
+	return -1;
+}
+
+int PathGuide::directionToBin(const vec3& direction)
+{
+	const float z = glm::clamp(direction.z, -1.0f, 1.0f);
+	const int thetaIndex = std::min(int((z + 1.0f) * 0.5f * float(ThetaBins)), ThetaBins - 1);
+	float phi = atan2(direction.y, direction.x);
+	if (phi < 0.0f)
+		phi += Math::TAU;
+	const int phiIndex = std::min(int(phi / Math::TAU * float(PhiBins)), PhiBins - 1);
+	return (thetaIndex * PhiBins) + phiIndex;
+}
+
+vec3 PathGuide::sample(int distribution, const vec2& u) const
+{
+	const float* cdf = &m_cdf[distribution * BinCount];
+	const int bin = std::min(int(std::upper_bound(cdf, cdf + BinCount, u.x) - cdf), BinCount - 1);
+	const float previous = bin > 0 ? cdf[bin - 1] : 0.0f;
+	const float probability = cdf[bin] - previous;
+	// Reuse the rest of u.x for the position inside the bin.
+	const float remapped = probability > 0.0f ? glm::clamp((u.x - previous) / probability, 0.0f, 0.99999994f) : 0.5f;
+
+	const int thetaIndex = bin / PhiBins;
+	const int phiIndex = bin % PhiBins;
+	const float z = -1.0f + 2.0f * (float(thetaIndex) + remapped) / float(ThetaBins);
+	const float phi = Math::TAU * (float(phiIndex) + u.y) / float(PhiBins);
+	const float r = sqrt(std::max(0.0f, 1.0f - z * z));
+	return vec3(r * cos(phi), r * sin(phi), z);
+}
+
+float PathGuide::pdf(int distribution, const vec3& direction) const
+{
+	const float* cdf = &m_cdf[distribution * BinCount];
+	const int bin = directionToBin(direction);
+	const float probability = cdf[bin] - (bin > 0 ? cdf[bin - 1] : 0.0f);
+	// Every bin covers 4 pi / BinCount steradians.
+	return probability * float(BinCount) / (2.0f * Math::TAU);
+}
+
+void PathGuide::record(const vec3& point, const vec3& direction, float value)
+{
+	if (value < 0.0f || std::isfinite(value) == false)
+		return;
+
+	const int slot = findTrainingCell(cellKey(point));
+	if (slot == -1)
+		return;
+
+	m_sampleCounts[slot].fetch_add(1, std::memory_order_relaxed);
+	if (value == 0.0f)
+		return;
+
+	Utils::atomicAdd(m_histograms[(slot * BinCount) + directionToBin(direction)], value);
+}
+
+void PathGuide::update()
+{
+	m_learnedCellCount = 0;
+
+	for (int slot = 0; slot < CellCount; ++slot)
+	{
+		m_distributionKeys[slot] = 0;
+
+		const uint64_t key = m_keys[slot].load();
+		if (key == 0 || m_sampleCounts[slot].load() < m_minSamples)
+			continue;
+
+		float sum = 0.0f;
+		for (int bin = 0; bin < BinCount; ++bin)
+			sum += m_histograms[(slot * BinCount) + bin].load();
+		if (sum <= 0.0f)
+			continue;
+
+		float* cdf = &m_cdf[slot * BinCount];
+		float cumulative = 0.0f;
+		for (int bin = 0; bin < BinCount; ++bin)
+		{
+			const float learned = m_histograms[(slot * BinCount) + bin].load() / sum;
+			cumulative += (1.0f - m_uniformFraction) * learned + m_uniformFraction / float(BinCount);
+			cdf[bin] = cumulative;
+		}
+		cdf[BinCount - 1] = 1.0f;
+
+		m_distributionKeys[slot] = key;
+		++m_learnedCellCount;
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+using glm::vec2;
+using glm::vec3;
+
+namespace Rae
+{
+
+// Learns where the light comes from, to sample the bounces of diffuse surfaces towards it
+// (after Müller et al. 2017, Practical Path Guiding for Efficient Light-Transport Simulation).
+// Space is split into a hashed grid of cells, and each cell has a histogram over the sphere
+// of directions, in equal area bins.
+// Paths record their incident radiance into the training histograms, which is thread safe.
+// update() turns the training into the sampling distributions between passes, so the
+// distributions stay fixed while the threads render, and guided sampling stays unbiased.
+class PathGuide
+{
+public:
+	PathGuide();
+
+	void clear();
+	// Call between passes, while no thread renders.
+	void update();
+
+	// The distribution of the cell around the point, or -1 if the cell hasn't learned enough.
+	int findDistribution(const vec3& point) const;
+	// Unit direction, world space
+	vec3 sample(int distribution, const vec2& u) const;
+	// Solid angle pdf of sample()
+	float pdf(int distribution, const vec3& direction) const;
+
+	// Radiance arriving at the point from the direction, divided by the pdf it was sampled with.
+	void record(const vec3& point, const vec3& direction, float value);
+
+	// The chance of sampling the guide instead of the BSDF where a distribution exists
+	float guideProbability() const { return m_guideProbability; }
+	int learnedCellCount() const { return m_learnedCellCount; }
+
+	static const int CellCount = 1 << 14;
+	static const int ThetaBins = 8; // in cos(theta), so that the bins have equal areas
+	static const int PhiBins = 16;
+	static const int BinCount = ThetaBins * PhiBins;
+	static const int MaxProbes = 8;
+
+protected:
+	uint64_t cellKey(const vec3& point) const;
+	int findTrainingCell(uint64_t key);
+	static int directionToBin(const vec3& direction);
+
+	float m_cellSize = 0.5f; // in world units
+	int m_minSamples = 64; // recorded paths before a cell guides
+	float m_guideProbability = 0.5f;
+	float m_uniformFraction = 0.1f; // of every distribution, so no direction is left with zero density
+
+	// Training, written by the rendering threads. A zero key is an empty cell.
+	std::unique_ptr<std::atomic<uint64_t>[]> m_keys;
+	std::unique_ptr<std::atomic<float>[]> m_histograms;
+	std::unique_ptr<std::atomic<int>[]> m_sampleCounts;
+
+	// Sampling, rebuilt by update()
+	std::vector<uint64_t> m_distributionKeys; // only the cells that guide, others are zero
+	std::vector<float> m_cdf; // cumulative bin probabilities of each cell
+	int m_learnedCellCount = 0;
+};
+
+} // end namespace Rae
@@ -0,0 +1,39 @@
+#include "Plane.hpp"
+#include "Ray.hpp"
+#include "HitRecord.hpp"
+#include "Aabb.hpp"
+#include "Material.hpp"
+
+#include <cfloat>
+
+using namespace Rae;
+
+Plane::~Plane()
+{
+	// The material belongs to the scene, see HitableList::addMaterial.
+}
+
+bool Plane::hit(const Ray& ray, float t_min, float t_max, HitRecord& record) const
+{
+	float denominator = glm::dot(ray.direction(), normal);
+	if (denominator == 0.0f)
+		return false; // parallel
+
+	float temp = glm::dot(point - ray.origin(), normal) / denominator;
+	if (temp < t_max && temp > t_min)
+	{
+		record.t = temp;
+		record.point = ray.point_at_parameter(record.t);
+		record.normal = normal;
+		record.material = material;
+		record.hitable = this;
+		record.primitiveIndex = 0;
+		return true;
+	}
+	return false;
+}
+
+Aabb Plane::getAabb(float t0, float t1) const
+{
+	return Aabb(vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX), vec3(FLT_MAX, FLT_MAX, FLT_MAX));
+}
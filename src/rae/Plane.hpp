@@ -0,0 +1,39 @@
+#pragma once
+
+#include <glm/glm.hpp>
+using glm::vec3;
+
+#include "Hitable.hpp"
+
+namespace Rae
+{
+
+class Ray;
+struct HitRecord;
+class Material;
+class Aabb;
+
+// An infinite plane through point, e.g. the ground. It bounds a half-space, and like the normal of
+// a sphere, its normal points out of it. Hit from both sides. The bounding box is infinite, so
+// BvhNode keeps planes out of the tree.
+class Plane : public Hitable
+{
+public:
+	Plane(){}
+	Plane(vec3 setPoint, vec3 setNormal, Material* setMaterial)
+		: point(setPoint),
+		normal(glm::normalize(setNormal)),
+		material(setMaterial)
+	{}
+
+	~Plane();
+
+	virtual bool hit(const Ray& ray, float t_min, float t_max, HitRecord& record) const;
+	virtual Aabb getAabb(float t0, float t1) const;
+
+	vec3 point;
+	vec3 normal;
+	Material* material;
+};
+
+}
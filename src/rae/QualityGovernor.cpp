@@ -0,0 +1,68 @@
+#include "QualityGovernor.hpp"
+
+#include <algorithm>
+
+using namespace Rae;
+
+void QualityGovernor::update(double frameCost, bool isCameraMoving, int fullBounces)
+{
+	m_frameCost = frameCost;
+	m_isQualityRestored = m_isCameraMoving && isCameraMoving == false && m_isBouncesReduced;
+	m_isCameraMoving = isCameraMoving;
+
+	if (m_isEnabled == false)
+	{
+		m_bouncesLimit = fullBounces;
+		m_isBouncesReduced = false;
+		return;
+	}
+
+	if (isCameraMoving)
+	{
+		m_motionBounces = std::min(m_motionBounces, fullBounces);
+
+		if (frameCost > m_motionFrameTime * 1.25)
+		{
+			// Resolution goes first, as it is the least visible while moving.
+			if (m_motionRefinementStep < MaxMotionRefinementStep)
+				m_motionRefinementStep *= 2;
+			else m_motionBounces = std::max(MinBounces, m_motionBounces / 2);
+		}
+		// Halving the step quadruples the pixels, so it needs more headroom than doubling the bounces.
+		else if (m_motionBounces < fullBounces && frameCost < m_motionFrameTime * 0.45)
+		{
+			m_motionBounces = std::min(fullBounces, m_motionBounces * 2);
+		}
+		else if (m_motionRefinementStep > MinMotionRefinementStep && frameCost < m_motionFrameTime * 0.2)
+		{
+			m_motionRefinementStep /= 2;
+		}
+
+		m_bouncesLimit = m_motionBounces;
+		m_isBouncesReduced = m_isBouncesReduced || m_motionBounces < fullBounces;
+	}
+	else
+	{
+		m_bouncesLimit = fullBounces;
+		m_isBouncesReduced = false;
+	}
+}
+
+std::string QualityGovernor::toString() const
+{
+	if (m_isEnabled == false)
+		return "Governor: OFF";
+
+	std::string result = "Governor: frame cost " + std::to_string(int(m_frameCost * 1000.0)) + " ms";
+	if (m_isCameraMoving)
+	{
+		result += " moving, target " + std::to_string(int(m_motionFrameTime * 1000.0)) + " ms, "
+			+ std::to_string(m_motionRefinementStep) + "x" + std::to_string(m_motionRefinementStep) + " blocks, "
+			+ std::to_string(m_bouncesLimit) + " bounces";
+	}
+	else
+	{
+		result += " still, budget " + std::to_string(int(m_stillFrameTime * 1000.0)) + " ms, full quality";
+	}
+	return result;
+}
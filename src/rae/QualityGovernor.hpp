@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+
+namespace Rae
+{
+
+// Holds a target frame time by trading image quality for speed.
+// Rendering yields when the frame budget runs out, so while the camera moves the governor
+// lowers the refinement resolution and the bounce count until a whole pass fits in the budget.
+// A still camera always gets full quality, and the budget only limits the work per frame.
+class QualityGovernor
+{
+public:
+	// Call once per frame, with what a whole frame of the last quality would cost: the reprojection,
+	// a complete render pass and the display update. fullBounces is the user's bounce limit.
+	void update(double frameCost, bool isCameraMoving, int fullBounces);
+
+	// True for one frame when the camera stopped after the governor had reduced the bounces.
+	// The samples traced with fewer bounces are darker, so the accumulation should be restarted.
+	bool isQualityRestored() const { return m_isQualityRestored; }
+
+	bool isCameraMoving() const { return m_isCameraMoving; }
+	int bouncesLimit() const { return m_bouncesLimit; }
+	int motionRefinementStep() const { return m_motionRefinementStep; }
+	// How long the ray tracer may work in this frame, in seconds
+	double frameBudget() const { return m_isCameraMoving ? m_motionFrameTime : m_stillFrameTime; }
+
+	void setMotionFrameTime(double seconds) { m_motionFrameTime = seconds; }
+	double motionFrameTime() const { return m_motionFrameTime; }
+	void setStillFrameTime(double seconds) { m_stillFrameTime = seconds; }
+	double stillFrameTime() const { return m_stillFrameTime; }
+
+	void toggleEnabled() { m_isEnabled = !m_isEnabled; }
+	bool isEnabled() const { return m_isEnabled; }
+
+	std::string toString() const;
+
+	static const int MinBounces = 2;
+	static const int MinMotionRefinementStep = 2;
+	static const int MaxMotionRefinementStep = 16;
+
+protected:
+	bool m_isEnabled = true;
+	double m_motionFrameTime = 1.0 / 30.0;
+	double m_stillFrameTime = 1.0 / 15.0;
+
+	bool m_isCameraMoving = false;
+	bool m_isQualityRestored = false;
+	bool m_isBouncesReduced = false;
+	double m_frameCost = 0.0;
+
+	int m_bouncesLimit = 50;
+	int m_motionBounces = 50; // remembered between camera moves
+	int m_motionRefinementStep = 8;
+};
+
+} // end namespace Rae
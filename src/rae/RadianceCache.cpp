@@ -0,0 +1,128 @@
+#include "RadianceCache.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "core/Utils.hpp"
+#include "Sampler.hpp"
+
+using namespace Rae;
+
+RadianceCache::RadianceCache(int capacity, float cellSize)
+: m_cellSize(cellSize),
+m_usedProbeCount(0)
+{
+	setCapacity(capacity);
+}
+
+void RadianceCache::setCapacity(int capacity)
+{
+	// Round up to a power of two for the hash mask.
+	int rounded = 1;
+	while (rounded < capacity)
+		rounded *= 2;
+
+	m_capacity = rounded;
+	m_keys.reset(new std::atomic<uint64_t>[m_capacity]);
+	m_sums.reset(new std::atomic<float>[m_capacity * 4]);
+	clear();
+}
+
+void RadianceCache::setCellSize(float set)
+{
+	m_cellSize = set;
+	clear();
+}
+
+void RadianceCache::clear()
+{
+	// Nothing renders during a clear, so the stores need no ordering, which makes them plain stores.
+	for (int i = 0; i < m_capacity; ++i)
+		m_keys[i].store(0, std::memory_order_relaxed);
+	for (int i = 0; i < m_capacity * 4; ++i)
+		m_sums[i].store(0.0f, std::memory_order_relaxed);
+	m_usedProbeCount.store(0);
+}
+
+uint64_t RadianceCache::probeKey(const vec3& point, const vec3& normal) const
+{
+	// 20 bits per axis, 3 bits for the main axis of the normal and its sign, and the top bit set.
+	const uint64_t mask = (1 << 20) - 1;
+	const uint64_t x = uint64_t(int64_t(floor(point.x / m_cellSize)) + (1 << 19)) & mask;
+	const uint64_t y = uint64_t(int64_t(floor(point.y / m_cellSize)) + (1 << 19)) & mask;
+	const uint64_t z = uint64_t(int64_t(floor(point.z / m_cellSize)) + (1 << 19)) & mask;
+
+	const vec3 absNormal = glm::abs(normal);
+	int axis = 0;
+	if (absNormal.y > absNormal[axis])
+		axis = 1;
+	if (absNormal.z > absNormal[axis])
+		axis = 2;
+	const uint64_t side = uint64_t(axis * 2 + (normal[axis] < 0.0f ? 1 : 0));
+
+	return (uint64_t(1) << 63) | (side << 60) | (x << 40) | (y << 20) | z;
+}
+
+int RadianceCache::findProbe(uint64_t key) const
+{
+	const int start = int(mixBits(key) & uint64_t(m_capacity - 1));
+	for (int probe = 0; probe < MaxProbes; ++probe)
+	{
+		const int slot = (start + probe) & (m_capacity - 1);
+		const uint64_t slotKey = m_keys[slot].load(std::memory_order_relaxed);
+		if (slotKey == key)
+			return slot;
+		if (slotKey == 0)
+			return -1;
+	}
+	return -1;
+}
+
+void RadianceCache::record(const vec3& point, const vec3& normal, const vec3& irradiance)
+{
+	if (std::isfinite(irradiance.x) == false || std::isfinite(irradiance.y) == false || std::isfinite(irradiance.z) == false)
+		return;
+
+	const uint64_t key = probeKey(point, normal);
+	const int start = int(mixBits(key) & uint64_t(m_capacity - 1));
+	for (int probe = 0; probe < MaxProbes; ++probe)
+	{
+		const int slot = (start + probe) & (m_capacity - 1);
+		uint64_t slotKey = m_keys[slot].load(std::memory_order_relaxed);
+		if (slotKey == 0)
+		{
+			// Claim the empty probe, unless another thread got there first.
+			if (m_keys[slot].compare_exchange_strong(slotKey, key))
+			{
+				m_usedProbeCount.fetch_add(1, std::memory_order_relaxed);
+				slotKey = key;
+			}
+		}
+		if (slotKey != key)
+			continue;
+
+		Utils::atomicAdd(m_sums[slot * 4 + 0], irradiance.x);
+		Utils::atomicAdd(m_sums[slot * 4 + 1], irradiance.y);
+		Utils::atomicAdd(m_sums[slot * 4 + 2], irradiance.z);
+		Utils::atomicAdd(m_sums[slot * 4 + 3], 1.0f);
+		return;
+	}
+	// The neighbourhood is full, so this part of space isn't cached.
+}
+
+bool RadianceCache::lookup(const vec3& point, const vec3& normal, vec3& irradiance) const
+{
+	const int slot = findProbe(probeKey(point, normal));
+	if (slot == -1)
+		return false;
+
+	const float count = m_sums[slot * 4 + 3].load(std::memory_order_relaxed);
+	if (count < m_minSamples)
+		return false;
+
+	irradiance = vec3(
+		m_sums[slot * 4 + 0].load(std::memory_order_relaxed),
+		m_sums[slot * 4 + 1].load(std::memory_order_relaxed),
+		m_sums[slot * 4 + 2].load(std::memory_order_relaxed)) / count;
+	return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+using glm::vec3;
+
+namespace Rae
+{
+
+// World space cache of the irradiance on diffuse surfaces, in a hashed grid of probes.
+// The probes are keyed by the cell and the main axis of the surface normal, so the two sides
+// of a thin wall don't mix. The irradiance of a static scene doesn't depend on the camera,
+// so the cache is only cleared when the scene changes.
+// Paths add their estimates from any thread, and lookups may run at the same time.
+class RadianceCache
+{
+public:
+	// capacity is the number of probes. Each takes 24 bytes.
+	explicit RadianceCache(int capacity = 1 << 18, float cellSize = 0.1f);
+
+	void clear();
+	// Both clear the cache.
+	void setCapacity(int capacity);
+	void setCellSize(float set);
+
+	int capacity() const { return m_capacity; }
+	float cellSize() const { return m_cellSize; }
+	size_t memoryUsage() const { return size_t(m_capacity) * (sizeof(uint64_t) + 4 * sizeof(float)); }
+
+	void record(const vec3& point, const vec3& normal, const vec3& irradiance);
+	// False until the probe has enough samples to stand for the rest of a path.
+	bool lookup(const vec3& point, const vec3& normal, vec3& irradiance) const;
+
+	int usedProbeCount() const { return m_usedProbeCount.load(); }
+
+	static const int MaxProbes = 8;
+
+protected:
+	uint64_t probeKey(const vec3& point, const vec3& normal) const;
+	int findProbe(uint64_t key) const;
+
+	int m_capacity = 0; // a power of two
+	float m_cellSize = 0.1f; // in world units
+	float m_minSamples = 16.0f;
+
+	// A zero key is an empty probe. Sums of the irradiance, and the sample count in w.
+	std::unique_ptr<std::atomic<uint64_t>[]> m_keys;
+	std::unique_ptr<std::atomic<float>[]> m_sums;
+	std::atomic<int> m_usedProbeCount;
+};
+
+} // end namespace Rae
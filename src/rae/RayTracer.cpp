@@ -3,6 +3,9 @@
 #include <iostream>	
 #include <vector>
 #include <string>
+#include <chrono>
+#include <cstring>
+#include <limits>
 
 #include <glm/glm.hpp>
 using glm::vec3;
@@ -14,7 +17,12 @@ using glm::dot;
 #include "CameraSystem.hpp"
 #include "Material.hpp"
 #include "Sphere.hpp"
+#include "Plane.hpp"
 #include "Mesh.hpp"
+#include "SceneLoader.hpp"
+#include "Checkpoint.hpp"
+#include "HdrImage.hpp"
+#include "core/MappedFile.hpp"
 
 using namespace Rae;
 
@@ -59,6 +67,17 @@ void ImageBuffer::init()
 	{
 		colorData.push_back(vec3(0.5f, 0.5f, 0.5f));
 	}	
+	varianceData.assign(width * height, vec3(0.0f, 0.0f, 0.0f));
+	sampleCounts.assign(width * height, 0);
+
+	albedoData.assign(width * height, vec3(0.0f, 0.0f, 0.0f));
+	normalData.assign(width * height, vec3(0.0f, 0.0f, 0.0f));
+	depthData.assign(width * height, 0.0f);
+
+	tilesX = (width + TileSize - 1) / TileSize;
+	tilesY = (height + TileSize - 1) / TileSize;
+	tileActive.assign(tilesX * tilesY, 1);
+
 	data.reserve(width * height * channels);
 	for (int i = 0; i < width * height; ++i)
 	{
@@ -69,25 +88,6 @@ void ImageBuffer::init()
 	}
 }
 
-void ImageBuffer::createImage(NVGcontext* vg)
-{
-	if (imageId == -1 && vg != nullptr)
-	{
-		//std::cout << "Creating image " << width << "x" << height << "\n";
-		imageId = nvgCreateImageRGBA(vg, width, height, /*imageFlags*/0, &data[0]);
-	}
-	else
-	{
-		std::cout << "Failed to create an image " << width << "x" << height << "\n";
-		if (imageId != -1)
-			std::cout << "imageId was not -1. It was " << imageId << "\n";
-		if (vg == nullptr)
-			std::cout << "vg was null.\n";
-		assert(imageId == -1);
-		assert(vg != nullptr);
-	}
-}
-
 vec3 pow(const vec3& color, float power)
 {
 	vec3 result;
@@ -103,7 +103,118 @@ vec3 gammaCorrectionAnd255(const vec3& linear)
 	return 255.99f * glm::clamp( pow(linear, gammaMul), 0.0f, 1.0f);
 }
 
-void ImageBuffer::update8BitImageBuffer(NVGcontext* vg)
+// Blue for few samples, through green to red for the most samples.
+vec3 heatMapColor(float value)
+{
+	value = glm::clamp(value, 0.0f, 1.0f);
+	if (value < 0.5f)
+		return glm::mix(vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 1.0f, 0.0f), value * 2.0f);
+	return glm::mix(vec3(0.0f, 1.0f, 0.0f), vec3(1.0f, 0.0f, 0.0f), (value - 0.5f) * 2.0f);
+}
+
+void ImageBuffer::updateSampleCountImage()
+{
+	int maxSampleCount = 1;
+	for (int count : sampleCounts)
+		maxSampleCount = std::max(maxSampleCount, count);
+
+	std::vector<vec3> heatMap(width * height);
+	for (int i = 0; i < width * height; ++i)
+	{
+		heatMap[i] = heatMapColor(float(sampleCounts[i]) / float(maxSampleCount));
+	}
+
+	update8BitImageBuffer(heatMap);
+}
+
+void ImageBuffer::upsampleLattice(int step, std::vector<vec3>& outColor, ThreadPool& threadPool) const
+{
+	// The last lattice points can be past the edge of the image.
+	const int lastLatticeX = ((width - 1) / step) * step;
+	const int lastLatticeY = ((height - 1) / step) * step;
+
+	threadPool.parallelFor(height, [&](int j, int)
+	{
+		for (int i = 0; i < width; ++i)
+		{
+			const int index = (j * width) + i;
+			if (sampleCounts[index] > 0)
+			{
+				outColor[index] = colorData[index];
+				continue;
+			}
+
+			const int x0 = (i / step) * step;
+			const int y0 = (j / step) * step;
+			const int cornersX[2] = { x0, std::min(x0 + step, lastLatticeX) };
+			const int cornersY[2] = { y0, std::min(y0 + step, lastLatticeY) };
+			const float fractionX = float(i - x0) / float(step);
+			const float fractionY = float(j - y0) / float(step);
+
+			int cornerIndices[4];
+			float cornerWeights[4];
+			int nearest = -1;
+			for (int corner = 0; corner < 4; ++corner)
+			{
+				cornerIndices[corner] = (cornersY[corner >> 1] * width) + cornersX[corner & 1];
+				cornerWeights[corner] = ((corner & 1) ? fractionX : 1.0f - fractionX)
+					* ((corner >> 1) ? fractionY : 1.0f - fractionY);
+
+				// Disoccluded lattice points can be empty after reprojection.
+				if (sampleCounts[cornerIndices[corner]] == 0)
+					cornerWeights[corner] = 0.0f;
+				else if (nearest == -1 || cornerWeights[corner] > cornerWeights[nearest])
+					nearest = corner;
+			}
+
+			if (nearest == -1)
+			{
+				outColor[index] = vec3(0.0f, 0.0f, 0.0f);
+				continue;
+			}
+
+			// The nearest corner decides which side of an edge this pixel is on.
+			const vec3& nearestNormal = normalData[cornerIndices[nearest]];
+			const bool isNearestSky = glm::dot(nearestNormal, nearestNormal) < 0.0001f;
+			const float nearestDepth = depthData[cornerIndices[nearest]];
+
+			vec3 colorSum(0.0f, 0.0f, 0.0f);
+			float weightSum = 0.0f;
+			for (int corner = 0; corner < 4; ++corner)
+			{
+				float weight = cornerWeights[corner];
+				if (weight == 0.0f && corner != nearest)
+					continue;
+
+				const int cornerIndex = cornerIndices[corner];
+				if (corner != nearest)
+				{
+					const vec3& normal = normalData[cornerIndex];
+					const bool isSky = glm::dot(normal, normal) < 0.0001f;
+					if (isSky != isNearestSky)
+						continue;
+
+					if (isSky == false)
+					{
+						float normalWeight = std::max(0.0f, glm::dot(normal, nearestNormal)
+							/ sqrt(glm::dot(normal, normal) * glm::dot(nearestNormal, nearestNormal)));
+						normalWeight *= normalWeight;
+						normalWeight *= normalWeight;
+						weight *= normalWeight * exp(-fabs(depthData[cornerIndex] - nearestDepth) / (0.05f * nearestDepth + 0.0001f));
+					}
+				}
+
+				colorSum += weight * colorData[cornerIndex];
+				weightSum += weight;
+			}
+
+			// Only the nearest corner can have zero weight here, when the pixel is on it.
+			outColor[index] = weightSum > 0.0f ? colorSum / weightSum : colorData[cornerIndices[nearest]];
+		}
+	});
+}
+
+void ImageBuffer::update8BitImageBuffer(const std::vector<vec3>& linearColor)
 {
 	// update 8 bit image buffer
 	{
@@ -111,7 +222,7 @@ void ImageBuffer::update8BitImageBuffer(NVGcontext* vg)
 		{
 			for (int i = 0; i < width; ++i)
 			{
-				const vec3& linear = colorData[(j*width)+i];
+				const vec3& linear = linearColor[(j*width)+i];
 
 				vec3 color = gammaCorrectionAnd255(linear);
 
@@ -121,23 +232,29 @@ void ImageBuffer::update8BitImageBuffer(NVGcontext* vg)
 			}
 		}
 
-		nvgUpdateImage(vg, imageId, &data[0]);
+		isImageChanged = true;
 	}
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
-RayTracer::RayTracer(CameraSystem& cameraSystem)
-: m_world(4),
-m_cameraSystem(cameraSystem)
+RayTracer::RayTracer(CameraSystem& cameraSystem, int width, int height, int threadCount)
+: m_zSobolSampler(width, height, m_samplesLimit),
+m_threadPool(threadCount),
+m_loadThreadPool(threadCount),
+m_world(4),
+m_cameraSystem(cameraSystem),
+m_restir(m_tree, m_lightBvh),
+m_bdpt(m_tree, m_lightBvh, [this](const Ray& ray) { return sky(ray); }),
+m_rayCount(0)
 {
-	m_smallBuffer.init(300, 150);
-	m_bigBuffer.init(1920, 1080);
+	m_buffer.init(width, height);
+	m_displayColor.resize(m_buffer.width * m_buffer.height);
+	m_splats.resize(m_buffer.width, m_buffer.height);
 
-	m_buffer = &m_smallBuffer;
+	m_activeTileCount = m_buffer.tileCount();
 
-	createSceneOne(m_world);
-	//createSceneFromBook(m_world);
+	loadScene("./data/scenes/spheres.scene");
 
 	using std::placeholders::_1;
 	m_cameraSystem.connectCameraChangedEventHandler(std::bind(&RayTracer::onCameraChanged, this, _1));
@@ -145,87 +262,241 @@ m_cameraSystem(cameraSystem)
 
 RayTracer::~RayTracer()
 {
+	// The load uses the thread pool and the scene's materials.
+	if (m_sceneLoad.valid())
+		m_sceneLoad.wait();
+	finishCheckpoint();
+	finishImage();
 }
 
 void ImageBuffer::clear()
 {
 	std::fill(colorData.begin(), colorData.end(), vec3(0,0,0));
+	std::fill(varianceData.begin(), varianceData.end(), vec3(0,0,0));
+	std::fill(sampleCounts.begin(), sampleCounts.end(), 0);
+	std::fill(tileActive.begin(), tileActive.end(), 1);
+	std::fill(albedoData.begin(), albedoData.end(), vec3(0,0,0));
+	std::fill(normalData.begin(), normalData.end(), vec3(0,0,0));
+	std::fill(depthData.begin(), depthData.end(), 0.0f);
 	//std::fill(data.begin(), data.end(), 0);
 }
 
-void RayTracer::createSceneOne(HitableList& world, bool loadBunny)
+void ImageBuffer::addSample(int index, const vec3& color)
 {
-	Camera& camera = m_cameraSystem.getCurrentCamera();
+	//http://stackoverflow.com/questions/22999487/update-the-average-of-a-continuous-sequence-of-numbers-in-constant-time
+	// add to average, and keep track of the variance with Welford's algorithm.
+	int count = ++sampleCounts[index];
+	vec3 delta = color - colorData[index];
+	colorData[index] += delta / float(count);
+	varianceData[index] += delta * (color - colorData[index]);
+}
+
+float luminance(const vec3& color)
+{
+	return glm::dot(color, vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+void ImageBuffer::addFeatures(int index, const PixelFeatures& features)
+{
+	float count = float(sampleCounts[index]);
+	albedoData[index] += (features.albedo - albedoData[index]) / count;
+	normalData[index] += (features.normal - normalData[index]) / count;
+	depthData[index] += (features.depth - depthData[index]) / count;
+}
+
+float ImageBuffer::varianceOfMean(int index) const
+{
+	int count = sampleCounts[index];
+	if (count < 2)
+		return FLT_MAX;
+
+	// Variance of the mean is the sample variance divided by the sample count.
+	return luminance(varianceData[index]) / (float(count - 1) * float(count));
+}
+
+float ImageBuffer::relativeError(int index) const
+{
+	if (sampleCounts[index] < 2)
+		return FLT_MAX;
+
+	// The small constant keeps black pixels from needing infinite samples.
+	return sqrt(varianceOfMean(index)) / (luminance(colorData[index]) + 0.01f);
+}
+
+int ImageBuffer::updateActiveTiles(float targetError, int minSamples, int startX, int startY, int endX, int endY)
+{
+	int activeCount = 0;
+
+	for (int tileY = startY / TileSize; tileY * TileSize < endY; ++tileY)
+	{
+		for (int tileX = startX / TileSize; tileX * TileSize < endX; ++tileX)
+		{
+			uint8_t& active = tileActive[(tileY * tilesX) + tileX];
+			if (active == 0) // Converged tiles get no new samples, so they stay converged.
+				continue;
+
+			// The pixels of a tile outside the crop never get samples.
+			bool needsSamples = false;
+			const int pixelEndY = std::min(endY, (tileY + 1) * TileSize);
+			const int pixelEndX = std::min(endX, (tileX + 1) * TileSize);
+			for (int j = std::max(startY, tileY * TileSize); j < pixelEndY && needsSamples == false; ++j)
+			{
+				for (int i = std::max(startX, tileX * TileSize); i < pixelEndX; ++i)
+				{
+					const int index = (j * width) + i;
+					if (sampleCounts[index] < minSamples || relativeError(index) > targetError)
+					{
+						needsSamples = true;
+						break;
+					}
+				}
+			}
+
+			active = needsSamples ? 1 : 0;
+			if (needsSamples)
+				++activeCount;
+		}
+	}
+
+	return activeCount;
+}
+
+void ImageBuffer::activateTiles(int startX, int startY, int endX, int endY)
+{
+	for (int tileY = startY / TileSize; tileY * TileSize < endY; ++tileY)
+	{
+		for (int tileX = startX / TileSize; tileX * TileSize < endX; ++tileX)
+			tileActive[(tileY * tilesX) + tileX] = 1;
+	}
+}
+
+namespace
+{
+	// Touches nothing of the renderer, so that it can run in the background.
+	std::unique_ptr<SceneLoad> buildScene(const std::string& path, Camera& camera, ThreadPool& threadPool)
+	{
+		std::unique_ptr<SceneLoad> scene(new SceneLoad);
+		auto startTime = std::chrono::steady_clock::now();
+		SceneLoader loader;
+		loader.setThreadPool(&threadPool);
+		scene->isLoaded = loader.load(path, scene->world, camera);
+		if (scene->isLoaded == false)
+			std::cout << loader.error() << "\n";
+		scene->meshes = loader.meshes();
+		// A checkpoint of the scene doesn't fit once any of its files changes.
+		MappedFile file;
+		scene->hash = file.open(path) ? file.contentHash() : 0;
+		for (const Mesh* mesh : scene->meshes)
+			scene->hash = mixBits(scene->hash ^ mesh->sourceHash());
+		for (uint64_t modelHash : loader.modelHashes())
+			scene->hash = mixBits(scene->hash ^ modelHash);
+		std::chrono::duration<double> loadTime = std::chrono::steady_clock::now() - startTime;
+
+		// Also after a failure, for what came before the bad line.
+		scene->tree.init(scene->world.list(), 0, 0);
+		scene->lightBvh.build(scene->world.list());
+		std::chrono::duration<double> totalTime = std::chrono::steady_clock::now() - startTime;
+
+		std::cout << "Loaded " << path << ": " << scene->world.list().size() << " hitables, "
+			<< loadTime.count() * 1000.0 << " ms to parse, "
+			<< (totalTime - loadTime).count() * 1000.0 << " ms to build the BVHs\n";
+		return scene;
+	}
+}
+
+bool RayTracer::loadScene(const std::string& path)
+{
+	cancelSceneLoad();
+	// The old scene goes first, so that the two are never in memory together.
+	clearScene();
+	std::unique_ptr<SceneLoad> scene = buildScene(path, m_cameraSystem.getCurrentCamera(), m_threadPool);
+	swapScene(*scene);
+	return scene->isLoaded;
+}
+
+void RayTracer::loadSceneInBackground(const std::string& path)
+{
+	auto startTime = std::chrono::steady_clock::now();
+	clearScene();
+	SceneLoader loader;
+	loader.setPreview(true);
+	// The errors are for the full load to tell.
+	loader.load(path, m_world, m_cameraSystem.getCurrentCamera());
+	m_tree.init(m_world.list(), 0, 0);
+	m_lightBvh.build(m_world.list());
+	std::chrono::duration<double> previewTime = std::chrono::steady_clock::now() - startTime;
+	std::cout << "Preview of " << path << ": " << m_world.list().size() << " hitables in "
+		<< previewTime.count() * 1000.0 << " ms\n";
+
+	if (m_sceneLoad.valid())
+	{
+		cancelSceneLoad();
+		m_nextScenePath = path;
+	}
+	else startSceneLoad(path);
+}
+
+void RayTracer::startSceneLoad(const std::string& path)
+{
+	m_isSceneLoadCancelled = false;
+	// The preview has set the camera already, and the user may move it before the load is done.
+	Camera camera = m_cameraSystem.getCurrentCamera();
+	ThreadPool& threadPool = m_loadThreadPool;
+	m_sceneLoad = std::async(std::launch::async, [path, camera, &threadPool]() mutable
+	{
+		return buildScene(path, camera, threadPool);
+	});
+}
+
+void RayTracer::updateSceneLoad()
+{
+	if (m_sceneLoad.valid() == false
+		|| m_sceneLoad.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		return;
+
+	std::unique_ptr<SceneLoad> scene = m_sceneLoad.get();
+	if (m_isSceneLoadCancelled)
+	{
+		if (m_nextScenePath.empty() == false)
+		{
+			startSceneLoad(m_nextScenePath);
+			m_nextScenePath.clear();
+		}
+		return;
+	}
+	swapScene(*scene);
+}
 
-	camera.setFieldOfViewDeg(44.6f);
-
-	//camera.setPosition(vec3(0.698890f, 1.275992f, 6.693169f));
-	//camera.setYaw(Math::toRadians(188.0f));
-	//camera.setPitch(Math::toRadians(-7.744f));
-	//camera.setAperture(0.3f);
-	//camera.setFocusDistance(7.6f);
-
-	camera.setPosition(vec3(-0.16f, 2.9664f, 14.8691f));
-	camera.setYaw(Math::toRadians(178.560333f));
-	camera.setPitch(Math::toRadians(-10.8084f));
-	camera.setAperture(0.07f);
-	camera.setFocusDistance(14.763986f);
-
-	// A big light
-	world.add(
-		new Sphere(vec3(0.0f, 6.0f, -1.0f), 2.0f,
-		new Light(vec3(4.0f, 4.0f, 4.0f)))
-		);
-
-	// A small light
-	world.add(
-		new Sphere(vec3(0.85, 0.3, -0.15f), 0.1f,
-		new Light(vec3(16.0f, 16.0f, 16.0f)))
-		);
-
-	// A ball
-	world.add(
-		new Sphere(vec3(0, 0, -1), 0.5f,
-		new Lambertian(vec3(0.8f, 0.3f, 0.3f)))
-		);
-	// The planet
-	world.add(
-		new Sphere(vec3(0, -100.5f, -1), 100.0f,
-		new Lambertian(vec3(0.0f, 0.7f, 0.8f)))
-		);
-	
-	// Metal balls
-	world.add(
-		new Sphere(vec3(1, 0, -1), 0.5f,
-		new Metal(vec3(0.8f, 0.6f, 0.2f), /*roughness*/0.0f))
-		);
-	world.add(
-		new Sphere(vec3(-0.5f, 0.65f, -1), 0.4f,
-		new Metal(vec3(0.8f, 0.4f, 0.8f), /*roughness*/0.3f))
-		);
-	// Dielectric
-	world.add(
-		new Sphere(vec3(-1, 0, -1), 0.5f,
-		new Dielectric(vec3(0.8f, 0.5f, 0.3f), /*refractive_index*/1.5f))
-		);
-	world.add(
-		new Sphere(vec3(-3.15f, 0.1f, -5), 0.6f,
-		new Lambertian(vec3(0.05f, 0.2f, 0.8f)))
-		);
-
-	///////////////////
-
-	auto bunny = new Mesh(0);
-	if (loadBunny)
-		bunny->loadModel("./data/models/bunny.obj");
-	else bunny->generateBox();
-
-	world.add(bunny);
-
-	m_tree.init(world.list(), 0, 0);
-}
-
-void RayTracer::createSceneFromBook(HitableList& list)
+void RayTracer::waitForScene()
+{
+	while (m_sceneLoad.valid())
+	{
+		m_sceneLoad.wait();
+		updateSceneLoad();
+	}
+}
+
+void RayTracer::cancelSceneLoad()
+{
+	if (m_sceneLoad.valid())
+		m_isSceneLoadCancelled = true;
+	m_nextScenePath.clear();
+}
+
+void RayTracer::swapScene(SceneLoad& scene)
+{
+	// Between the passes, so no thread sees half of each scene.
+	clearScene();
+	m_world.swap(scene.world);
+	m_tree = scene.tree;
+	m_lightBvh = std::move(scene.lightBvh);
+	m_sceneHash = scene.hash;
+	// The pager only takes clusters while nothing renders.
+	for (Mesh* mesh : scene.meshes)
+		mesh->setPager(&m_geometryPager);
+}
+
+void RayTracer::createSceneManyLights(HitableList& list)
 {
 	Camera& camera = m_cameraSystem.getCurrentCamera();
 
@@ -235,67 +506,62 @@ void RayTracer::createSceneFromBook(HitableList& list)
 	camera.setAperture(0.1f);
 	camera.setFocusDistance(17.29f);
 
-	list.add( new Sphere(vec3(0,-1000,0), 1000, new Lambertian(vec3(0.5, 0.5, 0.5))) );
+	list.add( new Plane(vec3(0, 0, 0), vec3(0, 1, 0), list.addMaterial(new Lambertian(vec3(0.5, 0.5, 0.5)))) );
 
-	for (int a = -11; a < 11; a++)
+	// A field of small lights. The light BVH only visits the ones near each shading point.
+	for (int a = -20; a < 20; a++)
 	{
-		for (int b = -11; b < 11; b++)
+		for (int b = -20; b < 20; b++)
 		{
-			float choose_mat = getRandom();
-			vec3 center(a + 0.9f * getRandom(), 0.2f, b + 0.9f * getRandom());
-			if ((center-vec3(4,0.2,0)).length() > 0.9f)
-			{ 
-				if (choose_mat < 0.8f)
-				{
-					// diffuse
-					list.add( new Sphere(center, 0.2f, new Lambertian(vec3( getRandom()*getRandom(), getRandom()*getRandom(), getRandom()*getRandom()))));
-				}
-				else if (choose_mat < 0.95f)
-				{
-					// metal
-					list.add( new Sphere(center, 0.2f,
-							new Metal(vec3(0.5f*(1.0f + getRandom()), 0.5f*(1.0f + getRandom()), 0.5f*(1.0f + getRandom())), /*roughness*/ 0.5f*getRandom())));
-				}
-				else
-				{
-					// glass
-					list.add( new Sphere(center, 0.2f, new Dielectric(vec3(0.8f, 0.5f, 0.3f), /*refractive_index*/1.5f)) );
-				}
-			}
+			vec3 center(a + 0.8f * getRandom(), 0.1f, b + 0.8f * getRandom());
+			vec3 emission(getRandom(), getRandom(), getRandom());
+			list.add( new Sphere(center, 0.1f, list.addMaterial(new Light(8.0f * emission))) );
 		}
 	}
 
-	list.add( new Sphere(vec3(0, 1, 0), 1.0, new Dielectric(vec3(0.8f, 0.5f, 0.3f), /*refractive_index*/1.5f)) );
-	list.add( new Sphere(vec3(-4, 1, 0), 1.0, new Lambertian(vec3(0.0, 0.2, 0.9))) );
-	list.add( new Sphere(vec3(4, 1, 0), 1.0, new Metal(vec3(0.7, 0.6, 0.5), 0.0)) );
+	list.add( new Sphere(vec3(0, 1, 0), 1.0, list.addMaterial(new Dielectric(vec3(0.8f, 0.5f, 0.3f), /*refractive_index*/1.5f))) );
+	list.add( new Sphere(vec3(-4, 1, 0), 1.0, list.addMaterial(new Lambertian(vec3(0.0, 0.2, 0.9)))) );
+	list.add( new Sphere(vec3(4, 1, 0), 1.0, list.addMaterial(new Metal(vec3(0.7, 0.6, 0.5), 0.0))) );
+
+	// An emissive mesh, where every triangle is a light of its own.
+	auto lamp = new Mesh(0);
+	lamp->generateBox();
+	lamp->translate(vec3(2.0f, 0.5f, 2.5f));
+	lamp->setMaterial(list.addMaterial(new Light(vec3(6.0f, 5.0f, 3.0f))));
+	list.add(lamp);
 
 	m_tree.init(list.list(), 0, 0);
+	m_lightBvh.build(list.list());
 }
 
 void RayTracer::showScene(int number)
 {
 	if (number == 1)
-	{
-		clearScene();
-		createSceneOne(m_world, false);
-	}
+		loadSceneInBackground("./data/scenes/spheres.scene");
 
 	if (number == 2)
-	{
-		clearScene();
-		createSceneOne(m_world, true);
-	}
+		loadSceneInBackground("./data/scenes/bunny.scene");
 
 	if (number == 3)
+		loadSceneInBackground("./data/scenes/book.scene");
+
+	if (number == 4)
 	{
+		cancelSceneLoad();
 		clearScene();
-		createSceneFromBook(m_world);
+		createSceneManyLights(m_world);
 	}
 }
 
 void RayTracer::clearScene()
 {
+	m_sceneHash = 0;
 	m_world.clear();
+	m_lightBvh.clear();
+	m_restir.clearHistory();
+	m_pathGuide.clear();
+	m_radianceCache.clear();
+	m_causticPhotons.clear();
 	m_cameraSystem.setNeedsUpdate();
 	clear();
 }
@@ -305,25 +571,370 @@ void RayTracer::onCameraChanged(const Camera& camera)
 	if (camera.shouldWeAutoFocus())
 		autoFocus();
 
+	m_isCameraChanged = true;
+
+	// Splats can't be reprojected, they don't know which pixel sample they came from.
+	if (m_isTemporalReprojection && isBdptActive() == false)
+	{
+		auto startTime = std::chrono::steady_clock::now();
+		reproject(camera.view());
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+		m_reprojectionTime = elapsed.count();
+	}
+	else clear();
+}
+
+void RayTracer::reproject(const CameraView& view)
+{
+	const CameraView previousView = m_accumulationView;
+	ImageBuffer& buffer = m_buffer;
+	const int width = buffer.width;
+	const int height = buffer.height;
+	const int pixelCount = width * height;
+
+	// The history only has samples on its finest finished lattice.
+	const int historyStep = isRefined() ? 1 : m_finishedRefinementStep;
+	if (historyStep == 0)
+	{
+		clear();
+		return;
+	}
+	// Reprojection keeps at most the governor's lattice density, so that camera motion stays interactive.
+	const int step = std::max(historyStep, m_governor.motionRefinementStep());
+
+	// The old accumulation becomes the history, and the buffer starts empty.
+	m_history.width = width;
+	m_history.height = height;
+	m_history.colorData.resize(pixelCount);
+	m_history.varianceData.resize(pixelCount);
+	m_history.sampleCounts.resize(pixelCount);
+	m_history.albedoData.resize(pixelCount);
+	m_history.normalData.resize(pixelCount);
+	m_history.depthData.resize(pixelCount);
+	std::swap(m_history.colorData, buffer.colorData);
+	std::swap(m_history.varianceData, buffer.varianceData);
+	std::swap(m_history.sampleCounts, buffer.sampleCounts);
+	std::swap(m_history.albedoData, buffer.albedoData);
+	std::swap(m_history.normalData, buffer.normalData);
+	std::swap(m_history.depthData, buffer.depthData);
+
 	clear();
+	m_accumulationView = view;
+	// Reprojection fills the lattice of the chosen step, and refinement continues from there.
+	m_finishedRefinementStep = step;
+	m_refinementStep = std::max(1, step / 2);
+
+	const float SkyDistance = 1.0e5f;
+
+	// Gather: find where the surface seen through each new pixel was in the previous view,
+	// and take a bilinear blend of the history pixels there that saw the same surface.
+	m_threadPool.parallelFor((height + step - 1) / step, [&](int row, int)
+	{
+		const int j = row * step;
+		for (int i = 0; i < width; i += step)
+		{
+			Ray ray = view.getExactRay((float(i) + 0.5f) / float(width), (float(j) + 0.5f) / float(height));
+			HitRecord record;
+			const bool isHit = m_tree.hit(ray, 0.001f, FLT_MAX, record);
+			const vec3 point = isHit ? record.point : ray.origin() + glm::normalize(ray.direction()) * SkyDistance;
+			const vec3 normal = isHit ? glm::normalize(record.normal) : vec3(0.0f, 0.0f, 0.0f);
+
+			float s, t;
+			if (previousView.project(point, s, t) == false)
+				continue;
+
+			const float x = (s * float(width) - 0.5f) / float(historyStep);
+			const float y = (t * float(height) - 0.5f) / float(historyStep);
+			const int x0 = int(floor(x));
+			const int y0 = int(floor(y));
+			const float fractionX = x - float(x0);
+			const float fractionY = y - float(y0);
+			const float expectedDepth = glm::length(point - previousView.position);
+
+			vec3 colorSum(0.0f, 0.0f, 0.0f);
+			vec3 varianceSum(0.0f, 0.0f, 0.0f); // per sample variance, not M2
+			vec3 albedoSum(0.0f, 0.0f, 0.0f);
+			float countSum = 0.0f;
+			float weightSum = 0.0f;
+
+			for (int tap = 0; tap < 4; ++tap)
+			{
+				const int tapX = (x0 + (tap & 1)) * historyStep;
+				const int tapY = (y0 + (tap >> 1)) * historyStep;
+				if (tapX < 0 || tapX >= width || tapY < 0 || tapY >= height)
+					continue;
+
+				const int tapIndex = (tapY * width) + tapX;
+				const int count = m_history.sampleCounts[tapIndex];
+				if (count == 0)
+					continue;
+
+				// Disocclusion tests
+				const vec3& tapNormal = m_history.normalData[tapIndex];
+				const bool isTapSky = glm::dot(tapNormal, tapNormal) < 0.0001f;
+				if (isTapSky == isHit)
+					continue;
+
+				if (isHit)
+				{
+					if (fabs(m_history.depthData[tapIndex] - expectedDepth) > m_reprojectionDepthTolerance * expectedDepth)
+						continue;
+					if (glm::dot(glm::normalize(tapNormal), normal) < m_reprojectionNormalTolerance)
+						continue;
+				}
+
+				const float weight = ((tap & 1) ? fractionX : 1.0f - fractionX) * ((tap >> 1) ? fractionY : 1.0f - fractionY);
+				colorSum += weight * m_history.colorData[tapIndex];
+				if (count > 1)
+					varianceSum += weight * m_history.varianceData[tapIndex] / float(count - 1);
+				albedoSum += weight * m_history.albedoData[tapIndex];
+				countSum += weight * float(count);
+				weightSum += weight;
+			}
+
+			if (weightSum < 0.01f)
+				continue;
+
+			const int seededCount = std::min(m_reprojectionMaxSamples, int(m_reprojectionConfidence * countSum / weightSum));
+			if (seededCount < 1)
+				continue;
+
+			const int index = (j * width) + i;
+			buffer.colorData[index] = colorSum / weightSum;
+			buffer.varianceData[index] = (varianceSum / weightSum) * float(seededCount - 1);
+			buffer.sampleCounts[index] = seededCount;
+			buffer.albedoData[index] = albedoSum / weightSum;
+			buffer.normalData[index] = normal;
+			buffer.depthData[index] = isHit ? glm::length(point - view.position) : FLT_MAX;
+		}
+	});
 }
 
 void RayTracer::clear()
 {
-	m_buffer->clear();
+	m_buffer.clear();
+	m_splats.clear();
+	m_accumulationView = m_cameraSystem.getCurrentCamera().view();
 	m_currentSample = 0;
+	m_regionSampleCount = 0;
+	m_refinementStep = CoarsestRefinementStep;
+	m_finishedRefinementStep = 0;
+	m_renderJob.isActive = false;
+	m_activeTileCount = m_buffer.tileCount();
+	m_denoisedSample = -1;
 	m_totalRayTracingTime = -1.0;
 	m_startTime = -1.0f;
 }
 
-void RayTracer::setNanovgContext(NVGcontext* setVg)
+bool RayTracer::isRenderingDone() const
 {
-	assert(setVg != NULL);
+	if (m_regionSampleCount >= m_samplesLimit)
+		return true;
+	return m_isRenderToErrorThreshold
+		&& m_currentSample >= m_adaptiveMinSamples
+		&& m_activeTileCount == 0;
+}
 
-	m_vg = setVg;
+void RayTracer::setSamplesLimit(int samples)
+{
+	m_samplesLimit = std::max(1, samples);
+	// The blue noise sampler spreads its sequence over the sample count.
+	m_zSobolSampler = ZSobolSampler(m_buffer.width, m_buffer.height, m_samplesLimit);
+	clear();
+}
 
-	m_smallBuffer.createImage(m_vg);
-	m_bigBuffer.createImage(m_vg);
+uint64_t RayTracer::checkpointKey() const
+{
+	uint64_t key = m_sceneHash;
+	auto add = [&key](uint64_t value) { key = mixBits(key ^ value); };
+	auto addFloat = [&add](float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		add(bits);
+	};
+	auto addVec3 = [&addFloat](const vec3& value)
+	{
+		addFloat(value.x);
+		addFloat(value.y);
+		addFloat(value.z);
+	};
+
+	add(uint64_t(m_buffer.width));
+	add(uint64_t(m_buffer.height));
+	add(uint64_t(m_samplesLimit));
+	add(uint64_t(m_samplerType));
+	add(uint64_t(m_integratorType));
+	add(uint64_t(m_bouncesLimit));
+	add(m_isFastMode ? 1 : 0);
+	add(m_isRenderToErrorThreshold ? 1 : 0);
+	addFloat(m_targetError);
+	add(uint64_t(m_adaptiveMinSamples));
+	add(uint64_t(m_roiMode));
+	addFloat(m_roiCenter.x);
+	addFloat(m_roiCenter.y);
+	addFloat(m_cropMin.x);
+	addFloat(m_cropMin.y);
+	addFloat(m_cropMax.x);
+	addFloat(m_cropMax.y);
+	add(m_isPathGuiding ? 1 : 0);
+	add(m_isRadianceCache ? 1 : 0);
+	add(m_isCaustics ? 1 : 0);
+
+	const CameraView view = m_cameraSystem.getCurrentCamera().view();
+	addVec3(view.position);
+	addVec3(view.topLeftCorner);
+	addVec3(view.horizontal);
+	addVec3(view.vertical);
+	addFloat(view.lensRadius);
+	return key;
+}
+
+bool RayTracer::saveCheckpoint(const std::string& path)
+{
+	if (m_sceneHash == 0 || m_integratorType == IntegratorType::Restir)
+		return false;
+	// Rather skipped than waited for.
+	if (m_checkpointWrite.valid())
+	{
+		if (m_checkpointWrite.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return false;
+		finishCheckpoint();
+	}
+
+	// Only the copy is on the render thread, about 25 ms at 1920x1080.
+	if (m_checkpoint == nullptr)
+		m_checkpoint.reset(new RenderCheckpoint);
+	RenderCheckpoint* checkpoint = m_checkpoint.get();
+	checkpoint->key = checkpointKey();
+	checkpoint->currentSample = m_currentSample;
+	checkpoint->refinementStep = m_refinementStep;
+	checkpoint->finishedRefinementStep = m_finishedRefinementStep;
+	checkpoint->activeTileCount = m_activeTileCount;
+	checkpoint->job = m_renderJob;
+	ImageBuffer& buffer = checkpoint->buffer;
+	buffer.width = m_buffer.width;
+	buffer.height = m_buffer.height;
+	buffer.tilesX = m_buffer.tilesX;
+	buffer.tilesY = m_buffer.tilesY;
+	buffer.colorData = m_buffer.colorData;
+	buffer.varianceData = m_buffer.varianceData;
+	buffer.sampleCounts = m_buffer.sampleCounts;
+	buffer.albedoData = m_buffer.albedoData;
+	buffer.normalData = m_buffer.normalData;
+	buffer.depthData = m_buffer.depthData;
+	buffer.tileActive = m_buffer.tileActive;
+	m_splats.copySums(checkpoint->splats);
+	checkpoint->splatPathCount = m_splats.pathCount();
+
+	m_checkpointWrite = m_ioThread.post([path, checkpoint]()
+	{
+		return writeCheckpoint(path, *checkpoint);
+	});
+	return true;
+}
+
+bool RayTracer::finishCheckpoint()
+{
+	if (m_checkpointWrite.valid() == false)
+		return true;
+	const bool isWritten = m_checkpointWrite.get();
+	if (isWritten == false)
+		std::cout << "Couldn't write a checkpoint\n";
+	return isWritten;
+}
+
+bool RayTracer::saveImage(const std::string& path, bool isFeatures, bool isFloat)
+{
+	if (m_imageWrite.valid())
+	{
+		if (m_imageWrite.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return false;
+		finishImage();
+	}
+
+	// The half floats and the compression are left to the I/O thread.
+	if (m_image == nullptr)
+		m_image.reset(new HdrImage);
+	HdrImage* image = m_image.get();
+	image->width = m_buffer.width;
+	image->height = m_buffer.height;
+	if (isRefined() == false && m_finishedRefinementStep > 0)
+	{
+		image->color.resize(m_buffer.colorData.size());
+		m_buffer.upsampleLattice(m_finishedRefinementStep, image->color, m_threadPool);
+	}
+	else
+	{
+		image->color = m_buffer.colorData;
+	}
+	addSplats(image->color);
+	if (isFeatures)
+	{
+		image->albedo = m_buffer.albedoData;
+		image->normal = m_buffer.normalData;
+		image->depth = m_buffer.depthData;
+	}
+	else
+	{
+		image->albedo.clear();
+		image->normal.clear();
+		image->depth.clear();
+	}
+
+	m_imageWrite = m_ioThread.post([path, image, isFloat]()
+	{
+		return writeHdrImage(path, *image, isFloat);
+	});
+	return true;
+}
+
+bool RayTracer::finishImage()
+{
+	if (m_imageWrite.valid() == false)
+		return true;
+	const bool isWritten = m_imageWrite.get();
+	if (isWritten == false)
+		std::cout << "Couldn't write an image\n";
+	return isWritten;
+}
+
+bool RayTracer::loadCheckpoint(const std::string& path)
+{
+	RenderCheckpoint checkpoint;
+	if (m_sceneHash == 0 || m_integratorType == IntegratorType::Restir
+		|| readCheckpoint(path, checkpoint) == false || checkpoint.key != checkpointKey()
+		|| checkpoint.buffer.width != m_buffer.width || checkpoint.buffer.height != m_buffer.height
+		|| m_splats.width() != m_buffer.width || m_splats.height() != m_buffer.height)
+		return false;
+
+	ImageBuffer& buffer = checkpoint.buffer;
+	m_buffer.colorData.swap(buffer.colorData);
+	m_buffer.varianceData.swap(buffer.varianceData);
+	m_buffer.sampleCounts.swap(buffer.sampleCounts);
+	m_buffer.albedoData.swap(buffer.albedoData);
+	m_buffer.normalData.swap(buffer.normalData);
+	m_buffer.depthData.swap(buffer.depthData);
+	m_buffer.tileActive.swap(buffer.tileActive);
+	m_splats.setSums(checkpoint.splats, checkpoint.splatPathCount);
+	m_accumulationView = m_cameraSystem.getCurrentCamera().view();
+	m_currentSample = checkpoint.currentSample;
+	m_refinementStep = checkpoint.refinementStep;
+	m_finishedRefinementStep = checkpoint.finishedRefinementStep;
+	m_activeTileCount = checkpoint.activeTileCount;
+	updateRegionSampleCount();
+	m_denoisedSample = -1;
+
+	m_renderJob = checkpoint.job;
+	if (m_renderJob.isActive)
+		cloneThreadSamplers();
+	return true;
+}
+
+void RayTracer::toggleRenderToErrorThreshold()
+{
+	m_isRenderToErrorThreshold = !m_isRenderToErrorThreshold;
+	clear();
 }
 
 std::string toString(const HitRecord& record)
@@ -347,44 +958,298 @@ void RayTracer::autoFocus()
 	}
 }
 
-vec3 RayTracer::rayTrace(const Ray& ray, Hitable& world, int depth)
+namespace
+{
+	float powerHeuristic(float pdf, float otherPdf)
+	{
+		float squared = pdf * pdf;
+		float sum = squared + otherPdf * otherPdf;
+		return sum > 0.0f ? squared / sum : 0.0f;
+	}
+}
+
+vec3 RayTracer::sampleDirectLight(const HitRecord& record, Sampler& sampler, int guideDistribution)
+{
+	const vec3 black(0.0f, 0.0f, 0.0f);
+
+	// The dimensions are taken even without lights, to keep them the same for every path.
+	const float lightChoice = sampler.get1D();
+	const vec2 pointOnLight = sampler.get2D();
+
+	float lightPmf = 0.0f;
+	const int lightIndex = m_lightBvh.sample(record.point, record.normal, lightChoice, lightPmf);
+	if (lightIndex == -1)
+		return black;
+
+	LightSample lightSample = m_lightBvh.light(lightIndex).sample(record.point, pointOnLight);
+	if (lightSample.pdf <= 0.0f)
+		return black;
+
+	vec3 bsdf = record.material->evaluate(record.normal, lightSample.direction);
+	if (bsdf == black)
+		return black;
+
+	HitRecord occluder;
+	if (m_tree.hit(Ray(record.point, lightSample.direction), 0.001f, lightSample.distance * 0.999f, occluder))
+		return black;
+
+	const float lightPdf = lightPmf * lightSample.pdf;
+	const float weight = powerHeuristic(lightPdf, diffusePdf(record, guideDistribution, lightSample.direction));
+	return bsdf * lightSample.radiance * (weight / lightPdf);
+}
+
+float RayTracer::diffusePdf(const HitRecord& record, int guideDistribution, const vec3& direction) const
+{
+	const float bsdfPdf = record.material->pdf(record.normal, direction);
+	if (guideDistribution == -1)
+		return bsdfPdf;
+
+	const float guideProbability = m_pathGuide.guideProbability();
+	return guideProbability * m_pathGuide.pdf(guideDistribution, direction) + (1.0f - guideProbability) * bsdfPdf;
+}
+
+bool RayTracer::scatterDiffuse(const Ray& ray, const HitRecord& record, int guideDistribution, Sampler& sampler,
+	Ray& scattered, vec3& attenuation, float& pdf)
+{
+	if (guideDistribution == -1)
+	{
+		if (record.material->scatter(ray, record, attenuation, scattered, sampler) == false)
+			return false;
+		pdf = record.material->pdf(record.normal, glm::normalize(scattered.direction()));
+		return true;
+	}
+
+	// One-sample MIS: pick the guide or the BSDF, and weight by the pdf of the mixture.
+	const float choice = sampler.get1D();
+	const vec2 u = sampler.get2D();
+	const vec3 direction = choice < m_pathGuide.guideProbability()
+		? m_pathGuide.sample(guideDistribution, u)
+		: toWorld(sampleCosineHemisphere(u), record.normal);
+
+	pdf = diffusePdf(record, guideDistribution, direction);
+	const vec3 bsdf = record.material->evaluate(record.normal, direction);
+	if (pdf <= 0.0f || bsdf == vec3(0.0f, 0.0f, 0.0f))
+		return false;
+
+	scattered = Ray(record.point, direction);
+	attenuation = bsdf / pdf;
+	return true;
+}
+
+vec3 RayTracer::rayTrace(const Ray& cameraRay, int depth, Sampler& sampler, PixelFeatures* features,
+	bool isLightSampled)
 {
 	Camera& camera = m_cameraSystem.getCurrentCamera();
-	HitRecord record;
-	if (m_tree.hit(ray, 0.001f, rayMaxLength(), record))
+
+	vec3 color(0.0f, 0.0f, 0.0f);
+	vec3 throughput(1.0f, 1.0f, 1.0f);
+	Ray ray = cameraRay;
+
+	// After a diffuse vertex the lights were also sampled directly, so hitting one is MIS weighted.
+	bool isAfterDiffuse = false;
+	vec3 previousPoint;
+	vec3 previousNormal;
+	float previousPdf = 0.0f;
+
+	// The path guide learns from the light that the scattered rays found, without the light samples
+	// and MIS weights, which makes an unbiased estimate of the incident light at each diffuse vertex.
+	const bool isTraining = m_isPathGuiding && isFastMode() == false;
+	struct GuideVertex
+	{
+		vec3 point;
+		vec3 direction;
+		vec3 trainingColor; // before the light that arrived from the direction
+		vec3 throughput; // after the vertex
+		float cosPerPdf;
+	};
+	static const int MaxGuideVertices = 16;
+	GuideVertex guideVertices[MaxGuideVertices];
+	int guideVertexCount = 0;
+	vec3 trainingColor(0.0f, 0.0f, 0.0f);
+
+	// The radiance cache learns the irradiance at the diffuse vertices of full paths. In preview, the
+	// other paths end into the cache at their second diffuse vertex. isLightSampled rays leave the first.
+	struct CacheVertex
 	{
+		vec3 point;
+		vec3 normal;
+		vec3 albedo;
+		vec3 color; // before the light reflected at the vertex
+		vec3 throughput; // arriving at the vertex
+	};
+	static const int MaxCacheVertices = 16;
+	CacheVertex cacheVertices[MaxCacheVertices];
+	int cacheVertexCount = 0;
+	int diffuseVertexCount = isLightSampled ? 1 : 0;
+	bool isEndedInCache = false;
+	const bool isCacheTrainingPath = m_isRadianceCache
+		&& (m_isCachePreview == false || sampler.get1D() < m_cacheTrainingFraction);
+
+	// The photon map has the light that reaches a diffuse vertex through specular bounces, so after
+	// a gather the path leaves out the lights it finds through specular surfaces.
+	const bool isGatheringCaustics = isCausticsActive();
+	bool isCausticPath = isLightSampled && isGatheringCaustics;
+
+	for (;; ++depth)
+	{
+		HitRecord record;
+		if (m_tree.hit(ray, 0.001f, rayMaxLength(), record) == false)
+		{
+			vec3 skyColor = sky(ray);
+			if (features)
+			{
+				features->albedo = skyColor;
+				features->normal = vec3(0.0f, 0.0f, 0.0f);
+				features->depth = FLT_MAX;
+			}
+			color += throughput * skyColor;
+			trainingColor += throughput * skyColor;
+			break;
+		}
+
+		if (features)
+		{
+			features->albedo = record.material->albedo;
+			features->normal = record.normal;
+			// From the centre of the lens, which reprojection knows for the history too.
+			features->depth = glm::length(record.point - camera.position());
+			features = nullptr; // only from the camera ray
+		}
+
 		// Visualize focus distance with a line
 		if (m_isVisualizeFocusDistance)
 		{
 			float hitDistance = glm::length(record.point - camera.position());
 			if (Utils::isEqual(camera.focusDistance(), hitDistance, 0.01f) == true)
 			{
-				return vec3(0,1,1); // cyan line
+				return color + throughput * vec3(0,1,1); // cyan line
 			}
 		}
 
+		// FastMode returns just the material color
+		if (isFastMode())
+		{
+			return color + throughput * record.material->albedo;
+		}
+
 		// Normal raytracing
-		if (isFastMode() == false)
+		vec3 emitted = record.material->emitted(record.point);
+		if (emitted != vec3(0.0f, 0.0f, 0.0f))
 		{
-			Ray scattered;
-			vec3 attenuation;
-			vec3 emitted = record.material->emitted(record.point);
+			float weight = 1.0f;
+			const int lightIndex = (isAfterDiffuse || isLightSampled) ? m_lightBvh.lightIndex(record) : -1;
+			if (lightIndex != -1 && isLightSampled)
+			{
+				weight = 0.0f;
+			}
+			else if (isCausticPath && isAfterDiffuse == false)
+			{
+				weight = 0.0f;
+			}
+			else if (lightIndex != -1)
+			{
+				float lightPdf = m_lightBvh.pmf(previousPoint, previousNormal, lightIndex)
+					* m_lightBvh.light(lightIndex).pdf(previousPoint, record.point);
+				weight = powerHeuristic(previousPdf, lightPdf);
+			}
+			color += throughput * emitted * weight;
+			trainingColor += throughput * emitted;
+		}
+		isLightSampled = false;
+
+		if (depth >= m_frameBouncesLimit)
+			break;
+
+		const bool isDiffuse = record.material->isDiffuse();
 
-			if (depth < m_bouncesLimit && record.material->scatter(ray, record, attenuation, scattered))
+		if (isDiffuse && isCacheTrainingPath == false && m_isCachePreview && diffuseVertexCount >= 1)
+		{
+			vec3 irradiance;
+			if (m_radianceCache.lookup(record.point, record.normal, irradiance))
 			{
-				return emitted + attenuation * rayTrace(scattered, world, depth + 1);
+				color += throughput * record.material->albedo * irradiance / Math::PI;
+				isEndedInCache = true;
+				break;
 			}
-			else
+		}
+
+		if (isDiffuse)
+		{
+			++diffuseVertexCount;
+			if (isCacheTrainingPath && cacheVertexCount < MaxCacheVertices)
 			{
-				return emitted;
+				CacheVertex& vertex = cacheVertices[cacheVertexCount++];
+				vertex.point = record.point;
+				vertex.normal = record.normal;
+				vertex.albedo = record.material->albedo;
+				vertex.color = color;
+				vertex.throughput = throughput;
 			}
 		}
-		else // FastMode returns just the material color
+
+		// Light samples only where a scattered ray can also find the light, so that MIS gets both halves.
+		const int guideDistribution = (isDiffuse && m_isPathGuiding) ? m_pathGuide.findDistribution(record.point) : -1;
+		if (isDiffuse)
+			color += throughput * sampleDirectLight(record, sampler, guideDistribution);
+		if (isDiffuse && isGatheringCaustics)
+			color += throughput * record.material->albedo * m_causticPhotons.irradiance(record.point, record.normal) / Math::PI;
+		if (isDiffuse)
+			isCausticPath = isGatheringCaustics;
+
+		Ray scattered;
+		vec3 attenuation;
+		float scatterPdf = 0.0f;
+		if (isDiffuse)
 		{
-			return record.material->albedo;
+			if (scatterDiffuse(ray, record, guideDistribution, sampler, scattered, attenuation, scatterPdf) == false)
+				break;
 		}
+		else if (record.material->scatter(ray, record, attenuation, scattered, sampler) == false)
+		{
+			break;
+		}
+
+		throughput *= attenuation;
+		isAfterDiffuse = isDiffuse;
+		if (isDiffuse)
+		{
+			previousPoint = record.point;
+			previousNormal = record.normal;
+			previousPdf = scatterPdf;
+
+			if (isTraining && guideVertexCount < MaxGuideVertices)
+			{
+				GuideVertex& vertex = guideVertices[guideVertexCount++];
+				vertex.point = record.point;
+				vertex.direction = glm::normalize(scattered.direction());
+				vertex.trainingColor = trainingColor;
+				vertex.throughput = throughput;
+				vertex.cosPerPdf = glm::dot(record.normal, vertex.direction) / scatterPdf;
+			}
+		}
+		ray = scattered;
+	}
+
+	// Lambertian surfaces reflect albedo / pi times the irradiance.
+	for (int i = 0; i < cacheVertexCount && isEndedInCache == false; ++i)
+	{
+		const CacheVertex& vertex = cacheVertices[i];
+		const vec3 reflected = (color - vertex.color) / glm::max(vertex.throughput, vec3(1.0e-6f));
+		m_radianceCache.record(vertex.point, vertex.normal, reflected * Math::PI / glm::max(vertex.albedo, vec3(1.0e-3f)));
+	}
+
+	// The guide learns the incident light times the cosine, divided by the pdf of the direction.
+	for (int i = 0; i < guideVertexCount; ++i)
+	{
+		const GuideVertex& vertex = guideVertices[i];
+		const float throughputLuminance = luminance(vertex.throughput);
+		if (throughputLuminance <= 0.0f)
+			continue;
+		const float incident = luminance(trainingColor - vertex.trainingColor) / throughputLuminance;
+		m_pathGuide.record(vertex.point, vertex.direction, incident * vertex.cosPerPdf);
 	}
-	return sky(ray);
+
+	return color;
 }
 
 vec3 RayTracer::sky(const Ray& ray)
@@ -398,57 +1263,178 @@ vec3 RayTracer::sky(const Ray& ray)
 
 void RayTracer::update(double time, double deltaTime, std::vector<Entity>& entities)
 {
-	/*
-	Old time based switch buffers system:
-
-	if (switchTime > 0.0f)
-	{
-		if (m_buffer != &m_bigBuffer
-			&&
-			(total_ray_tracing_time >= switchTime
-			||
-			current_sample >= samples_limit))
-		{
-			m_buffer = &m_bigBuffer;
-			m_buffer->clear();
-			current_sample = 0;
-		}
-	}
-	*/
-
 	if (m_startTime == -1.0f)
 		m_startTime = time;
 
 	if (m_totalRayTracingTime == -1.0f)
 		m_totalRayTracingTime = time;
 
+	updateSceneLoad();
+
 	#ifdef RENDER_ALL_AT_ONCE
 		renderAllAtOnce(time);
 	#else
 
-		renderSamples(time, deltaTime);
-		if (m_currentSample <= m_samplesLimit) // do once more than render
+		// The governor decides this frame's quality from the cost of the last one.
+		const double reprojectionTime = m_isCameraChanged ? m_reprojectionTime : 0.0;
+		m_governor.update(reprojectionTime + m_lastPassTime + m_lastDisplayTime, m_isCameraChanged, m_bouncesLimit);
+		if (m_governor.isQualityRestored())
+			clear();
+		m_frameBouncesLimit = m_governor.bouncesLimit();
+
+		// The cached light is a biased preview, so its samples go once the camera stops.
+		m_isCachePreview = m_isRadianceCache && m_governor.isCameraMoving();
+		if (m_hasCachedSamples && m_isCachePreview == false)
 		{
+			clear();
+			m_hasCachedSamples = false;
+		}
+		m_hasCachedSamples = m_hasCachedSamples || m_isCachePreview;
+
+		// Reprojection and the display update come out of the same budget.
+		double timeBudget = m_governor.frameBudget() - reprojectionTime - m_lastDisplayTime;
+		if (m_integratorType == IntegratorType::Restir)
+		{
+			// The reservoirs are resampled over the whole image, so a ReSTIR frame is not split by the budget.
+			if (isRenderingDone() == false)
+			{
+				m_totalRayTracingTime = time - m_startTime;
+				renderRestirFrame();
+			}
+		}
+		else renderSamples(time, std::max(0.0, timeBudget));
+
+		// Once more after the render is done. Passes of a region of interest can go past the limit.
+		if (m_currentSample <= m_samplesLimit || m_displayedSample != m_currentSample)
+		{
+			auto displayStartTime = std::chrono::steady_clock::now();
 			updateImageBuffer();
+			std::chrono::duration<double> displayTime = std::chrono::steady_clock::now() - displayStartTime;
+			m_lastDisplayTime = displayTime.count();
+			m_displayedSample = m_currentSample;
 		}
+
+		m_isCameraChanged = false;
 	#endif
 }
 
-void RayTracer::toggleBufferQuality()
+float RayTracer::rayMaxLength()
+{
+	if (isFastMode() == false)
+		return FLT_MAX;
+	else return 5.0f;
+}
+
+void RayTracer::nextSampler()
+{
+	m_samplerType = SamplerType((int(m_samplerType) + 1) % int(SamplerType::Count));
+	clear();
+}
+
+void RayTracer::nextIntegrator()
+{
+	m_integratorType = IntegratorType((int(m_integratorType) + 1) % int(IntegratorType::Count));
+	m_restir.clearHistory();
+	clear();
+}
+
+void RayTracer::nextRoiMode()
+{
+	// The samples stay valid, only their distribution changes.
+	m_roiMode = RoiMode((int(m_roiMode) + 1) % int(RoiMode::Count));
+	reopenRegion();
+}
+
+const char* RayTracer::roiModeName() const
 {
-	if (m_buffer == &m_smallBuffer)
+	switch (m_roiMode)
 	{
-		m_buffer = &m_bigBuffer;
+		case RoiMode::Cursor: return "cursor";
+		case RoiMode::Crop: return "crop";
+		default:
+		break;
 	}
-	else m_buffer = &m_smallBuffer;
-	clear();
+	return "OFF";
 }
 
-float RayTracer::rayMaxLength()
+void RayTracer::setCropWindow(vec2 corner0, vec2 corner1)
 {
-	if (isFastMode() == false)
-		return FLT_MAX;
-	else return 5.0f;
+	m_cropMin = glm::clamp(glm::min(corner0, corner1), vec2(0.0f, 0.0f), vec2(1.0f, 1.0f));
+	m_cropMax = glm::clamp(glm::max(corner0, corner1), vec2(0.0f, 0.0f), vec2(1.0f, 1.0f));
+	if (m_roiMode == RoiMode::Crop)
+		reopenRegion();
+}
+
+void RayTracer::regionBounds(int step, int& startX, int& startY, int& endX, int& endY) const
+{
+	startX = 0;
+	startY = 0;
+	endX = m_buffer.width;
+	endY = m_buffer.height;
+	if (m_roiMode == RoiMode::Crop)
+	{
+		// Rounded out to the lattice, so that the crop samples the same points as the whole image.
+		startX = (int(m_cropMin.x * float(m_buffer.width)) / step) * step;
+		startY = (int(m_cropMin.y * float(m_buffer.height)) / step) * step;
+		endX = std::min(m_buffer.width, std::max(startX + 1, int(ceil(m_cropMax.x * float(m_buffer.width)))));
+		endY = std::min(m_buffer.height, std::max(startY + 1, int(ceil(m_cropMax.y * float(m_buffer.height)))));
+	}
+}
+
+void RayTracer::updateRegionSampleCount()
+{
+	int startX, startY, endX, endY;
+	regionBounds(1, startX, startY, endX, endY);
+	// Once a pass, so a plain loop is quick enough.
+	int fewest = std::numeric_limits<int>::max();
+	for (int j = startY; j < endY; ++j)
+	{
+		for (int i = startX; i < endX; ++i)
+		{
+			if (m_isRenderToErrorThreshold && m_buffer.isTileActive(i, j) == false)
+				continue;
+			fewest = std::min(fewest, m_buffer.sampleCounts[(j * m_buffer.width) + i]);
+		}
+	}
+	m_regionSampleCount = fewest;
+}
+
+void RayTracer::reopenRegion()
+{
+	m_renderJob.isActive = false;
+	int startX, startY, endX, endY;
+	regionBounds(1, startX, startY, endX, endY);
+	// The tiles that converged with some of their pixels outside the last crop get another look.
+	m_buffer.activateTiles(startX, startY, endX, endY);
+	if (m_isRenderToErrorThreshold && m_currentSample >= m_adaptiveMinSamples)
+		m_activeTileCount = m_buffer.updateActiveTiles(m_targetError, m_adaptiveMinSamples, startX, startY, endX, endY);
+	else
+		m_activeTileCount = m_buffer.tileCount();
+	updateRegionSampleCount();
+}
+
+const char* RayTracer::integratorName() const
+{
+	switch (m_integratorType)
+	{
+		case IntegratorType::Restir: return "ReSTIR direct light";
+		case IntegratorType::Bdpt: return "Bidirectional path tracing";
+		default:
+		break;
+	}
+	return "Path tracing";
+}
+
+Sampler& RayTracer::sampler()
+{
+	switch (m_samplerType)
+	{
+		case SamplerType::Random: return m_randomSampler;
+		case SamplerType::Sobol: return m_sobolSampler;
+		default:
+		break;
+	}
+	return m_zSobolSampler;
 }
 
 void RayTracer::plusBounces(int delta)
@@ -475,30 +1461,36 @@ void RayTracer::renderAllAtOnce(double time)
 	if (m_currentSample < m_samplesLimit)
 	{
 		Camera& camera = m_cameraSystem.getCurrentCamera();
+		Sampler& pixelSampler = sampler();
 		m_startTime = time;
 
-		for (int j = 0; j < m_buffer->height; ++j)
+		for (int j = 0; j < m_buffer.height; ++j)
 		{
-			for (int i = 0; i < m_buffer->width; ++i)
+			for (int i = 0; i < m_buffer.width; ++i)
 			{
 				vec3 color;
 
 				for (int sample = 0; sample < m_samplesLimit; sample++)
 				{
-					float u = float(i + drand48()) / float(m_buffer->width);
-					float v = float(j + drand48()) / float(m_buffer->height);
+					pixelSampler.startPixelSample(i, j, sample);
+					vec2 pixelSample = pixelSampler.get2D();
+					float u = float(i + pixelSample.x) / float(m_buffer.width);
+					float v = float(j + pixelSample.y) / float(m_buffer.height);
 					
-					Ray ray = camera.getRay(u, v);
-					color += rayTrace(ray, m_world, 0);
+					Ray ray = camera.getRay(u, v, pixelSampler.get2D());
+					color += rayTrace(ray, 0, pixelSampler);
 				}
 
 				color /= float(m_samplesLimit);
 
-				m_buffer->colorData[(j * m_buffer->width) + i] = color;
+				m_buffer.colorData[(j * m_buffer.width) + i] = color;
+				m_buffer.sampleCounts[(j * m_buffer.width) + i] = m_samplesLimit;
 			}
 		}
 		
 		m_currentSample = m_samplesLimit;
+		m_regionSampleCount = m_samplesLimit;
+		m_refinementStep = 0;
 	}
 	else if (m_currentSample == m_samplesLimit)
 	{
@@ -511,130 +1503,363 @@ void RayTracer::renderAllAtOnce(double time)
 	}
 }
 
-void RayTracer::renderSamples(double time, double deltaTime)
+double RenderJob::estimatedTime() const
+{
+	if (nextTile == 0)
+		return elapsedTime;
+	return elapsedTime * double(tilesX * tilesY) / double(nextTile);
+}
+
+void RayTracer::renderSamples(double time, double timeBudget)
 {
 	// timings for 100 samples at 500x250:
 	// 15.426324 s
 	// 15.402015 s
 	// 15.347182 s
 
-	if (m_currentSample < m_samplesLimit)
+	if (isRenderingDone())
+		return;
+
+	m_totalRayTracingTime = time - m_startTime;
+
+	auto startTime = std::chrono::steady_clock::now();
+	double elapsedTime = 0.0;
+	double lastBatchTime = 0.0;
+
+	while (isRenderingDone() == false)
 	{
-		Camera& camera = m_cameraSystem.getCurrentCamera();
-		m_totalRayTracingTime = time - m_startTime;
+		if (m_renderJob.isActive == false)
+			startRenderJob();
+
+		// Always make some progress, then stop when another batch like the last one wouldn't fit.
+		if (lastBatchTime > 0.0 && elapsedTime + lastBatchTime > timeBudget)
+			break;
+
+		// A couple of tiles per thread keeps the threads busy while the batches stay short.
+		const int batchSize = std::min(m_threadPool.threadCount() * 2,
+			(m_renderJob.tilesX * m_renderJob.tilesY) - m_renderJob.nextTile);
+		const int firstTile = m_renderJob.nextTile;
 
-		for (int j = 0; j < m_buffer->height; ++j)
+		auto batchStartTime = std::chrono::steady_clock::now();
+		m_threadPool.parallelFor(batchSize, [&](int index, int threadIndex)
 		{
-			for (int i = 0; i < m_buffer->width; ++i)
-			{
-				float u = float(i + drand48()) / float(m_buffer->width);
-				float v = float(j + drand48()) / float(m_buffer->height);
+			renderTile(firstTile + index, *m_threadSamplers[threadIndex]);
+		});
+		std::chrono::duration<double> batchTime = std::chrono::steady_clock::now() - batchStartTime;
+		lastBatchTime = batchTime.count();
+
+		m_renderJob.nextTile += batchSize;
+		m_renderJob.elapsedTime += lastBatchTime;
+		m_lastPassTime = m_renderJob.estimatedTime();
 
-				Ray ray = camera.getRay(u, v);
-				vec3 color = rayTrace(ray, m_world, 0);
+		if (m_renderJob.isFinished())
+			finishRenderJob();
 
-				//http://stackoverflow.com/questions/22999487/update-the-average-of-a-continuous-sequence-of-numbers-in-constant-time
-				// add to average
-				m_buffer->colorData[(j * m_buffer->width) + i]
-					= (float(m_currentSample) * m_buffer->colorData[(j * m_buffer->width) + i] + color) / float(m_currentSample + 1);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+		elapsedTime = elapsed.count();
+	}
+}
+
+void RayTracer::startRenderJob()
+{
+	RenderJob& job = m_renderJob;
+	job.isActive = true;
+	job.isRefinement = isRefined() == false;
+	job.step = job.isRefinement ? m_refinementStep : 1;
+	job.isAdaptive = job.isRefinement == false && m_isRenderToErrorThreshold && m_currentSample >= m_adaptiveMinSamples;
+
+	regionBounds(job.step, job.startX, job.startY, job.endX, job.endY);
+
+	const int tileSize = RenderJob::TileLatticeSize * job.step;
+	job.tilesX = (job.endX - job.startX + tileSize - 1) / tileSize;
+	job.tilesY = (job.endY - job.startY + tileSize - 1) / tileSize;
+	job.nextTile = 0;
+	job.elapsedTime = 0.0;
+
+	cloneThreadSamplers();
+}
+
+void RayTracer::cloneThreadSamplers()
+{
+	// Fresh clones pick up a changed sampler type.
+	m_threadSamplers.clear();
+	for (int i = 0; i < m_threadPool.threadCount(); ++i)
+		m_threadSamplers.push_back(std::unique_ptr<Sampler>(sampler().clone()));
+}
+
+void RayTracer::renderTile(int tileIndex, Sampler& pixelSampler)
+{
+	const RenderJob& job = m_renderJob;
+	Camera& camera = m_cameraSystem.getCurrentCamera();
+
+	const int tileSize = RenderJob::TileLatticeSize * job.step;
+	const int startX = job.startX + (tileIndex % job.tilesX) * tileSize;
+	const int startY = job.startY + (tileIndex / job.tilesX) * tileSize;
+	const int endX = std::min(job.endX, startX + tileSize);
+	const int endY = std::min(job.endY, startY + tileSize);
+
+	// The refinement gives every pixel its first sample. After that, the cursor mode skips tiles
+	// by chance. Each pixel averages only its own samples, so the image stays unbiased.
+	if (job.isRefinement == false && m_roiMode == RoiMode::Cursor)
+	{
+		const uint64_t hash = mixBits((uint64_t(tileIndex) << 32) | uint64_t(m_currentSample));
+		const float u = float(hash >> 40) / float(1 << 24);
+		if (u >= roiWeight(startX, startY, endX, endY))
+			return;
+	}
+
+	for (int j = startY; j < endY; j += job.step)
+	{
+		for (int i = startX; i < endX; i += job.step)
+		{
+			if (job.isRefinement)
+			{
+				// Points of the coarser lattices, and the ones seeded by reprojection, already have their sample.
+				if (m_buffer.sampleCounts[(j * m_buffer.width) + i] > 0)
+					continue;
 			}
+			else if ((job.isAdaptive && m_buffer.isTileActive(i, j) == false)
+				|| m_buffer.sampleCounts[(j * m_buffer.width) + i] >= m_samplesLimit)
+			{
+				// The pixels of the region of interest can reach the limit before the rest.
+				continue;
+			}
+
+			traceSample(i, j, camera, pixelSampler);
 		}
-		
-		m_currentSample++;
 	}
+
+	// Once per tile, so the threads rarely touch the shared counter.
+	m_rayCount.fetch_add(BvhNode::takeRayCount(), std::memory_order_relaxed);
 }
 
-void RayTracer::updateImageBuffer()
+float RayTracer::roiWeight(int startX, int startY, int endX, int endY) const
 {
-	m_buffer->update8BitImageBuffer(m_vg);
+	// Distance from the cursor to the nearest pixel of the tile, in image heights
+	const vec2 cursor(m_roiCenter.x * float(m_buffer.width), m_roiCenter.y * float(m_buffer.height));
+	const vec2 nearest(
+		glm::clamp(cursor.x, float(startX), float(endX)),
+		glm::clamp(cursor.y, float(startY), float(endY)));
+	const float distance = glm::length(nearest - cursor) / float(m_buffer.height);
+	if (distance <= m_roiRadius)
+		return 1.0f;
+
+	const float falloff = (distance - m_roiRadius) / m_roiRadius;
+	return std::max(m_roiOutsideWeight, exp(-falloff * falloff));
 }
 
-void RayTracer::renderNanoVG(NVGcontext* vg, float x, float y, float w, float h)
+void RayTracer::updateCaustics()
 {
-	ImageBuffer& readBuffer = imageBuffer();
-
-	nvgSave(vg);
+	// BDPT finds the caustics with its light subpaths.
+	if (m_isCaustics && isFastMode() == false && m_integratorType != IntegratorType::Bdpt)
+		m_causticPhotons.emitPass(m_tree, m_lightBvh, m_threadPool);
+}
 
-	//override the given parameters and reuse w and h...
-	/*
-	x = -g_rae->screenHalfWidthP();
-	y = -g_rae->screenHalfHeightP();
-	w = g_rae->screenWidthP();
-	h = g_rae->screenHeightP();
-	*/
+void RayTracer::finishRenderJob()
+{
+	m_renderJob.isActive = false;
 
-	m_imgPaint = nvgImagePattern(vg, x, y, w, h, 0.0f, readBuffer.imageId, 1.0f);
-	nvgBeginPath(vg);
-	nvgRect(vg, x, y, w, h);
-	nvgFillPaint(vg, m_imgPaint);
-	nvgFill(vg);
+	// No thread is rendering between the batches, so the guide can swap in what it learned.
+	if (m_isPathGuiding)
+		m_pathGuide.update();
+	updateCaustics();
 
-	// Text
-	if (m_isInfoText)
+	if (m_renderJob.isRefinement)
 	{
-		Camera& camera = m_cameraSystem.getCurrentCamera();
+		m_finishedRefinementStep = m_renderJob.step;
+		m_refinementStep = m_renderJob.step / 2;
+		if (isRefined() == false)
+			return;
+	}
 
-		nvgFontFace(vg, "sans");
+	// The last refinement pass completes the first sample of every pixel.
+	m_currentSample++;
 
-		nvgFontSize(vg, 18.0f);
-		nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
-		nvgFillColor(vg, nvgRGBA(128, 128, 128, 192));
-	
-		float vertPos = 200.0f;
+	if (m_isRenderToErrorThreshold && m_currentSample >= m_adaptiveMinSamples)
+	{
+		int startX, startY, endX, endY;
+		regionBounds(1, startX, startY, endX, endY);
+		m_activeTileCount = m_buffer.updateActiveTiles(m_targetError, m_adaptiveMinSamples, startX, startY, endX, endY);
+	}
+	updateRegionSampleCount();
+}
 
-		std::string samplesStr = "Samples: " + std::to_string(m_currentSample);
-		nvgText(vg, 10.0f, vertPos, samplesStr.c_str(), nullptr); vertPos += 20.0f;
+void RayTracer::traceSample(int i, int j, Camera& camera, Sampler& pixelSampler)
+{
+	const int index = (j * m_buffer.width) + i;
+
+	// Pixel jitter and lens get the first dimensions, which are the best distributed.
+	pixelSampler.startPixelSample(i, j, m_buffer.sampleCounts[index]);
+	vec2 pixelSample = pixelSampler.get2D();
+	float u = float(i + pixelSample.x) / float(m_buffer.width);
+	float v = float(j + pixelSample.y) / float(m_buffer.height);
+
+	Ray ray = camera.getRay(u, v, pixelSampler.get2D());
+	PixelFeatures features;
+	vec3 color = isBdptActive()
+		? m_bdpt.trace(camera.view(), ray, m_frameBouncesLimit, pixelSampler, m_splats, &features)
+		: rayTrace(ray, 0, pixelSampler, &features);
+
+	m_buffer.addSample(index, color);
+	m_buffer.addFeatures(index, features);
+}
 
-		std::string samplesLimitStr = "/" + std::to_string(m_samplesLimit);
-		nvgText(vg, 10.0f, vertPos, samplesLimitStr.c_str(), nullptr); vertPos += 20.0f;
+void RayTracer::renderRestirFrame()
+{
+	auto startTime = std::chrono::steady_clock::now();
 
-		std::string totalTimeStr = "Time: " + std::to_string(m_totalRayTracingTime) + " s";
-		nvgText(vg, 10.0f, vertPos, totalTimeStr.c_str(), nullptr); vertPos += 20.0f;
+	const int width = m_buffer.width;
+	const int height = m_buffer.height;
+	m_restir.resize(width, height);
+	m_restirColor.resize(width * height);
+	m_restirFeatures.resize(width * height);
 
-		std::string positionStr = "Position: "
-			+ std::to_string(camera.position().x) + ", "
-			+ std::to_string(camera.position().y) + ", "
-			+ std::to_string(camera.position().z);
-		nvgText(vg, 10.0f, vertPos, positionStr.c_str(), nullptr); vertPos += 20.0f;
+	// Fresh clones pick up a changed sampler type.
+	m_threadSamplers.clear();
+	for (int i = 0; i < m_threadPool.threadCount(); ++i)
+		m_threadSamplers.push_back(std::unique_ptr<Sampler>(sampler().clone()));
 
-		std::string yawStr = "Yaw: "
-			+ std::to_string(Math::toDegrees(camera.yaw())) + "°"
-			+ " Pitch: "
-			+ std::to_string(Math::toDegrees(camera.pitch())) + "°";
-		nvgText(vg, 10.0f, vertPos, yawStr.c_str(), nullptr); vertPos += 20.0f;
+	Camera& camera = m_cameraSystem.getCurrentCamera();
 
-		std::string fovStr = "Field of View: "
-			+ std::to_string(Math::toDegrees(camera.fieldOfView())) + "°";
-		nvgText(vg, 10.0f, vertPos, fovStr.c_str(), nullptr); vertPos += 20.0f;
+	// Primary hits and the initial reservoirs
+	m_threadPool.parallelFor(height, [&](int j, int threadIndex)
+	{
+		for (int i = 0; i < width; ++i)
+			tracePrimaryRestir(i, j, camera, *m_threadSamplers[threadIndex]);
+	});
 
-		std::string focusDistanceStr = "Focus distance: "
-			+ std::to_string(camera.focusDistance());
-		nvgText(vg, 10.0f, vertPos, focusDistanceStr.c_str(), nullptr); vertPos += 20.0f;
+	m_restir.reuse(m_threadPool);
 
-		nvgText(vg, 10.0f, vertPos, camera.isContinuousAutoFocus() ? "Autofocus ON" : "Autofocus OFF", nullptr);
-		vertPos += 20.0f;
+	m_threadPool.parallelFor(height, [&](int j, int)
+	{
+		for (int i = 0; i < width; ++i)
+		{
+			const int index = (j * width) + i;
+			m_buffer.addSample(index, m_restirColor[index] + m_restir.shade(index));
+			m_buffer.addFeatures(index, m_restirFeatures[index]);
+		}
+	});
+
+	m_restir.endFrame(camera.view());
+	if (m_isPathGuiding)
+		m_pathGuide.update();
+	updateCaustics();
+
+	// Every pixel has its sample, whatever the refinement or reprojection left.
+	m_renderJob.isActive = false;
+	m_refinementStep = 0;
+	m_finishedRefinementStep = 1;
+	m_currentSample++;
+	updateRegionSampleCount();
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+	m_lastPassTime = elapsed.count();
+}
 
-		std::string apertureStr = "Aperture: "
-			+ std::to_string(camera.aperture());
-		nvgText(vg, 10.0f, vertPos, apertureStr.c_str(), nullptr); vertPos += 20.0f;
+void RayTracer::tracePrimaryRestir(int i, int j, Camera& camera, Sampler& pixelSampler)
+{
+	const int index = (j * m_buffer.width) + i;
+	RestirSurface& surface = m_restir.surface(index);
+	surface = RestirSurface();
 
-		std::string bouncesStr = "Bounces: "
-			+ std::to_string(m_bouncesLimit);
-		nvgText(vg, 10.0f, vertPos, bouncesStr.c_str(), nullptr); vertPos += 20.0f;
+	pixelSampler.startPixelSample(i, j, m_buffer.sampleCounts[index]);
+	vec2 pixelSample = pixelSampler.get2D();
+	float u = float(i + pixelSample.x) / float(m_buffer.width);
+	float v = float(j + pixelSample.y) / float(m_buffer.height);
+	Ray ray = camera.getRay(u, v, pixelSampler.get2D());
 
-		std::string debugStr = "Debug hit pos: "
-			+ std::to_string(debugHitRecord.point.x) + ", "
-			+ std::to_string(debugHitRecord.point.y) + ", "
-			+ std::to_string(debugHitRecord.point.z);
-		nvgText(vg, 10.0f, vertPos, debugStr.c_str(), nullptr); vertPos += 20.0f;
+	PixelFeatures& features = m_restirFeatures[index];
+	HitRecord record;
+	const bool isHit = isFastMode() == false && m_frameBouncesLimit > 0
+		&& m_tree.hit(ray, 0.001f, rayMaxLength(), record);
+	const bool isFocusLine = isHit && m_isVisualizeFocusDistance
+		&& Utils::isEqual(camera.focusDistance(), glm::length(record.point - camera.position()), 0.01f);
 
-		vec3 focusPos = camera.getFocusPosition();
-		std::string debugStr2 = "Debug focus pos: "
-			+ std::to_string(focusPos.x) + ", "
-			+ std::to_string(focusPos.y) + ", "
-			+ std::to_string(focusPos.z);
-		nvgText(vg, 10.0f, vertPos, debugStr2.c_str(), nullptr); vertPos += 20.0f;
+	// Only diffuse surfaces get reservoirs. The rest is path traced as usual.
+	if (isHit == false || isFocusLine || record.material->isDiffuse() == false)
+	{
+		m_restirColor[index] = rayTrace(ray, 0, pixelSampler, &features);
+		return;
 	}
 
-	nvgRestore(vg);
+	features.albedo = record.material->albedo;
+	features.normal = record.normal;
+	features.depth = glm::length(record.point - camera.position());
+
+	surface.point = record.point;
+	surface.normal = glm::normalize(record.normal);
+	surface.material = record.material;
+	surface.depth = features.depth;
+	m_restir.sampleInitial(i, j);
+
+	// Indirect light continues the path. The lights it finds first were covered by the reservoir.
+	vec3 color = record.material->emitted(record.point);
+	if (isCausticsActive())
+		color += record.material->albedo * m_causticPhotons.irradiance(record.point, record.normal) / Math::PI;
+	Ray scattered;
+	vec3 attenuation;
+	if (record.material->scatter(ray, record, attenuation, scattered, pixelSampler))
+		color += attenuation * rayTrace(scattered, 1, pixelSampler, nullptr, true);
+	m_restirColor[index] = color;
+}
+
+void RayTracer::addSplats(std::vector<vec3>& color)
+{
+	if (m_splats.isEmpty())
+		return;
+
+	m_threadPool.parallelFor(m_buffer.height, [&](int j, int)
+	{
+		for (int i = 0; i < m_buffer.width; ++i)
+		{
+			const int index = (j * m_buffer.width) + i;
+			color[index] += m_splats.pixel(index);
+		}
+	});
+}
+
+void RayTracer::updateImageBuffer()
+{
+	if (m_isVisualizeSampleCount)
+	{
+		m_buffer.updateSampleCountImage();
+	}
+	else if (isRefined() == false)
+	{
+		// The upsampled coarse levels are already smooth, so the denoiser waits for full resolution.
+		if (m_finishedRefinementStep > 0)
+		{
+			m_buffer.upsampleLattice(m_finishedRefinementStep, m_displayColor, m_threadPool);
+			addSplats(m_displayColor);
+			m_buffer.update8BitImageBuffer(m_displayColor);
+		}
+	}
+	else if (m_isDenoiserEnabled)
+	{
+		if (m_denoisedSample != m_currentSample)
+		{
+			if (m_splats.isEmpty())
+			{
+				m_denoiser.denoise(m_buffer, m_threadPool);
+			}
+			else
+			{
+				m_displayColor = m_buffer.colorData;
+				addSplats(m_displayColor);
+				m_denoiser.denoise(m_buffer, m_displayColor, m_threadPool);
+			}
+			m_buffer.update8BitImageBuffer(m_denoiser.output());
+			m_denoisedSample = m_currentSample;
+		}
+	}
+	else if (m_splats.isEmpty() == false)
+	{
+		m_displayColor = m_buffer.colorData;
+		addSplats(m_displayColor);
+		m_buffer.update8BitImageBuffer(m_displayColor);
+	}
+	else
+	{
+		m_buffer.update8BitImageBuffer(m_buffer.colorData);
+	}
 }
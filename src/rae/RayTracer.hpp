@@ -4,12 +4,15 @@
 
 #include <stdint.h> // uint8_t etc.
 #include <vector>
+#include <string>
 #include <mutex>
 #include <thread>
-
-#include "nanovg.h"
+#include <memory>
+#include <atomic>
+#include <future>
 
 #include <glm/glm.hpp>
+using glm::vec2;
 using glm::vec3;
 
 #include "System.hpp"
@@ -19,13 +22,39 @@ using glm::vec3;
 #include "Hitable.hpp"
 #include "HitableList.hpp"
 #include "BvhNode.hpp"
+#include "LightBvh.hpp"
+#include "Restir.hpp"
+#include "PathGuide.hpp"
+#include "RadianceCache.hpp"
+#include "CausticPhotonMap.hpp"
+#include "Bdpt.hpp"
+#include "SplatBuffer.hpp"
+#include "Sampler.hpp"
+#include "Denoiser.hpp"
+#include "core/ThreadPool.hpp"
+#include "core/IoThread.hpp"
+#include "core/ClusterPager.hpp"
+#include "Camera.hpp"
+#include "QualityGovernor.hpp"
+
+struct NVGcontext;
 
 namespace Rae
 {
 
 class CameraSystem;
-class Camera;
 class Material;
+class Mesh;
+struct RenderCheckpoint;
+struct HdrImage;
+
+// What the camera ray saw first. Guides the denoiser.
+struct PixelFeatures
+{
+	vec3 albedo = vec3(0.0f, 0.0f, 0.0f);
+	vec3 normal = vec3(0.0f, 0.0f, 0.0f); // zero for the sky
+	float depth = 0.0f;
+};
 
 struct ImageBuffer
 {
@@ -35,47 +64,174 @@ struct ImageBuffer
 	void init(int setWidth, int setHeight);
 	void init();
 
+	// Gamma corrects linearColor into the 8 bit data.
+	void update8BitImageBuffer(const std::vector<vec3>& linearColor);
+	void updateSampleCountImage();
+	// The nanovg image of the 8 bit data. These live in RayTracerGl.cpp.
 	void createImage(NVGcontext* vg);
-	void update8BitImageBuffer(NVGcontext* vg);
+	void uploadImage(NVGcontext* vg);
+	// Copies colorData to outColor, filling the pixels without samples from the lattice of the given step.
+	// The lattice pixels are weighted by how well their depth and normal match the nearest one,
+	// so colors don't bleed over edges.
+	void upsampleLattice(int step, std::vector<vec3>& outColor, ThreadPool& threadPool) const;
 	void clear();
 
+	// Welford's online mean and variance. colorData holds the running mean.
+	void addSample(int index, const vec3& color);
+	// Standard error of the mean luminance relative to the mean luminance.
+	float relativeError(int index) const;
+	// Variance of the mean luminance. Call after addSample for the same pixel.
+	float varianceOfMean(int index) const;
+	// Running mean of the feature buffers. Call after addSample for the same pixel.
+	void addFeatures(int index, const PixelFeatures& features);
+
+	// Adaptive sampling is decided per tile, so that a single lucky pixel
+	// (e.g. one that hasn't yet found a small light) can't stop early on its own.
+	// Only the pixels in the rectangle count, and only the tiles it overlaps are updated.
+	// Returns the number of those tiles that still need samples.
+	int updateActiveTiles(float targetError, int minSamples, int startX, int startY, int endX, int endY);
+	void activateTiles(int startX, int startY, int endX, int endY);
+	bool isTileActive(int x, int y) const { return tileActive[((y / TileSize) * tilesX) + (x / TileSize)] != 0; }
+	int tileCount() const { return tilesX * tilesY; }
+
+	static const int TileSize = 8;
+
 	int channels = 4; // needs to be 4 for rgba with nanovg create image func
 	
 	int width;
 	int height;
 
 	std::vector<vec3> colorData;
+	std::vector<vec3> varianceData; // Welford M2, the sum of squared differences from the mean
+	std::vector<int> sampleCounts;
 	std::vector<uint8_t> data;
 
+	// Feature buffers
+	std::vector<vec3> albedoData;
+	std::vector<vec3> normalData;
+	std::vector<float> depthData;
+
+	int tilesX = 0;
+	int tilesY = 0;
+	std::vector<uint8_t> tileActive;
+
 	int imageId;
+	bool isImageChanged = false; // data has changed since the last upload
+};
+
+// One pass over the image, split into tiles. Rendering works through the tiles until the frame's
+// time budget runs out, and the job resumes from the next tile on the following update.
+struct RenderJob
+{
+	bool isFinished() const { return nextTile >= tilesX * tilesY; }
+	// Estimated time of the whole pass from the tiles done so far, in seconds
+	double estimatedTime() const;
+
+	static const int TileLatticeSize = 16; // A tile is 16x16 lattice points, so tiles are equal work at any step.
+
+	bool isActive = false;
+	int step = 1; // lattice step, 1 samples every pixel
+	bool isRefinement = false;
+	bool isAdaptive = false;
+	int tilesX = 0;
+	int tilesY = 0;
+	int nextTile = 0;
+	double elapsedTime = 0.0; // time spent on the tiles so far
+	// The pixels that the tiles cover, the whole image or a crop window
+	int startX = 0;
+	int startY = 0;
+	int endX = 0;
+	int endY = 0;
+};
+
+// A scene loaded away from the renderer, with the BVHs of its meshes and the top level ones.
+struct SceneLoad
+{
+	HitableList world;
+	BvhNode tree;
+	LightBvh lightBvh;
+	std::vector<Mesh*> meshes; // given the pager when the scene comes in
+	bool isLoaded = false;
+	uint64_t hash = 0; // of the scene file
 };
 
 class RayTracer : public System
 {
 public:
-	RayTracer(CameraSystem& cameraSystem);
+	// threadCount 0 uses every hardware thread.
+	RayTracer(CameraSystem& cameraSystem, int width = 1920, int height = 1080, int threadCount = 0);
 	~RayTracer();
 
 	void showScene(int number);
 	void clearScene();
 
-	void createSceneOne(HitableList& world, bool loadBunny = false);
-	void createSceneFromBook(HitableList& list);
+	// Scenes 1-3 are files in data/scenes, see SceneLoader for the format.
+	bool loadScene(const std::string& path);
+	// Shows the scene at once without its mesh files and models, see SceneLoader::setPreview, and
+	// loads all of it in the background. The full scene replaces the preview between two passes.
+	// A scene asked for during a load waits for it, and only the last one asked for comes in.
+	void loadSceneInBackground(const std::string& path);
+	bool isSceneLoading() const { return m_sceneLoad.valid(); }
+	// Until the background load is in the scene.
+	void waitForScene();
+
+	// Checkpoints of the accumulation and of where the render is, see RenderCheckpoint. A checkpoint
+	// only fits the scene, camera and settings it was saved with. The BDPT splats are in it. Path
+	// guiding, the radiance cache and the caustics aren't, so with them the render carries on but
+	// learns again. ReSTIR has none, as each of its frames reuses the reservoirs of the last one.
+	// Copies the state and writes it on another thread. Returns false without saving when the last
+	// write is still going, for ReSTIR, or for a scene that isn't from a file.
+	bool saveCheckpoint(const std::string& path);
+	// Waits for the write that saveCheckpoint started. False if it failed.
+	bool finishCheckpoint();
+	// Carries on from the checkpoint when it fits, otherwise leaves the image as it is and returns false.
+	// Also false for ReSTIR.
+	bool loadCheckpoint(const std::string& path);
+	// Of the scene file and everything else that the samples depend on
+	uint64_t checkpointKey() const;
+	// The linear accumulation, with the BDPT splats and the unsampled pixels upsampled, as a .pfm or
+	// .exr file, see writeHdrImage. isFeatures adds the albedo, normal and depth. Like saveCheckpoint,
+	// copies the image and writes it on the I/O thread, and returns false when the last save is
+	// still going.
+	bool saveImage(const std::string& path, bool isFeatures, bool isFloat);
+	// Waits for the write that saveImage started. False if it failed.
+	bool finishImage();
+	// The memory for the clusters of cached meshes, see ClusterPager. 0 is no limit.
+	void setGeometryBudget(size_t bytes) { m_geometryPager.setBudget(bytes); }
+	const ClusterPager& geometryPager() const { return m_geometryPager; }
+	void createSceneManyLights(HitableList& list);
 
 	void update(double time, double delta_time, std::vector<Entity>& entities) override;
 	void renderAllAtOnce(double time);
-	void renderSamples(double time, double deltaTime);
+	// Continues the render job until timeBudget (in seconds) runs out or the rendering is done.
+	void renderSamples(double time, double timeBudget);
 	void updateImageBuffer();
 	void renderNanoVG(NVGcontext* vg,  float x, float y, float w, float h);
 	void setNanovgContext(NVGcontext* setVg);
 
 	void autoFocus();
 
-	vec3 rayTrace(const Ray& ray, Hitable& world, int depth);
+	// A path through m_tree. isLightSampled: the ray leaves a diffuse surface whose direct light was
+	// already estimated in full, so the lights it hits first add nothing.
+	vec3 rayTrace(const Ray& ray, int depth, Sampler& sampler, PixelFeatures* features = nullptr,
+		bool isLightSampled = false);
+	// Light arriving from one light picked by the light BVH, MIS weighted against the BSDF samples.
+	vec3 sampleDirectLight(const HitRecord& record, Sampler& sampler, int guideDistribution = -1);
+	// Scatters from a diffuse surface, from the BSDF or the path guide's distribution (-1 for none).
+	bool scatterDiffuse(const Ray& ray, const HitRecord& record, int guideDistribution, Sampler& sampler,
+		Ray& scattered, vec3& attenuation, float& pdf);
+	float diffusePdf(const HitRecord& record, int guideDistribution, const vec3& direction) const;
 	vec3 sky(const Ray& ray);
 
 	void clear();
-	void toggleBufferQuality();
+	bool isRenderingDone() const;
+	// Samples per pixel to stop at. Clears the image.
+	void setSamplesLimit(int samples);
+	int samplesLimit() const { return m_samplesLimit; }
+	int currentSample() const { return m_currentSample; }
+	// Rays cast at the scene so far, for rays/sec
+	int64_t rayCount() const { return m_rayCount.load(); }
+	void resetRayCount() { m_rayCount.store(0); }
 	bool isFastMode() { return m_isFastMode; }
 	void toggleFastMode() { m_isFastMode = !m_isFastMode; }
 	float rayMaxLength();
@@ -86,40 +242,236 @@ public:
 	bool isInfoText() { return m_isInfoText; }
 
 	void toggleVisualizeFocusDistance() { m_isVisualizeFocusDistance = !m_isVisualizeFocusDistance; }
+	void toggleVisualizeSampleCount() { m_isVisualizeSampleCount = !m_isVisualizeSampleCount; m_denoisedSample = -1; }
+	void toggleDenoiser() { m_isDenoiserEnabled = !m_isDenoiserEnabled; m_denoisedSample = -1; }
+	Denoiser& denoiser() { return m_denoiser; }
+
+	// Render to error threshold: after m_adaptiveMinSamples, only tiles whose relative error
+	// is above m_targetError get more samples, and rendering stops once every tile meets it.
+	void toggleRenderToErrorThreshold();
+	bool isRenderToErrorThreshold() const { return m_isRenderToErrorThreshold; }
+	void setTargetError(float set) { m_targetError = set; }
+	float targetError() const { return m_targetError; }
 
-	ImageBuffer& imageBuffer() { return *m_buffer; }
+	ImageBuffer& imageBuffer() { return m_buffer; }
+
+	// Progressive refinement: the first passes trace one sample per block of pixels, halving the block
+	// size each pass, and only the pixels that are new to the finer lattice get a sample.
+	// Until every pixel has a sample, the image is upsampled from the finest finished lattice.
+	bool isRefined() const { return m_refinementStep == 0; }
+
+	// Cycles between the random, Sobol and blue noise samplers
+	void nextSampler();
+	Sampler& sampler();
+
+	// Cycles between path tracing, ReSTIR direct lighting and bidirectional path tracing
+	void nextIntegrator();
+	const char* integratorName() const;
 
 	void plusBounces(int delta = 1);
 	void minusBounces(int delta = 1);
 
 	void onCameraChanged(const Camera& camera);
 
+	QualityGovernor& governor() { return m_governor; }
+
+	// Temporal reprojection: when the camera moves, the accumulated samples are warped into
+	// the new view instead of being thrown away. Disoccluded pixels start again from zero.
+	void toggleTemporalReprojection() { m_isTemporalReprojection = !m_isTemporalReprojection; }
+	bool isTemporalReprojection() const { return m_isTemporalReprojection; }
+
+	// Path guiding: diffuse bounces are sampled partly from a distribution learned from earlier paths.
+	void togglePathGuiding() { m_isPathGuiding = !m_isPathGuiding; }
+	bool isPathGuiding() const { return m_isPathGuiding; }
+
+	// Radiance cache: full paths store the irradiance of diffuse surfaces in world space. While the
+	// camera moves, most paths end into the cache after their first diffuse bounce.
+	void toggleRadianceCache() { m_isRadianceCache = !m_isRadianceCache; }
+	bool isRadianceCacheEnabled() const { return m_isRadianceCache; }
+	RadianceCache& radianceCache() { return m_radianceCache; }
+
+	// Caustics from a photon map: a new pass of photons is traced from the lights after every batch
+	// of samples, and diffuse surfaces gather them instead of finding lights through glass and metal.
+	void toggleCaustics() { m_isCaustics = !m_isCaustics; }
+	bool isCausticsEnabled() const { return m_isCaustics; }
+	CausticPhotonMap& causticPhotons() { return m_causticPhotons; }
+
+	// Region of interest. Cursor mode gives every sample pass to the tiles around the cursor, and
+	// only some of the passes to the tiles further away. Crop mode traces nothing but the tiles of a
+	// window dragged with the first mouse button. Image points go from 0 to 1 from the top left.
+	// The render is done when the pixels of the region are, so a new region renders again.
+	void nextRoiMode();
+	const char* roiModeName() const;
+	bool isRoiCursorMode() const { return m_roiMode == RoiMode::Cursor; }
+	bool isCropMode() const { return m_roiMode == RoiMode::Crop; }
+	void setRoiCenter(vec2 imagePoint) { m_roiCenter = imagePoint; }
+	void setCropWindow(vec2 corner0, vec2 corner1);
+
 protected:
+	void startSceneLoad(const std::string& path);
+	// Called every update. Swaps in the loaded scene, or starts the one that waited.
+	void updateSceneLoad();
+	// The running load will be thrown away when it's done.
+	void cancelSceneLoad();
+	void swapScene(SceneLoad& scene);
+
+	void reproject(const CameraView& view);
+	void startRenderJob();
+	void cloneThreadSamplers();
+	void renderTile(int tileIndex, Sampler& pixelSampler);
+	void finishRenderJob();
+	bool isCausticsActive() const { return m_isCaustics && m_causticPhotons.isEmpty() == false && m_isFastMode == false; }
+	// Between the passes, while no thread renders.
+	void updateCaustics();
+	bool isBdptActive() const { return m_integratorType == IntegratorType::Bdpt && m_isFastMode == false; }
+	// The chance of a tile getting its sample in a pass of the cursor mode
+	float roiWeight(int startX, int startY, int endX, int endY) const;
+	// The pixels that are rendered, the crop window rounded out to the lattice of the step, or the
+	// whole image.
+	void regionBounds(int step, int& startX, int& startY, int& endX, int& endY) const;
+	void updateRegionSampleCount();
+	// After the region changed. The samples stay, and the pass in progress starts again in the new region.
+	void reopenRegion();
+	void traceSample(int i, int j, Camera& camera, Sampler& pixelSampler);
+	void addSplats(std::vector<vec3>& color);
+	// One sample for every pixel, with the direct light of diffuse surfaces from ReSTIR.
+	void renderRestirFrame();
+	void tracePrimaryRestir(int i, int j, Camera& camera, Sampler& pixelSampler);
 
 	bool m_isInfoText = true;
 	bool m_isFastMode = false;
 	bool m_isVisualizeFocusDistance = true;
+	bool m_isVisualizeSampleCount = false;
+	bool m_isDenoiserEnabled = true;
 
-	double m_switchTime = 5.0f; // time to switch to big buffer rendering in seconds
-	ImageBuffer m_smallBuffer;
-	ImageBuffer m_bigBuffer;
-	ImageBuffer* m_buffer;
+	ImageBuffer m_buffer;
+	std::vector<vec3> m_displayColor; // m_buffer with the unsampled pixels upsampled
+
+	static const int CoarsestRefinementStep = 16;
+	int m_refinementStep = CoarsestRefinementStep; // the lattice the next pass samples, 0 when refined
+	int m_finishedRefinementStep = 0; // the finest fully sampled lattice, 0 when none
 
 	int m_samplesLimit = 2000;
 	int m_bouncesLimit = 50;
+	int m_frameBouncesLimit = 50; // m_bouncesLimit, or less while the camera moves
+
+	QualityGovernor m_governor;
+	bool m_isCameraChanged = false; // since the last update
+	double m_reprojectionTime = 0.0; // in seconds
+	double m_lastDisplayTime = 0.0;
+	double m_lastPassTime = 0.0; // estimated from the tiles when the pass didn't finish
+
+	RenderJob m_renderJob;
+	std::vector<std::unique_ptr<Sampler>> m_threadSamplers; // one clone of sampler() per thread
+
+	bool m_isRenderToErrorThreshold = false;
+	float m_targetError = 0.02f;
+	int m_adaptiveMinSamples = 16;
+	int m_activeTileCount = 0;
+
+	bool m_isTemporalReprojection = true;
+	// Reprojected history counts as this fraction of its samples, so that newly traced samples
+	// quickly take over things that reprojection gets wrong, like reflections.
+	float m_reprojectionConfidence = 0.5f;
+	int m_reprojectionMaxSamples = 64;
+	float m_reprojectionDepthTolerance = 0.05f; // relative to the distance
+	float m_reprojectionNormalTolerance = 0.9f; // minimum dot product of the normals
+	CameraView m_accumulationView; // The view the samples in m_buffer were traced from
+	ImageBuffer m_history;
 	
-	int m_currentSample = 0;
+	enum class SamplerType
+	{
+		Random,
+		Sobol,
+		ZSobol,
+		Count
+	};
+
+	SamplerType m_samplerType = SamplerType::ZSobol;
+
+	enum class IntegratorType
+	{
+		PathTracing,
+		Restir,
+		Bdpt,
+		Count
+	};
+
+	IntegratorType m_integratorType = IntegratorType::PathTracing;
+
+	enum class RoiMode
+	{
+		Off,
+		Cursor,
+		Crop,
+		Count
+	};
+
+	RoiMode m_roiMode = RoiMode::Off;
+	vec2 m_roiCenter = vec2(0.5f, 0.5f);
+	float m_roiRadius = 0.1f; // of the image height. The falloff is as wide again.
+	float m_roiOutsideWeight = 1.0f / 32.0f;
+	vec2 m_cropMin = vec2(0.25f, 0.25f);
+	vec2 m_cropMax = vec2(0.75f, 0.75f);
+	RandomSampler m_randomSampler;
+	SobolSampler m_sobolSampler;
+	ZSobolSampler m_zSobolSampler;
+
+	int m_currentSample = 0; // the sample passes, which can cover only the region of interest
+	// The fewest samples of a pixel in the region, leaving out the converged tiles
+	int m_regionSampleCount = 0;
+	int m_displayedSample = -1;
 	double m_totalRayTracingTime = -1.0;
 
 	// for renderAllAtOnce:
 	double m_startTime = -1.0;
 
+	ThreadPool m_threadPool;
+	ThreadPool m_loadThreadPool; // for the meshes of background loads, as m_threadPool renders
+	Denoiser m_denoiser;
+	int m_denoisedSample = -1; // The image is only denoised again after new samples
+
 	CameraSystem& m_cameraSystem;
+	ClusterPager m_geometryPager; // before m_world, which has meshes in it
 	HitableList m_world;
 	BvhNode m_tree;
+	LightBvh m_lightBvh;
+
+	// Can't be stopped, so a scene change only marks it cancelled.
+	std::future<std::unique_ptr<SceneLoad>> m_sceneLoad;
+	bool m_isSceneLoadCancelled = false;
+	std::string m_nextScenePath; // waits for m_sceneLoad, empty for none
+	uint64_t m_sceneHash = 0; // 0 for the scenes that aren't from a file, and for previews
+
+	std::future<bool> m_checkpointWrite;
+	// Kept for the next save, so that its memory is already there. Not touched while it's written.
+	std::unique_ptr<RenderCheckpoint> m_checkpoint;
+	std::future<bool> m_imageWrite;
+	std::unique_ptr<HdrImage> m_image; // like m_checkpoint
+	IoThread m_ioThread; // writes the checkpoints and the images
+
+	Restir m_restir;
+	std::vector<vec3> m_restirColor; // everything but the direct light of the ReSTIR surfaces
+	std::vector<PixelFeatures> m_restirFeatures;
+
+	bool m_isPathGuiding = false;
+	PathGuide m_pathGuide;
+
+	bool m_isRadianceCache = false;
+	bool m_isCachePreview = false; // while the camera moves
+	bool m_hasCachedSamples = false; // the accumulation has samples that ended into the cache
+	float m_cacheTrainingFraction = 0.25f; // of the preview paths, run in full to keep the cache learning
+	RadianceCache m_radianceCache;
+
+	bool m_isCaustics = false;
+	CausticPhotonMap m_causticPhotons;
+
+	Bdpt m_bdpt;
+	SplatBuffer m_splats; // the light tracing strategies of BDPT, added on top of m_buffer
+
+	std::atomic<int64_t> m_rayCount;
 
 	NVGcontext* m_vg = nullptr;
-	NVGpaint m_imgPaint;
 };
 
 } // end namespace Rae
@@ -0,0 +1,202 @@
+#include "RayTracer.hpp"
+
+#include <string>
+
+#include "nanovg.h"
+
+#include "CameraSystem.hpp"
+
+using namespace Rae;
+
+// The nanovg side of the ray tracer, left out of the headless core.
+
+void ImageBuffer::createImage(NVGcontext* vg)
+{
+	if (imageId == -1 && vg != nullptr)
+	{
+		//std::cout << "Creating image " << width << "x" << height << "\n";
+		imageId = nvgCreateImageRGBA(vg, width, height, /*imageFlags*/0, &data[0]);
+	}
+	else
+	{
+		std::cout << "Failed to create an image " << width << "x" << height << "\n";
+		if (imageId != -1)
+			std::cout << "imageId was not -1. It was " << imageId << "\n";
+		if (vg == nullptr)
+			std::cout << "vg was null.\n";
+		assert(imageId == -1);
+		assert(vg != nullptr);
+	}
+}
+
+void ImageBuffer::uploadImage(NVGcontext* vg)
+{
+	if (isImageChanged == false || imageId == -1)
+		return;
+
+	nvgUpdateImage(vg, imageId, &data[0]);
+	isImageChanged = false;
+}
+
+void RayTracer::setNanovgContext(NVGcontext* setVg)
+{
+	assert(setVg != NULL);
+
+	m_vg = setVg;
+
+	m_buffer.createImage(m_vg);
+}
+
+void RayTracer::renderNanoVG(NVGcontext* vg, float x, float y, float w, float h)
+{
+	ImageBuffer& readBuffer = imageBuffer();
+	readBuffer.uploadImage(vg);
+
+	nvgSave(vg);
+
+	//override the given parameters and reuse w and h...
+	/*
+	x = -g_rae->screenHalfWidthP();
+	y = -g_rae->screenHalfHeightP();
+	w = g_rae->screenWidthP();
+	h = g_rae->screenHeightP();
+	*/
+
+	NVGpaint imgPaint = nvgImagePattern(vg, x, y, w, h, 0.0f, readBuffer.imageId, 1.0f);
+	nvgBeginPath(vg);
+	nvgRect(vg, x, y, w, h);
+	nvgFillPaint(vg, imgPaint);
+	nvgFill(vg);
+
+	if (m_roiMode != RoiMode::Off)
+	{
+		nvgBeginPath(vg);
+		if (m_roiMode == RoiMode::Cursor)
+			nvgCircle(vg, x + (m_roiCenter.x * w), y + (m_roiCenter.y * h), m_roiRadius * h);
+		else nvgRect(vg, x + (m_cropMin.x * w), y + (m_cropMin.y * h), (m_cropMax.x - m_cropMin.x) * w, (m_cropMax.y - m_cropMin.y) * h);
+		nvgStrokeColor(vg, nvgRGBA(255, 255, 255, 96));
+		nvgStroke(vg);
+	}
+
+	// Text
+	if (m_isInfoText)
+	{
+		Camera& camera = m_cameraSystem.getCurrentCamera();
+
+		nvgFontFace(vg, "sans");
+
+		nvgFontSize(vg, 18.0f);
+		nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
+		nvgFillColor(vg, nvgRGBA(128, 128, 128, 192));
+	
+		float vertPos = 200.0f;
+
+		std::string samplesStr = "Samples: " + std::to_string(m_currentSample);
+		if (isRefined() == false)
+			samplesStr += " Refining " + std::to_string(m_refinementStep) + "x" + std::to_string(m_refinementStep) + " blocks";
+		nvgText(vg, 10.0f, vertPos, samplesStr.c_str(), nullptr); vertPos += 20.0f;
+
+		std::string samplesLimitStr = "/" + std::to_string(m_samplesLimit);
+		nvgText(vg, 10.0f, vertPos, samplesLimitStr.c_str(), nullptr); vertPos += 20.0f;
+
+		if (m_isRenderToErrorThreshold)
+		{
+			std::string errorStr = "Error threshold: " + std::to_string(m_targetError * 100.0f) + " %"
+				+ " Active tiles: " + std::to_string(m_activeTileCount) + "/" + std::to_string(m_buffer.tileCount());
+			nvgText(vg, 10.0f, vertPos, errorStr.c_str(), nullptr); vertPos += 20.0f;
+		}
+		else
+		{
+			nvgText(vg, 10.0f, vertPos, "Sample limit mode", nullptr); vertPos += 20.0f;
+		}
+
+		std::string totalTimeStr = "Time: " + std::to_string(m_totalRayTracingTime) + " s";
+		nvgText(vg, 10.0f, vertPos, totalTimeStr.c_str(), nullptr); vertPos += 20.0f;
+
+		std::string positionStr = "Position: "
+			+ std::to_string(camera.position().x) + ", "
+			+ std::to_string(camera.position().y) + ", "
+			+ std::to_string(camera.position().z);
+		nvgText(vg, 10.0f, vertPos, positionStr.c_str(), nullptr); vertPos += 20.0f;
+
+		std::string yawStr = "Yaw: "
+			+ std::to_string(Math::toDegrees(camera.yaw())) + "°"
+			+ " Pitch: "
+			+ std::to_string(Math::toDegrees(camera.pitch())) + "°";
+		nvgText(vg, 10.0f, vertPos, yawStr.c_str(), nullptr); vertPos += 20.0f;
+
+		std::string fovStr = "Field of View: "
+			+ std::to_string(Math::toDegrees(camera.fieldOfView())) + "°";
+		nvgText(vg, 10.0f, vertPos, fovStr.c_str(), nullptr); vertPos += 20.0f;
+
+		std::string focusDistanceStr = "Focus distance: "
+			+ std::to_string(camera.focusDistance());
+		nvgText(vg, 10.0f, vertPos, focusDistanceStr.c_str(), nullptr); vertPos += 20.0f;
+
+		nvgText(vg, 10.0f, vertPos, camera.isContinuousAutoFocus() ? "Autofocus ON" : "Autofocus OFF", nullptr);
+		vertPos += 20.0f;
+
+		std::string apertureStr = "Aperture: "
+			+ std::to_string(camera.aperture());
+		nvgText(vg, 10.0f, vertPos, apertureStr.c_str(), nullptr); vertPos += 20.0f;
+
+		std::string bouncesStr = "Bounces: "
+			+ std::to_string(m_bouncesLimit);
+		nvgText(vg, 10.0f, vertPos, bouncesStr.c_str(), nullptr); vertPos += 20.0f;
+
+		nvgText(vg, 10.0f, vertPos, m_isTemporalReprojection ? "Reprojection ON" : "Reprojection OFF", nullptr);
+		vertPos += 20.0f;
+
+		std::string cacheStr = m_isRadianceCache
+			? "Radiance cache ON, " + std::to_string(m_radianceCache.usedProbeCount()) + "/"
+				+ std::to_string(m_radianceCache.capacity()) + " probes, "
+				+ std::to_string(m_radianceCache.memoryUsage() / (1024 * 1024)) + " MB"
+				+ (m_isCachePreview ? ", preview" : "")
+			: "Radiance cache OFF";
+		nvgText(vg, 10.0f, vertPos, cacheStr.c_str(), nullptr); vertPos += 20.0f;
+
+		std::string causticsStr = m_isCaustics
+			? "Caustics ON, pass " + std::to_string(m_causticPhotons.passCount()) + ", "
+				+ std::to_string(m_causticPhotons.photonCount()) + " photons, radius "
+				+ std::to_string(m_causticPhotons.radius())
+			: "Caustics OFF";
+		nvgText(vg, 10.0f, vertPos, causticsStr.c_str(), nullptr); vertPos += 20.0f;
+
+		std::string guidingStr = m_isPathGuiding
+			? "Path guiding ON, " + std::to_string(m_pathGuide.learnedCellCount()) + " cells learned"
+			: "Path guiding OFF";
+		nvgText(vg, 10.0f, vertPos, guidingStr.c_str(), nullptr); vertPos += 20.0f;
+
+		std::string governorStr = m_governor.toString();
+		nvgText(vg, 10.0f, vertPos, governorStr.c_str(), nullptr); vertPos += 20.0f;
+
+		std::string roiStr = std::string("Region of interest: ") + roiModeName();
+		nvgText(vg, 10.0f, vertPos, roiStr.c_str(), nullptr); vertPos += 20.0f;
+
+		std::string integratorStr = std::string("Integrator: ") + integratorName();
+		nvgText(vg, 10.0f, vertPos, integratorStr.c_str(), nullptr); vertPos += 20.0f;
+
+		std::string samplerStr = std::string("Sampler: ") + sampler().name();
+		nvgText(vg, 10.0f, vertPos, samplerStr.c_str(), nullptr); vertPos += 20.0f;
+
+		std::string denoiserStr = m_isDenoiserEnabled
+			? "Denoiser: ON " + std::to_string(m_denoiser.lastDenoiseTime() * 1000.0) + " ms"
+			: "Denoiser: OFF";
+		nvgText(vg, 10.0f, vertPos, denoiserStr.c_str(), nullptr); vertPos += 20.0f;
+
+		std::string debugStr = "Debug hit pos: "
+			+ std::to_string(debugHitRecord.point.x) + ", "
+			+ std::to_string(debugHitRecord.point.y) + ", "
+			+ std::to_string(debugHitRecord.point.z);
+		nvgText(vg, 10.0f, vertPos, debugStr.c_str(), nullptr); vertPos += 20.0f;
+
+		vec3 focusPos = camera.getFocusPosition();
+		std::string debugStr2 = "Debug focus pos: "
+			+ std::to_string(focusPos.x) + ", "
+			+ std::to_string(focusPos.y) + ", "
+			+ std::to_string(focusPos.z);
+		nvgText(vg, 10.0f, vertPos, debugStr2.c_str(), nullptr); vertPos += 20.0f;
+	}
+
+	nvgRestore(vg);
+}
@@ -425,8 +425,8 @@ void RenderSystem::render2d(double time, double delta_time)
 
 			nvgText(vg, 10.0f, vertPos, "Esc to quit, R reset, F autofocus, H visualize focus, VB focus distance,"
 				" NM aperture, KL bounces, G debug view, T text, U fastmode", nullptr); vertPos += 20.0f;
-			nvgText(vg, 10.0f, vertPos, "Movement: Second mouse button, WASDQE, Arrows", nullptr); vertPos += 20.0f;
-			nvgText(vg, 10.0f, vertPos, "Y toggle resolution", nullptr); vertPos += 20.0f;
+			nvgText(vg, 10.0f, vertPos, "Movement: Second mouse button, WASDQE, Arrows. Scenes: 1 2 3 4 (many lights)", nullptr); vertPos += 20.0f;
+			nvgText(vg, 10.0f, vertPos, "Y quality governor, P render to error threshold, J sample count view, C sampler, X denoiser, Z reprojection, Tab integrator, F1 path guiding, F2 radiance cache, F3 caustics, F4 region of interest, F5 save render.exr", nullptr); vertPos += 20.0f;
 
 			std::string entity_count_str = "Entities: " + std::to_string(m_objectFactory.entityCount());
 			nvgText(vg, 10.0f, vertPos, entity_count_str.c_str(), nullptr); vertPos += 20.0f;
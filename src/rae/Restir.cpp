@@ -0,0 +1,333 @@
+#include "Restir.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+#include "Ray.hpp"
+#include "HitRecord.hpp"
+#include "Hitable.hpp"
+#include "LightBvh.hpp"
+#include "Material.hpp"
+#include "Sampler.hpp"
+#include "core/ThreadPool.hpp"
+
+using namespace Rae;
+
+namespace
+{
+	// Separate random streams for each stage
+	const uint32_t InitialSeed = 0x1b873593u;
+	const uint32_t TemporalSeed = 0x85ebca6bu;
+	const uint32_t SpatialSeed = 0xc2b2ae35u;
+
+	float luminanceOf(const vec3& color)
+	{
+		return glm::dot(color, vec3(0.2126f, 0.7152f, 0.0722f));
+	}
+}
+
+bool Reservoir::update(int candidateLight, const vec3& candidatePoint, float weight, float u)
+{
+	weightSum += weight;
+	count += 1.0f;
+	if (weight > 0.0f && u * weightSum < weight)
+	{
+		lightIndex = candidateLight;
+		point = candidatePoint;
+		return true;
+	}
+	return false;
+}
+
+void Reservoir::updateContributionWeight()
+{
+	contributionWeight = (count > 0.0f && targetPdf > 0.0f) ? weightSum / (count * targetPdf) : 0.0f;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+Restir::Restir(const Hitable& scene, const LightBvh& lightBvh)
+: m_scene(scene),
+m_lightBvh(lightBvh)
+{
+}
+
+void Restir::resize(int width, int height)
+{
+	if (width == m_width && height == m_height)
+		return;
+
+	m_width = width;
+	m_height = height;
+	const int pixelCount = width * height;
+	m_surfaces.assign(pixelCount, RestirSurface());
+	m_reservoirs.assign(pixelCount, Reservoir());
+	m_spatialReservoirs.assign(pixelCount, Reservoir());
+	m_previousSurfaces.assign(pixelCount, RestirSurface());
+	m_previousReservoirs.assign(pixelCount, Reservoir());
+	clearHistory();
+}
+
+void Restir::clearHistory()
+{
+	m_hasHistory = false;
+}
+
+float Restir::targetPdf(const RestirSurface& surface, int lightIndex, const vec3& pointOnLight, vec3& contribution) const
+{
+	contribution = vec3(0.0f, 0.0f, 0.0f);
+
+	const AreaLight& light = m_lightBvh.light(lightIndex);
+	const vec3 toLight = pointOnLight - surface.point;
+	const float distanceSquared = glm::dot(toLight, toLight);
+	if (distanceSquared <= 0.0f)
+		return 0.0f;
+
+	const vec3 direction = toLight / sqrt(distanceSquared);
+	const float cosLight = -glm::dot(direction, light.normal(pointOnLight));
+	if (cosLight <= 0.0f)
+		return 0.0f;
+
+	// In area measure, so that samples can move between pixels without a Jacobian.
+	contribution = surface.material->evaluate(surface.normal, direction) * light.emission() * (cosLight / distanceSquared);
+	return luminanceOf(contribution);
+}
+
+bool Restir::isVisible(const RestirSurface& surface, const vec3& pointOnLight) const
+{
+	const vec3 toLight = pointOnLight - surface.point;
+	const float distance = glm::length(toLight);
+	HitRecord occluder;
+	return m_scene.hit(Ray(surface.point, toLight / distance), 0.001f, distance * 0.999f, occluder) == false;
+}
+
+bool Restir::isSimilar(const RestirSurface& surface, const RestirSurface& other) const
+{
+	if (other.isValid() == false)
+		return false;
+	if (glm::length(other.point - surface.point) > m_depthTolerance * surface.depth)
+		return false;
+	return glm::dot(other.normal, surface.normal) >= m_normalTolerance;
+}
+
+void Restir::combine(Reservoir& combined, const RestirSurface& surface, const ReuseInput* inputs, int inputCount,
+	const float* u) const
+{
+	combined = Reservoir();
+	int chosen = -1;
+	for (int k = 0; k < inputCount; ++k)
+	{
+		const Reservoir& other = *inputs[k].reservoir;
+		combined.count += other.count;
+		if (other.lightIndex == -1 || other.contributionWeight <= 0.0f)
+			continue;
+
+		vec3 contribution;
+		const float pdf = targetPdf(surface, other.lightIndex, other.point, contribution);
+		const float weight = pdf * other.contributionWeight * other.count;
+		combined.weightSum += weight;
+		if (weight > 0.0f && u[k] * combined.weightSum < weight)
+		{
+			combined.lightIndex = other.lightIndex;
+			combined.point = other.point;
+			combined.targetPdf = pdf;
+			chosen = k;
+		}
+	}
+	if (chosen == -1)
+		return;
+
+	// A sample this surface doesn't see adds nothing here, and would only darken the pixels it spreads to.
+	if (chosen != 0 && isVisible(surface, combined.point) == false)
+		return;
+
+	// Dividing by all of M would count the reservoirs that can't have the sample, e.g. the ones whose
+	// surfaces are in its shadow, and make the image too dark. A reservoir with a sample sees it.
+	float supportCount = 0.0f;
+	for (int k = 0; k < inputCount; ++k)
+	{
+		const RestirSurface& otherSurface = *inputs[k].surface;
+		const float otherCount = inputs[k].reservoir->count;
+		vec3 contribution;
+		if (k == chosen || k == 0)
+			supportCount += otherCount;
+		else if (otherCount > 0.0f && otherSurface.isValid()
+			&& targetPdf(otherSurface, combined.lightIndex, combined.point, contribution) > 0.0f
+			&& isVisible(otherSurface, combined.point))
+			supportCount += otherCount;
+	}
+	combined.contributionWeight = supportCount > 0.0f && combined.targetPdf > 0.0f
+		? combined.weightSum / (supportCount * combined.targetPdf) : 0.0f;
+}
+
+void Restir::sampleInitial(int x, int y)
+{
+	const int index = (y * m_width) + x;
+	const RestirSurface& surface = m_surfaces[index];
+	Reservoir& reservoir = m_reservoirs[index];
+	reservoir = Reservoir();
+
+	if (surface.isValid() == false || m_lightBvh.isEmpty())
+		return;
+
+	RandomSampler random(InitialSeed);
+	random.startPixelSample(x, y, int(m_frameIndex));
+
+	// Resampled importance sampling: candidates from the light BVH, kept in proportion to their contribution.
+	for (int candidate = 0; candidate < m_initialCandidates; ++candidate)
+	{
+		const float lightChoice = random.get1D();
+		const vec2 pointSample = random.get2D();
+		const float u = random.get1D();
+
+		float lightPmf = 0.0f;
+		const int lightIndex = m_lightBvh.sample(surface.point, surface.normal, lightChoice, lightPmf);
+		if (lightIndex == -1)
+		{
+			reservoir.count += 1.0f;
+			continue;
+		}
+
+		const AreaLight& light = m_lightBvh.light(lightIndex);
+		LightSample lightSample = light.sample(surface.point, pointSample);
+		vec3 contribution;
+		const float pdf = lightSample.pdf > 0.0f ? targetPdf(surface, lightIndex, lightSample.point, contribution) : 0.0f;
+
+		float weight = 0.0f;
+		if (pdf > 0.0f)
+		{
+			// The source pdf converted from solid angle to area
+			const float cosLight = -glm::dot(lightSample.direction, light.normal(lightSample.point));
+			const float sourcePdf = lightPmf * lightSample.pdf * cosLight / (lightSample.distance * lightSample.distance);
+			weight = sourcePdf > 0.0f ? pdf / sourcePdf : 0.0f;
+		}
+
+		if (reservoir.update(lightIndex, lightSample.point, weight, u))
+			reservoir.targetPdf = pdf;
+	}
+
+	reservoir.updateContributionWeight();
+
+	// Occluded samples are dropped before they spread to other pixels.
+	if (reservoir.lightIndex != -1 && isVisible(surface, reservoir.point) == false)
+		reservoir.contributionWeight = 0.0f;
+}
+
+void Restir::reuse(ThreadPool& threadPool)
+{
+	temporalReuse(threadPool);
+	spatialReuse(threadPool);
+}
+
+void Restir::temporalReuse(ThreadPool& threadPool)
+{
+	if (m_hasHistory == false)
+		return;
+
+	threadPool.parallelFor(m_height, [&](int j, int)
+	{
+		RandomSampler random(TemporalSeed);
+
+		for (int i = 0; i < m_width; ++i)
+		{
+			const int index = (j * m_width) + i;
+			const RestirSurface& surface = m_surfaces[index];
+			if (surface.isValid() == false)
+				continue;
+
+			float s, t;
+			if (m_previousView.project(surface.point, s, t) == false)
+				continue;
+			const int previousX = int(floor(s * float(m_width)));
+			const int previousY = int(floor(t * float(m_height)));
+			if (previousX < 0 || previousX >= m_width || previousY < 0 || previousY >= m_height)
+				continue;
+
+			const int previousIndex = (previousY * m_width) + previousX;
+			if (isSimilar(surface, m_previousSurfaces[previousIndex]) == false)
+				continue;
+
+			Reservoir& current = m_reservoirs[index];
+			Reservoir history = m_previousReservoirs[previousIndex];
+			// Limit the history, so that the lighting can still change.
+			history.count = std::min(history.count, float(m_historyLimit) * std::max(current.count, 1.0f));
+
+			random.startPixelSample(i, j, int(m_frameIndex));
+			const Reservoir own = current;
+			const ReuseInput inputs[2] = { { &surface, &own }, { &m_previousSurfaces[previousIndex], &history } };
+			float u[2];
+			u[0] = random.get1D();
+			u[1] = random.get1D();
+			combine(current, surface, inputs, 2, u);
+		}
+	});
+}
+
+void Restir::spatialReuse(ThreadPool& threadPool)
+{
+	threadPool.parallelFor(m_height, [&](int j, int)
+	{
+		RandomSampler random(SpatialSeed);
+
+		for (int i = 0; i < m_width; ++i)
+		{
+			const int index = (j * m_width) + i;
+			const RestirSurface& surface = m_surfaces[index];
+			Reservoir& combined = m_spatialReservoirs[index];
+			combined = Reservoir();
+			if (surface.isValid() == false)
+				continue;
+
+			random.startPixelSample(i, j, int(m_frameIndex));
+			ReuseInput inputs[MaxSpatialNeighbours + 1];
+			float u[MaxSpatialNeighbours + 1];
+			inputs[0] = { &surface, &m_reservoirs[index] };
+			u[0] = random.get1D();
+			int inputCount = 1;
+
+			for (int neighbour = 0; neighbour < m_spatialNeighbours; ++neighbour)
+			{
+				const vec2 offset = sampleConcentricDisk(random.get2D()) * m_spatialRadius;
+				const float neighbourU = random.get1D();
+				const int x = i + int(offset.x);
+				const int y = j + int(offset.y);
+				if ((x == i && y == j) || x < 0 || x >= m_width || y < 0 || y >= m_height)
+					continue;
+
+				const int neighbourIndex = (y * m_width) + x;
+				if (isSimilar(surface, m_surfaces[neighbourIndex]) == false)
+					continue;
+
+				inputs[inputCount] = { &m_surfaces[neighbourIndex], &m_reservoirs[neighbourIndex] };
+				u[inputCount] = neighbourU;
+				++inputCount;
+			}
+
+			combine(combined, surface, inputs, inputCount, u);
+		}
+	});
+}
+
+vec3 Restir::shade(int index) const
+{
+	const vec3 black(0.0f, 0.0f, 0.0f);
+	const RestirSurface& surface = m_surfaces[index];
+	const Reservoir& reservoir = m_spatialReservoirs[index];
+	if (surface.isValid() == false || reservoir.lightIndex == -1 || reservoir.contributionWeight <= 0.0f)
+		return black;
+
+	vec3 contribution;
+	if (targetPdf(surface, reservoir.lightIndex, reservoir.point, contribution) <= 0.0f)
+		return black;
+	return contribution * reservoir.contributionWeight;
+}
+
+void Restir::endFrame(const CameraView& view)
+{
+	// The current buffers are overwritten by the next frame.
+	std::swap(m_previousSurfaces, m_surfaces);
+	std::swap(m_previousReservoirs, m_spatialReservoirs);
+	m_previousView = view;
+	m_hasHistory = true;
+	++m_frameIndex;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+using glm::vec3;
+
+#include "Camera.hpp"
+
+namespace Rae
+{
+
+class Hitable;
+class LightBvh;
+class Material;
+class ThreadPool;
+
+// The first diffuse surface seen through a pixel.
+struct RestirSurface
+{
+	bool isValid() const { return material != nullptr; }
+
+	vec3 point;
+	vec3 normal;
+	const Material* material = nullptr; // null for pixels that don't use reservoirs
+	float depth = 0.0f; // distance from the camera
+};
+
+// Weighted reservoir of light samples (Talbot et al. 2005, Importance Resampling for Global Illumination).
+// Holds one point on a light out of all the candidates it has seen.
+struct Reservoir
+{
+	// Keeps the candidate with the probability weight / weightSum. u is a uniform random number.
+	bool update(int candidateLight, const vec3& candidatePoint, float weight, float u);
+	// Call after the last update, once targetPdf is the pdf of the kept sample.
+	void updateContributionWeight();
+
+	int lightIndex = -1;
+	vec3 point; // on the light
+	float targetPdf = 0.0f; // luminance of the unshadowed contribution at the owner pixel
+	float weightSum = 0.0f;
+	float count = 0.0f; // candidates seen, M
+	float contributionWeight = 0.0f; // W, weightSum / (count * targetPdf)
+};
+
+// A reservoir to resample, with the surface it was made for.
+struct ReuseInput
+{
+	const RestirSurface* surface;
+	const Reservoir* reservoir;
+};
+
+// ReSTIR DI (Bitterli et al. 2020, Spatiotemporal Reservoir Resampling for Real-Time Ray Tracing
+// with Dynamic Direct Lighting). Each pixel picks a light sample out of a few candidates,
+// then reuses the reservoirs of the previous frame and of its neighbours, so that one shadow ray
+// per pixel stands for hundreds of light samples.
+// The reuse is the unbiased variant: a reused sample is normalized only by the reservoirs that could
+// have produced it, those whose surfaces see it, which takes a shadow ray for each. The depth and
+// normal tests only choose the neighbours. A reservoir keeps a sample only if its surface sees it.
+class Restir
+{
+public:
+	Restir(const Hitable& scene, const LightBvh& lightBvh);
+
+	void resize(int width, int height);
+	// Forgets the previous frame, e.g. when the scene changes.
+	void clearHistory();
+
+	// Fill the surfaces, then sampleInitial for the valid ones, reuse, and shade.
+	RestirSurface& surface(int index) { return m_surfaces[index]; }
+	void sampleInitial(int x, int y);
+	void reuse(ThreadPool& threadPool);
+	// Direct light at the pixel from its reservoir. The reuse already knows that the surface sees it.
+	vec3 shade(int index) const;
+	// The reservoirs become the history of the next frame, which sees them from view.
+	void endFrame(const CameraView& view);
+
+	int initialCandidates() const { return m_initialCandidates; }
+	int spatialNeighbours() const { return m_spatialNeighbours; }
+
+protected:
+	// Unshadowed contribution of a light point at a surface, and its luminance as the target pdf.
+	float targetPdf(const RestirSurface& surface, int lightIndex, const vec3& pointOnLight, vec3& contribution) const;
+	bool isVisible(const RestirSurface& surface, const vec3& pointOnLight) const;
+	bool isSimilar(const RestirSurface& surface, const RestirSurface& other) const;
+	// Resamples the reservoirs at this surface, each as one candidate weighted by its target pdf here
+	// (Bitterli et al. 2020, algorithm 6). inputs[0] is the surface's own. u has a number for each input.
+	void combine(Reservoir& combined, const RestirSurface& surface, const ReuseInput* inputs, int inputCount,
+		const float* u) const;
+	void temporalReuse(ThreadPool& threadPool);
+	void spatialReuse(ThreadPool& threadPool);
+
+	const Hitable& m_scene;
+	const LightBvh& m_lightBvh;
+
+	int m_width = 0;
+	int m_height = 0;
+	uint32_t m_frameIndex = 0; // seeds the random numbers of the reuse
+
+	static const int MaxSpatialNeighbours = 4;
+
+	int m_initialCandidates = 8;
+	int m_spatialNeighbours = MaxSpatialNeighbours;
+	float m_spatialRadius = 20.0f; // in pixels
+	int m_historyLimit = 20; // the previous frame counts at most this many times the current candidates
+	float m_depthTolerance = 0.1f; // relative to the distance
+	float m_normalTolerance = 0.9f; // minimum dot product of the normals
+
+	std::vector<RestirSurface> m_surfaces;
+	std::vector<Reservoir> m_reservoirs;
+	std::vector<Reservoir> m_spatialReservoirs;
+
+	bool m_hasHistory = false;
+	CameraView m_previousView;
+	std::vector<RestirSurface> m_previousSurfaces;
+	std::vector<Reservoir> m_previousReservoirs;
+};
+
+} // end namespace Rae
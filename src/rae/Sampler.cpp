@@ -0,0 +1,295 @@
+#include "Sampler.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+#include "core/Utils.hpp"
+
+namespace Rae
+{
+
+const float OneMinusEpsilon = 0.99999994f;
+
+uint64_t mixBits(uint64_t v)
+{
+	v ^= (v >> 31);
+	v *= 0x7fb5d329728ea185ULL;
+	v ^= (v >> 27);
+	v *= 0x81dadef4bc2dd44dULL;
+	v ^= (v >> 33);
+	return v;
+}
+
+uint32_t hashCombine(uint32_t seed, uint32_t value)
+{
+	return uint32_t(mixBits((uint64_t(seed) << 32) | value));
+}
+
+float toUnitFloat(uint32_t value)
+{
+	return std::min(float(value) * 2.3283064365386963e-10f, OneMinusEpsilon); // value / 2^32
+}
+
+uint32_t reverseBits(uint32_t x)
+{
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+	x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+	x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+	x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+	return x;
+}
+
+// Laine-Karras style permutation, where lower bits only affect higher bits.
+uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed)
+{
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return x;
+}
+
+// Owen scrambling: each digit is flipped based on all the digits above it.
+uint32_t nestedUniformScramble(uint32_t x, uint32_t seed)
+{
+	x = reverseBits(x);
+	x = laineKarrasPermutation(x, seed);
+	x = reverseBits(x);
+	return x;
+}
+
+// The first Sobol dimension is the van der Corput sequence.
+uint32_t sobolDimension0(uint64_t index)
+{
+	return reverseBits(uint32_t(index));
+}
+
+// The second Sobol dimension. Direction numbers come from the recurrence v_k = v_(k-1) ^ (v_(k-1) >> 1).
+// They are kept in 64 bits, because index bits above 32 still affect the top bits of the result.
+uint32_t sobolDimension1(uint64_t index)
+{
+	uint64_t result = 0;
+	uint64_t direction = 1ULL << 63;
+	for (; index != 0; index >>= 1)
+	{
+		if (index & 1)
+			result ^= direction;
+		direction ^= direction >> 1;
+	}
+	return uint32_t(result >> 32);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void RandomSampler::startPixelSample(int x, int y, int sampleIndex)
+{
+	Sampler::startPixelSample(x, y, sampleIndex);
+	m_state = mixBits((uint64_t(uint32_t(x)) << 32) ^ uint64_t(uint32_t(y)) ^ (uint64_t(m_seed) << 16))
+		^ mixBits(uint64_t(sampleIndex) + 0x9e3779b97f4a7c15ULL);
+}
+
+float RandomSampler::get1D()
+{
+	// SplitMix64
+	m_state += 0x9e3779b97f4a7c15ULL;
+	++m_dimension;
+	return toUnitFloat(uint32_t(mixBits(m_state) >> 32));
+}
+
+vec2 RandomSampler::get2D()
+{
+	float x = get1D();
+	float y = get1D();
+	return vec2(x, y);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+float SobolSampler::get1D()
+{
+	uint32_t pixelSeed = hashCombine(m_seed, (uint32_t(m_pixelX) << 16) ^ uint32_t(m_pixelY));
+	uint32_t dimensionSeed = hashCombine(pixelSeed, uint32_t(m_dimension));
+	++m_dimension;
+
+	uint32_t index = nestedUniformScramble(uint32_t(m_sampleIndex), dimensionSeed);
+	return toUnitFloat(nestedUniformScramble(sobolDimension0(index), hashCombine(dimensionSeed, 0)));
+}
+
+vec2 SobolSampler::get2D()
+{
+	uint32_t pixelSeed = hashCombine(m_seed, (uint32_t(m_pixelX) << 16) ^ uint32_t(m_pixelY));
+	uint32_t dimensionSeed = hashCombine(pixelSeed, uint32_t(m_dimension));
+	m_dimension += 2;
+
+	// Shuffling the index decorrelates this pair of dimensions from the others.
+	uint32_t index = nestedUniformScramble(uint32_t(m_sampleIndex), dimensionSeed);
+	return vec2(
+		toUnitFloat(nestedUniformScramble(sobolDimension0(index), hashCombine(dimensionSeed, 0))),
+		toUnitFloat(nestedUniformScramble(sobolDimension1(index), hashCombine(dimensionSeed, 1))));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int log2Int(uint32_t value)
+{
+	int result = 0;
+	while (value > 1)
+	{
+		value >>= 1;
+		++result;
+	}
+	return result;
+}
+
+uint32_t roundUpPow2(uint32_t value)
+{
+	uint32_t result = 1;
+	while (result < value)
+		result <<= 1;
+	return result;
+}
+
+uint64_t encodeMorton2(uint32_t x, uint32_t y)
+{
+	auto spread = [](uint64_t v) -> uint64_t
+	{
+		v &= 0xffffffff;
+		v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+		v = (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+		v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+		v = (v | (v << 2)) & 0x3333333333333333ULL;
+		v = (v | (v << 1)) & 0x5555555555555555ULL;
+		return v;
+	};
+	return (spread(y) << 1) | spread(x);
+}
+
+ZSobolSampler::ZSobolSampler(int width, int height, int samplesPerPixel, uint32_t seed)
+: m_seed(seed)
+{
+	m_log2SamplesPerPixel = log2Int(roundUpPow2(uint32_t(std::max(1, samplesPerPixel))));
+	int log2Resolution = log2Int(roundUpPow2(uint32_t(std::max(width, height))));
+	int log4SamplesPerPixel = (m_log2SamplesPerPixel + 1) / 2;
+	m_base4Digits = log2Resolution + log4SamplesPerPixel;
+}
+
+// Randomly permutes the base 4 digits of the Morton ordered index. The permutation of each digit
+// depends on the digits above it, which keeps the hierarchical Z-order structure intact.
+uint64_t ZSobolSampler::sampleIndexForDimension(int dimension) const
+{
+	static const uint8_t permutations[24][4] =
+	{
+		{0, 1, 2, 3}, {0, 1, 3, 2}, {0, 2, 1, 3}, {0, 2, 3, 1}, {0, 3, 2, 1}, {0, 3, 1, 2},
+		{1, 0, 2, 3}, {1, 0, 3, 2}, {1, 2, 0, 3}, {1, 2, 3, 0}, {1, 3, 2, 0}, {1, 3, 0, 2},
+		{2, 1, 0, 3}, {2, 1, 3, 0}, {2, 0, 1, 3}, {2, 0, 3, 1}, {2, 3, 0, 1}, {2, 3, 1, 0},
+		{3, 1, 2, 0}, {3, 1, 0, 2}, {3, 2, 1, 0}, {3, 2, 0, 1}, {3, 0, 2, 1}, {3, 0, 1, 2}
+	};
+
+	const int samplesPerPixel = 1 << m_log2SamplesPerPixel;
+	const uint64_t mortonIndex = (encodeMorton2(uint32_t(m_pixelX), uint32_t(m_pixelY)) << m_log2SamplesPerPixel)
+		| uint64_t(m_sampleIndex & (samplesPerPixel - 1));
+
+	const bool isPow2Samples = (m_log2SamplesPerPixel & 1) != 0;
+	const int lastDigit = isPow2Samples ? 1 : 0;
+
+	uint64_t sampleIndex = 0;
+	for (int i = m_base4Digits - 1; i >= lastDigit; --i)
+	{
+		int digitShift = 2 * i - (isPow2Samples ? 1 : 0);
+		int digit = int((mortonIndex >> digitShift) & 3);
+		uint64_t higherDigits = mortonIndex >> (digitShift + 2);
+		int permutation = int((mixBits(higherDigits ^ (0x55555555ULL * uint64_t(dimension))) >> 24) % 24);
+		digit = permutations[permutation][digit];
+		sampleIndex |= uint64_t(digit) << digitShift;
+	}
+
+	if (isPow2Samples)
+	{
+		uint64_t digit = mortonIndex & 1;
+		sampleIndex |= digit ^ (mixBits((mortonIndex >> 1) ^ (0x55555555ULL * uint64_t(dimension))) & 1);
+	}
+
+	return sampleIndex;
+}
+
+float ZSobolSampler::get1D()
+{
+	uint64_t sampleIndex = sampleIndexForDimension(m_dimension);
+	// Past the rounded up sample count we start again with a different scramble.
+	uint32_t seed = hashCombine(hashCombine(m_seed, uint32_t(m_dimension)), uint32_t(m_sampleIndex >> m_log2SamplesPerPixel));
+	++m_dimension;
+	return toUnitFloat(nestedUniformScramble(sobolDimension0(sampleIndex), seed));
+}
+
+vec2 ZSobolSampler::get2D()
+{
+	uint64_t sampleIndex = sampleIndexForDimension(m_dimension);
+	uint32_t seed = hashCombine(hashCombine(m_seed, uint32_t(m_dimension)), uint32_t(m_sampleIndex >> m_log2SamplesPerPixel));
+	m_dimension += 2;
+	return vec2(
+		toUnitFloat(nestedUniformScramble(sobolDimension0(sampleIndex), hashCombine(seed, 0))),
+		toUnitFloat(nestedUniformScramble(sobolDimension1(sampleIndex), hashCombine(seed, 1))));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+vec2 sampleConcentricDisk(const vec2& u)
+{
+	vec2 offset = 2.0f * u - vec2(1.0f, 1.0f);
+	if (offset.x == 0.0f && offset.y == 0.0f)
+		return vec2(0.0f, 0.0f);
+
+	float radius;
+	float theta;
+	if (fabs(offset.x) > fabs(offset.y))
+	{
+		radius = offset.x;
+		theta = (Math::PI / 4.0f) * (offset.y / offset.x);
+	}
+	else
+	{
+		radius = offset.y;
+		theta = (Math::PI / 2.0f) - (Math::PI / 4.0f) * (offset.x / offset.y);
+	}
+	return radius * vec2(cos(theta), sin(theta));
+}
+
+vec3 sampleCosineHemisphere(const vec2& u)
+{
+	vec2 disk = sampleConcentricDisk(u);
+	float z = sqrt(std::max(0.0f, 1.0f - disk.x * disk.x - disk.y * disk.y));
+	return vec3(disk.x, disk.y, z);
+}
+
+vec3 sampleUniformSphere(const vec2& u)
+{
+	float z = 1.0f - 2.0f * u.x;
+	float radius = sqrt(std::max(0.0f, 1.0f - z * z));
+	float phi = Math::TAU * u.y;
+	return vec3(radius * cos(phi), radius * sin(phi), z);
+}
+
+vec3 sampleUniformBall(const vec2& u, float radiusSample)
+{
+	return sampleUniformSphere(u) * cbrt(radiusSample);
+}
+
+void orthonormalBasis(const vec3& normal, vec3& tangent, vec3& bitangent)
+{
+	float sign = copysignf(1.0f, normal.z);
+	const float a = -1.0f / (sign + normal.z);
+	const float b = normal.x * normal.y * a;
+	tangent = vec3(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+	bitangent = vec3(b, sign + normal.y * normal.y * a, -normal.y);
+}
+
+vec3 toWorld(const vec3& local, const vec3& normal)
+{
+	vec3 tangent, bitangent;
+	orthonormalBasis(normal, tangent, bitangent);
+	return local.x * tangent + local.y * bitangent + local.z * normal;
+}
+
+} // end namespace Rae
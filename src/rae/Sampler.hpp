@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include <glm/glm.hpp>
+using glm::vec2;
+using glm::vec3;
+
+namespace Rae
+{
+
+// A Sampler gives the random numbers for one pixel sample. Every call to get1D or get2D
+// consumes the next dimension. Samplers are deterministic functions of the pixel, the sample
+// index and the dimension. The only state is the current pixel sample, so each thread
+// works with its own clone.
+class Sampler
+{
+public:
+	virtual ~Sampler(){}
+
+	virtual Sampler* clone() const = 0;
+
+	virtual void startPixelSample(int x, int y, int sampleIndex)
+	{
+		m_pixelX = x;
+		m_pixelY = y;
+		m_sampleIndex = sampleIndex;
+		m_dimension = 0;
+	}
+
+	virtual float get1D() = 0;
+	virtual vec2 get2D() = 0;
+
+	virtual const char* name() const = 0;
+
+protected:
+	int m_pixelX = 0;
+	int m_pixelY = 0;
+	int m_sampleIndex = 0;
+	int m_dimension = 0;
+};
+
+// Independent uniform random numbers. Hashed from the pixel and sample index instead of
+// drand48, so that it is thread safe and reproducible.
+class RandomSampler : public Sampler
+{
+public:
+	RandomSampler(uint32_t seed = 0) : m_seed(seed) {}
+	Sampler* clone() const override { return new RandomSampler(*this); }
+
+	void startPixelSample(int x, int y, int sampleIndex) override;
+	float get1D() override;
+	vec2 get2D() override;
+	const char* name() const override { return "Random"; }
+
+protected:
+	uint32_t m_seed;
+	uint64_t m_state = 0;
+};
+
+// Shuffled and Owen-scrambled Sobol (Burley 2020, Practical Hash-based Owen Scrambling).
+// Every pair of dimensions uses the well distributed first two Sobol dimensions with its own
+// index shuffle and scramble. Each pixel gets its own seed, so the error is white noise between pixels.
+class SobolSampler : public Sampler
+{
+public:
+	SobolSampler(uint32_t seed = 0) : m_seed(seed) {}
+	Sampler* clone() const override { return new SobolSampler(*this); }
+
+	float get1D() override;
+	vec2 get2D() override;
+	const char* name() const override { return "Sobol"; }
+
+protected:
+	uint32_t m_seed;
+};
+
+// Owen-scrambled Sobol indexed in Morton (Z) order over the image (Ahmed and Wonka 2020,
+// Screen-Space Blue-Noise Diffusion of Monte Carlo Sampling Error via Hierarchical Ordering of Pixels).
+// Neighbouring pixels get consecutive parts of one Sobol sequence, which distributes
+// the error as blue noise. The samples per pixel are rounded up to a power of two.
+class ZSobolSampler : public Sampler
+{
+public:
+	ZSobolSampler(int width, int height, int samplesPerPixel, uint32_t seed = 0);
+	Sampler* clone() const override { return new ZSobolSampler(*this); }
+
+	float get1D() override;
+	vec2 get2D() override;
+	const char* name() const override { return "Blue noise (ZSobol)"; }
+
+protected:
+	uint64_t sampleIndexForDimension(int dimension) const;
+
+	uint32_t m_seed;
+	int m_log2SamplesPerPixel;
+	int m_base4Digits;
+};
+
+// 64-bit finalizer (Stafford's Mix13). Also hashes the cells of the spatial caches.
+uint64_t mixBits(uint64_t v);
+
+// Direct warps from the unit square. No rejection loops.
+
+// Shirley-Chiu concentric mapping to the unit disk.
+vec2 sampleConcentricDisk(const vec2& u);
+// Cosine weighted direction around +z. pdf = cos(theta) / pi.
+vec3 sampleCosineHemisphere(const vec2& u);
+vec3 sampleUniformSphere(const vec2& u);
+// Uniform point inside the unit ball.
+vec3 sampleUniformBall(const vec2& u, float radiusSample);
+
+// Builds tangent and bitangent for a unit normal (Duff et al. 2017).
+void orthonormalBasis(const vec3& normal, vec3& tangent, vec3& bitangent);
+vec3 toWorld(const vec3& local, const vec3& normal);
+
+} // end namespace Rae
@@ -0,0 +1,397 @@
+#include "SceneLoader.hpp"
+
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <stdint.h>
+
+#include "core/Utils.hpp"
+#include "Camera.hpp"
+#include "HitableList.hpp"
+#include "Material.hpp"
+#include "Sphere.hpp"
+#include "Plane.hpp"
+#include "Mesh.hpp"
+#include "Instance.hpp"
+#include "ModelImporter.hpp"
+
+using namespace Rae;
+
+namespace
+{
+	bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+	glm::mat3 rotation(int axis, float radians)
+	{
+		const float c = cos(radians);
+		const float s = sin(radians);
+		const int a = (axis + 1) % 3;
+		const int b = (axis + 2) % 3;
+		glm::mat3 result(1.0f);
+		result[a][a] = c;
+		result[a][b] = s;
+		result[b][a] = -s;
+		result[b][b] = c;
+		return result;
+	}
+}
+
+bool SceneLoader::load(const std::string& path, HitableList& world, Camera& camera)
+{
+	m_materials.clear();
+	m_objects.clear();
+	m_meshes.clear();
+	m_modelHashes.clear();
+	m_error.clear();
+	m_lineNumber = 0;
+
+	const size_t slash = path.find_last_of("/\\");
+	m_directory = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+
+	std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+	if (file.is_open() == false)
+		return fail("Couldn't open scene file: " + path);
+
+	std::vector<char> text(size_t(file.tellg()));
+	file.seekg(0);
+	if (text.empty() == false && file.read(&text[0], text.size()).fail())
+		return fail("Couldn't read scene file: " + path);
+
+	const char* const textEnd = text.data() + text.size();
+	const char* lineBegin = text.data();
+	while (lineBegin < textEnd)
+	{
+		const char* newline = static_cast<const char*>(memchr(lineBegin, '\n', size_t(textEnd - lineBegin)));
+		m_lineEnd = newline != nullptr ? newline : textEnd;
+		m_cursor = lineBegin;
+		++m_lineNumber;
+
+		if (nextToken() && parseStatement(world, camera) == false)
+		{
+			m_error = path + ":" + std::to_string(m_lineNumber) + ": " + m_error;
+			return false;
+		}
+
+		lineBegin = m_lineEnd + 1;
+	}
+	return true;
+}
+
+bool SceneLoader::parseStatement(HitableList& world, Camera& camera)
+{
+	bool isOk = true;
+	if (isToken("instance"))
+	{
+		// The most common by far, so it goes first.
+		isOk = parseInstance(world);
+	}
+	else if (isToken("sphere") || isToken("plane") || isToken("mesh"))
+	{
+		const std::string keyword(m_tokenBegin, m_tokenEnd);
+		Hitable* hitable = parseShape(keyword.c_str(), /*isObject*/false);
+		if (hitable == nullptr)
+			return m_isLeftOut;
+		world.add(hitable);
+	}
+	else if (isToken("object"))
+	{
+		if (readName(m_name) == false)
+			return fail("object needs a name");
+		const std::string name = m_name;
+		if (m_objects.count(name) != 0)
+			return fail("object " + name + " is defined twice");
+		if (nextToken() == false || (isToken("sphere") == false && isToken("mesh") == false))
+			return fail("object " + name + " needs to be a sphere or a mesh");
+
+		const std::string keyword(m_tokenBegin, m_tokenEnd);
+		Hitable* object = parseShape(keyword.c_str(), /*isObject*/true);
+		if (object == nullptr && m_isLeftOut == false)
+			return false;
+		if (object != nullptr)
+			world.addObject(object);
+		m_objects[name] = object;
+	}
+	else if (isToken("material"))
+		isOk = parseMaterial(world);
+	else if (isToken("model"))
+		isOk = parseModel(world);
+	else if (isToken("camera"))
+		isOk = parseCamera(camera);
+	else return fail("unknown statement " + std::string(m_tokenBegin, m_tokenEnd));
+
+	if (isOk == false)
+		return false;
+	if (nextToken())
+		return fail("unexpected " + std::string(m_tokenBegin, m_tokenEnd) + " at the end of the line");
+	return true;
+}
+
+bool SceneLoader::parseCamera(Camera& camera)
+{
+	while (nextToken())
+	{
+		float value = 0.0f;
+		if (isToken("position"))
+		{
+			vec3 position;
+			if (readVec3(position) == false)
+				return fail("camera position needs x y z");
+			camera.setPosition(position);
+			continue;
+		}
+
+		const std::string key(m_tokenBegin, m_tokenEnd);
+		if (readFloat(value) == false)
+			return fail("camera " + key + " needs a number");
+
+		if      (key == "yaw")      camera.setYaw(Math::toRadians(value));
+		else if (key == "pitch")    camera.setPitch(Math::toRadians(value));
+		else if (key == "fov")      camera.setFieldOfViewDeg(value);
+		else if (key == "aperture") camera.setAperture(value);
+		else if (key == "focus")    camera.setFocusDistance(value);
+		else return fail("unknown camera setting " + key);
+	}
+	return true;
+}
+
+bool SceneLoader::parseMaterial(HitableList& world)
+{
+	if (readName(m_name) == false)
+		return fail("material needs a name");
+	const std::string name = m_name;
+	if (nextToken() == false)
+		return fail("material " + name + " needs a type");
+
+	Material* material = nullptr;
+	vec3 color;
+	float parameter = 0.0f;
+	if (isToken("lambertian"))
+	{
+		if (readVec3(color) == false)
+			return fail("lambertian needs r g b");
+		material = new Lambertian(color);
+	}
+	else if (isToken("metal"))
+	{
+		if (readVec3(color) == false || readFloat(parameter) == false)
+			return fail("metal needs r g b roughness");
+		material = new Metal(color, parameter);
+	}
+	else if (isToken("dielectric"))
+	{
+		if (readVec3(color) == false || readFloat(parameter) == false)
+			return fail("dielectric needs r g b refractive_index");
+		material = new Dielectric(color, parameter);
+	}
+	else if (isToken("light"))
+	{
+		if (readVec3(color) == false)
+			return fail("light needs r g b");
+		material = new Light(color);
+	}
+	else return fail("unknown material type " + std::string(m_tokenBegin, m_tokenEnd));
+
+	// A later definition replaces the name, the earlier primitives keep theirs.
+	m_materials[name] = world.addMaterial(material);
+	return true;
+}
+
+Hitable* SceneLoader::parseShape(const char* keyword, bool isObject)
+{
+	m_isLeftOut = false;
+	Material* material = readMaterial();
+	if (material == nullptr)
+		return nullptr;
+
+	if (strcmp(keyword, "sphere") == 0)
+	{
+		// An object is at the origin, its instances place it.
+		vec3 center(0.0f, 0.0f, 0.0f);
+		float radius = 0.0f;
+		if ((isObject == false && readVec3(center) == false) || readFloat(radius) == false)
+		{
+			fail(isObject ? "sphere object needs a radius" : "sphere needs x y z radius");
+			return nullptr;
+		}
+		return new Sphere(center, radius, material);
+	}
+
+	if (strcmp(keyword, "plane") == 0)
+	{
+		vec3 point;
+		vec3 normal;
+		if (readVec3(point) == false || readVec3(normal) == false)
+		{
+			fail("plane needs x y z nx ny nz");
+			return nullptr;
+		}
+		return new Plane(point, normal, material);
+	}
+
+	if (nextToken() == false)
+	{
+		fail("mesh needs a file or box");
+		return nullptr;
+	}
+
+	const std::string file(m_tokenBegin, m_tokenEnd);
+	bool isCompact = false;
+	if (nextToken())
+	{
+		if (isToken("compact"))
+			isCompact = true;
+		else m_cursor = m_tokenBegin; // left for the end of line check
+	}
+	if (m_isPreview && file != "box")
+	{
+		m_isLeftOut = true;
+		return nullptr;
+	}
+
+	Mesh* mesh = new Mesh(0);
+	mesh->setCompactAttributes(isCompact);
+	if (file == "box")
+		mesh->generateBox();
+	else if (mesh->loadModel(m_directory + file, m_threadPool) == false)
+	{
+		delete mesh;
+		fail("couldn't load mesh " + file);
+		return nullptr;
+	}
+	mesh->setMaterial(material);
+	mesh->setPager(m_pager);
+	m_meshes.push_back(mesh);
+	return mesh;
+}
+
+bool SceneLoader::parseInstance(HitableList& world)
+{
+	if (readName(m_name) == false)
+		return fail("instance needs an object");
+	auto found = m_objects.find(m_name);
+	if (found == m_objects.end())
+		return fail("unknown object " + m_name);
+
+	vec3 position;
+	if (readVec3(position) == false)
+		return fail("instance needs x y z");
+
+	glm::mat3 basis(1.0f);
+	if (nextToken())
+	{
+		// Back to the start of the token, so it can be read as a number.
+		m_cursor = m_tokenBegin;
+		vec3 angles;
+		if (readVec3(angles) == false)
+			return fail("instance rotation needs rx ry rz");
+		if (angles != vec3(0.0f, 0.0f, 0.0f))
+		{
+			basis = rotation(2, Math::toRadians(angles.z))
+				* rotation(1, Math::toRadians(angles.y))
+				* rotation(0, Math::toRadians(angles.x));
+		}
+
+		float scale = 1.0f;
+		if (nextToken())
+		{
+			m_cursor = m_tokenBegin;
+			if (readFloat(scale) == false || scale == 0.0f)
+				return fail("instance scale needs to be a number other than 0");
+			basis *= scale;
+		}
+	}
+
+	// Only the 3x3 part is multiplied, the position goes straight to the last column.
+	mat4 transform(basis);
+	transform[3] = glm::vec4(position, 1.0f);
+
+	if (found->second != nullptr)
+		world.addInstance(found->second, transform);
+	return true;
+}
+
+bool SceneLoader::parseModel(HitableList& world)
+{
+	if (nextToken() == false)
+		return fail("model needs a file");
+	const std::string file(m_tokenBegin, m_tokenEnd);
+
+	ModelImporter importer;
+	importer.setThreadPool(m_threadPool);
+	if (nextToken())
+	{
+		if (isToken("compact"))
+			importer.setCompactAttributes(true);
+		else m_cursor = m_tokenBegin;
+	}
+	if (m_isPreview)
+		return true;
+	if (importer.import(m_directory + file, world) == false)
+		return fail(importer.error());
+	m_modelHashes.push_back(importer.sourceHash());
+	return true;
+}
+
+bool SceneLoader::nextToken()
+{
+	while (m_cursor < m_lineEnd && isSpace(*m_cursor))
+		++m_cursor;
+	if (m_cursor == m_lineEnd || *m_cursor == '#')
+	{
+		m_cursor = m_lineEnd;
+		return false;
+	}
+
+	m_tokenBegin = m_cursor;
+	while (m_cursor < m_lineEnd && isSpace(*m_cursor) == false && *m_cursor != '#')
+		++m_cursor;
+	m_tokenEnd = m_cursor;
+	return true;
+}
+
+bool SceneLoader::isToken(const char* keyword) const
+{
+	const size_t length = strlen(keyword);
+	return size_t(m_tokenEnd - m_tokenBegin) == length && memcmp(m_tokenBegin, keyword, length) == 0;
+}
+
+bool SceneLoader::readFloat(float& out)
+{
+	return nextToken() && Utils::parseFloat(m_tokenBegin, m_tokenEnd, out);
+}
+
+bool SceneLoader::readVec3(vec3& out)
+{
+	return readFloat(out.x) && readFloat(out.y) && readFloat(out.z);
+}
+
+bool SceneLoader::readName(std::string& out)
+{
+	if (nextToken() == false)
+		return false;
+	out.assign(m_tokenBegin, m_tokenEnd);
+	return true;
+}
+
+Material* SceneLoader::readMaterial()
+{
+	if (readName(m_name) == false)
+	{
+		fail("missing a material");
+		return nullptr;
+	}
+	auto found = m_materials.find(m_name);
+	if (found == m_materials.end())
+	{
+		fail("unknown material " + m_name);
+		return nullptr;
+	}
+	return found->second;
+}
+
+bool SceneLoader::fail(const std::string& message)
+{
+	m_error = message;
+	return false;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+using glm::vec3;
+
+namespace Rae
+{
+
+class Camera;
+class ClusterPager;
+class Hitable;
+class HitableList;
+class Material;
+class Mesh;
+class ThreadPool;
+
+// Reads the text scenes of bin/data/scenes. One statement per line, # starts a comment,
+// names have no spaces and angles are in degrees.
+//
+//   camera [position x y z] [yaw a] [pitch a] [fov a] [aperture a] [focus distance]
+//   material name lambertian|metal|dielectric|light r g b [roughness|refractive index]
+//   sphere material x y z radius
+//   plane material x y z nx ny nz
+//   mesh material file.obj|box [compact]
+//   object name sphere material radius
+//   object name mesh material file.obj|box [compact]
+//   instance object x y z [rx ry rz [scale]]
+//   model file.dae [compact]
+//
+// Objects are only in the scene through their instances, which rotate around x, then y, then z.
+// Mesh files are relative to the scene file. compact stores the normals and UVs of a mesh in
+// 8 bytes a vertex instead of 20. A model brings all the meshes, nodes and materials of its file,
+// see ModelImporter.
+//
+// The file is read at once and parsed in a single pass, straight into the scene, so a line
+// allocates nothing but its primitive.
+class SceneLoader
+{
+public:
+	// On failure the world keeps what came before the bad line, and error() says what went wrong.
+	bool load(const std::string& path, HitableList& world, Camera& camera);
+	const std::string& error() const { return m_error; }
+	// For the meshes that come from their cache files.
+	void setPager(ClusterPager* pager) { m_pager = pager; }
+	// For building the meshes of models in parallel.
+	void setThreadPool(ThreadPool* threadPool) { m_threadPool = threadPool; }
+	// Leaves out the mesh files and models, and the instances of their objects. What is left
+	// loads in no time, for a look at the scene while the rest loads.
+	void setPreview(bool set) { m_isPreview = set; }
+	// The meshes of the last load, for giving them a pager later.
+	const std::vector<Mesh*>& meshes() const { return m_meshes; }
+	// The contents of the model files of the last load. The meshes have their own, see Mesh::sourceHash.
+	const std::vector<uint64_t>& modelHashes() const { return m_modelHashes; }
+
+protected:
+	bool parseStatement(HitableList& world, Camera& camera);
+	bool parseCamera(Camera& camera);
+	bool parseMaterial(HitableList& world);
+	bool parseInstance(HitableList& world);
+	bool parseModel(HitableList& world);
+	// A sphere, plane or mesh. Objects have no position.
+	Hitable* parseShape(const char* keyword, bool isObject);
+
+	// The tokens of the current line
+	bool nextToken();
+	bool isToken(const char* keyword) const;
+	bool readFloat(float& out);
+	bool readVec3(vec3& out);
+	bool readName(std::string& out);
+	Material* readMaterial();
+	bool fail(const std::string& message);
+
+	std::unordered_map<std::string, Material*> m_materials;
+	std::unordered_map<std::string, Hitable*> m_objects; // null for the objects left out of a preview
+	std::vector<Mesh*> m_meshes;
+	std::vector<uint64_t> m_modelHashes;
+	std::string m_name; // reused, so that looking up a name doesn't allocate
+	std::string m_directory;
+	std::string m_error;
+	ClusterPager* m_pager = nullptr;
+	ThreadPool* m_threadPool = nullptr;
+	bool m_isPreview = false;
+	bool m_isLeftOut = false; // parseShape returned null for the preview, not for an error
+
+	const char* m_cursor = nullptr;
+	const char* m_lineEnd = nullptr;
+	const char* m_tokenBegin = nullptr;
+	const char* m_tokenEnd = nullptr;
+	int m_lineNumber = 0;
+};
+
+}
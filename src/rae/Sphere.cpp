@@ -8,7 +8,7 @@ using namespace Rae;
 
 Sphere::~Sphere()
 {
-	delete material; // Hmm. Currently no shared materials... TODO memory management.
+	// The material belongs to the scene, see HitableList::addMaterial.
 }
 
 bool Sphere::hit(const Ray& ray, float t_min, float t_max, HitRecord& record) const
@@ -27,6 +27,8 @@ bool Sphere::hit(const Ray& ray, float t_min, float t_max, HitRecord& record) co
 			record.point = ray.point_at_parameter(record.t);
 			record.normal = (record.point - center) / radius;
 			record.material = material;
+			record.hitable = this;
+			record.primitiveIndex = 0;
 			return true;
 		}
 	}
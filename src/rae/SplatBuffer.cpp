@@ -0,0 +1,63 @@
+#include "SplatBuffer.hpp"
+
+#include "core/Utils.hpp"
+
+using namespace Rae;
+
+SplatBuffer::SplatBuffer()
+: m_pathCount(0)
+{
+}
+
+void SplatBuffer::resize(int width, int height)
+{
+	m_width = width;
+	m_height = height;
+	m_sums.reset(new std::atomic<float>[width * height * 3]);
+	clear();
+}
+
+void SplatBuffer::clear()
+{
+	for (int i = 0; i < m_width * m_height * 3; ++i)
+		m_sums[i].store(0.0f);
+	m_pathCount.store(0);
+}
+
+void SplatBuffer::add(int x, int y, const vec3& color)
+{
+	if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+		return;
+
+	const int index = (y * m_width) + x;
+	Utils::atomicAdd(m_sums[index * 3 + 0], color.x);
+	Utils::atomicAdd(m_sums[index * 3 + 1], color.y);
+	Utils::atomicAdd(m_sums[index * 3 + 2], color.z);
+}
+
+void SplatBuffer::copySums(std::vector<float>& sums) const
+{
+	sums.resize(size_t(m_width) * size_t(m_height) * 3);
+	for (size_t i = 0; i < sums.size(); ++i)
+		sums[i] = m_sums[i].load(std::memory_order_relaxed);
+}
+
+void SplatBuffer::setSums(const std::vector<float>& sums, int64_t pathCount)
+{
+	for (size_t i = 0; i < sums.size(); ++i)
+		m_sums[i].store(sums[i]);
+	m_pathCount.store(pathCount);
+}
+
+vec3 SplatBuffer::pixel(int index) const
+{
+	const int64_t pathCount = m_pathCount.load();
+	if (pathCount == 0)
+		return vec3(0.0f, 0.0f, 0.0f);
+
+	const float scale = float(m_width * m_height) / float(pathCount);
+	return scale * vec3(
+		m_sums[index * 3 + 0].load(std::memory_order_relaxed),
+		m_sums[index * 3 + 1].load(std::memory_order_relaxed),
+		m_sums[index * 3 + 2].load(std::memory_order_relaxed));
+}
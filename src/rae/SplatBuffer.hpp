@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+using glm::vec3;
+
+namespace Rae
+{
+
+// Light that paths add to whichever pixel they reach, like the light tracing strategies of BDPT.
+// Kept apart from the per-pixel sample means, because a splat doesn't belong to any pixel sample.
+// Any thread can add at the same time.
+class SplatBuffer
+{
+public:
+	SplatBuffer();
+
+	// Both clear the buffer.
+	void resize(int width, int height);
+	void clear();
+
+	void add(int x, int y, const vec3& color);
+	// Every path that could have splatted counts, also the ones that didn't.
+	void addPaths(int count) { m_pathCount.fetch_add(count, std::memory_order_relaxed); }
+
+	// The splatted light of the pixel, as a per-pixel estimate: the sum over all paths, times the
+	// pixel count, divided by the path count. Call while no thread adds.
+	vec3 pixel(int index) const;
+	bool isEmpty() const { return m_pathCount.load() == 0; }
+	int64_t pathCount() const { return m_pathCount.load(); }
+
+	// The sums as they are, rgb per pixel, e.g. for a checkpoint. Call while no thread adds.
+	void copySums(std::vector<float>& sums) const;
+	// Carries on from copySums and its path count. The sums have to fit the size.
+	void setSums(const std::vector<float>& sums, int64_t pathCount);
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+
+protected:
+	int m_width = 0;
+	int m_height = 0;
+	std::unique_ptr<std::atomic<float>[]> m_sums; // rgb per pixel
+	std::atomic<int64_t> m_pathCount;
+};
+
+} // end namespace Rae
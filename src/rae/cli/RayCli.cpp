@@ -0,0 +1,276 @@
+// rae_ray_cli renders a scene to a PPM file without a window or GL, e.g. on render farm nodes.
+//
+//   rae_ray_cli --scene 3 --width 1280 --height 720 --spp 256 --threads 16 --output book.ppm
+//   rae_ray_cli --scene 4 --time 60 --output lights.ppm
+//   rae_ray_cli --scene data/scenes/book.scene --spp 64
+//
+// A .pfm or .exr output is the linear image before denoising, optionally with the albedo, normal
+// and depth, and --progress writes it during the render without holding the render threads:
+//
+//   rae_ray_cli --scene 3 --spp 1024 --output book.exr --features --progress 30
+//
+// With a time budget, the render stops at whichever comes first, the budget or --spp.
+// With a checkpoint file, a render that was stopped, by the budget or by anything else, carries on
+// from the last checkpoint when it's run again with the same scene and options:
+//
+//   rae_ray_cli --scene 3 --spp 2000 --time 3600 --checkpoint book.checkpoint
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "RayTracer.hpp"
+#include "CameraSystem.hpp"
+#include "Entity.hpp"
+#include "HdrImage.hpp"
+
+using namespace Rae;
+
+namespace
+{
+	struct Options
+	{
+		std::string scene = "1"; // a scene number, or a scene file
+		int width = 1280;
+		int height = 720;
+		int samples = 64;
+		double timeBudget = 0.0; // seconds, 0 for none
+		int threadCount = 0; // 0 uses every hardware thread
+		double geometryMegabytes = 0.0; // 0 for no limit
+		std::string output = "render.ppm";
+		std::string checkpoint; // empty for none
+		double checkpointInterval = 60.0; // seconds
+		bool isFeatures = false; // albedo, normal and depth with a .pfm or .exr output
+		bool isFloat = false; // 32-bit instead of half floats in an .exr
+		double progressInterval = 0.0; // seconds between saves of a .pfm or .exr output, 0 for none
+	};
+
+	void printUsage()
+	{
+		std::cout << "Usage: rae_ray_cli [options]\n"
+			<< "  --scene N      scene number 1-4, or a scene file (default 1)\n"
+			<< "  --width N      image width in pixels (default 1280)\n"
+			<< "  --height N     image height in pixels (default 720)\n"
+			<< "  --spp N        samples per pixel (default 64)\n"
+			<< "  --time S       time budget in seconds, stops early when it runs out\n"
+			<< "  --threads N    render threads, 0 for all hardware threads (default 0)\n"
+			<< "  --geometry-mb N  memory for cached mesh clusters, 0 for no limit (default 0)\n"
+			<< "  --output FILE  .ppm, or linear .pfm or .exr file to write (default render.ppm)\n"
+			<< "  --features     also writes the albedo, normal and depth to a .pfm or .exr\n"
+			<< "  --float        32-bit floats in an .exr instead of half floats\n"
+			<< "  --progress S   writes the .pfm or .exr every S seconds during the render\n"
+			<< "  --checkpoint FILE  saves the render there and resumes from it, removed when done\n"
+			<< "  --checkpoint-interval S  seconds between checkpoints (default 60)\n";
+	}
+
+	bool parseOptions(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			const std::string arg = argv[i];
+			if (arg == "--help" || arg == "-h")
+				return false;
+			if (arg == "--features")
+			{
+				options.isFeatures = true;
+				continue;
+			}
+			if (arg == "--float")
+			{
+				options.isFloat = true;
+				continue;
+			}
+
+			if (i + 1 >= argc)
+			{
+				std::cerr << "Missing a value for " << arg << "\n";
+				return false;
+			}
+			const char* value = argv[++i];
+
+			if      (arg == "--scene")   options.scene = value;
+			else if (arg == "--width")   options.width = atoi(value);
+			else if (arg == "--height")  options.height = atoi(value);
+			else if (arg == "--spp")     options.samples = atoi(value);
+			else if (arg == "--time")    options.timeBudget = atof(value);
+			else if (arg == "--threads") options.threadCount = atoi(value);
+			else if (arg == "--geometry-mb") options.geometryMegabytes = atof(value);
+			else if (arg == "--output")  options.output = value;
+			else if (arg == "--checkpoint") options.checkpoint = value;
+			else if (arg == "--checkpoint-interval") options.checkpointInterval = atof(value);
+			else if (arg == "--progress") options.progressInterval = atof(value);
+			else
+			{
+				std::cerr << "Unknown option " << arg << "\n";
+				return false;
+			}
+		}
+
+		if (options.width <= 0 || options.height <= 0 || options.samples <= 0 || options.threadCount < 0)
+		{
+			std::cerr << "Width, height and spp need to be positive.\n";
+			return false;
+		}
+		if ((options.isFeatures || options.progressInterval > 0.0) && isHdrImagePath(options.output) == false)
+		{
+			std::cerr << "--features and --progress need a .pfm or .exr output.\n";
+			return false;
+		}
+		return true;
+	}
+
+	// ImageBuffer::data is gamma corrected RGBA, a binary PPM wants RGB.
+	bool writePpm(const std::string& path, const ImageBuffer& buffer)
+	{
+		std::ofstream file(path.c_str(), std::ios::binary);
+		if (file.is_open() == false)
+			return false;
+
+		file << "P6\n" << buffer.width << " " << buffer.height << "\n255\n";
+		std::vector<uint8_t> row(buffer.width * 3);
+		for (int j = 0; j < buffer.height; ++j)
+		{
+			for (int i = 0; i < buffer.width; ++i)
+			{
+				const int index = ((j * buffer.width) + i) * buffer.channels;
+				row[i * 3 + 0] = buffer.data[index + 0];
+				row[i * 3 + 1] = buffer.data[index + 1];
+				row[i * 3 + 2] = buffer.data[index + 2];
+			}
+			file.write(reinterpret_cast<const char*>(&row[0]), row.size());
+		}
+		return file.good();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (parseOptions(argc, argv, options) == false)
+	{
+		printUsage();
+		return 1;
+	}
+
+	CameraSystem cameraSystem;
+	cameraSystem.setAspectRatio(float(options.width) / float(options.height));
+
+	RayTracer rayTracer(cameraSystem, options.width, options.height, options.threadCount);
+	rayTracer.setGeometryBudget(size_t(std::max(0.0, options.geometryMegabytes) * 1024.0 * 1024.0));
+	// Scenes 1-3 are files too, relative to the bin directory.
+	const bool isSceneNumber = options.scene.size() == 1 && options.scene[0] >= '1' && options.scene[0] <= '4';
+	if (isSceneNumber)
+	{
+		// The app shows a preview while the meshes load, here it's the full scene or nothing.
+		rayTracer.showScene(options.scene[0] - '0');
+		rayTracer.waitForScene();
+	}
+	else if (rayTracer.loadScene(options.scene) == false)
+		return 1;
+	rayTracer.setSamplesLimit(options.samples);
+
+	// Updates the camera's frustum, and the ray tracer hears of the change.
+	std::vector<Entity> entities;
+	cameraSystem.update(0.0, 0.0, entities);
+	rayTracer.resetRayCount();
+
+	int resumedSample = 0;
+	if (options.checkpoint.empty() == false && options.scene == "4")
+		std::cout << "Scene 4 is made in code, so it has no checkpoints\n";
+	else if (options.checkpoint.empty() == false && rayTracer.loadCheckpoint(options.checkpoint))
+	{
+		resumedSample = rayTracer.currentSample();
+		std::cout << "Resuming from " << options.checkpoint << " at " << resumedSample << " spp\n";
+	}
+
+	std::cout << "Rendering scene " << options.scene << " at " << options.width << "x" << options.height
+		<< ", " << options.samples << " spp";
+	if (options.timeBudget > 0.0)
+		std::cout << ", at most " << options.timeBudget << " s";
+	std::cout << "\n";
+
+	auto startTime = std::chrono::steady_clock::now();
+	double elapsedTime = 0.0;
+	double checkpointTime = 0.0;
+	double progressTime = 0.0;
+	int reportedSample = resumedSample;
+	while (rayTracer.isRenderingDone() == false)
+	{
+		// Slices of a second, so progress gets reported and the budget is kept.
+		double slice = 1.0;
+		if (options.timeBudget > 0.0)
+		{
+			slice = std::min(slice, options.timeBudget - elapsedTime);
+			if (slice <= 0.0)
+				break;
+		}
+		rayTracer.renderSamples(elapsedTime, slice);
+
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+		elapsedTime = elapsed.count();
+
+		// Written in the background. If the last one is still being written, the next slice tries again.
+		if (options.checkpoint.empty() == false && elapsedTime - checkpointTime >= options.checkpointInterval
+			&& rayTracer.isRenderingDone() == false && rayTracer.saveCheckpoint(options.checkpoint))
+			checkpointTime = elapsedTime;
+		if (options.progressInterval > 0.0 && elapsedTime - progressTime >= options.progressInterval
+			&& rayTracer.isRenderingDone() == false
+			&& rayTracer.saveImage(options.output, options.isFeatures, options.isFloat))
+			progressTime = elapsedTime;
+
+		if (rayTracer.currentSample() != reportedSample)
+		{
+			reportedSample = rayTracer.currentSample();
+			std::cout << "  " << reportedSample << "/" << options.samples << " spp, "
+				<< elapsedTime << " s\n";
+		}
+	}
+
+	if (options.checkpoint.empty() == false)
+	{
+		rayTracer.finishCheckpoint();
+		// Stopped by the budget, so the next run carries on from here.
+		if (rayTracer.isRenderingDone() == false && rayTracer.saveCheckpoint(options.checkpoint)
+			&& rayTracer.finishCheckpoint())
+			std::cout << "Saved " << options.checkpoint << " at " << rayTracer.currentSample() << " spp\n";
+	}
+
+	const bool isHdrOutput = isHdrImagePath(options.output);
+	if (isHdrOutput == false)
+		rayTracer.updateImageBuffer();
+
+	const double pixelSamples = double(rayTracer.currentSample() - resumedSample) * double(options.width) * double(options.height);
+	const double seconds = std::max(elapsedTime, 1e-9);
+	std::cout << "Rendered " << rayTracer.currentSample() - resumedSample << " spp in " << elapsedTime << " s\n"
+		<< "  " << double(rayTracer.rayCount()) / seconds / 1e6 << " M rays/sec\n"
+		<< "  " << pixelSamples / seconds / 1e6 << " M samples/sec\n";
+
+	const ClusterPager& pager = rayTracer.geometryPager();
+	if (pager.pageInCount() > 0)
+	{
+		std::cout << "  " << pager.pageInCount() << " mesh clusters paged in, " << pager.evictionCount()
+			<< " evicted, " << double(pager.residentBytes()) / (1024.0 * 1024.0) << " MB resident\n";
+	}
+
+	// A progress save can still be going, and the last save has to be the final image.
+	if (isHdrOutput)
+		rayTracer.finishImage();
+	const bool isWritten = isHdrOutput
+		? rayTracer.saveImage(options.output, options.isFeatures, options.isFloat) && rayTracer.finishImage()
+		: writePpm(options.output, rayTracer.imageBuffer());
+	if (isWritten == false)
+	{
+		std::cerr << "Failed to write " << options.output << "\n";
+		return 1;
+	}
+	std::cout << "Wrote " << options.output << "\n";
+
+	// Nothing left to resume.
+	if (options.checkpoint.empty() == false && rayTracer.isRenderingDone())
+		remove(options.checkpoint.c_str());
+	return 0;
+}
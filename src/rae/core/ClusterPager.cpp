@@ -0,0 +1,101 @@
+#include "core/ClusterPager.hpp"
+#include "core/MappedFile.hpp"
+
+#include <algorithm>
+#include <vector>
+#include <utility>
+
+using namespace Rae;
+
+ClusterPager::ClusterPager(size_t budgetBytes)
+: m_clock(0),
+m_budget(budgetBytes)
+{
+}
+
+void ClusterPager::setBudget(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_budget = bytes;
+	if (m_budget > 0 && m_residentBytes > m_budget)
+		evictOver(m_budget, -1);
+}
+
+int ClusterPager::addCluster(const Range* ranges, int rangeCount)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_clusters.emplace_back();
+	Cluster& cluster = m_clusters.back();
+	cluster.rangeCount = std::min(rangeCount, int(MaxRanges));
+	for (int i = 0; i < cluster.rangeCount; ++i)
+	{
+		cluster.ranges[i] = ranges[i];
+		cluster.bytes += ranges[i].size;
+	}
+	cluster.lastUse.store(0);
+	cluster.isResident.store(false);
+	++m_liveCount;
+	return int(m_clusters.size()) - 1;
+}
+
+void ClusterPager::removeClusters(int firstId, int count)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (int id = firstId; id < firstId + count; ++id)
+	{
+		Cluster& cluster = m_clusters[id];
+		if (cluster.isResident.load())
+			m_residentBytes -= cluster.bytes;
+		cluster.isResident.store(false);
+		cluster.isRemoved = true;
+		--m_liveCount;
+	}
+	// The ids aren't reused while any are in use, and a cleared scene starts over.
+	if (m_liveCount == 0)
+		m_clusters.clear();
+}
+
+void ClusterPager::pageIn(int id)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Cluster& cluster = m_clusters[id];
+	if (cluster.isResident.load(std::memory_order_relaxed))
+		return; // another thread got here first
+
+	for (int i = 0; i < cluster.rangeCount; ++i)
+		MappedFile::prefetch(cluster.ranges[i].data, cluster.ranges[i].size);
+	m_residentBytes += cluster.bytes;
+	++m_pageInCount;
+	// A page in starts a new moment for the LRU order.
+	m_clock.fetch_add(1, std::memory_order_relaxed);
+	cluster.lastUse.store(m_clock.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	cluster.isResident.store(true, std::memory_order_release);
+
+	if (m_budget > 0 && m_residentBytes > m_budget)
+		evictOver(m_budget - m_budget / 4, id);
+}
+
+void ClusterPager::evictOver(size_t bytes, int keepId)
+{
+	std::vector<std::pair<uint32_t, int>> resident;
+	for (int id = 0; id < int(m_clusters.size()); ++id)
+	{
+		const Cluster& cluster = m_clusters[id];
+		if (id != keepId && cluster.isRemoved == false && cluster.isResident.load(std::memory_order_relaxed))
+			resident.push_back(std::make_pair(cluster.lastUse.load(std::memory_order_relaxed), id));
+	}
+	std::sort(resident.begin(), resident.end());
+
+	// A ray still in an evicted cluster only reads its pages again from the file.
+	for (const std::pair<uint32_t, int>& entry : resident)
+	{
+		if (m_residentBytes <= bytes)
+			break;
+		Cluster& cluster = m_clusters[entry.second];
+		cluster.isResident.store(false, std::memory_order_release);
+		for (int i = 0; i < cluster.rangeCount; ++i)
+			MappedFile::evict(cluster.ranges[i].data, cluster.ranges[i].size);
+		m_residentBytes -= cluster.bytes;
+		++m_evictionCount;
+	}
+}
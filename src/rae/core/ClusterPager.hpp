@@ -0,0 +1,82 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Rae
+{
+
+// Keeps the clusters of mapped geometry under a memory budget. A cluster is a few ranges of
+// mapped files that are used together, like the BVH nodes, triangles and vertices of a part of
+// a mesh. The first touch of a cluster asks for all of its pages at once, and when the resident
+// clusters go over the budget the least recently used ones are given back to the system.
+//
+// Evicting only drops pages of read-only mappings, which are read again when touched, so
+// a scene bigger than the budget, or than the memory, renders slower but correctly.
+class ClusterPager
+{
+public:
+	struct Range
+	{
+		const void* data;
+		size_t size;
+	};
+	static const int MaxRanges = 6;
+
+	// 0 is no budget: clusters are still prefetched, but never evicted.
+	ClusterPager(size_t budgetBytes = 0);
+
+	void setBudget(size_t bytes);
+	size_t budget() const { return m_budget; }
+
+	// Returns the id of the cluster. Not while other threads touch clusters.
+	int addCluster(const Range* ranges, int rangeCount);
+	void removeClusters(int firstId, int count);
+
+	// Called by every ray that enters the cluster, so it's cheap when the cluster is resident.
+	void touch(int id)
+	{
+		Cluster& cluster = m_clusters[id];
+		const uint32_t now = m_clock.load(std::memory_order_relaxed);
+		// Only written when it changes, so that the threads don't fight over the cache line.
+		if (cluster.lastUse.load(std::memory_order_relaxed) != now)
+			cluster.lastUse.store(now, std::memory_order_relaxed);
+		if (cluster.isResident.load(std::memory_order_acquire) == false)
+			pageIn(id);
+	}
+
+	size_t residentBytes() const { return m_residentBytes; }
+	int64_t pageInCount() const { return m_pageInCount; }
+	int64_t evictionCount() const { return m_evictionCount; }
+
+protected:
+	struct Cluster
+	{
+		Range ranges[MaxRanges];
+		int rangeCount = 0;
+		size_t bytes = 0;
+		bool isRemoved = false;
+		std::atomic<uint32_t> lastUse;
+		std::atomic<bool> isResident;
+	};
+
+	void pageIn(int id);
+	// Down to a part of the budget, so that evictions come in batches and not on every page in.
+	void evictOver(size_t bytes, int keepId);
+
+	// A deque, since its elements stay put when it grows.
+	std::deque<Cluster> m_clusters;
+	int m_liveCount = 0;
+
+	std::mutex m_mutex;
+	std::atomic<uint32_t> m_clock;
+	size_t m_budget = 0;
+	size_t m_residentBytes = 0;
+	int64_t m_pageInCount = 0;
+	int64_t m_evictionCount = 0;
+};
+
+}
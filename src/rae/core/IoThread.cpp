@@ -0,0 +1,48 @@
+#include "core/IoThread.hpp"
+
+using namespace Rae;
+
+IoThread::IoThread()
+{
+	m_thread = std::thread(&IoThread::loop, this);
+}
+
+IoThread::~IoThread()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_isQuitting = true;
+	}
+	m_jobCondition.notify_all();
+	m_thread.join();
+}
+
+std::future<bool> IoThread::post(std::function<bool()> job)
+{
+	// A packaged_task can't be copied, and a std::function needs to be.
+	std::shared_ptr<std::packaged_task<bool()>> task(new std::packaged_task<bool()>(std::move(job)));
+	std::future<bool> result = task->get_future();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_jobs.push_back(task);
+	}
+	m_jobCondition.notify_one();
+	return result;
+}
+
+void IoThread::loop()
+{
+	while (true)
+	{
+		std::shared_ptr<std::packaged_task<bool()>> task;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_jobCondition.wait(lock, [this]() { return m_isQuitting || m_jobs.empty() == false; });
+			if (m_jobs.empty())
+				return;
+			task = m_jobs.front();
+			m_jobs.pop_front();
+		}
+		(*task)();
+	}
+}
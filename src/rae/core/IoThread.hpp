@@ -0,0 +1,36 @@
+#pragma once
+
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+namespace Rae
+{
+
+// One thread for writing files, so that the render threads never wait for the disk or for the
+// compression. The jobs run one at a time in the order they were posted. The destructor finishes
+// the jobs that are left.
+class IoThread
+{
+public:
+	IoThread();
+	~IoThread();
+
+	// The future has what the job returned, usually whether the file was written.
+	std::future<bool> post(std::function<bool()> job);
+
+protected:
+	void loop();
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_jobCondition;
+	std::deque<std::shared_ptr<std::packaged_task<bool()>>> m_jobs;
+	bool m_isQuitting = false;
+};
+
+}
@@ -0,0 +1,226 @@
+#include "core/MappedFile.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <utility>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+using namespace Rae;
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+MappedFile::MappedFile(MappedFile&& other)
+{
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other)
+{
+	if (this != &other)
+	{
+		close();
+		std::swap(m_data, other.m_data);
+		std::swap(m_size, other.m_size);
+	#ifdef _WIN32
+		std::swap(m_file, other.m_file);
+		std::swap(m_mapping, other.m_mapping);
+	#endif
+	}
+	return *this;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& path)
+{
+	close();
+
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(file, &size) == FALSE || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == nullptr)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	m_file = file;
+	m_mapping = mapping;
+	m_data = static_cast<const uint8_t*>(data);
+	m_size = size_t(size.QuadPart);
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (m_data != nullptr)
+		UnmapViewOfFile(m_data);
+	if (m_mapping != nullptr)
+		CloseHandle(m_mapping);
+	if (m_file != nullptr)
+		CloseHandle(m_file);
+	m_data = nullptr;
+	m_size = 0;
+	m_mapping = nullptr;
+	m_file = nullptr;
+}
+
+void MappedFile::prefetch(const void* data, size_t size)
+{
+	// PrefetchVirtualMemory needs Windows 8, the first touch reads the pages instead.
+}
+
+void MappedFile::evict(const void* data, size_t size)
+{
+	// Unlocking pages that aren't locked takes them out of the working set.
+	if (size > 0)
+		VirtualUnlock(const_cast<void*>(data), size);
+}
+
+#else
+
+bool MappedFile::open(const std::string& path)
+{
+	close();
+
+	const int file = ::open(path.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(file, &info) != 0 || info.st_size <= 0)
+	{
+		::close(file);
+		return false;
+	}
+
+	void* data = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+	// The mapping keeps the file open by itself.
+	::close(file);
+	if (data == MAP_FAILED)
+		return false;
+
+	m_data = static_cast<const uint8_t*>(data);
+	m_size = size_t(info.st_size);
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (m_data != nullptr)
+		munmap(const_cast<uint8_t*>(m_data), m_size);
+	m_data = nullptr;
+	m_size = 0;
+}
+
+namespace
+{
+	// madvise wants the start at a page. The pages at the ends may be shared with a neighbouring
+	// range, which only costs that range a read.
+	void advise(const void* data, size_t size, int advice)
+	{
+		if (data == nullptr || size == 0)
+			return;
+		const uintptr_t pageSize = uintptr_t(sysconf(_SC_PAGESIZE));
+		const uintptr_t begin = uintptr_t(data) / pageSize * pageSize;
+		const uintptr_t end = uintptr_t(data) + size;
+		madvise(reinterpret_cast<void*>(begin), size_t(end - begin), advice);
+	}
+}
+
+void MappedFile::prefetch(const void* data, size_t size)
+{
+	advise(data, size, MADV_WILLNEED);
+}
+
+void MappedFile::evict(const void* data, size_t size)
+{
+	// A private read-only mapping has no changes to lose, the pages are read again from the file.
+	advise(data, size, MADV_DONTNEED);
+}
+
+#endif
+
+uint64_t MappedFile::contentHash() const
+{
+	// FNV-1a on words instead of bytes, with a final mix so that the high bits depend on everything.
+	uint64_t hash = 14695981039346656037ULL ^ uint64_t(m_size);
+	const uint64_t prime = 1099511628211ULL;
+
+	size_t i = 0;
+	for (; i + 8 <= m_size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, m_data + i, sizeof(word));
+		hash = (hash ^ word) * prime;
+	}
+	for (; i < m_size; ++i)
+		hash = (hash ^ m_data[i]) * prime;
+
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+bool Rae::writeFileAtomically(const std::string& path, const std::function<void(std::ostream& out)>& write)
+{
+	const std::string tempPath = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+	{
+		std::ofstream out(tempPath.c_str(), std::ios::binary | std::ios::trunc);
+		if (out.is_open() == false)
+			return false;
+		write(out);
+		out.flush();
+		if (out.fail())
+		{
+			out.close();
+			remove(tempPath.c_str());
+			return false;
+		}
+	}
+
+#ifdef _WIN32
+	// Windows doesn't rename over an existing file.
+	remove(path.c_str());
+#endif
+	if (rename(tempPath.c_str(), path.c_str()) != 0)
+	{
+		remove(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
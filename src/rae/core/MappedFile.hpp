@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <functional>
+#include <iosfwd>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Rae
+{
+
+// A read-only memory mapping of a whole file. Nothing is read at open, the pages come from
+// the disk, or from the page cache on a warm start, when they are first touched.
+class MappedFile
+{
+public:
+	MappedFile(){}
+	~MappedFile();
+
+	MappedFile(MappedFile&& other);
+	MappedFile& operator=(MappedFile&& other);
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Fails on missing and empty files.
+	bool open(const std::string& path);
+	void close();
+
+	bool isOpen() const { return m_data != nullptr; }
+	const uint8_t* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+	// A 64-bit hash of the contents, eight bytes at a time. Touches every page.
+	uint64_t contentHash() const;
+
+	// Hints for the pages of a range inside a mapping. prefetch starts reading them in the background,
+	// and evict gives them back to the system. Evicted pages are read again from the file if they are
+	// touched, so neither changes what the mapping reads.
+	static void prefetch(const void* data, size_t size);
+	static void evict(const void* data, size_t size);
+
+protected:
+	const uint8_t* m_data = nullptr;
+	size_t m_size = 0;
+#ifdef _WIN32
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#endif
+};
+
+// Writes the file next to path and renames it over path, so that a crash or a reader never sees
+// half a file. The name of the temporary file is the thread's own, so two threads can write the
+// same path at once. Fails, and leaves path as it was, when the stream fails.
+bool writeFileAtomically(const std::string& path, const std::function<void(std::ostream& out)>& write);
+
+}
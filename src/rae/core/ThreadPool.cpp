@@ -0,0 +1,93 @@
+#include "core/ThreadPool.hpp"
+
+#include <algorithm>
+
+using namespace Rae;
+
+ThreadPool::ThreadPool(int threadCount)
+: m_nextIndex(0)
+{
+	if (threadCount <= 0)
+		threadCount = std::max(1, int(std::thread::hardware_concurrency()));
+
+	for (int i = 1; i < threadCount; ++i)
+	{
+		m_workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_isQuitting = true;
+	}
+	m_jobCondition.notify_all();
+
+	for (auto& worker : m_workers)
+		worker.join();
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int index, int threadIndex)>& func)
+{
+	if (count <= 0)
+		return;
+
+	if (m_workers.empty() || count == 1)
+	{
+		for (int i = 0; i < count; ++i)
+			func(i, 0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_job = &func;
+		m_jobCount = count;
+		m_nextIndex = 0;
+		m_busyWorkers = int(m_workers.size());
+		++m_jobGeneration;
+	}
+	m_jobCondition.notify_all();
+
+	runJob(0);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_doneCondition.wait(lock, [this]() { return m_busyWorkers == 0; });
+	m_job = nullptr;
+}
+
+void ThreadPool::runJob(int threadIndex)
+{
+	const std::function<void(int, int)>& func = *m_job;
+	for (int index = m_nextIndex++; index < m_jobCount; index = m_nextIndex++)
+	{
+		func(index, threadIndex);
+	}
+}
+
+void ThreadPool::workerLoop(int threadIndex)
+{
+	int seenGeneration = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_jobCondition.wait(lock, [this, seenGeneration]()
+			{
+				return m_isQuitting || m_jobGeneration != seenGeneration;
+			});
+			if (m_isQuitting)
+				return;
+			seenGeneration = m_jobGeneration;
+		}
+
+		runJob(threadIndex);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			--m_busyWorkers;
+		}
+		m_doneCondition.notify_one();
+	}
+}
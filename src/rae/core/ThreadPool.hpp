@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+namespace Rae
+{
+
+// A small pool of persistent worker threads. The calling thread works too,
+// so threadCount() includes it and threadIndex 0 is always the caller.
+class ThreadPool
+{
+public:
+	// threadCount 0 means one thread per hardware thread.
+	ThreadPool(int threadCount = 0);
+	~ThreadPool();
+
+	int threadCount() const { return int(m_workers.size()) + 1; }
+
+	// Calls func(index, threadIndex) for every index in [0, count) and returns when all are done.
+	// Indices are handed out one at a time, so uneven work balances itself.
+	// Not reentrant: call it from one thread at a time, and not from inside func.
+	void parallelFor(int count, const std::function<void(int index, int threadIndex)>& func);
+
+protected:
+	void workerLoop(int threadIndex);
+	void runJob(int threadIndex);
+
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_mutex;
+	std::condition_variable m_jobCondition;
+	std::condition_variable m_doneCondition;
+
+	const std::function<void(int, int)>* m_job = nullptr;
+	int m_jobCount = 0;
+	int m_jobGeneration = 0;
+	int m_busyWorkers = 0;
+	bool m_isQuitting = false;
+
+	std::atomic<int> m_nextIndex;
+};
+
+} // end namespace Rae
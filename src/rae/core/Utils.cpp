@@ -2,6 +2,7 @@
 #include <math.h>
 #include <cstdlib> // for rand. TODO remove deprecated rand stuff.
 #include <assert.h>
+#include <stdint.h>
 
 namespace Rae
 {
@@ -51,6 +52,89 @@ bool isEqualVec(const glm::vec3& set_a, const glm::vec3& set_b, float epsilon)
 		&& isEqual(set_a.z, set_b.z, epsilon);
 }
 
+const char* readFloat(const char* begin, const char* end, float& out)
+{
+	static const double powersOfTen[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	const char* p = begin;
+	bool isNegative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		isNegative = *p == '-';
+		++p;
+	}
+
+	// Up to 19 significant digits fit in the mantissa, the rest only move the exponent.
+	uint64_t mantissa = 0;
+	int significantDigits = 0;
+	int exponent = 0;
+	bool hasDigits = false;
+	for (; p < end && *p >= '0' && *p <= '9'; ++p)
+	{
+		hasDigits = true;
+		if (significantDigits < 19)
+		{
+			mantissa = mantissa * 10 + uint64_t(*p - '0');
+			if (mantissa != 0)
+				++significantDigits;
+		}
+		else ++exponent;
+	}
+	if (p < end && *p == '.')
+	{
+		for (++p; p < end && *p >= '0' && *p <= '9'; ++p)
+		{
+			hasDigits = true;
+			if (significantDigits < 19)
+			{
+				mantissa = mantissa * 10 + uint64_t(*p - '0');
+				if (mantissa != 0)
+					++significantDigits;
+				--exponent;
+			}
+		}
+	}
+	if (hasDigits == false)
+		return nullptr;
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		++p;
+		bool isExponentNegative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			isExponentNegative = *p == '-';
+			++p;
+		}
+		int value = 0;
+		bool hasExponentDigits = false;
+		for (; p < end && *p >= '0' && *p <= '9'; ++p)
+		{
+			hasExponentDigits = true;
+			if (value < 10000)
+				value = value * 10 + (*p - '0');
+		}
+		if (hasExponentDigits == false)
+			return nullptr;
+		exponent += isExponentNegative ? -value : value;
+	}
+	double result = double(mantissa);
+	if (exponent >= 0 && exponent <= 22)
+		result *= powersOfTen[exponent];
+	else if (exponent < 0 && exponent >= -22)
+		result /= powersOfTen[-exponent];
+	else result *= pow(10.0, double(exponent));
+
+	out = float(isNegative ? -result : result);
+	return p;
+}
+
+bool parseFloat(const char* begin, const char* end, float& out)
+{
+	return readFloat(begin, end, out) == end;
+}
+
 float getManhattanDistance( float rx, float ry )
 {
 	return (float)(rx * rx + ry * ry);
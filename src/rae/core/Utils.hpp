@@ -4,6 +4,7 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <string>
+#include <atomic>
 
 #include <glm/glm.hpp>
 
@@ -41,6 +42,22 @@ float randFloat(float a_min, float a_max);
 bool isEqual(float set_a, float set_b, float epsilon = 0.0001f);
 bool isEqualVec(const glm::vec3& set_a, const glm::vec3& set_b, float epsilon = 0.0001f);
 
+// strtof is slow and depends on the locale. Decimal and exponent notation only, and all of
+// begin to end has to be the number.
+bool parseFloat(const char* begin, const char* end, float& out);
+// The same for a number at the start of begin to end. Returns where the number ends, or nullptr.
+const char* readFloat(const char* begin, const char* end, float& out);
+
+// std::atomic<float> has no fetch_add before C++20. Inline, as it's in the inner loops of the
+// splats and of learning the guiding and the radiance cache.
+inline void atomicAdd(std::atomic<float>& target, float value)
+{
+	float old = target.load(std::memory_order_relaxed);
+	while (target.compare_exchange_weak(old, old + value, std::memory_order_relaxed) == false)
+	{
+	}
+}
+
 }
 
 } // end namespace Rae